@@ -13,12 +13,15 @@ template <typename Dtype>
 class Blob {
  public:
   Blob()
-       : num_(0), channels_(0), height_(0), width_(0), count_(0), data_(),
-       diff_() {}
+       : num_(0), channels_(0), height_(0), width_(0), count_(0),
+       capacity_(0), diff_enabled_(true), data_(), diff_() {}
   explicit Blob(const int num, const int channels, const int height,
     const int width);
+  // Changes the dimensions. The memory is only reallocated if the new count
+  // exceeds the capacity, otherwise it is reused with its current content.
   void Reshape(const int num, const int channels, const int height,
     const int width);
+  // Same as Reshape (kept for existing callers).
   void Reshape_keepdata(const int num, const int channels, const int height,
     const int width);
   void ReshapeLike(const Blob& other);
@@ -27,6 +30,8 @@ class Blob {
   inline int height() const { return height_; }
   inline int width() const { return width_; }
   inline int count() const {return count_; }
+  // The number of elements the memory has room for.
+  inline int capacity() const { return capacity_; }
   inline int offset(const int n, const int c = 0, const int h = 0,
       const int w = 0) const {
     CHECK_GE(n, 0);
@@ -60,7 +65,7 @@ class Blob {
   }
 
   inline const shared_ptr<SyncedMemory>& diff() const {
-    CHECK(diff_);
+    CHECK(diff_) << "Blob without diff (not used by the backward pass)";
     return diff_;
   }
 
@@ -85,6 +90,13 @@ class Blob {
   // shared_ptr calls its destructor when reset with the = operator.
   void ShareData(const Blob& other);
   void ShareDiff(const Blob& other);
+  // Makes the data_ shared_ptr point to memory of at least count() elements,
+  // e.g. a buffer shared by blobs that are never used at the same time.
+  void SetDataMemory(const shared_ptr<SyncedMemory>& data);
+  // Blobs that no backward pass uses can do without diff memory: disabling
+  // the diff releases it and makes the diff accessors fail.
+  void set_diff_enabled(const bool enabled);
+  inline bool diff_enabled() const { return diff_enabled_; }
 
  protected:
   shared_ptr<SyncedMemory> data_;
@@ -94,6 +106,8 @@ class Blob {
   int height_;
   int width_;
   int count_;
+  int capacity_;
+  bool diff_enabled_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
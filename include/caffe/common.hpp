@@ -4,6 +4,7 @@
 #define CAFFE_COMMON_HPP_
 
 #include <boost/shared_ptr.hpp>
+#include <algorithm>
 #include <cublas_v2.h>
 #include <cuda.h>
 #include <curand.h>
@@ -99,6 +100,9 @@ class Caffe {
 
   // Getters for boost rng, curand, and cublas handles
   inline static RNG& rng_stream() {
+    if (thread_rng_stream_) {
+      return *thread_rng_stream_;
+    }
     if (!Get().random_generator_) {
       Get().random_generator_.reset(new RNG());
     }
@@ -112,7 +116,10 @@ class Caffe {
   // Returns the mode: running on CPU or GPU.
   inline static Brew mode() { return Get().mode_; }
   // Returns the phase: TRAIN or TEST.
-  inline static Phase phase() { return Get().phase_; }
+  inline static Phase phase() {
+    return thread_phase_ >= 0 ? static_cast<Phase>(thread_phase_)
+        : Get().phase_;
+  }
   // The setters for the variables
   // Sets the mode. It is recommended that you don't change the mode halfway
   // into the program since that may cause allocation of pinned memory being
@@ -121,8 +128,30 @@ class Caffe {
   inline static void set_mode(Brew mode) { Get().mode_ = mode; }
   // Sets the phase.
   inline static void set_phase(Phase phase) { Get().phase_ = phase; }
+  // Makes phase() return phase on the calling thread only, so that a thread
+  // can test a net while others train.
+  inline static void set_thread_phase(Phase phase) { thread_phase_ = phase; }
+  // Makes phase() return the phase of set_phase again on the calling thread.
+  inline static void clear_thread_phase() { thread_phase_ = -1; }
+  // Returns the number of threads CPU layers may use to process the items of
+  // a batch in parallel (effective only when built with OpenMP).
+  inline static int cpu_threads() { return Get().cpu_threads_; }
+  // Sets the default number of CPU threads for layers that do not set their
+  // own count. The layers call BLAS from each of their threads, so BLAS runs
+  // single-threaded while threads > 1 or a layer has reserved more than one
+  // thread, and with its initial count otherwise.
+  static void set_cpu_threads(int threads);
+  // Notes that a layer splits its batches over threads of its own count;
+  // from then on BLAS stays single-threaded if threads > 1.
+  static void reserve_cpu_threads(int threads);
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
+  // Makes rng_stream() return rng on the calling thread, so that threads
+  // running nets concurrently do not share a generator; NULL restores the
+  // shared one. The caller keeps rng alive while it is set.
+  inline static void set_thread_rng_stream(RNG* rng) {
+    thread_rng_stream_ = rng;
+  }
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
   static void SetDevice(const int device_id);
@@ -136,11 +165,21 @@ class Caffe {
 
   Brew mode_;
   Phase phase_;
+  int cpu_threads_;
+  // the largest count of reserve_cpu_threads
+  int layer_threads_;
+  // the BLAS thread count outside of the layers' parallel loops
+  int blas_threads_;
   static shared_ptr<Caffe> singleton_;
+  static __thread RNG* thread_rng_stream_;
+  // the Phase of set_thread_phase, or -1
+  static __thread int thread_phase_;
 
  private:
   // The private constructor to avoid duplicate instantiation.
   Caffe();
+  // Sets BLAS to one thread if any layer may run more than one.
+  void SetBlasThreads();
 
   DISABLE_COPY_AND_ASSIGN(Caffe);
 };
@@ -158,6 +197,18 @@ const char* curandGetErrorString(curandStatus_t error);
     const int CAFFE_CUDA_NUM_THREADS = 512;
 #endif
 
+// The number of threads to split num independent items over: the layer's own
+// request if positive, otherwise Caffe::cpu_threads(), but never more than
+// num. Always 1 when built without OpenMP.
+inline int caffe_cpu_threads(const int requested, const int num) {
+#ifdef _OPENMP
+  int threads = requested > 0 ? requested : Caffe::cpu_threads();
+  return std::max(1, std::min(threads, num));
+#else
+  return 1;
+#endif
+}
+
 // CUDA: number of blocks for threads.
 inline int CAFFE_GET_BLOCKS(const int N) {
   return (N + CAFFE_CUDA_NUM_THREADS - 1) / CAFFE_CUDA_NUM_THREADS;
@@ -18,9 +18,12 @@
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/hdf5_reader.hpp"
 
 namespace caffe {
 
+class CounterRNG;
+
 #define HDF5_DATA_DATASET_NAME "data"
 #define HDF5_DATA_LABEL_NAME "label"
 
@@ -59,11 +62,17 @@ class HDF5OutputLayer : public Layer<Dtype> {
 };
 
 
+template <typename Dtype>
+void* HDF5DataLayerPrefetch(void* layer_pointer);
+
 template <typename Dtype>
 class HDF5DataLayer : public Layer<Dtype> {
+  // The function used to read the next files ahead.
+  friend void* HDF5DataLayerPrefetch<Dtype>(void* layer_pointer);
+
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param), data_in_memory_(true) {}
+      : Layer<Dtype>(param), data_in_memory_(true), prefetching_(false) {}
   virtual ~HDF5DataLayer();
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -84,6 +93,12 @@ class HDF5DataLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void LoadHDF5FileData(const char* filename, Blob<Dtype>* data_blob, Blob<Dtype>* label_blob);
+  // Opens the readers of the datasets of a file, with cache_mb.
+  virtual void OpenHDF5FileReaders(const char* filename);
+  // Moves on to the next file once the rows of the current one are used up.
+  virtual void NextFile();
+  virtual void CreatePrefetchThread();
+  virtual void JoinPrefetchThread();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
@@ -94,13 +109,31 @@ class HDF5DataLayer : public Layer<Dtype> {
   Blob<Dtype>* current_data_blob_;
   Blob<Dtype>* current_label_blob_;
   bool data_in_memory_;
+  // Streaming mode reads the files after the current one into a ring of
+  // prefetch_files standby blobs. The n-th file read ahead goes to slot
+  // n % prefetch_files, and is swapped with the current blobs when reached.
+  pthread_t thread_;
+  bool prefetching_;
+  pthread_mutex_t prefetch_mutex_;
+  pthread_cond_t file_ready_;
+  pthread_cond_t file_free_;
+  bool prefetch_stop_;
+  int prefetch_loaded_;
+  int prefetch_used_;
+  vector<Blob<Dtype>* > prefetch_data_;
+  vector<Blob<Dtype>* > prefetch_label_;
+  // With cache_mb, the rows of the current file are read through these
+  // instead of the blobs, with the next windows read ahead.
+  shared_ptr<HDF5RowReader<Dtype> > data_reader_;
+  shared_ptr<HDF5RowReader<Dtype> > label_reader_;
 };
 
 template <typename Dtype>
 class HDF5DataCouplesLayer : public Layer<Dtype> {
  public:
   explicit HDF5DataCouplesLayer(const LayerParameter& param)
-      : Layer<Dtype>(param), data_in_memory_(true) {}
+      : Layer<Dtype>(param), data_blob_(NULL), label_blob_(NULL),
+        data_in_memory_(true) {}
   virtual ~HDF5DataCouplesLayer();
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
@@ -125,6 +158,9 @@ class HDF5DataCouplesLayer : public Layer<Dtype> {
   Blob<Dtype>* data_blob_;
   Blob<Dtype>* label_blob_;
   bool data_in_memory_;
+  // Without data_in_memory, the rows of the pairs are read through windows
+  // of one chunk each.
+  shared_ptr<HDF5RowReader<Dtype> > data_reader_;
   Dtype match_ratio_;
   int in_data_num_;
   Dtype scale_;
@@ -137,9 +173,14 @@ class HDF5DataCouplesLayer : public Layer<Dtype> {
 template <typename Dtype>
 void* DataLayerPrefetch(void* layer_pointer);
 
+// DataLayer prefetches with a pool of data_param().prefetch_threads()
+// workers into a ring of data_param().prefetch_depth() batches. The workers
+// take turns at reading the raw datums of a whole batch from the database,
+// so the cursor order does not depend on the number of workers, and decode
+// and transform them in parallel. Forward consumes the batches in order.
 template <typename Dtype>
 class DataLayer : public Layer<Dtype> {
-  // The function used to perform prefetching.
+  // The function run by the prefetch workers.
   friend void* DataLayerPrefetch<Dtype>(void* layer_pointer);
 
  public:
@@ -155,6 +196,9 @@ class DataLayer : public Layer<Dtype> {
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline int MaxTopBlobs() const { return 2; }
+  // Forward hands the prefetched batch to the tops and their memory to the
+  // ring.
+  virtual inline bool ForwardSwapsTopMemory() const { return true; }
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -166,17 +210,40 @@ class DataLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) { return; }
 
+  // Start and stop the prefetch workers.
   virtual void CreatePrefetchThread();
   virtual void JoinPrefetchThread();
-  virtual unsigned int PrefetchRand();
-
-  shared_ptr<Caffe::RNG> prefetch_rng_;
 
-  // LEVELDB
+  // The raw datums of a batch being prefetched, with the number of the
+  // batch and the phase it is read in. LMDB records point into the memory
+  // map, which stays valid for the read-only transaction; LevelDB reuses
+  // its buffers, so its records point into copies kept in values.
+  struct PrefetchBatch {
+    vector<const char*> records;
+    vector<size_t> record_sizes;
+    vector<string> values;
+    int index;
+    Caffe::Phase phase;
+  };
+  // Helpers for the workers. ReadBatch waits for a free slot of the ring,
+  // reads the next batch_size datums into batch and returns the slot, or -1
+  // once the workers are stopped. TransformBatch fills the slot.
+  int ReadBatch(PrefetchBatch* batch);
+  void TransformBatch(const PrefetchBatch& batch, const int slot);
+  // Helpers for Forward: wait for the next batch in order and return its
+  // slot to the ring after use.
+  int WaitForBatch();
+  void ReleaseBatch();
+
+  // Moves the cursor num_skip datums on, wrapping around at the end.
+  void SkipRecords(const int num_skip);
+
+  // LEVELDB; the database and the LMDB environment are shared by the data
+  // layers of the process reading the same source
   shared_ptr<leveldb::DB> db_;
   shared_ptr<leveldb::Iterator> iter_;
   // LMDB
-  MDB_env* mdb_env_;
+  shared_ptr<MDB_env> mdb_env_;
   MDB_dbi mdb_dbi_;
   MDB_txn* mdb_txn_;
   MDB_cursor* mdb_cursor_;
@@ -186,12 +253,27 @@ class DataLayer : public Layer<Dtype> {
   int datum_height_;
   int datum_width_;
   int datum_size_;
-  pthread_t thread_;
-  shared_ptr<Blob<Dtype> > prefetch_data_;
-  shared_ptr<Blob<Dtype> > prefetch_label_;
+  vector<pthread_t> threads_;
+  // the ring of prefetched batches
+  vector<shared_ptr<Blob<Dtype> > > prefetch_data_;
+  vector<shared_ptr<Blob<Dtype> > > prefetch_label_;
+  vector<bool> prefetch_ready_;
+  // number of batches read from the database and used by Forward
+  int prefetch_read_;
+  int prefetch_used_;
+  bool prefetch_stop_;
+  // prefetch_mutex_ guards the ring state and phase_, cursor_mutex_ the
+  // database cursor
+  pthread_mutex_t prefetch_mutex_;
+  pthread_mutex_t cursor_mutex_;
+  pthread_cond_t batch_free_;
+  pthread_cond_t batch_ready_;
   Blob<Dtype> data_mean_;
   bool output_labels_;
   Caffe::Phase phase_;
+  // item i of the n-th batch draws its crop from the stream (rng_seed_, n, i)
+  // and its skip from (rng_seed_, n, i, 1) (see CounterRNG)
+  unsigned int rng_seed_;
 };
 
 template <typename Dtype>
@@ -362,30 +444,51 @@ class WindowDataLayer : public Layer<Dtype> {
   vector<vector<float> > bg_windows_;
 };
 
+// This function is used to create a pthread that augments a batch.
+template <typename Dtype>
+void* DataAugmentationLayerAugment(void* layer_pointer);
+
 template <typename Dtype>
 class DataAugmentationLayer : public Layer<Dtype> {
+  // The function used to augment batches in the background.
+  friend void* DataAugmentationLayerAugment<Dtype>(void* layer_pointer);
+
  public:
   explicit DataAugmentationLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
-  virtual ~DataAugmentationLayer() {};
+      : Layer<Dtype>(param), augmenting_(false) {}
+  virtual ~DataAugmentationLayer();
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+
+  // With async, Forward swaps the augmented batch into the tops.
+  virtual inline bool ForwardSwapsTopMemory() const {
+    return this->layer_param_.augmentation_param().async();
+  }
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
   virtual Dtype Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top){
-    Forward_cpu(bottom, top);
+    return Forward_cpu(bottom, top);
   };
+  // Augments bottom[0] into (*top)[0], reading the coefficients from
+  // bottom[1] and writing them to (*top)[1] if requested.
+  virtual void Augment(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top, const bool train_phase);
+  virtual void CreateAugmentThread();
+  virtual void JoinAugmentThread();
 
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom)  { return; }
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom)  { return; }
       
-  virtual void generate_spatial_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, Dtype discount_coeff = 1);
-  virtual void generate_chromatic_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, Dtype discount_coeff = 1);
+  // The coefficients are drawn from rng, the stream of the item.
+  virtual void generate_spatial_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, CounterRNG* rng, Dtype discount_coeff = 1);
+  virtual void generate_chromatic_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, CounterRNG* rng, Dtype discount_coeff = 1);
   virtual void clear_spatial_coeffs(AugmentationCoeff& coeff);
   virtual void clear_defaults(AugmentationCoeff& coeff);
   virtual void coeff_to_array(const AugmentationCoeff& coeff, Dtype* out);
@@ -398,8 +501,29 @@ class DataAugmentationLayer : public Layer<Dtype> {
   int num_params_;
   Blob<Dtype> data_mean_;
   int num_iter_;
+  // colour statistics of the chromatic transforms, averaged over
+  // num_color_stats_ batches
+  Dtype mean_rgb_[3];
+  Dtype max_abs_eig_[3];
+  Dtype max_rgb_[3];
+  Dtype min_rgb_[3];
+  int num_color_stats_;
+  // seed of the per-item random streams (see CounterRNG)
+  unsigned int rng_seed_;
   AugmentationParameter aug_;
   CoeffScheduleParameter discount_coeff_schedule_;
+  int num_passthrough_;
+
+  // With async, the background thread augments the copies of the bottoms in
+  // pipeline_bottom_ into pipeline_top_, whose memory is swapped with the
+  // tops by the next forward pass.
+  pthread_t thread_;
+  bool augmenting_;
+  Caffe::Phase pipeline_phase_;
+  vector<shared_ptr<Blob<Dtype> > > pipeline_bottom_;
+  vector<shared_ptr<Blob<Dtype> > > pipeline_top_;
+  vector<Blob<Dtype>*> pipeline_bottom_vec_;
+  vector<Blob<Dtype>*> pipeline_top_vec_;
 };
 
 // This function is used to create a pthread that prefetches the data.
@@ -430,7 +554,7 @@ class DataLoadAndAugmentLayer : public Layer<Dtype> {
       vector<Blob<Dtype>*>* top);
   virtual Dtype Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-    Forward_cpu(bottom, top);
+    return Forward_cpu(bottom, top);
   };
   virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) { return; }
@@ -440,6 +564,10 @@ class DataLoadAndAugmentLayer : public Layer<Dtype> {
   virtual void CreatePrefetchThread();
   virtual void JoinPrefetchThread();
   virtual unsigned int PrefetchRand();
+  // Parses the serialized Datum of item item_id of the prefetched batch and
+  // writes its augmented crop and label. Called concurrently for the items.
+  virtual void TransformItem(const string& value, const int item_id,
+      Dtype* top_data, Dtype* top_label);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
 
@@ -458,11 +586,17 @@ class DataLoadAndAugmentLayer : public Layer<Dtype> {
   int datum_width_;
   int datum_size_;
   pthread_t thread_;
+  // the records of the batch being prefetched
+  vector<string> prefetch_values_;
   shared_ptr<Blob<Dtype> > prefetch_data_;
   shared_ptr<Blob<Dtype> > prefetch_label_;
   Blob<Dtype> data_mean_;
   bool output_labels_;
   Caffe::Phase phase_;
+  // the augmentation of item i of the n-th prefetched batch draws from the
+  // stream (rng_seed_, n, i) (see CounterRNG)
+  unsigned int rng_seed_;
+  int prefetch_iter_;
   int cropped_height_;
   int cropped_width_;
 };
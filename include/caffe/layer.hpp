@@ -22,7 +22,7 @@ class Layer {
   // to SetUp(), where the dimensions of the bottom blobs are provided to the
   // layer.
   explicit Layer(const LayerParameter& param)
-    : layer_param_(param) {
+    : layer_param_(param), accumulate_param_diffs_(false) {
       // The only thing we do is to copy blobs if there are any.
       if (layer_param_.blobs_size() > 0) {
         blobs_.resize(layer_param_.blobs_size());
@@ -39,6 +39,16 @@ class Layer {
       vector<Blob<Dtype>*>* top) {
     CheckBlobCounts(bottom, *top);
   }
+  // Reshape: adapts the top blobs and internal buffers to changed bottom
+  // shapes (e.g. a different batch size) without touching the parameters.
+  // The default re-runs SetUp; layers whose SetUp resets state override it.
+  // Layers without bottoms keep their tops.
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+    if (!bottom.empty()) {
+      SetUp(bottom, top);
+    }
+  }
 
   // Forward and backward wrappers. You should implement the cpu and
   // gpu specific implementations instead, and should not change these
@@ -72,6 +82,22 @@ class Layer {
   virtual void normalize_weights(Dtype mnorm) {
   }
 
+  // If set, Backward adds the parameter gradients to the diffs of blobs()
+  // instead of overwriting them, so that the gradients of several batches
+  // sum up; whoever sets it clears the diffs between updates.
+  void set_accumulate_param_diffs(const bool accumulate) {
+    accumulate_param_diffs_ = accumulate;
+  }
+  bool accumulate_param_diffs() const { return accumulate_param_diffs_; }
+
+  // Lets the layer absorb a directly following in-place activation layer
+  // (RELU, SIGMOID or TANH) into the epilogue of its CPU forward pass and the
+  // start of its CPU backward pass. Returns true if it did, in which case the
+  // net skips the activation layer on the CPU.
+  virtual bool FuseActivation(const LayerParameter& activation_param) {
+    return false;
+  }
+
   // These methods can be overwritten to declare that this layer type expects
   // a certain number of blobs as input and output.
   //
@@ -87,11 +113,27 @@ class Layer {
   virtual inline int MinTopBlobs() const { return -1; }
   virtual inline int MaxTopBlobs() const { return -1; }
 
+  // Returns true if the forward pass makes the tops share the data of the
+  // first bottom (e.g. split, flatten) rather than writing their own memory.
+  virtual inline bool ForwardSharesData() const { return false; }
+  // Returns true if the forward pass exchanges the data memory of the tops
+  // with buffers of its own (e.g. a prefetch ring) instead of writing into
+  // it. The net keeps such tops out of the shared activation memory.
+  virtual inline bool ForwardSwapsTopMemory() const { return false; }
+
  protected:
   // The protobuf that stores the layer parameters
   LayerParameter layer_param_;
   // The vector that stores the parameters as a set of blobs.
   vector<shared_ptr<Blob<Dtype> > > blobs_;
+  // Whether Backward accumulates into the parameter diffs.
+  bool accumulate_param_diffs_;
+
+  // The beta of the BLAS calls writing the parameter gradients: 1 to add to
+  // the diffs when accumulating, 0 to overwrite them.
+  inline Dtype param_diff_beta() const {
+    return accumulate_param_diffs_ ? Dtype(1) : Dtype(0);
+  }
 
   // Forward functions: compute the layer output
   // (and loss layers return the loss; other layers return the dummy value 0.)
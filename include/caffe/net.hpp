@@ -57,6 +57,19 @@ class Net {
 
   // Updates the network weights based on the diff values computed.
   void Update();
+  // Makes Backward add the parameter gradients to the parameter diffs
+  // rather than overwrite them, to sum the gradients of several batches.
+  void SetAccumulateParamDiffs(const bool accumulate);
+  // Zeroes the parameter diffs, before accumulating into them.
+  void ClearParamDiffs();
+  // Multiplies the parameter diffs by scale.
+  void ScaleParamDiffs(const Dtype scale);
+
+  // Propagates changed input blob shapes (e.g. a new batch size) through all
+  // layers without re-running Init. Blobs keep their memory unless they grow.
+  void Reshape();
+  // Sets the num of all input blobs and reshapes the net accordingly.
+  void ReshapeInputs(const int num);
 
   // For an already initialized net, ShareTrainedLayersWith() implicitly copies
   // (i.e., using no additional memory) the already trained layers from another
@@ -66,6 +79,9 @@ class Net {
   // trained layers from another net parameter instance.
   void CopyTrainedLayersFrom(const NetParameter& param);
   void CopyTrainedLayersFrom(const string trained_filename);
+  // Copies the data of the already trained layers of another net, which
+  // may keep training meanwhile.
+  void CopyTrainedLayersFrom(Net* other);
   // Writes the net to a proto.
   void ToProto(NetParameter* param, bool write_diff = false);
 
@@ -101,10 +117,19 @@ class Net {
   // Access intermediary computation layers, testing with centre image only
   bool has_blob(const string& blob_name);
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name);
+  // Keeps the data of a blob after the forward pass when activations are
+  // shared, as NetParameter.keep_blob does. Call it before the first
+  // forward pass: it gives the blob fresh memory and moves the shared
+  // buffers.
+  void PinBlob(const string& blob_name);
   bool has_layer(const string& layer_name);
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name);
   // return losses
   inline vector<std::pair<int, float> >& losses() {return losses_; }
+  // returns the bytes of memory used by the activations
+  inline size_t memory_used() const { return memory_used_ * sizeof(Dtype); }
+  // whether the net was built forward only (NetParameter.inference)
+  inline bool inference() const { return inference_; }
   void initialize_weights();
 
  protected:
@@ -120,18 +145,36 @@ class Net {
   // Function to get misc parameters, e.g. the learning rate multiplier and
   // weight decay.
   void GetLearningRateAndWeightDecay();
+  // Lets layers absorb directly following in-place activation layers.
+  void FuseActivations();
+  // Assigns the data of the activations that are not pinned to shared
+  // buffers, based on the layers that produce and use them.
+  void PlanActivationMemory();
+  // Excludes a blob from the shared buffers.
+  void PinBlob(const int blob_id);
 
   // Individual layers in the net
   vector<shared_ptr<Layer<Dtype> > > layers_;
   vector<string> layer_names_;
   map<string, int> layer_names_index_;
   vector<bool> layer_need_backward_;
+  // activation layers absorbed by the preceding layer, skipped on the CPU
+  vector<bool> layer_fused_;
   // blobs stores the blobs that store intermediate results between the
   // layers.
   vector<shared_ptr<Blob<Dtype> > > blobs_;
   vector<string> blob_names_;
   map<string, int> blob_names_index_;
   vector<bool> blob_need_backward_;
+  // forward only net: no diffs, layer_need_backward_ all false
+  bool inference_;
+  // activation memory sharing (see NetParameter.share_activations): blobs
+  // that keep their own data, the shared buffer of every blob (-1 if none)
+  // and the buffers
+  bool share_activations_;
+  vector<bool> blob_pinned_;
+  vector<int> blob_buffer_;
+  vector<shared_ptr<SyncedMemory> > activation_buffers_;
   // bottom_vecs stores the vectors containing the input for each layer.
   // They don't actually host the blobs (blobs_ does), so we simply store
   // pointers.
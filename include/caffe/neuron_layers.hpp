@@ -83,7 +83,7 @@ template <typename Dtype>
 class DropoutLayer : public NeuronLayer<Dtype> {
  public:
   explicit DropoutLayer(const LayerParameter& param)
-      : NeuronLayer<Dtype>(param) {}
+      : NeuronLayer<Dtype>(param), rng_iter_(0) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
@@ -105,6 +105,10 @@ class DropoutLayer : public NeuronLayer<Dtype> {
   Dtype threshold_;
   Dtype scale_;
   unsigned int uint_thres_;
+  // the CPU mask of item i in the n-th training pass is drawn from the
+  // stream (rng_seed_, n, i) (see CounterRNG)
+  unsigned int rng_seed_;
+  int rng_iter_;
 };
 
 /* PowerLayer
@@ -3,17 +3,33 @@
 #ifndef CAFFE_OPTIMIZATION_SOLVER_HPP_
 #define CAFFE_OPTIMIZATION_SOLVER_HPP_
 
+#include <pthread.h>
+#include <sched.h>
+
 #include <string>
 #include <vector>
 #include <fstream>
 
+#include "caffe/util/benchmark.hpp"
+
 namespace caffe {
 
 template <typename Dtype>
 class TerminationCriterion;
+
+template <typename Dtype>
+void* SolverWorker(void* worker_pointer);
+
+template <typename Dtype>
+void* SolverTester(void* tester_pointer);
   
 template <typename Dtype>
 class Solver {
+  // The function run by the threads of the data parallel workers.
+  friend void* SolverWorker<Dtype>(void* worker_pointer);
+  // The function run by the threads of the asynchronous tests.
+  friend void* SolverTester<Dtype>(void* tester_pointer);
+
  public:
   explicit Solver(const SolverParameter& param);
   explicit Solver(const string& param_file);
@@ -22,15 +38,57 @@ class Solver {
   // in a non-zero iter number to resume training for a pre-trained net.
   virtual void Solve(const char* resume_file = NULL);
   inline void Solve(const string resume_file) { Solve(resume_file.c_str()); }
-  virtual ~Solver() {}
+  virtual ~Solver();
   inline shared_ptr<Net<Dtype> > net() { return net_; }
 
  protected:
   // PreSolve is run before any solving iteration starts, allowing one to
   // put up some scaffold.
   virtual void PreSolve() {}
+  // Runs the forward and backward passes of an iteration: param_.iter_size()
+  // batches on each worker, leaving the mean of their gradients in the
+  // parameter diffs and of their losses in net_->losses(). Returns the mean
+  // loss.
+  Dtype ForwardBackward(const vector<Blob<Dtype>*>& bottom);
+  // The passes of an iteration on a single net.
+  Dtype ForwardBackward(Net<Dtype>* net, const vector<Blob<Dtype>*>& bottom);
+  // Data parallel training, if param_.num_workers() > 1: worker 0 is the
+  // solver thread training net_, the others train replicas of net_ built
+  // from train_net_param_ on their own threads, sharing the parameter data of
+  // net_ (so the updated weights need no broadcast) and keeping their own
+  // diffs.
+  void CreateWorkers();
+  void JoinWorkers();
+  // Averages the parameter diffs of the workers into those of net_, each
+  // thread summing a slice of every parameter.
+  void ReduceParamDiffs();
+  // Hogwild training, if param_.hogwild() too: the workers other than the
+  // solver thread run free, taking HogwildStep after HogwildStep until
+  // paused (around tests and snapshots, so that these see fixed weights).
+  inline bool hogwild() const {
+    return param_.hogwild() && workers_.size() > 1;
+  }
+  void PauseWorkers();
+  void ResumeWorkers();
+  // Runs the passes of an iteration on the net of worker worker_id and
+  // applies its update, measuring the staleness of the weights it read as
+  // the number of updates of other workers applied meanwhile. Returns the
+  // loss.
+  Dtype HogwildStep(const int worker_id, const vector<Blob<Dtype>*>& bottom);
+  // Applies the update computed from the diffs of the net of worker
+  // worker_id to the shared weights, concurrently with the other workers,
+  // at iteration iter of the solver thread.
+  virtual void ApplyWorkerUpdate(const int worker_id, const int iter) {
+    LOG(FATAL) << "This solver does not train asynchronously.";
+  }
   // Get the update value for the current iteration.
   virtual void ComputeUpdateValue() = 0;
+  // Computes the update value and applies it to the net; solvers may fuse
+  // the two.
+  virtual void ApplyUpdate() {
+    ComputeUpdateValue();
+    net_->Update();
+  }
   // The Solver::Snapshot function implements the basic snapshotting utility
   // that stores the learned net. You should implement the SnapshotSolverState()
   // function that produces a SolverState protocol buffer that needs to be
@@ -41,6 +99,22 @@ class Solver {
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
+  // Runs the test_iter passes of a test net, summing the scores of its
+  // outputs and, if test_compute_loss, its loss.
+  void Evaluate(const int test_net_id, vector<Dtype>* test_score,
+      Dtype* loss);
+  // Logs the results of a test of the weights of iteration iter and feeds
+  // them to the termination criteria.
+  void ReportTest(const int test_net_id, const int iter,
+      const vector<Dtype>& test_score, const Dtype loss);
+  // Asynchronous tests, if param_.test_async(): TestAsync copies the weights
+  // of net_ into the test net and hands it to its tester thread, and
+  // ReportTests reports the finished tests, on the solver thread.
+  void CreateTesters();
+  void TestAsync(const int test_net_id);
+  void ReportTests();
+  // Waits for the running tests and reports them, then ends the threads.
+  void JoinTesters();
   virtual void SnapshotSolverState(SolverState* state) = 0;
   // The Restore function implements how one should restore the solver to a
   // previously snapshotted state. You should implement the RestoreSolverState()
@@ -54,6 +128,69 @@ class Solver {
   vector<shared_ptr<Net<Dtype> > > test_nets_;
   vector<shared_ptr<TerminationCriterion<Dtype > > > termination_criterions_;
 
+  // the train net parameter the workers' replicas are built from
+  NetParameter train_net_param_;
+  struct Worker {
+    Solver<Dtype>* solver;
+    int id;
+    shared_ptr<Net<Dtype> > net;
+    pthread_t thread;
+    // the mean loss of its last iteration, and the seconds it took
+    Dtype loss;
+    float seconds;
+  };
+  vector<Worker> workers_;
+  // The workers run an iteration each time the generation is increased and
+  // count themselves done; worker_mutex_ guards both and workers_stop_.
+  int workers_generation_;
+  int workers_done_;
+  bool workers_stop_;
+  pthread_mutex_t worker_mutex_;
+  pthread_cond_t worker_start_;
+  pthread_cond_t worker_done_;
+  // the Hogwild workers are asked to pause, and how many are in a step
+  bool workers_paused_;
+  int workers_running_;
+  // the iteration of the solver thread, published to the Hogwild workers
+  int hogwild_iter_;
+  // the Hogwild updates applied, and the staleness of those since the last
+  // display
+  int hogwild_updates_;
+  int hogwild_display_updates_;
+  double staleness_sum_;
+  int staleness_max_;
+  // the thread count of the layers before CreateWorkers
+  int cpu_threads_;
+  // whether CreateWorkers pinned the solver thread as worker 0, and the
+  // cores it ran on before
+  bool solver_pinned_;
+  cpu_set_t solver_cores_;
+  // the seconds the workers spent in their passes and the iterations took,
+  // since the last display
+  float worker_seconds_;
+  float iteration_seconds_;
+
+  enum TesterState { TESTER_IDLE, TESTER_RUNNING, TESTER_DONE };
+  struct Tester {
+    Solver<Dtype>* solver;
+    int id;
+    pthread_t thread;
+    // the seed of the generator of the thread
+    unsigned int seed;
+    // tester_mutex_ guards the state; the rest belongs to the tester thread
+    // while it is running
+    TesterState state;
+    int iter;
+    Timer timer;
+    vector<Dtype> test_score;
+    Dtype loss;
+  };
+  vector<Tester> testers_;
+  bool testers_stop_;
+  pthread_mutex_t tester_mutex_;
+  pthread_cond_t tester_start_;
+  pthread_cond_t tester_done_;
+
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
 
@@ -68,12 +205,23 @@ class SGDSolver : public Solver<Dtype> {
 
  protected:
   virtual void PreSolve();
-  Dtype GetLearningRate();
+  Dtype GetLearningRate() { return GetLearningRate(this->iter_); }
+  // The learning rate at iteration iter.
+  Dtype GetLearningRate(const int iter);
   virtual void ComputeUpdateValue();
+  // On the CPU, applies the update in the pass computing it, unless the
+  // weight constraint has to rescale the weights in between.
+  virtual void ApplyUpdate();
+  // The update of worker 0 is ApplyUpdate; the others keep their own
+  // momentum history.
+  virtual void ApplyWorkerUpdate(const int worker_id, const int iter);
+  void ComputeUpdateValue(const bool update_data);
   virtual void SnapshotSolverState(SolverState * state);
   virtual void RestoreSolverState(const SolverState& state);
   // history maintains the historical momentum data.
   vector<shared_ptr<Blob<Dtype> > > history_;
+  // the history of each Hogwild worker but the first, not snapshotted
+  vector<vector<shared_ptr<Blob<Dtype> > > > worker_history_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -6,6 +6,7 @@
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 
 namespace caffe {
 
@@ -22,13 +23,18 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// The memory comes from HostAllocator::Get(), a caching allocator unless
+// configured otherwise, and has to be returned to the same allocator.
 
-inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
+inline void CaffeMallocHost(void** ptr, size_t size,
+    HostAllocator** allocator) {
+  *allocator = HostAllocator::Get();
+  *ptr = (*allocator)->Allocate(size);
 }
 
-inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
+inline void CaffeFreeHost(void* ptr, size_t size, HostAllocator* allocator) {
+  allocator->Free(ptr, size);
 }
 
 
@@ -36,10 +42,10 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), cpu_allocator_(NULL), version_(0) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), cpu_allocator_(NULL), version_(0) {}
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
@@ -49,6 +55,9 @@ class SyncedMemory {
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
   SyncedHead head() { return head_; }
   size_t size() { return size_; }
+  // Incremented whenever the memory is handed out for writing, so that
+  // derived data (e.g. transformed weights) can be cached until it changes.
+  size_t version() const { return version_; }
 
  private:
   void to_cpu();
@@ -58,6 +67,8 @@ class SyncedMemory {
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  HostAllocator* cpu_allocator_;
+  size_t version_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,35 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_ACTIVATION_HPP_
+#define _CAFFE_UTIL_ACTIVATION_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Epilogue of a gemm computing the M x N matrix Y: adds the bias (per row if
+// bias_per_row, per column otherwise; none if bias is NULL) and applies the
+// activation (RELU with negative_slope, SIGMOID, TANH or NONE) in one pass,
+// with the same arithmetic as the corresponding neuron layers.
+template <typename Dtype>
+void caffe_cpu_bias_activation(const int M, const int N, const Dtype* bias,
+    const bool bias_per_row, const LayerParameter_LayerType activation,
+    const Dtype negative_slope, Dtype* Y);
+
+// Reads the activation of an in-place RELU, SIGMOID or TANH layer that a
+// layer applies in its own epilogue instead (see Layer::FuseActivation).
+// Returns false for any other layer type.
+template <typename Dtype>
+bool caffe_fusable_activation(const LayerParameter& activation_param,
+    LayerParameter_LayerType* activation, Dtype* negative_slope);
+
+// Multiplies dY in place by the derivative of the activation, given its
+// output Y.
+template <typename Dtype>
+void caffe_cpu_activation_backward(const int count,
+    const LayerParameter_LayerType activation, const Dtype negative_slope,
+    const Dtype* Y, Dtype* dY);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_ACTIVATION_HPP_
@@ -0,0 +1,42 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_DATUM_TRANSFORM_HPP_
+#define CAFFE_UTIL_DATUM_TRANSFORM_HPP_
+
+#include <stdint.h>
+
+#include <cstddef>
+
+namespace caffe {
+
+// The fields of a serialized Datum holding uint8 data, pointing into the
+// serialized buffer instead of copying the data out as Datum::ParseFrom*
+// does. It is valid as long as the buffer is.
+struct DatumView {
+  int channels;
+  int height;
+  int width;
+  int label;
+  const uint8_t* data;
+  size_t data_size;
+};
+
+// Decodes the Datum serialized in buffer into view. Returns false if the
+// buffer holds no uint8 data, float_data, fields Datum does not know of, or
+// is malformed: those are left to Datum::ParseFromArray.
+bool ParseDatumView(const char* buffer, const size_t size, DatumView* view);
+
+// Converts a crop_height x crop_width crop at (h_off, w_off) of a channels x
+// height x width uint8 image, subtracting mean (laid out as the image) and
+// multiplying by scale, and mirroring the columns if mirror is set, in a
+// single pass over the rows of the crop. The full image is the crop of
+// height x width at (0, 0).
+template <typename Dtype>
+void datum_transform_cpu(const uint8_t* data, const int channels,
+    const int height, const int width, const Dtype* mean, const Dtype scale,
+    const int crop_height, const int crop_width, const int h_off,
+    const int w_off, const bool mirror, Dtype* dst);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DATUM_TRANSFORM_HPP_
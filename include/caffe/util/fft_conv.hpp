@@ -0,0 +1,51 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_FFT_CONV_HPP_
+#define _CAFFE_UTIL_FFT_CONV_HPP_
+
+namespace caffe {
+
+// Stride 1 convolution in the frequency domain with overlap-add: the input
+// is cut into tiles of fft_size - ksize + 1 pixels, whose spectra are
+// multiplied with the kernel spectra and summed over the input channels, and
+// the inverse transforms are added up into the output. Spectra are stored as
+// interleaved complex numbers; as the signals are real, only the
+// fft_size * (fft_size / 2 + 1) non-redundant frequency bins are kept.
+
+// Power of two size of the transforms for ksize kernels on height x width
+// inputs.
+int fft_conv_size(const int ksize, const int height, const int width);
+
+// Number of Dtype values of the kernel spectra of num_out x num_in kernels.
+int fft_conv_kernel_count(const int num_out, const int num_in,
+    const int fft_size);
+
+// Number of Dtype values of the work buffer of fft_conv_cpu.
+int fft_conv_buffer_count(const int num_in, const int num_out,
+    const int width, const int ksize, const int fft_size);
+
+// Transforms kernels stored as (num_a, num_b, ksize, ksize) into spectra
+// laid out as bins x num_out x num_in. Without transposed, num_a kernels
+// map num_b input channels and are flipped, so that fft_conv_cpu computes
+// a correlation as in the convolution forward pass. With transposed, the
+// kernels map num_a input channels to num_b outputs unflipped, as in the
+// gradient of a convolution w.r.t. its input.
+template <typename Dtype>
+void fft_conv_kernel_transform_cpu(const Dtype* kernel, const int num_a,
+    const int num_b, const int ksize, const bool transposed,
+    const int fft_size, Dtype* kernel_fft);
+
+// Computes the full linear convolution of the num_in x height x width input
+// with the kernels and writes the window starting at (offset, offset) of it
+// to the num_out x height_out x width_out output. offset is ksize - 1 - pad
+// for a correlation and pad for a transposed convolution.
+template <typename Dtype>
+void fft_conv_cpu(const Dtype* data_in, const int num_in, const int height,
+    const int width, const Dtype* kernel_fft, const int num_out,
+    const int ksize, const int fft_size, const int offset,
+    const int height_out, const int width_out, Dtype* buffer,
+    Dtype* data_out);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FFT_CONV_HPP_
@@ -0,0 +1,126 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_HDF5_READER_HPP_
+#define CAFFE_UTIL_HDF5_READER_HPP_
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "hdf5.h"
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Counters of an HDF5RowReader.
+struct HDF5ReaderStats {
+  size_t num_hits;
+  size_t num_misses;
+  size_t num_read_ahead;
+  size_t num_windows;
+  size_t bytes_cached;
+
+  // Fraction of the window lookups served from the cache.
+  double hit_rate() const {
+    const size_t num_reads = num_hits + num_misses;
+    return num_reads ? static_cast<double>(num_hits) / num_reads : 0.;
+  }
+};
+
+template <typename Dtype>
+class HDF5RowReader;
+
+// The function used to read the next windows ahead.
+template <typename Dtype>
+void* HDF5RowReaderPrefetch(void* reader_pointer);
+
+// Reads the rows of a float or double HDF5 dataset of 1 to 4 dimensions
+// without loading all of it: rows are read in windows of whole chunks with
+// hyperslab selections, and a least recently used cache keeps as many
+// windows as fit in its capacity, but at least two. With read_ahead, a
+// background thread reads the window following the one last read, so that
+// sequential reads overlap with the file I/O; random reads are served
+// window by window without it. Reads are thread-safe, and every HDF5 call
+// holds hdf5_mutex().
+template <typename Dtype>
+class HDF5RowReader {
+  friend void* HDF5RowReaderPrefetch<Dtype>(void* reader_pointer);
+
+ public:
+  // Windows hold at least min_window_rows rows, rounded up to whole chunks
+  // of the dataset.
+  HDF5RowReader(const std::string& filename, const std::string& dataset,
+      const int min_dim, const int max_dim, const int min_window_rows,
+      const size_t capacity, const bool read_ahead);
+  ~HDF5RowReader();
+
+  // The shape of the dataset, as hdf5_load_nd_dataset reshapes blobs.
+  inline int num() const { return num_; }
+  inline int channels() const { return channels_; }
+  inline int height() const { return height_; }
+  inline int width() const { return width_; }
+  // The values per row.
+  inline int row_size() const { return channels_ * height_ * width_; }
+  inline int window_rows() const { return window_rows_; }
+
+  // Copies num_rows rows starting at row to data.
+  void ReadRows(const int row, const int num_rows, Dtype* data);
+  inline void ReadRow(const int row, Dtype* data) { ReadRows(row, 1, data); }
+  HDF5ReaderStats stats() const;
+
+ protected:
+  struct Window {
+    int index;
+    bool loaded;
+    // the reads copying out of the window, which keep it from eviction
+    int users;
+    std::vector<Dtype> data;
+  };
+  typedef typename std::list<Window>::iterator WindowIterator;
+
+  // Finds or reads a window and waits until it is loaded, with the lock
+  // held. The window is kept until its users count is decremented.
+  WindowIterator UseWindow(const int index);
+  // Adds an empty window to the cache, with the lock held.
+  WindowIterator InsertWindow(const int index);
+  // Reads a window from the file, without the lock.
+  void LoadWindow(const int index, std::vector<Dtype>* data);
+  // Evicts the least recently used loaded windows, with the lock held.
+  void Evict();
+
+  std::string filename_;
+  hid_t file_id_;
+  hid_t dataset_id_;
+  std::vector<hsize_t> dims_;
+  int num_;
+  int channels_;
+  int height_;
+  int width_;
+  int window_rows_;
+  size_t max_windows_;
+  size_t num_hits_;
+  size_t num_misses_;
+  size_t num_read_ahead_;
+  // most recently used first
+  std::list<Window> lru_;
+  std::map<int, WindowIterator> index_;
+  mutable pthread_mutex_t mutex_;
+  pthread_cond_t window_loaded_;
+  // Read-ahead: the thread reads wanted_window_ unless it is -1.
+  bool read_ahead_;
+  pthread_t thread_;
+  pthread_cond_t window_wanted_;
+  bool stop_;
+  int wanted_window_;
+
+  DISABLE_COPY_AND_ASSIGN(HDF5RowReader);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HDF5_READER_HPP_
@@ -0,0 +1,120 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <pthread.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Counters of a HostAllocator. Sizes are in bytes as handed out, i.e.
+// rounded up to the size class for the caching allocator.
+struct HostAllocatorStats {
+  size_t bytes_in_use;
+  size_t peak_bytes_in_use;
+  size_t bytes_cached;
+  size_t num_allocs;
+  size_t num_cache_hits;
+
+  // Fraction of the allocations served from a free list.
+  double hit_rate() const {
+    return num_allocs ? static_cast<double>(num_cache_hits) / num_allocs : 0.;
+  }
+};
+
+// Interface of the allocators behind the host memory of SyncedMemory.
+// Implementations must be thread-safe. Memory is returned with the size it
+// was requested with, to the allocator that handed it out.
+class HostAllocator {
+ public:
+  HostAllocator();
+  virtual ~HostAllocator() {}
+  virtual void* Allocate(size_t size) = 0;
+  virtual void Free(void* ptr, size_t size) = 0;
+  // Returns cached but unused memory to the system.
+  virtual void ReleaseCached() {}
+  HostAllocatorStats stats() const;
+  void ResetPeak();
+
+  // The allocator used for new host memory: CachingHostAllocator by
+  // default, MallocHostAllocator if the environment variable
+  // CAFFE_HOST_ALLOCATOR is set to "malloc" (e.g. for memory debuggers).
+  static HostAllocator* Get();
+  // Replaces the allocator used for new host memory; NULL restores the
+  // default. Memory allocated before keeps going back to its own allocator,
+  // which therefore has to outlive it.
+  static void Set(HostAllocator* allocator);
+  // The built-in allocators, which live until the end of the program.
+  static HostAllocator* Malloc();
+  static HostAllocator* Caching();
+
+ protected:
+  // Bookkeeping for the implementations; safe to call from any thread.
+  void CountAlloc(size_t size, bool cache_hit);
+  void CountFree(size_t size);
+  void CountCached(size_t size, bool add);
+
+  size_t bytes_in_use_;
+  size_t peak_bytes_in_use_;
+  size_t bytes_cached_;
+  size_t num_allocs_;
+  size_t num_cache_hits_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+// Plain malloc and free.
+class MallocHostAllocator : public HostAllocator {
+ public:
+  MallocHostAllocator() {}
+  virtual void* Allocate(size_t size);
+  virtual void Free(void* ptr, size_t size);
+};
+
+// Keeps freed blocks for reuse instead of returning them to the system, so
+// that nets reshaping between a few batch sizes stop churning the heap.
+// Blocks are 64-byte aligned and rounded up to size classes, four per power
+// of two (at most 25% padding). Small blocks are first put into a cache of
+// the freeing thread, which serves allocations without locking; the rest go
+// to free lists shared by all threads. Blocks above kMaxCachedSize bypass
+// the cache, and once more than max_bytes_cached bytes are cached the
+// largest shared blocks are returned to the system.
+class CachingHostAllocator : public HostAllocator {
+ public:
+  explicit CachingHostAllocator(size_t max_bytes_cached = kMaxBytesCached);
+  virtual ~CachingHostAllocator();
+  virtual void* Allocate(size_t size);
+  virtual void Free(void* ptr, size_t size);
+  virtual void ReleaseCached();
+
+  static const size_t kAlignment = 64;
+  static const size_t kMaxCachedSize = size_t(1) << 28;
+  static const size_t kMaxBytesCached = size_t(1) << 30;
+  // Largest block and total size kept per thread.
+  static const size_t kMaxThreadCachedSize = 256 << 10;
+  static const size_t kThreadCacheSize = 4 << 20;
+
+  // The size class of a size in [1, kMaxCachedSize], and its block size.
+  static int size_class(size_t size);
+  static size_t class_size(int size_class);
+
+ protected:
+  struct ThreadCache;
+  ThreadCache* thread_cache(bool create);
+  void FlushThreadCache(ThreadCache* cache);
+  static void DestroyThreadCache(void* cache);
+
+  size_t max_bytes_cached_;
+  pthread_mutex_t mutex_;
+  pthread_key_t thread_cache_key_;
+  std::vector<std::vector<void*> > free_lists_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -15,6 +15,20 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int psize, const int pad,
     const int stride, Dtype* data_im);
 
+// Block variants: the column matrix of num consecutive images is laid out
+// with (channels * ksize * ksize) rows and num * height_col * width_col
+// columns, image n occupying columns [n * height_col * width_col, ...), so a
+// whole block can be multiplied by the weights with a single gemm.
+template <typename Dtype>
+void im2col_batch_cpu(const Dtype* data_im, const int num, const int channels,
+    const int height, const int width, const int ksize, const int pad,
+    const int stride, Dtype* data_col);
+
+template <typename Dtype>
+void col2im_batch_cpu(const Dtype* data_col, const int num, const int channels,
+    const int height, const int width, const int psize, const int pad,
+    const int stride, Dtype* data_im);
+
 template <typename Dtype>
 void im2col_gpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int ksize, const int pad,
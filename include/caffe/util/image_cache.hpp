@@ -0,0 +1,88 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <pthread.h>
+#include <opencv2/core/core.hpp>
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Reads an image the way ReadImageToDatum does: in color or grayscale, and
+// resized to height x width if both are positive. Returns an empty Mat if
+// the file cannot be read.
+cv::Mat ReadImageToCVMat(const std::string& filename, const int height,
+    const int width, const bool is_color);
+
+// Counters of an ImageCache.
+struct ImageCacheStats {
+  size_t num_hits;
+  size_t num_misses;
+  size_t num_evictions;
+  size_t num_images;
+  size_t bytes_cached;
+
+  // Fraction of the reads served from the cache.
+  double hit_rate() const {
+    const size_t num_reads = num_hits + num_misses;
+    return num_reads ? static_cast<double>(num_hits) / num_reads : 0.;
+  }
+};
+
+// A least recently used cache of decoded images, keyed by file name, color
+// mode and size, and bounded by the bytes of their pixels. It is
+// thread-safe; images are decoded outside of the lock, so that prefetch
+// threads missing at the same time decode concurrently. The returned Mats
+// share the cached pixels and must not be written to.
+class ImageCache {
+ public:
+  explicit ImageCache(size_t capacity);
+  ~ImageCache();
+
+  // ReadImageToCVMat through the cache. Images that cannot be read are not
+  // cached.
+  cv::Mat Read(const std::string& filename, const int height,
+      const int width, const bool is_color);
+  ImageCacheStats stats() const;
+  // Drops the cached images, keeping the counters.
+  void Clear();
+  size_t capacity() const;
+  // Evicts down to the new capacity if needed.
+  void set_capacity(size_t capacity);
+
+  // The cache shared by the image data layers, empty until a layer asks for
+  // a capacity with Reserve.
+  static ImageCache* Get();
+  // Grows the capacity of the shared cache to at least capacity, so that
+  // layers sharing it get the largest of their budgets.
+  static void Reserve(size_t capacity);
+
+ protected:
+  typedef std::pair<std::string, cv::Mat> Entry;
+  // evicts the least recently used images, with the lock held
+  void Evict();
+
+  size_t capacity_;
+  size_t bytes_cached_;
+  size_t num_hits_;
+  size_t num_misses_;
+  size_t num_evictions_;
+  // most recently used first
+  std::list<Entry> lru_;
+  std::map<std::string, std::list<Entry>::iterator> index_;
+  mutable pthread_mutex_t mutex_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -3,6 +3,8 @@
 #ifndef CAFFE_UTIL_IO_H_
 #define CAFFE_UTIL_IO_H_
 
+#include <pthread.h>
+
 #include <string>
 
 #include "google/protobuf/message.h"
@@ -60,8 +62,19 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+class ImageCache;
+
+// Reads an image into a Datum of uint8 data; through cache if given (see
+// ImageCache).
 bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum);
+    const int height, const int width, const bool is_color, Datum* datum,
+    ImageCache* cache);
+
+inline bool ReadImageToDatum(const string& filename, const int label,
+    const int height, const int width, const bool is_color, Datum* datum) {
+  return ReadImageToDatum(filename, label, height, width, is_color, datum,
+      NULL);
+}
 
 inline bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, Datum* datum) {
@@ -88,6 +101,10 @@ template <typename Dtype>
 void hdf5_save_nd_dataset(
   const hid_t file_id, const string dataset_name, const Blob<Dtype>& blob);
 
+// HDF5 is usually built without thread-safety, and data layers read files
+// on background threads: the layers hold this lock around their HDF5 calls.
+pthread_mutex_t* hdf5_mutex();
+
 }  // namespace caffe
 
 #endif   // CAFFE_UTIL_IO_H_
@@ -35,6 +35,12 @@ void caffe_cpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
     Dtype* y);
 
+// The number of threads the CPU BLAS uses for a single call, and a setter to
+// keep BLAS serial while the layers run their own threads over a batch.
+// Both are no-ops for BLAS libraries without thread control (ATLAS).
+int caffe_cpu_blas_num_threads();
+void caffe_set_cpu_blas_num_threads(const int threads);
+
 template <typename Dtype>
 void caffe_gpu_gemv(const CBLAS_TRANSPOSE TransA, const int M, const int N,
     const Dtype alpha, const Dtype* A, const Dtype* x, const Dtype beta,
@@ -263,6 +269,16 @@ void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 template <typename Dtype>
 void caffe_gpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// The SGD step of a parameter in a single pass: history = rate * diff +
+// momentum * history + decay * rate * data, then diff = history and, if
+// update_data, data -= history. It computes the same values as
+// caffe_cpu_axpby, caffe_axpy, caffe_copy and Blob::Update in turn, over
+// blocks split across Caffe::cpu_threads().
+template <typename Dtype>
+void caffe_cpu_sgd_update(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const bool update_data, Dtype* data, Dtype* diff,
+    Dtype* history);
+
 }  // namespace caffe
 
 
@@ -3,6 +3,11 @@
 #ifndef CAFFE_RNG_CPP_HPP_
 #define CAFFE_RNG_CPP_HPP_
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+
 #include <boost/random/mersenne_twister.hpp>
 #include "caffe/common.hpp"
 
@@ -14,6 +19,64 @@ namespace caffe {
     return static_cast<caffe::rng_t*>(Caffe::rng_stream().generator());
   }
 
+  // Counter-based random numbers for worker threads. The n-th number of the
+  // stream keyed by (seed, iteration, item, stream) is a hash of these values
+  // and n, so every item of a batch gets its own generator without shared
+  // state, and the results do not depend on which thread draws them or in
+  // which order. seed is typically drawn once from caffe_rng_rand(), so that
+  // Caffe::set_random_seed makes the streams reproducible.
+  class CounterRNG {
+   public:
+    typedef uint32_t result_type;
+
+    CounterRNG(const uint64_t seed, const uint64_t iteration,
+        const uint64_t item, const uint64_t stream = 0)
+        : counter_(0) {
+      key_ = mix(mix(mix(mix(seed) ^ iteration) ^ item) ^ stream);
+    }
+
+    static inline result_type min() { return 0; }
+    static inline result_type max() { return 0xffffffffu; }
+    inline result_type operator()() {
+      return static_cast<result_type>(next() >> 32);
+    }
+
+    // Uniform in [0, 1).
+    inline double uniform() {
+      return (next() >> 11) * (1. / (uint64_t(1) << 53));
+    }
+    // Uniform in [a, b].
+    template <typename Dtype>
+    inline Dtype uniform(const Dtype a, const Dtype b) {
+      return std::min(b, static_cast<Dtype>(a + (b - a) * uniform()));
+    }
+    // Box-Muller; one number per pair of uniforms.
+    template <typename Dtype>
+    inline Dtype gaussian(const Dtype mu, const Dtype sigma) {
+      const double u1 = 1. - uniform();
+      const double u2 = uniform();
+      return static_cast<Dtype>(mu + sigma *
+          std::sqrt(-2. * std::log(u1)) * std::cos(2. * M_PI * u2));
+    }
+    inline bool bernoulli(const double p) {
+      return uniform() < p;
+    }
+
+   protected:
+    // SplitMix64 finalizer.
+    static inline uint64_t mix(uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+    inline uint64_t next() {
+      return mix(key_ + (++counter_) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    uint64_t key_;
+    uint64_t counter_;
+  };
+
 }  // namespace caffe
 
 #endif  // CAFFE_RNG_HPP_
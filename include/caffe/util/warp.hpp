@@ -0,0 +1,48 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_WARP_HPP_
+#define _CAFFE_UTIL_WARP_HPP_
+
+namespace caffe {
+
+// Spatial transforms of the augmentation layers. Images are stored as width
+// rows of height values per channel, i.e. the value of channel c at (x, y)
+// is at (c * width + x) * height + y, and so is the crop. The transform
+// maps every crop position to a source position through an affine matrix,
+//   src_x = affine[0] * x + affine[1] * y + affine[2],
+//   src_y = affine[3] * x + affine[4] * y + affine[5],
+// so that there is no trigonometry per pixel, and the crop is written row
+// by row, one channel after the other.
+
+// The matrix of the transform of the augmentation layers: the crop is
+// centered, mirrored along y, rotated by angle, translated by (dx, dy) times
+// the crop size and zoomed out by (zoom_x, zoom_y), in this order, and then
+// centered on the source.
+template <typename Dtype>
+void warp_affine_matrix(const bool mirror, const Dtype angle, const Dtype dx,
+    const Dtype dy, const Dtype zoom_x, const Dtype zoom_y,
+    const int crop_width, const int crop_height, const int width,
+    const int height, Dtype* affine);
+
+// Whether the four corners of the crop fall inside the source, so that
+// every pixel can be interpolated.
+template <typename Dtype>
+bool warp_inside(const Dtype* affine, const int crop_width,
+    const int crop_height, const int width, const int height);
+
+// Warps a channels x width x height image into a channels x crop_width x
+// crop_height crop. Pixels are interpolated bilinearly, or without
+// interpolate take the source pixel to the top left of their position, and
+// pixels whose neighbourhood leaves the source are 0. If mean is given, the
+// mean value of the source pixel to the top left is subtracted (mean is laid
+// out as the source), and the result is multiplied by scale. Stype is Dtype
+// or uint8_t for encoded data.
+template <typename Dtype, typename Stype>
+void warp_bilinear_cpu(const Stype* src, const int channels, const int width,
+    const int height, const Dtype* affine, const bool interpolate,
+    const Dtype* mean, const Dtype scale, const int crop_width,
+    const int crop_height, Dtype* dst);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WARP_HPP_
@@ -0,0 +1,40 @@
+// Copyright 2014 BVLC and contributors.
+
+#ifndef _CAFFE_UTIL_WINOGRAD_HPP_
+#define _CAFFE_UTIL_WINOGRAD_HPP_
+
+namespace caffe {
+
+// Winograd F(2x2, 3x3) convolution: every 2x2 output tile is computed from a
+// 4x4 input tile with 16 instead of 36 multiplications. After transforming
+// the kernels (U) and the input tiles (V), the products for each of the 16
+// tile positions xi form one gemm over channels,
+//   M[xi] (num_output x tiles) = U[xi] (num_output x channels) * V[xi],
+// and the output transform turns M back into 2x2 output tiles.
+
+// Transforms 3x3 kernels of shape (num_output, channels, 3, 3) into U, laid
+// out as 16 x num_output x channels. With backward set, the kernels are
+// rotated by 180 degrees and U is laid out as 16 x channels x num_output,
+// which turns the gradient w.r.t. the input into a forward convolution of
+// the top diff.
+template <typename Dtype>
+void winograd_kernel_transform_cpu(const Dtype* kernel, const int num_output,
+    const int channels, const bool backward, Dtype* U);
+
+// Transforms the overlapping 4x4 input tiles (stride 2, zero padded by pad)
+// of an image into V, laid out as 16 x channels x (tiles_h * tiles_w).
+template <typename Dtype>
+void winograd_input_transform_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int pad, const int tiles_h,
+    const int tiles_w, Dtype* V);
+
+// Transforms M (16 x channels x (tiles_h * tiles_w)) into 2x2 output tiles,
+// overwriting the height x width image and cropping tiles at the border.
+template <typename Dtype>
+void winograd_output_transform_cpu(const Dtype* M, const int channels,
+    const int tiles_h, const int tiles_w, const int height, const int width,
+    Dtype* data_im);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WINOGRAD_HPP_
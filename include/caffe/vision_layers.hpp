@@ -128,7 +128,9 @@ template <typename Dtype>
 class ConvolutionLayer : public Layer<Dtype> {
  public:
   explicit ConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param),
+        fused_activation_(LayerParameter_LayerType_NONE),
+        fused_negative_slope_(0) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
@@ -137,6 +139,7 @@ class ConvolutionLayer : public Layer<Dtype> {
   }
   virtual void normalize_weights(Dtype mnorm);
   virtual void normalize_weights(Dtype min_norm, Dtype max_norm, Dtype target_norm);
+  virtual bool FuseActivation(const LayerParameter& activation_param);
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -149,22 +152,74 @@ class ConvolutionLayer : public Layer<Dtype> {
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+  // CPU path over blocks of col_block_size_ images (col_buffer_mb > 0).
+  Dtype Forward_cpu_batched(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  void Backward_cpu_batched(const vector<Blob<Dtype>*>& top,
+      const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+  // Winograd F(2x2, 3x3) path (engine: WINOGRAD). The backward pass only
+  // computes the gradient w.r.t. the bottom; the parameter gradients are
+  // left to the im2col path.
+  Dtype Forward_cpu_winograd(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  void Backward_cpu_winograd(const vector<Blob<Dtype>*>& top,
+      vector<Blob<Dtype>*>* bottom);
+  void WinogradTransformWeights();
+  // FFT path (engine: FFT, or DEFAULT for large kernels); as for Winograd,
+  // the parameter gradients are left to the im2col path.
+  Dtype Forward_cpu_fft(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  void Backward_cpu_fft(const vector<Blob<Dtype>*>& top,
+      vector<Blob<Dtype>*>* bottom);
+  void FFTTransformWeights();
 
   int kernel_size_;
   int stride_;
   int num_;
   int channels_;
   int pad_;
+  // kernel 1, stride 1, no padding: the CPU path skips im2col/col2im
+  bool is_1x1_;
   int height_;
   int width_;
   int num_output_;
   int group_;
   Blob<Dtype> col_buffer_;
+  // num_output_ x (block * N_) gemm result of the batched path.
+  Blob<Dtype> out_buffer_;
+  int col_block_size_;
+  // weight gradients of threads 1.. when the batch is split across threads
+  Blob<Dtype> weight_diff_buffer_;
+  int num_threads_;
+  bool use_winograd_;
+  // Transformed weights of the forward and the backward pass, valid for the
+  // memory and data version of blobs_[0] they were computed from.
+  Blob<Dtype> winograd_weight_;
+  Blob<Dtype> winograd_weight_backward_;
+  const SyncedMemory* winograd_weight_mem_;
+  size_t winograd_weight_version_;
+  // per-thread transformed input tiles and their products with the weights
+  Blob<Dtype> winograd_in_;
+  Blob<Dtype> winograd_out_;
+  bool use_fft_;
+  // transform sizes of the forward and the backward pass
+  int fft_size_;
+  int fft_size_backward_;
+  // kernel spectra of the two passes, cached like the Winograd weights
+  Blob<Dtype> fft_weight_;
+  Blob<Dtype> fft_weight_backward_;
+  const SyncedMemory* fft_weight_mem_;
+  size_t fft_weight_version_;
+  // per-thread work buffers of fft_conv_cpu
+  Blob<Dtype> fft_buffer_;
   shared_ptr<SyncedMemory> bias_multiplier_;
   bool bias_term_;
   int M_;
   int K_;
   int N_;
+  // activation applied with the bias on the CPU (see FuseActivation)
+  LayerParameter_LayerType fused_activation_;
+  Dtype fused_negative_slope_;
 };
 
 /* ConvolutionOrthLayer
@@ -176,6 +231,8 @@ class ConvolutionOrthLayer : public Layer<Dtype> {
       : Layer<Dtype>(param) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_CONVOLUTION_ORTH;
@@ -194,17 +251,30 @@ class ConvolutionOrthLayer : public Layer<Dtype> {
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+  // CPU path over blocks of col_block_size_ images (col_buffer_mb > 0).
+  Dtype Forward_cpu_batched(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  void Backward_cpu_batched(const vector<Blob<Dtype>*>& top,
+      const bool propagate_down, vector<Blob<Dtype>*>* bottom);
 
   int kernel_size_;
   int stride_;
   int num_;
   int channels_;
   int pad_;
+  // kernel 1, stride 1, no padding: the CPU path skips im2col/col2im
+  bool is_1x1_;
   int height_;
   int width_;
   int num_output_;
   int group_;
   Blob<Dtype> col_buffer_;
+  // num_output_ x (block * N_) gemm result of the batched path.
+  Blob<Dtype> out_buffer_;
+  int col_block_size_;
+  // weight gradients of threads 1.. when the batch is split across threads
+  Blob<Dtype> weight_diff_buffer_;
+  int num_threads_;
   shared_ptr<SyncedMemory> bias_multiplier_;
   bool bias_term_;
   int M_;
@@ -235,13 +305,16 @@ template <typename Dtype>
 class DeConvolutionLayer : public Layer<Dtype> {
  public:
   explicit DeConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param),
+        fused_activation_(LayerParameter_LayerType_NONE),
+        fused_negative_slope_(0) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_DECONVOLUTION;
   }
+  virtual bool FuseActivation(const LayerParameter& activation_param);
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -254,12 +327,21 @@ class DeConvolutionLayer : public Layer<Dtype> {
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom);
+  // FFT path (engine: FFT, or DEFAULT for large kernels); the parameter
+  // gradients are left to the im2col path.
+  Dtype Forward_cpu_fft(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
+  void Backward_cpu_fft(const vector<Blob<Dtype>*>& top,
+      vector<Blob<Dtype>*>* bottom);
+  void FFTTransformWeights();
 
   int kernel_size_;
   int stride_;
   int num_;
   int channels_;
   int pad_;
+  // kernel 1, stride 1, no padding: the CPU path skips im2col/col2im
+  bool is_1x1_;
   int height_;
   int width_;
   int height_out_;
@@ -267,11 +349,29 @@ class DeConvolutionLayer : public Layer<Dtype> {
   int num_output_;
   int group_;
   Blob<Dtype> col_buffer_;
+  // weight gradients of threads 1.. when the batch is split across threads
+  Blob<Dtype> weight_diff_buffer_;
+  int num_threads_;
+  bool use_fft_;
+  // transform sizes of the forward and the backward pass
+  int fft_size_;
+  int fft_size_backward_;
+  // kernel spectra of the two passes, valid for the memory and data version
+  // of blobs_[0] they were computed from
+  Blob<Dtype> fft_weight_;
+  Blob<Dtype> fft_weight_backward_;
+  const SyncedMemory* fft_weight_mem_;
+  size_t fft_weight_version_;
+  // per-thread work buffers of fft_conv_cpu
+  Blob<Dtype> fft_buffer_;
   shared_ptr<SyncedMemory> bias_multiplier_;
   bool bias_term_;
   int M_;
   int K_;
   int N_;
+  // activation applied with the bias on the CPU (see FuseActivation)
+  LayerParameter_LayerType fused_activation_;
+  Dtype fused_negative_slope_;
 };
 
 /* DeConvolutionOrthLayer
@@ -283,6 +383,8 @@ class DeConvolutionOrthLayer : public Layer<Dtype> {
       : Layer<Dtype>(param) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_DECONVOLUTION_ORTH;
@@ -307,6 +409,8 @@ class DeConvolutionOrthLayer : public Layer<Dtype> {
   int num_;
   int channels_;
   int pad_;
+  // kernel 1, stride 1, no padding: the CPU path skips im2col/col2im
+  bool is_1x1_;
   int height_;
   int width_;
   int height_out_;
@@ -314,6 +418,9 @@ class DeConvolutionOrthLayer : public Layer<Dtype> {
   int num_output_;
   int group_;
   Blob<Dtype> col_buffer_;
+  // weight gradients of threads 1.. when the batch is split across threads
+  Blob<Dtype> weight_diff_buffer_;
+  int num_threads_;
   shared_ptr<SyncedMemory> bias_multiplier_;
   bool bias_term_;
   int M_;
@@ -383,6 +490,7 @@ class FlattenLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool ForwardSharesData() const { return true; }
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -404,12 +512,15 @@ class InvertGradientLayer : public Layer<Dtype> {
       : Layer<Dtype>(param) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_INVERT_GRADIENT;
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool ForwardSharesData() const { return true; }
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -443,6 +554,7 @@ class ReshapeLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool ForwardSharesData() const { return true; }
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -532,7 +644,9 @@ template <typename Dtype>
 class InnerProductLayer : public Layer<Dtype> {
  public:
   explicit InnerProductLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param),
+        fused_activation_(LayerParameter_LayerType_NONE),
+        fused_negative_slope_(0) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
 
@@ -541,6 +655,7 @@ class InnerProductLayer : public Layer<Dtype> {
   }
   virtual void normalize_weights(Dtype mnorm);
   virtual void normalize_weights(Dtype min_norm, Dtype max_norm, Dtype target_norm);
+  virtual bool FuseActivation(const LayerParameter& activation_param);
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -559,6 +674,9 @@ class InnerProductLayer : public Layer<Dtype> {
   int N_;
   bool bias_term_;
   shared_ptr<SyncedMemory> bias_multiplier_;
+  // activation applied with the bias on the CPU (see FuseActivation)
+  LayerParameter_LayerType fused_activation_;
+  Dtype fused_negative_slope_;
 };
 
 /* InnerProductOrthLayer - InnerProductLayer with orthogonalization 
@@ -570,6 +688,8 @@ class InnerProductOrthLayer : public Layer<Dtype> {
       : Layer<Dtype>(param) {}
   virtual void SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top);
 
   virtual inline LayerParameter_LayerType type() const {
     return LayerParameter_LayerType_INNER_PRODUCT_ORTH;
@@ -1075,6 +1195,7 @@ class SplitLayer : public Layer<Dtype> {
   }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
+  virtual inline bool ForwardSharesData() const { return true; }
 
  protected:
   virtual Dtype Forward_cpu(const vector<Blob<Dtype>*>& bottom,
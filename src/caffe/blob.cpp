@@ -3,6 +3,8 @@
 #include <cuda_runtime.h>
 #include <cublas_v2.h>
 
+#include <algorithm>
+
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
@@ -22,27 +24,31 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   height_ = height;
   width_ = width;
   count_ = num_ * channels_ * height_ * width_;
-  if (count_) {
-    data_.reset(new SyncedMemory(count_ * sizeof(Dtype)));
-    diff_.reset(new SyncedMemory(count_ * sizeof(Dtype)));
-  } else {
-    data_.reset(reinterpret_cast<SyncedMemory*>(NULL));
-    diff_.reset(reinterpret_cast<SyncedMemory*>(NULL));
+  // within the capacity the memory (and its content) is kept, so that
+  // changing batch sizes do not reallocate
+  if (count_ > capacity_) {
+    capacity_ = count_;
+    data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    if (diff_enabled_) {
+      diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
+    }
+  }
+}
+
+template <typename Dtype>
+void Blob<Dtype>::set_diff_enabled(const bool enabled) {
+  diff_enabled_ = enabled;
+  if (!enabled) {
+    diff_.reset();
+  } else if (!diff_ && capacity_) {
+    diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
   }
 }
 
 template <typename Dtype>
 void Blob<Dtype>::Reshape_keepdata(const int num, const int channels, const int height,
     const int width) {
-  CHECK_GE(num, 0);
-  CHECK_GE(channels, 0);
-  CHECK_GE(height, 0);
-  CHECK_GE(width, 0);
-  num_ = num;
-  channels_ = channels;
-  height_ = height;
-  width_ = width;
-  count_ = num_ * channels_ * height_ * width_;
+  Reshape(num, channels, height, width);
 }
 
 template <typename Dtype>
@@ -52,7 +58,9 @@ void Blob<Dtype>::ReshapeLike(const Blob<Dtype>& other) {
 
 template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
-    const int width) {
+    const int width)
+  // capacity_ must be initialized before calling Reshape
+  : capacity_(0), diff_enabled_(true) {
   Reshape(num, channels, height, width);
 }
 
@@ -76,13 +84,13 @@ const Dtype* Blob<Dtype>::gpu_data() const {
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_diff() const {
-  CHECK(diff_);
+  CHECK(diff_) << "Blob without diff (not used by the backward pass)";
   return (const Dtype*)diff_->cpu_data();
 }
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::gpu_diff() const {
-  CHECK(diff_);
+  CHECK(diff_) << "Blob without diff (not used by the backward pass)";
   return (const Dtype*)diff_->gpu_data();
 }
 
@@ -100,13 +108,13 @@ Dtype* Blob<Dtype>::mutable_gpu_data() {
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_diff() {
-  CHECK(diff_);
+  CHECK(diff_) << "Blob without diff (not used by the backward pass)";
   return reinterpret_cast<Dtype*>(diff_->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_diff() {
-  CHECK(diff_);
+  CHECK(diff_) << "Blob without diff (not used by the backward pass)";
   return reinterpret_cast<Dtype*>(diff_->mutable_gpu_data());
 }
 
@@ -114,12 +122,22 @@ template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
   data_ = other.data();
+  capacity_ = std::min(capacity_, other.capacity());
+}
+
+template <typename Dtype>
+void Blob<Dtype>::SetDataMemory(const shared_ptr<SyncedMemory>& data) {
+  CHECK(data);
+  CHECK_GE(data->size(), count_ * sizeof(Dtype));
+  data_ = data;
+  capacity_ = std::min<int>(capacity_, data->size() / sizeof(Dtype));
 }
 
 template <typename Dtype>
 void Blob<Dtype>::ShareDiff(const Blob& other) {
   CHECK_EQ(count_, other.count());
   diff_ = other.diff();
+  capacity_ = std::min(capacity_, other.capacity());
 }
 
 // The "update" method is used for parameter blobs in a Net, which are stored
@@ -192,7 +210,7 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
   for (int i = 0; i < count_; ++i) {
     data_vec[i] = proto.data(i);
   }
-  if (proto.diff_size() > 0) {
+  if (proto.diff_size() > 0 && diff_enabled_) {
     Dtype* diff_vec = mutable_cpu_diff();
     for (int i = 0; i < count_; ++i) {
       diff_vec[i] = proto.diff(i);
@@ -211,7 +229,7 @@ void Blob<Dtype>::FromProto_noReshape(const BlobProto& proto) {
   for (int i = 0; i < count_; ++i) {
     data_vec[i] = proto.data(i);
   }
-  if (proto.diff_size() > 0) {
+  if (proto.diff_size() > 0 && diff_enabled_) {
     Dtype* diff_vec = mutable_cpu_diff();
     for (int i = 0; i < count_; ++i) {
       diff_vec[i] = proto.diff(i);
@@ -231,7 +249,7 @@ void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
   for (int i = 0; i < count_; ++i) {
     proto->add_data(data_vec[i]);
   }
-  if (write_diff) {
+  if (write_diff && diff_enabled_) {
     const Dtype* diff_vec = cpu_diff();
     for (int i = 0; i < count_; ++i) {
       proto->add_diff(diff_vec[i]);
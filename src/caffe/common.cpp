@@ -4,11 +4,14 @@
 #include <ctime>
 
 #include "caffe/common.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
 namespace caffe {
 
 shared_ptr<Caffe> Caffe::singleton_;
+__thread Caffe::RNG* Caffe::thread_rng_stream_ = NULL;
+__thread int Caffe::thread_phase_ = -1;
 
 
 // curand seeding
@@ -22,7 +25,9 @@ int64_t cluster_seedgen(void) {
 
 
 Caffe::Caffe()
-    : mode_(Caffe::CPU), phase_(Caffe::TRAIN), cublas_handle_(NULL),
+    : mode_(Caffe::CPU), phase_(Caffe::TRAIN), cpu_threads_(1),
+      layer_threads_(1), blas_threads_(caffe_cpu_blas_num_threads()),
+      cublas_handle_(NULL),
       curand_generator_(NULL),
       random_generator_() {
   // Try to create a cublas handler, and report an error if failed (but we will
@@ -46,6 +51,28 @@ Caffe::~Caffe() {
   }
 }
 
+void Caffe::SetBlasThreads() {
+#ifdef _OPENMP
+  const bool parallel = cpu_threads_ > 1 || layer_threads_ > 1;
+#else
+  const bool parallel = false;
+#endif
+  caffe_set_cpu_blas_num_threads(parallel ? 1 : blas_threads_);
+}
+
+void Caffe::set_cpu_threads(int threads) {
+  CHECK_GE(threads, 1);
+  Get().cpu_threads_ = threads;
+  Get().SetBlasThreads();
+}
+
+void Caffe::reserve_cpu_threads(int threads) {
+  if (threads > Get().layer_threads_) {
+    Get().layer_threads_ = threads;
+    Get().SetBlasThreads();
+  }
+}
+
 void Caffe::set_random_seed(const unsigned int seed) {
   // Curand seed
   // Yangqing's note: simply setting the generator seed does not seem to
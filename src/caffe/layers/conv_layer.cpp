@@ -1,12 +1,16 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/vision_layers.hpp"
+#include "caffe/util/activation.hpp"
+#include "caffe/util/fft_conv.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/winograd.hpp"
 
 namespace caffe {
 
@@ -18,6 +22,9 @@ void ConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   stride_ = this->layer_param_.convolution_param().stride();
   group_ = this->layer_param_.convolution_param().group();
   pad_ = this->layer_param_.convolution_param().pad();
+  // A 1x1 convolution without padding and striding uses the image itself as
+  // its column buffer, so the CPU code skips im2col and col2im.
+  is_1x1_ = kernel_size_ == 1 && stride_ == 1 && pad_ == 0;
   num_ = bottom[0]->num();
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
@@ -26,11 +33,27 @@ void ConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_GT(num_output_, 0);
   CHECK_EQ(channels_ % group_, 0);
   // The im2col result buffer would only hold one image at a time to avoid
-  // overly large memory usage.
+  // overly large memory usage, unless a budget for a batched buffer is set.
   int height_out = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
   int width_out = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
-  col_buffer_.Reshape(
-      1, channels_ * kernel_size_ * kernel_size_, height_out, width_out);
+  num_threads_ = this->layer_param_.convolution_param().num_threads();
+  // each of the threads calls BLAS
+  Caffe::reserve_cpu_threads(num_threads_);
+  col_block_size_ = 1;
+  const size_t col_buffer_mb =
+      this->layer_param_.convolution_param().col_buffer_mb();
+  if (col_buffer_mb > 0 && !is_1x1_) {
+    // data and diff of both the column and the output buffer
+    const size_t image_bytes = 2 * sizeof(Dtype) * height_out * width_out *
+        (channels_ * kernel_size_ * kernel_size_ + num_output_);
+    col_block_size_ = std::max(1, std::min(num_,
+        static_cast<int>(col_buffer_mb * 1024 * 1024 / image_bytes)));
+  }
+  col_buffer_.Reshape(col_block_size_,
+      channels_ * kernel_size_ * kernel_size_, height_out, width_out);
+  if (col_block_size_ > 1) {
+    out_buffer_.Reshape(col_block_size_, num_output_, height_out, width_out);
+  }
   // Set the parameters
   CHECK_EQ(num_output_ % group_, 0)
       << "Number of output should be multiples of group.";
@@ -40,6 +63,35 @@ void ConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   K_ = channels_ * kernel_size_ * kernel_size_ / group_;
   N_ = height_out * width_out;
   (*top)[0]->Reshape(bottom[0]->num(), num_output_, height_out, width_out);
+  const ConvolutionParameter_Engine engine =
+      this->layer_param_.convolution_param().engine();
+  const int fft_min_kernel_size =
+      this->layer_param_.convolution_param().fft_min_kernel_size();
+  use_winograd_ = false;
+  winograd_weight_mem_ = NULL;
+  winograd_weight_version_ = 0;
+  if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    if (kernel_size_ == 3 && stride_ == 1 && pad_ <= 2 && group_ == 1) {
+      use_winograd_ = true;
+    } else {
+      LOG(INFO) << "Winograd needs 3x3 kernels with stride 1, pad <= 2 and "
+          << "no groups; falling back to im2col";
+    }
+  }
+  use_fft_ = false;
+  fft_weight_mem_ = NULL;
+  fft_weight_version_ = 0;
+  if (engine == ConvolutionParameter_Engine_FFT ||
+      (engine == ConvolutionParameter_Engine_DEFAULT &&
+       fft_min_kernel_size > 0 && kernel_size_ >= fft_min_kernel_size)) {
+    if (stride_ == 1 && group_ == 1) {
+      use_fft_ = true;
+      fft_size_ = fft_conv_size(kernel_size_, height_, width_);
+      fft_size_backward_ = fft_conv_size(kernel_size_, height_out, width_out);
+    } else if (engine == ConvolutionParameter_Engine_FFT) {
+      LOG(INFO) << "FFT needs stride 1 and no groups; falling back to im2col";
+    }
+  }
   // Check if we need to set up the weights
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -66,10 +118,11 @@ void ConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Set up the bias filler
   if (bias_term_) {
-    bias_multiplier_.reset(new SyncedMemory(N_ * sizeof(Dtype)));
+    bias_multiplier_.reset(
+        new SyncedMemory(col_block_size_ * N_ * sizeof(Dtype)));
     Dtype* bias_multiplier_data =
         reinterpret_cast<Dtype*>(bias_multiplier_->mutable_cpu_data());
-    for (int i = 0; i < N_; ++i) {
+    for (int i = 0; i < col_block_size_ * N_; ++i) {
         bias_multiplier_data[i] = 1.;
     }
   }
@@ -79,29 +132,53 @@ void ConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 Dtype ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
+  if (use_winograd_) {
+    return Forward_cpu_winograd(bottom, top);
+  }
+  if (use_fft_) {
+    return Forward_cpu_fft(bottom, top);
+  }
+  if (col_block_size_ > 1) {
+    return Forward_cpu_batched(bottom, top);
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int top_offset = M_ * N_;
-  for (int n = 0; n < num_; ++n) {
-    // First, im2col
-    im2col_cpu(bottom_data + bottom[0]->offset(n), channels_, height_,
-                      width_, kernel_size_, pad_, stride_, col_data);
-    // Second, innerproduct with groups
-    for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-        (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-        (Dtype)0., top_data + (*top)[0]->offset(n) + top_offset * g);
-    }
-    // third, add bias
-    if (bias_term_) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-          N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-          reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-          (Dtype)1., top_data + (*top)[0]->offset(n));
+  // Split the batch across threads, each with its own slice of col_buffer_
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_base = col_buffer_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_data = col_base + col_buffer_.offset(t);
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      // First, im2col
+      const Dtype* col = col_data;
+      if (is_1x1_) {
+        col = bottom_data + bottom[0]->offset(n);
+      } else {
+        im2col_cpu(bottom_data + bottom[0]->offset(n), channels_, height_,
+            width_, kernel_size_, pad_, stride_, col_data);
+      }
+      // Second, innerproduct with groups
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+          (Dtype)1., weight + weight_offset * g, col + col_offset * g,
+          (Dtype)0., top_data + (*top)[0]->offset(n) + top_offset * g);
+      }
+      // third, add bias and apply the fused activation
+      if (bias_term_ || fused_activation_ != LayerParameter_LayerType_NONE) {
+        caffe_cpu_bias_activation(num_output_, N_, bias, true,
+            fused_activation_, fused_negative_slope_,
+            top_data + (*top)[0]->offset(n));
+      }
     }
   }
   return Dtype(0.);
@@ -110,19 +187,38 @@ Dtype ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if ((use_winograd_ || use_fft_) && propagate_down) {
+    // parameter gradients by im2col, the bottom gradient by Winograd or FFT
+    Backward_cpu(top, false, bottom);
+    if (use_winograd_) {
+      Backward_cpu_winograd(top, bottom);
+    } else {
+      Backward_cpu_fft(top, bottom);
+    }
+    return;
+  }
+  if (fused_activation_ != LayerParameter_LayerType_NONE) {
+    // backward of the fused activation, whose output the top holds
+    caffe_cpu_activation_backward(top[0]->count(), fused_activation_,
+        fused_negative_slope_, top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  }
+  if (col_block_size_ > 1) {
+    Backward_cpu_batched(top, propagate_down, bottom);
+    return;
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
   // bias gradient if necessary
   Dtype* bias_diff = NULL;
 
   if (bias_term_) {
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
-    memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+    if (!this->accumulate_param_diffs_) {
+      memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+    }
     for (int n = 0; n < num_; ++n) {
       caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
           1., top_diff + top[0]->offset(n),
@@ -134,30 +230,384 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int top_offset = M_ * N_;
-  memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
-  for (int n = 0; n < num_; ++n) {
-    // since we saved memory in the forward pass by not storing all col data,
-    // we will need to recompute them.
-    im2col_cpu(bottom_data + (*bottom)[0]->offset(n), channels_, height_,
-                      width_, kernel_size_, pad_, stride_, col_data);
+  const int weight_count = this->blobs_[0]->count();
+  if (!this->accumulate_param_diffs_) {
+    memset(weight_diff, 0, sizeof(Dtype) * weight_count);
+  }
+  // Split the batch across threads; thread 0 accumulates its weight gradient
+  // in place, the others into weight_diff_buffer_, reduced at the end.
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_data_base = col_buffer_.mutable_cpu_data();
+  Dtype* col_diff_base = col_buffer_.mutable_cpu_diff();
+  Dtype* weight_diff_partial = NULL;
+  if (threads > 1) {
+    if (weight_diff_buffer_.count() < (threads - 1) * weight_count) {
+      weight_diff_buffer_.Reshape(threads - 1, 1, 1, weight_count);
+    }
+    weight_diff_partial = weight_diff_buffer_.mutable_cpu_data();
+    memset(weight_diff_partial, 0,
+        sizeof(Dtype) * (threads - 1) * weight_count);
+  }
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_data = col_data_base + col_buffer_.offset(t);
+    Dtype* col_diff = col_diff_base + col_buffer_.offset(t);
+    Dtype* thread_weight_diff = (t == 0) ? weight_diff :
+        weight_diff_partial + (t - 1) * weight_count;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      // since we saved memory in the forward pass by not storing all col
+      // data, we will need to recompute them.
+      const Dtype* col = col_data;
+      if (is_1x1_) {
+        col = bottom_data + (*bottom)[0]->offset(n);
+      } else {
+        im2col_cpu(bottom_data + (*bottom)[0]->offset(n), channels_, height_,
+            width_, kernel_size_, pad_, stride_, col_data);
+      }
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+          (Dtype)1., top_diff + top[0]->offset(n) + top_offset * g,
+          col + col_offset * g, (Dtype)1.,
+          thread_weight_diff + weight_offset * g);
+      }
+      // gradient w.r.t. bottom data, if necessary
+      if (propagate_down) {
+        Dtype* col_grad = is_1x1_ ?
+            bottom_diff + (*bottom)[0]->offset(n) : col_diff;
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+            (Dtype)1., weight + weight_offset * g,
+            top_diff + top[0]->offset(n) + top_offset * g,
+            (Dtype)0., col_grad + col_offset * g);
+        }
+        // col2im back to the data
+        if (!is_1x1_) {
+          col2im_cpu(col_diff, channels_, height_, width_, kernel_size_,
+              pad_, stride_, bottom_diff + (*bottom)[0]->offset(n));
+        }
+      }
+    }
+  }
+  // reduce the per-thread weight gradients
+  for (int t = 1; t < threads; ++t) {
+    caffe_axpy<Dtype>(weight_count, (Dtype)1.,
+        weight_diff_partial + (t - 1) * weight_count, weight_diff);
+  }
+}
+
+template <typename Dtype>
+Dtype ConvolutionLayer<Dtype>::Forward_cpu_batched(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  Dtype* out_data = out_buffer_.mutable_cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  int weight_offset = M_ * K_;
+  for (int n0 = 0; n0 < num_; n0 += col_block_size_) {
+    const int block = std::min(col_block_size_, num_ - n0);
+    const int block_N = block * N_;
+    // First, im2col of the whole block
+    im2col_batch_cpu(bottom_data + bottom[0]->offset(n0), block, channels_,
+        height_, width_, kernel_size_, pad_, stride_, col_data);
+    // Second, one innerproduct per group for all images of the block
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, block_N, K_,
+        (Dtype)1., weight + weight_offset * g, col_data + K_ * block_N * g,
+        (Dtype)0., out_data + M_ * block_N * g);
+    }
+    // third, add bias and apply the fused activation
+    if (fused_activation_ != LayerParameter_LayerType_NONE) {
+      caffe_cpu_bias_activation(num_output_, block_N,
+          bias_term_ ? this->blobs_[1]->cpu_data() : NULL, true,
+          fused_activation_, fused_negative_slope_, out_data);
+    } else if (bias_term_) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+          block_N, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+          reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+          (Dtype)1., out_data);
+    }
+    // finally, scatter the rows back to the per-image top layout
+    for (int o = 0; o < num_output_; ++o) {
+      for (int b = 0; b < block; ++b) {
+        caffe_copy(N_, out_data + o * block_N + b * N_,
+            top_data + (*top)[0]->offset(n0 + b, o));
+      }
+    }
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_cpu_batched(const vector<Blob<Dtype>*>& top,
+      const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const Dtype* bottom_data = (*bottom)[0]->cpu_data();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
+  Dtype* out_diff = out_buffer_.mutable_cpu_diff();
+  Dtype* bias_diff = NULL;
+  if (bias_term_) {
+    bias_diff = this->blobs_[1]->mutable_cpu_diff();
+    if (!this->accumulate_param_diffs_) {
+      memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+    }
+  }
+  int weight_offset = M_ * K_;
+  if (!this->accumulate_param_diffs_) {
+    memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
+  }
+  for (int n0 = 0; n0 < num_; n0 += col_block_size_) {
+    const int block = std::min(col_block_size_, num_ - n0);
+    const int block_N = block * N_;
+    // gather the top diff of the block into num_output_ x block_N
+    for (int o = 0; o < num_output_; ++o) {
+      for (int b = 0; b < block; ++b) {
+        caffe_copy(N_, top_diff + top[0]->offset(n0 + b, o),
+            out_diff + o * block_N + b * N_);
+      }
+    }
+    // bias gradient if necessary
+    if (bias_term_) {
+      caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, block_N,
+          1., out_diff,
+          reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), 1.,
+          bias_diff);
+    }
+    // we did not keep the col data of the forward pass, so recompute it.
+    im2col_batch_cpu(bottom_data + (*bottom)[0]->offset(n0), block,
+        channels_, height_, width_, kernel_size_, pad_, stride_, col_data);
     // gradient w.r.t. weight. Note that we will accumulate diffs.
     for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-        (Dtype)1., top_diff + top[0]->offset(n) + top_offset * g,
-        col_data + col_offset * g, (Dtype)1.,
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, block_N,
+        (Dtype)1., out_diff + M_ * block_N * g,
+        col_data + K_ * block_N * g, (Dtype)1.,
         weight_diff + weight_offset * g);
     }
     // gradient w.r.t. bottom data, if necessary
     if (propagate_down) {
       for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, block_N, M_,
           (Dtype)1., weight + weight_offset * g,
-          top_diff + top[0]->offset(n) + top_offset * g,
-          (Dtype)0., col_diff + col_offset * g);
+          out_diff + M_ * block_N * g,
+          (Dtype)0., col_diff + K_ * block_N * g);
       }
       // col2im back to the data
-      col2im_cpu(col_diff, channels_, height_, width_, kernel_size_, pad_,
-          stride_, bottom_diff + (*bottom)[0]->offset(n));
+      col2im_batch_cpu(col_diff, block, channels_, height_, width_,
+          kernel_size_, pad_, stride_,
+          bottom_diff + (*bottom)[0]->offset(n0));
+    }
+  }
+}
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::FuseActivation(
+      const LayerParameter& activation_param) {
+  return caffe_fusable_activation(activation_param, &fused_activation_,
+      &fused_negative_slope_);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::WinogradTransformWeights() {
+  const SyncedMemory* weight_mem = this->blobs_[0]->data().get();
+  if (weight_mem == winograd_weight_mem_ &&
+      weight_mem->version() == winograd_weight_version_) {
+    return;
+  }
+  winograd_weight_.Reshape(16, 1, num_output_, channels_);
+  winograd_weight_backward_.Reshape(16, 1, channels_, num_output_);
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  winograd_kernel_transform_cpu(weight, num_output_, channels_, false,
+      winograd_weight_.mutable_cpu_data());
+  winograd_kernel_transform_cpu(weight, num_output_, channels_, true,
+      winograd_weight_backward_.mutable_cpu_data());
+  winograd_weight_mem_ = weight_mem;
+  winograd_weight_version_ = weight_mem->version();
+}
+
+template <typename Dtype>
+Dtype ConvolutionLayer<Dtype>::Forward_cpu_winograd(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  WinogradTransformWeights();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  const Dtype* weight = winograd_weight_.cpu_data();
+  const int height_out = (*top)[0]->height();
+  const int width_out = (*top)[0]->width();
+  const int tiles_h = (height_out + 1) / 2;
+  const int tiles_w = (width_out + 1) / 2;
+  const int tiles = tiles_h * tiles_w;
+  const int in_size = 16 * channels_ * tiles;
+  const int out_size = 16 * num_output_ * tiles;
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (winograd_in_.count() < threads * in_size) {
+    winograd_in_.Reshape(threads, 1, 1, in_size);
+  }
+  if (winograd_out_.count() < threads * out_size) {
+    winograd_out_.Reshape(threads, 1, 1, out_size);
+  }
+  Dtype* in_base = winograd_in_.mutable_cpu_data();
+  Dtype* out_base = winograd_out_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* in = in_base + t * in_size;
+    Dtype* out = out_base + t * out_size;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      winograd_input_transform_cpu(bottom_data + bottom[0]->offset(n),
+          channels_, height_, width_, pad_, tiles_h, tiles_w, in);
+      // one gemm over the channels per tile position
+      for (int xi = 0; xi < 16; ++xi) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_, tiles,
+            channels_, (Dtype)1., weight + xi * num_output_ * channels_,
+            in + xi * channels_ * tiles, (Dtype)0.,
+            out + xi * num_output_ * tiles);
+      }
+      winograd_output_transform_cpu(out, num_output_, tiles_h, tiles_w,
+          height_out, width_out, top_data + (*top)[0]->offset(n));
+      if (bias_term_ || fused_activation_ != LayerParameter_LayerType_NONE) {
+        caffe_cpu_bias_activation(num_output_, N_, bias, true,
+            fused_activation_, fused_negative_slope_,
+            top_data + (*top)[0]->offset(n));
+      }
+    }
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_cpu_winograd(
+      const vector<Blob<Dtype>*>& top, vector<Blob<Dtype>*>* bottom) {
+  // The gradient w.r.t. the bottom is the convolution of the top diff, padded
+  // by 2 - pad_, with the rotated and transposed kernels.
+  WinogradTransformWeights();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  const Dtype* weight = winograd_weight_backward_.cpu_data();
+  const int height_out = top[0]->height();
+  const int width_out = top[0]->width();
+  const int tiles_h = (height_ + 1) / 2;
+  const int tiles_w = (width_ + 1) / 2;
+  const int tiles = tiles_h * tiles_w;
+  const int in_size = 16 * num_output_ * tiles;
+  const int out_size = 16 * channels_ * tiles;
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (winograd_in_.count() < threads * in_size) {
+    winograd_in_.Reshape(threads, 1, 1, in_size);
+  }
+  if (winograd_out_.count() < threads * out_size) {
+    winograd_out_.Reshape(threads, 1, 1, out_size);
+  }
+  Dtype* in_base = winograd_in_.mutable_cpu_data();
+  Dtype* out_base = winograd_out_.mutable_cpu_data();
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* in = in_base + t * in_size;
+    Dtype* out = out_base + t * out_size;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      winograd_input_transform_cpu(top_diff + top[0]->offset(n),
+          num_output_, height_out, width_out, 2 - pad_, tiles_h, tiles_w, in);
+      for (int xi = 0; xi < 16; ++xi) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels_, tiles,
+            num_output_, (Dtype)1., weight + xi * channels_ * num_output_,
+            in + xi * num_output_ * tiles, (Dtype)0.,
+            out + xi * channels_ * tiles);
+      }
+      winograd_output_transform_cpu(out, channels_, tiles_h, tiles_w,
+          height_, width_, bottom_diff + (*bottom)[0]->offset(n));
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::FFTTransformWeights() {
+  const SyncedMemory* weight_mem = this->blobs_[0]->data().get();
+  if (weight_mem == fft_weight_mem_ &&
+      weight_mem->version() == fft_weight_version_) {
+    return;
+  }
+  fft_weight_.Reshape(1, 1, 1,
+      fft_conv_kernel_count(num_output_, channels_, fft_size_));
+  fft_weight_backward_.Reshape(1, 1, 1,
+      fft_conv_kernel_count(channels_, num_output_, fft_size_backward_));
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  fft_conv_kernel_transform_cpu(weight, num_output_, channels_, kernel_size_,
+      false, fft_size_, fft_weight_.mutable_cpu_data());
+  fft_conv_kernel_transform_cpu(weight, num_output_, channels_, kernel_size_,
+      true, fft_size_backward_, fft_weight_backward_.mutable_cpu_data());
+  fft_weight_mem_ = weight_mem;
+  fft_weight_version_ = weight_mem->version();
+}
+
+template <typename Dtype>
+Dtype ConvolutionLayer<Dtype>::Forward_cpu_fft(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  FFTTransformWeights();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  const Dtype* weight = fft_weight_.cpu_data();
+  const int height_out = (*top)[0]->height();
+  const int width_out = (*top)[0]->width();
+  const int buffer_size = fft_conv_buffer_count(channels_, num_output_,
+      width_, kernel_size_, fft_size_);
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (fft_buffer_.count() < threads * buffer_size) {
+    fft_buffer_.Reshape(threads, 1, 1, buffer_size);
+  }
+  Dtype* buffer_base = fft_buffer_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* buffer = buffer_base + t * buffer_size;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      fft_conv_cpu(bottom_data + bottom[0]->offset(n), channels_, height_,
+          width_, weight, num_output_, kernel_size_, fft_size_,
+          kernel_size_ - 1 - pad_, height_out, width_out, buffer,
+          top_data + (*top)[0]->offset(n));
+      if (bias_term_ || fused_activation_ != LayerParameter_LayerType_NONE) {
+        caffe_cpu_bias_activation(num_output_, N_, bias, true,
+            fused_activation_, fused_negative_slope_,
+            top_data + (*top)[0]->offset(n));
+      }
+    }
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::Backward_cpu_fft(
+      const vector<Blob<Dtype>*>& top, vector<Blob<Dtype>*>* bottom) {
+  // The gradient w.r.t. the bottom is the transposed convolution of the top
+  // diff.
+  FFTTransformWeights();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  const Dtype* weight = fft_weight_backward_.cpu_data();
+  const int height_out = top[0]->height();
+  const int width_out = top[0]->width();
+  const int buffer_size = fft_conv_buffer_count(num_output_, channels_,
+      width_out, kernel_size_, fft_size_backward_);
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (fft_buffer_.count() < threads * buffer_size) {
+    fft_buffer_.Reshape(threads, 1, 1, buffer_size);
+  }
+  Dtype* buffer_base = fft_buffer_.mutable_cpu_data();
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* buffer = buffer_base + t * buffer_size;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      fft_conv_cpu(top_diff + top[0]->offset(n), num_output_, height_out,
+          width_out, weight, channels_, kernel_size_, fft_size_backward_,
+          pad_, height_, width_, buffer,
+          bottom_diff + (*bottom)[0]->offset(n));
     }
   }
 }
@@ -56,8 +56,10 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 
   if (bias_term_) {
     bias_diff = this->blobs_[1]->mutable_gpu_diff();
-    CUDA_CHECK(cudaMemset(bias_diff, 0,
-        sizeof(Dtype) * this->blobs_[1]->count()));
+    if (!this->accumulate_param_diffs_) {
+      CUDA_CHECK(cudaMemset(bias_diff, 0,
+          sizeof(Dtype) * this->blobs_[1]->count()));
+    }
     for (int n = 0; n < num_; ++n) {
       caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
           1., top_diff + top[0]->offset(n),
@@ -69,8 +71,10 @@ void ConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int top_offset = M_ * N_;
-  CUDA_CHECK(cudaMemset(weight_diff, 0,
-      sizeof(Dtype) * this->blobs_[0]->count()));
+  if (!this->accumulate_param_diffs_) {
+    CUDA_CHECK(cudaMemset(weight_diff, 0,
+        sizeof(Dtype) * this->blobs_[0]->count()));
+  }
   for (int n = 0; n < num_; ++n) {
     // since we saved memory in the forward pass by not storing all col data,
     // we will need to recompute them.
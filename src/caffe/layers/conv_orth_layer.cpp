@@ -1,5 +1,6 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -18,6 +19,9 @@ void ConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   stride_ = this->layer_param_.convolution_param().stride();
   group_ = this->layer_param_.convolution_param().group();
   pad_ = this->layer_param_.convolution_param().pad();
+  // A 1x1 convolution without padding and striding uses the image itself as
+  // its column buffer, so the CPU code skips im2col and col2im.
+  is_1x1_ = kernel_size_ == 1 && stride_ == 1 && pad_ == 0;
   num_ = bottom[0]->num();
   channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
@@ -26,11 +30,27 @@ void ConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_GT(num_output_, 0);
   CHECK_EQ(channels_ % group_, 0);
   // The im2col result buffer would only hold one image at a time to avoid
-  // overly large memory usage.
+  // overly large memory usage, unless a budget for a batched buffer is set.
   int height_out = (height_ + 2 * pad_ - kernel_size_) / stride_ + 1;
   int width_out = (width_ + 2 * pad_ - kernel_size_) / stride_ + 1;
-  col_buffer_.Reshape(
-      1, channels_ * kernel_size_ * kernel_size_, height_out, width_out);
+  num_threads_ = this->layer_param_.convolution_param().num_threads();
+  // each of the threads calls BLAS
+  Caffe::reserve_cpu_threads(num_threads_);
+  col_block_size_ = 1;
+  const size_t col_buffer_mb =
+      this->layer_param_.convolution_param().col_buffer_mb();
+  if (col_buffer_mb > 0 && !is_1x1_) {
+    // data and diff of both the column and the output buffer
+    const size_t image_bytes = 2 * sizeof(Dtype) * height_out * width_out *
+        (channels_ * kernel_size_ * kernel_size_ + num_output_);
+    col_block_size_ = std::max(1, std::min(num_,
+        static_cast<int>(col_buffer_mb * 1024 * 1024 / image_bytes)));
+  }
+  col_buffer_.Reshape(col_block_size_,
+      channels_ * kernel_size_ * kernel_size_, height_out, width_out);
+  if (col_block_size_ > 1) {
+    out_buffer_.Reshape(col_block_size_, num_output_, height_out, width_out);
+  }
   // Set the parameters
   CHECK_EQ(num_output_ % group_, 0)
       << "Number of output should be multiples of group.";
@@ -66,10 +86,11 @@ void ConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Set up the bias filler
   if (bias_term_) {
-    bias_multiplier_.reset(new SyncedMemory(N_ * sizeof(Dtype)));
+    bias_multiplier_.reset(
+        new SyncedMemory(col_block_size_ * N_ * sizeof(Dtype)));
     Dtype* bias_multiplier_data =
         reinterpret_cast<Dtype*>(bias_multiplier_->mutable_cpu_data());
-    for (int i = 0; i < N_; ++i) {
+    for (int i = 0; i < col_block_size_ * N_; ++i) {
         bias_multiplier_data[i] = 1.;
     }
   }
@@ -101,13 +122,21 @@ void ConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void ConvolutionOrthLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  // keep the iteration count
+  const int iter = iter_;
+  SetUp(bottom, top);
+  iter_ = iter;
+}
+
 
 template <typename Dtype>
 Dtype ConvolutionOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
   Dtype* weight = this->blobs_[0]->mutable_cpu_data();
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
@@ -174,25 +203,47 @@ Dtype ConvolutionOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& botto
   
   // actually performing forward pass
   
+  if (col_block_size_ > 1) {
+    return Forward_cpu_batched(bottom, top);
+  }
+
   // reset weight pointer
   weight = this->blobs_[0]->mutable_cpu_data();
   
-  for (int n = 0; n < num_; ++n) {
-    // First, im2col
-    im2col_cpu(bottom_data + bottom[0]->offset(n), channels_, height_,
-                      width_, kernel_size_, pad_, stride_, col_data);
-    // Second, innerproduct with groups
-    for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-        (Dtype)1., weight + weight_offset * g, col_data + col_offset * g,
-        (Dtype)0., top_data + (*top)[0]->offset(n) + top_offset * g);
-    }
-    // third, add bias
-    if (bias_term_) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-          N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-          reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-          (Dtype)1., top_data + (*top)[0]->offset(n));
+  // Split the batch across threads, each with its own slice of col_buffer_
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_base = col_buffer_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const Dtype* bias_multiplier = bias_term_ ?
+      reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()) : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_data = col_base + col_buffer_.offset(t);
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      // First, im2col
+      const Dtype* col = col_data;
+      if (is_1x1_) {
+        col = bottom_data + bottom[0]->offset(n);
+      } else {
+        im2col_cpu(bottom_data + bottom[0]->offset(n), channels_, height_,
+            width_, kernel_size_, pad_, stride_, col_data);
+      }
+      // Second, innerproduct with groups
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+          (Dtype)1., weight + weight_offset * g, col + col_offset * g,
+          (Dtype)0., top_data + (*top)[0]->offset(n) + top_offset * g);
+      }
+      // third, add bias
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+            N_, 1, (Dtype)1., bias, bias_multiplier,
+            (Dtype)1., top_data + (*top)[0]->offset(n));
+      }
     }
   }
   
@@ -202,19 +253,23 @@ Dtype ConvolutionOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& botto
 template <typename Dtype>
 void ConvolutionOrthLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if (col_block_size_ > 1) {
+    Backward_cpu_batched(top, propagate_down, bottom);
+    return;
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
   // bias gradient if necessary
   Dtype* bias_diff = NULL;
 
   if (bias_term_) {
     bias_diff = this->blobs_[1]->mutable_cpu_diff();
-    memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+    if (!this->accumulate_param_diffs_) {
+      memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+    }
     for (int n = 0; n < num_; ++n) {
       caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
           1., top_diff + top[0]->offset(n),
@@ -226,30 +281,176 @@ void ConvolutionOrthLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int top_offset = M_ * N_;
-  memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
-  for (int n = 0; n < num_; ++n) {
-    // since we saved memory in the forward pass by not storing all col data,
-    // we will need to recompute them.
-    im2col_cpu(bottom_data + (*bottom)[0]->offset(n), channels_, height_,
-                      width_, kernel_size_, pad_, stride_, col_data);
+  const int weight_count = this->blobs_[0]->count();
+  if (!this->accumulate_param_diffs_) {
+    memset(weight_diff, 0, sizeof(Dtype) * weight_count);
+  }
+  // Split the batch across threads; thread 0 accumulates its weight gradient
+  // in place, the others into weight_diff_buffer_, reduced at the end.
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_data_base = col_buffer_.mutable_cpu_data();
+  Dtype* col_diff_base = col_buffer_.mutable_cpu_diff();
+  Dtype* weight_diff_partial = NULL;
+  if (threads > 1) {
+    if (weight_diff_buffer_.count() < (threads - 1) * weight_count) {
+      weight_diff_buffer_.Reshape(threads - 1, 1, 1, weight_count);
+    }
+    weight_diff_partial = weight_diff_buffer_.mutable_cpu_data();
+    memset(weight_diff_partial, 0,
+        sizeof(Dtype) * (threads - 1) * weight_count);
+  }
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_data = col_data_base + col_buffer_.offset(t);
+    Dtype* col_diff = col_diff_base + col_buffer_.offset(t);
+    Dtype* thread_weight_diff = (t == 0) ? weight_diff :
+        weight_diff_partial + (t - 1) * weight_count;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      // since we saved memory in the forward pass by not storing all col
+      // data, we will need to recompute them.
+      const Dtype* col = col_data;
+      if (is_1x1_) {
+        col = bottom_data + (*bottom)[0]->offset(n);
+      } else {
+        im2col_cpu(bottom_data + (*bottom)[0]->offset(n), channels_, height_,
+            width_, kernel_size_, pad_, stride_, col_data);
+      }
+      // gradient w.r.t. weight. Note that we will accumulate diffs.
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+          (Dtype)1., top_diff + top[0]->offset(n) + top_offset * g,
+          col + col_offset * g, (Dtype)1.,
+          thread_weight_diff + weight_offset * g);
+      }
+      // gradient w.r.t. bottom data, if necessary
+      if (propagate_down) {
+        Dtype* col_grad = is_1x1_ ?
+            bottom_diff + (*bottom)[0]->offset(n) : col_diff;
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+            (Dtype)1., weight + weight_offset * g,
+            top_diff + top[0]->offset(n) + top_offset * g,
+            (Dtype)0., col_grad + col_offset * g);
+        }
+        // col2im back to the data
+        if (!is_1x1_) {
+          col2im_cpu(col_diff, channels_, height_, width_, kernel_size_,
+              pad_, stride_, bottom_diff + (*bottom)[0]->offset(n));
+        }
+      }
+    }
+  }
+  // reduce the per-thread weight gradients
+  for (int t = 1; t < threads; ++t) {
+    caffe_axpy<Dtype>(weight_count, (Dtype)1.,
+        weight_diff_partial + (t - 1) * weight_count, weight_diff);
+  }
+}
+
+template <typename Dtype>
+Dtype ConvolutionOrthLayer<Dtype>::Forward_cpu_batched(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  Dtype* out_data = out_buffer_.mutable_cpu_data();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  int weight_offset = M_ * K_;
+  for (int n0 = 0; n0 < num_; n0 += col_block_size_) {
+    const int block = std::min(col_block_size_, num_ - n0);
+    const int block_N = block * N_;
+    // First, im2col of the whole block
+    im2col_batch_cpu(bottom_data + bottom[0]->offset(n0), block, channels_,
+        height_, width_, kernel_size_, pad_, stride_, col_data);
+    // Second, one innerproduct per group for all images of the block
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, block_N, K_,
+        (Dtype)1., weight + weight_offset * g, col_data + K_ * block_N * g,
+        (Dtype)0., out_data + M_ * block_N * g);
+    }
+    // third, add bias
+    if (bias_term_) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+          block_N, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+          reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+          (Dtype)1., out_data);
+    }
+    // finally, scatter the rows back to the per-image top layout
+    for (int o = 0; o < num_output_; ++o) {
+      for (int b = 0; b < block; ++b) {
+        caffe_copy(N_, out_data + o * block_N + b * N_,
+            top_data + (*top)[0]->offset(n0 + b, o));
+      }
+    }
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void ConvolutionOrthLayer<Dtype>::Backward_cpu_batched(const vector<Blob<Dtype>*>& top,
+      const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const Dtype* bottom_data = (*bottom)[0]->cpu_data();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  Dtype* col_data = col_buffer_.mutable_cpu_data();
+  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
+  Dtype* out_diff = out_buffer_.mutable_cpu_diff();
+  Dtype* bias_diff = NULL;
+  if (bias_term_) {
+    bias_diff = this->blobs_[1]->mutable_cpu_diff();
+    if (!this->accumulate_param_diffs_) {
+      memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+    }
+  }
+  int weight_offset = M_ * K_;
+  if (!this->accumulate_param_diffs_) {
+    memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
+  }
+  for (int n0 = 0; n0 < num_; n0 += col_block_size_) {
+    const int block = std::min(col_block_size_, num_ - n0);
+    const int block_N = block * N_;
+    // gather the top diff of the block into num_output_ x block_N
+    for (int o = 0; o < num_output_; ++o) {
+      for (int b = 0; b < block; ++b) {
+        caffe_copy(N_, top_diff + top[0]->offset(n0 + b, o),
+            out_diff + o * block_N + b * N_);
+      }
+    }
+    // bias gradient if necessary
+    if (bias_term_) {
+      caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, block_N,
+          1., out_diff,
+          reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), 1.,
+          bias_diff);
+    }
+    // we did not keep the col data of the forward pass, so recompute it.
+    im2col_batch_cpu(bottom_data + (*bottom)[0]->offset(n0), block,
+        channels_, height_, width_, kernel_size_, pad_, stride_, col_data);
     // gradient w.r.t. weight. Note that we will accumulate diffs.
     for (int g = 0; g < group_; ++g) {
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-        (Dtype)1., top_diff + top[0]->offset(n) + top_offset * g,
-        col_data + col_offset * g, (Dtype)1.,
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, block_N,
+        (Dtype)1., out_diff + M_ * block_N * g,
+        col_data + K_ * block_N * g, (Dtype)1.,
         weight_diff + weight_offset * g);
     }
     // gradient w.r.t. bottom data, if necessary
     if (propagate_down) {
       for (int g = 0; g < group_; ++g) {
-        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, block_N, M_,
           (Dtype)1., weight + weight_offset * g,
-          top_diff + top[0]->offset(n) + top_offset * g,
-          (Dtype)0., col_diff + col_offset * g);
+          out_diff + M_ * block_N * g,
+          (Dtype)0., col_diff + K_ * block_N * g);
       }
       // col2im back to the data
-      col2im_cpu(col_diff, channels_, height_, width_, kernel_size_, pad_,
-          stride_, bottom_diff + (*bottom)[0]->offset(n));
+      col2im_batch_cpu(col_diff, block, channels_, height_, width_,
+          kernel_size_, pad_, stride_,
+          bottom_diff + (*bottom)[0]->offset(n0));
     }
   }
 }
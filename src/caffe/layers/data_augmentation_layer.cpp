@@ -11,6 +11,7 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/util/rng.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/warp.hpp"
 
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -22,6 +23,10 @@
 #include <fstream>
 #include <omp.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 using std::max;
 
 namespace caffe {
@@ -30,8 +35,11 @@ template <typename T> int sgn(T val) {
   return (T(0) < val) - (val < T(0));
 }  
 
+// Draws from the stream of an item, so that the result does not depend on
+// the thread the item is augmented by.
 template <typename Dtype>
-Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_coeff = 1) {
+Dtype caffe_rng_generate(const RandomGeneratorParameter& param,
+    CounterRNG* rng, Dtype discount_coeff = 1) {
   float spread;
   if (param.apply_schedule())
     spread = param.spread() * discount_coeff;
@@ -43,7 +51,7 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_c
   if (rand_type.compare("uniform") == 0) {
     float tmp;
     if (spread > 0.)
-      caffe_rng_uniform(1, param.mean() - spread, param.mean() + spread, &tmp);
+      tmp = rng->uniform<float>(param.mean() - spread, param.mean() + spread);
     else
       tmp = param.mean();
     if (param.exp())
@@ -53,7 +61,7 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_c
   else if (rand_type.compare("gaussian") == 0) {
     float tmp;
     if (spread > 0.)
-      caffe_rng_gaussian(1, param.mean(), spread, &tmp);
+      tmp = rng->gaussian<float>(param.mean(), spread);
     else
       tmp = param.mean();
     if (param.exp())
@@ -63,7 +71,7 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_c
   else if (rand_type.compare("bernoulli") == 0) {
     int tmp;
     if (param.prob() > 0.)
-      caffe_rng_bernoulli(1, param.prob(), &tmp);
+      tmp = rng->bernoulli(param.prob());
     else
       tmp = 0;
     rand = static_cast<Dtype>(tmp);
@@ -73,12 +81,12 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_c
     int tmp2;
     
     if (spread > 0.) 
-      caffe_rng_uniform(1, param.mean() - spread, param.mean() + spread, &tmp1);
+      tmp1 = rng->uniform<float>(param.mean() - spread, param.mean() + spread);
     else
       tmp1 = param.mean();
     
     if (param.prob() > 0.)
-      caffe_rng_bernoulli(1, param.prob(), &tmp2);
+      tmp2 = rng->bernoulli(param.prob());
     else
       tmp2 = 0;
     
@@ -94,12 +102,12 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_c
     int tmp2;
     
     if (spread > 0.) 
-      caffe_rng_gaussian(1, param.mean(), spread, &tmp1);
+      tmp1 = rng->gaussian<float>(param.mean(), spread);
     else
       tmp1 = param.mean();
     
     if (param.prob() > 0.)
-      caffe_rng_bernoulli(1, param.prob(), &tmp2);
+      tmp2 = rng->bernoulli(param.prob());
     else
       tmp2 = 0;
     
@@ -120,18 +128,21 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter& param, Dtype discount_c
 template <typename Dtype>
 void DataAugmentationLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  CHECK_GE(bottom.size(), 1) << "Data aumentation layer takes one or two input blobs.";
-  CHECK_LE(bottom.size(), 2) << "Data aumentation layer takes one or two input blobs.";
-  CHECK_GE(top->size(), 1) << "Data Layer takes one or two output blobs.";
-  CHECK_LE(top->size(), 2) << "Data Layer takes one or two output blobs.";
+  num_passthrough_ = this->layer_param_.augmentation_param().num_passthrough();
+  const int num_bottom = bottom.size() - num_passthrough_;
+  const int num_top = top->size() - num_passthrough_;
+  CHECK_GE(num_bottom, 1) << "Data aumentation layer takes one or two input blobs.";
+  CHECK_LE(num_bottom, 2) << "Data aumentation layer takes one or two input blobs.";
+  CHECK_GE(num_top, 1) << "Data Layer takes one or two output blobs.";
+  CHECK_LE(num_top, 2) << "Data Layer takes one or two output blobs.";
 
-  if (top->size() == 1) {
+  if (num_top == 1) {
     output_params_ = false;
   } else {
     output_params_ = true;
   }
   
-  if (bottom.size() == 1) {
+  if (num_bottom == 1) {
     input_params_ = false;
   } else {
     input_params_ = true;
@@ -193,14 +204,261 @@ void DataAugmentationLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   if (aug_.recompute_mean()) {
     data_mean_.Reshape(1, channels, crop_size, crop_size);
   }
+
+  for (int i = 0; i < num_passthrough_; ++i) {
+    (*top)[num_top + i]->ReshapeLike(*bottom[num_bottom + i]);
+  }
+
+  if (aug_.async()) {
+    // buffers of the batch in flight
+    pipeline_bottom_.clear();
+    pipeline_bottom_vec_.clear();
+    for (int i = 0; i < bottom.size(); ++i) {
+      pipeline_bottom_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      pipeline_bottom_.back()->ReshapeLike(*bottom[i]);
+      pipeline_bottom_vec_.push_back(pipeline_bottom_.back().get());
+    }
+    pipeline_top_.clear();
+    pipeline_top_vec_.clear();
+    for (int i = 0; i < num_top; ++i) {
+      pipeline_top_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      pipeline_top_.back()->ReshapeLike(*(*top)[i]);
+      pipeline_top_vec_.push_back(pipeline_top_.back().get());
+    }
+    LOG(INFO) << "Augmenting in the background";
+  }
   
   num_iter_ = 0;
-  
+  num_color_stats_ = 0;
+  rng_seed_ = caffe_rng_rand();
+}
+
+template <typename Dtype>
+DataAugmentationLayer<Dtype>::~DataAugmentationLayer() {
+  if (augmenting_) {
+    JoinAugmentThread();
+  }
+}
+
+template <typename Dtype>
+void* DataAugmentationLayerAugment(void* layer_pointer) {
+  CHECK(layer_pointer);
+  DataAugmentationLayer<Dtype>* layer =
+      static_cast<DataAugmentationLayer<Dtype>*>(layer_pointer);
+  layer->Augment(layer->pipeline_bottom_vec_, &layer->pipeline_top_vec_,
+      layer->pipeline_phase_ == Caffe::TRAIN);
+  return static_cast<void*>(NULL);
+}
+
+template <typename Dtype>
+void DataAugmentationLayer<Dtype>::CreateAugmentThread() {
+  pipeline_phase_ = Caffe::phase();
+  // the worker only touches host memory
+  for (int i = 0; i < pipeline_top_.size(); ++i) {
+    pipeline_top_[i]->mutable_cpu_data();
+  }
+  CHECK(!pthread_create(&thread_, NULL, DataAugmentationLayerAugment<Dtype>,
+        static_cast<void*>(this))) << "Pthread execution failed.";
+  augmenting_ = true;
+}
+
+template <typename Dtype>
+void DataAugmentationLayer<Dtype>::JoinAugmentThread() {
+  CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
+  augmenting_ = false;
+}
+
+template <typename Dtype>
+void DataAugmentationLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  // the batch in flight is dropped and the pipeline starts over
+  if (augmenting_) {
+    JoinAugmentThread();
+  }
+  // keep the iteration count and the random streams
+  const int iter = num_iter_;
+  const unsigned int rng_seed = rng_seed_;
+  SetUp(bottom, top);
+  num_iter_ = iter;
+  rng_seed_ = rng_seed;
+}
+
+// Exchanges the data memory of two blobs of the same size.
+template <typename Dtype>
+static void swap_data(Blob<Dtype>* a, Blob<Dtype>* b) {
+  const shared_ptr<SyncedMemory> data = a->data();
+  a->SetDataMemory(b->data());
+  b->SetDataMemory(data);
+}
+
+// Copies on the host, where the background thread reads.
+template <typename Dtype>
+static void copy_data(const Blob<Dtype>& source, Blob<Dtype>* destination) {
+  caffe_copy(source.count(), source.cpu_data(),
+      destination->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
+  const int num_bottom = bottom.size() - num_passthrough_;
+  const int num_top = top->size() - num_passthrough_;
+  if (!aug_.async()) {
+    Augment(bottom, top, Caffe::phase() == Caffe::TRAIN);
+    for (int i = 0; i < num_passthrough_; ++i) {
+      copy_data(*bottom[num_bottom + i], (*top)[num_top + i]);
+    }
+    return Dtype(0);
+  }
+  if (augmenting_) {
+    JoinAugmentThread();
+  } else {
+    // fill the pipeline
+    for (int i = 0; i < bottom.size(); ++i) {
+      copy_data(*bottom[i], pipeline_bottom_[i].get());
+    }
+    Augment(pipeline_bottom_vec_, &pipeline_top_vec_,
+        Caffe::phase() == Caffe::TRAIN);
+  }
+  // hand the augmented batch to the tops, whose memory is written next
+  for (int i = 0; i < num_top; ++i) {
+    swap_data(pipeline_top_[i].get(), (*top)[i]);
+  }
+  for (int i = 0; i < num_passthrough_; ++i) {
+    copy_data(*pipeline_bottom_[num_bottom + i], (*top)[num_top + i]);
+  }
+  // and start on the current one
+  for (int i = 0; i < bottom.size(); ++i) {
+    copy_data(*bottom[i], pipeline_bottom_[i].get());
+  }
+  CreateAugmentThread();
+  return Dtype(0);
+}
+
+// Colour statistics of one item, whose channels are planes of size pixels:
+// stats[0..2] the mean of each channel, stats[3..5] the largest absolute
+// projection on each eigenvector, stats[6..8] and stats[9..11] the largest
+// and smallest value of each channel (not above and below 0, as the
+// augmentation always measured them).
+template <typename Dtype>
+static void item_color_stats(const Dtype* data, const int size,
+    const Dtype* eigvec, Dtype* stats) {
+  const Dtype* r = data;
+  const Dtype* g = data + size;
+  const Dtype* b = data + 2 * size;
+  double sum[3] = {0., 0., 0.};
+  std::fill(stats + 3, stats + 12, Dtype(0));
+  for (int i = 0; i < size; ++i) {
+    const Dtype rgb[3] = {r[i], g[i], b[i]};
+    for (int c = 0; c < 3; ++c) {
+      const Dtype eig = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1]
+          + eigvec[3*c+2] * rgb[2];
+      stats[3 + c] = std::max(stats[3 + c], Dtype(fabs(eig)));
+      stats[6 + c] = std::max(stats[6 + c], rgb[c]);
+      stats[9 + c] = std::min(stats[9 + c], rgb[c]);
+      sum[c] += rgb[c];
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    stats[c] = sum[c] / size;
+  }
+}
+
+#ifdef __SSE2__
+// Four pixels at a time, reading the three planes sequentially.
+static void item_color_stats(const float* data, const int size,
+    const float* eigvec, float* stats) {
+  const float* rgb[3] = {data, data + size, data + 2 * size};
+  const __m128 sign = _mm_set1_ps(-0.f);
+  __m128 max_abs_eig[3], max_rgb[3], min_rgb[3];
+  __m128d sum[3];
+  for (int c = 0; c < 3; ++c) {
+    max_abs_eig[c] = max_rgb[c] = min_rgb[c] = _mm_setzero_ps();
+    sum[c] = _mm_setzero_pd();
+  }
+  int i = 0;
+  for (; i + 4 <= size; i += 4) {
+    __m128 v[3];
+    for (int c = 0; c < 3; ++c) {
+      v[c] = _mm_loadu_ps(rgb[c] + i);
+      max_rgb[c] = _mm_max_ps(max_rgb[c], v[c]);
+      min_rgb[c] = _mm_min_ps(min_rgb[c], v[c]);
+      // in double, so that large images do not lose the small values
+      sum[c] = _mm_add_pd(sum[c], _mm_add_pd(_mm_cvtps_pd(v[c]),
+          _mm_cvtps_pd(_mm_movehl_ps(v[c], v[c]))));
+    }
+    for (int c = 0; c < 3; ++c) {
+      const __m128 eig = _mm_add_ps(_mm_add_ps(
+          _mm_mul_ps(_mm_set1_ps(eigvec[3*c]), v[0]),
+          _mm_mul_ps(_mm_set1_ps(eigvec[3*c+1]), v[1])),
+          _mm_mul_ps(_mm_set1_ps(eigvec[3*c+2]), v[2]));
+      max_abs_eig[c] = _mm_max_ps(max_abs_eig[c], _mm_andnot_ps(sign, eig));
+    }
+  }
+  // the lanes, then the remaining pixels
+  double total[3];
+  for (int c = 0; c < 3; ++c) {
+    float lanes[4];
+    _mm_storeu_ps(lanes, max_abs_eig[c]);
+    stats[3 + c] = std::max(std::max(lanes[0], lanes[1]),
+        std::max(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, max_rgb[c]);
+    stats[6 + c] = std::max(std::max(lanes[0], lanes[1]),
+        std::max(lanes[2], lanes[3]));
+    _mm_storeu_ps(lanes, min_rgb[c]);
+    stats[9 + c] = std::min(std::min(lanes[0], lanes[1]),
+        std::min(lanes[2], lanes[3]));
+    double halves[2];
+    _mm_storeu_pd(halves, sum[c]);
+    total[c] = halves[0] + halves[1];
+  }
+  for (; i < size; ++i) {
+    const float v[3] = {rgb[0][i], rgb[1][i], rgb[2][i]};
+    for (int c = 0; c < 3; ++c) {
+      const float eig = eigvec[3*c] * v[0] + eigvec[3*c+1] * v[1]
+          + eigvec[3*c+2] * v[2];
+      stats[3 + c] = std::max(stats[3 + c], fabsf(eig));
+      stats[6 + c] = std::max(stats[6 + c], v[c]);
+      stats[9 + c] = std::min(stats[9 + c], v[c]);
+      total[c] += v[c];
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    stats[c] = total[c] / size;
+  }
+}
+#endif  // __SSE2__
+
+// Colour statistics of a batch of 3 channel images: the items are reduced in
+// parallel and then combined in order, so the result does not depend on the
+// number of threads.
+template <typename Dtype>
+static void batch_color_stats(const Dtype* data, const int num,
+    const int size, const Dtype* eigvec, Dtype* mean_rgb, Dtype* max_abs_eig,
+    Dtype* max_rgb, Dtype* min_rgb) {
+  std::vector<Dtype> stats(num * 12);
+  const int threads = caffe_cpu_threads(0, num);
+#pragma omp parallel for num_threads(threads)
+  for (int item_id = 0; item_id < num; ++item_id) {
+    item_color_stats(data + item_id * 3 * size, size, eigvec,
+        &stats[item_id * 12]);
+  }
+  for (int c = 0; c < 3; ++c) {
+    mean_rgb[c] = max_abs_eig[c] = max_rgb[c] = min_rgb[c] = 0;
+    for (int item_id = 0; item_id < num; ++item_id) {
+      const Dtype* item_stats = &stats[item_id * 12];
+      mean_rgb[c] += item_stats[c];
+      max_abs_eig[c] = std::max(max_abs_eig[c], item_stats[3 + c]);
+      max_rgb[c] = std::max(max_rgb[c], item_stats[6 + c]);
+      min_rgb[c] = std::min(min_rgb[c], item_stats[9 + c]);
+    }
+    mean_rgb[c] /= num;
+  }
+}
+
+template <typename Dtype>
+void DataAugmentationLayer<Dtype>::Augment(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top, const bool train_phase) {
   
   num_iter_++;
  
@@ -219,7 +477,6 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
     write_augmented = std::string("");
   
   bool augment_during_test = aug_.augment_during_test();  
-  bool train_phase = (Caffe::phase() == Caffe::TRAIN);
   //LOG(INFO) <<  " === train_phase " << train_phase;
   
   Dtype mean_eig [3];
@@ -235,30 +492,40 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
 //   const Dtype eigvec [9] = {0.57, 0.58, 0.57, -0.72, 0.03, 0.68, -0.38, 0.81, -0.44};
 //  const Dtype eigvec [9] = {0.5878, 0.5859, 0.5579, -0.5631, -0.1989, 0.8021, -0.5809, 0.7856, -0.2130};
   const Dtype eigvec [9] = {0.51, 0.56, 0.65, 0.79, 0.01, -0.62, 0.35, -0.83, 0.44};
-  if (channels == 3) {  
-    for (int item_id = 0; item_id < num; ++item_id) {
-      for (int x=0; x < width; x++) {
-        for (int y=0; y < height; y++) {
-          for (int c=0; c<channels; c++) {          
-            rgb[c] = bottom_data[((item_id*channels + c)*width + x)*height + y];      
-          }
-          //if (x==0 && y ==0)
-          //    LOG(INFO) << "item_id=" << item_id << ", x=" << x << ", y=" << y << ", rgb[0]=" << rgb[0] << ", rgb[1]=" << rgb[1] << ", rgb[2]=" << rgb[2];
-          for (int c=0; c<channels; c++) {
-            eig[c] = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1] + eigvec[3*c+2] * rgb[2];
-            if (fabs(eig[c]) > max_abs_eig[c])
-              max_abs_eig[c] = fabs(eig[c]);
-            if (rgb[c] > max_rgb[c])
-              max_rgb[c] = rgb[c];
-            if (rgb[c] < min_rgb[c])
-              min_rgb[c] = rgb[c];
-            mean_rgb[c] = mean_rgb[c] + rgb[c]/width/height;
-          }
+  if (channels == 3) {
+    // measure the batch, or refresh the running estimates
+    const int interval = aug_.color_stats_interval();
+    if (interval <= 1 || num_color_stats_ == 0 ||
+        (num_iter_ - 1) % interval == 0) {
+      Dtype batch_mean_rgb[3], batch_max_abs_eig[3], batch_max_rgb[3],
+          batch_min_rgb[3];
+      batch_color_stats(bottom_data, num, width * height, eigvec,
+          batch_mean_rgb, batch_max_abs_eig, batch_max_rgb, batch_min_rgb);
+      if (interval <= 1) {
+        num_color_stats_ = 0;
+      }
+      for (int c = 0; c < 3; ++c) {
+        if (num_color_stats_ == 0) {
+          mean_rgb_[c] = batch_mean_rgb[c];
+          max_abs_eig_[c] = batch_max_abs_eig[c];
+          max_rgb_[c] = batch_max_rgb[c];
+          min_rgb_[c] = batch_min_rgb[c];
+        } else {
+          mean_rgb_[c] += (batch_mean_rgb[c] - mean_rgb_[c])
+              / (num_color_stats_ + 1);
+          max_abs_eig_[c] = std::max(max_abs_eig_[c], batch_max_abs_eig[c]);
+          max_rgb_[c] = std::max(max_rgb_[c], batch_max_rgb[c]);
+          min_rgb_[c] = std::min(min_rgb_[c], batch_min_rgb[c]);
         }
       }
+      ++num_color_stats_;
+    }
+    for (int c = 0; c < 3; ++c) {
+      mean_rgb[c] = mean_rgb_[c];
+      max_abs_eig[c] = max_abs_eig_[c];
+      max_rgb[c] = max_rgb_[c];
+      min_rgb[c] = min_rgb_[c];
     }
-    for (int c=0; c<channels; c++)
-      mean_rgb[c] = mean_rgb[c] / num;
     
     for (int c=0; c<channels; c++) {
       mean_eig[c] = eigvec[3*c] * mean_rgb[0] + eigvec[3*c+1] * mean_rgb[1] + eigvec[3*c+2] * mean_rgb[2];
@@ -291,10 +558,12 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
 #pragma omp parallel for shared(aug, train_phase, write_augmented, augment_during_test, mean_rgb, mean_eig, max_abs_eig, max_rgb, min_rgb, max_l, eigvec,  output_params, input_params, num_params, discount_coeff)  private(rgb, eig)
   for (int item_id = 0; item_id < num; ++item_id) {
     int x, y, c, top_idx, bottom_idx, h_off, w_off;
-    Dtype x1, y1, x2, y2;
+    Dtype affine[6];
     bool do_spatial_transform, do_chromatic_transform;
     
     AugmentationCoeff coeff; 
+    // the random stream of this item in this iteration
+    CounterRNG rng(rng_seed_, num_iter_, item_id);
 
     //   We only do transformations during training or if specifically asked to do them during testing.
     if (!(train_phase || aug.augment_during_test())) {
@@ -318,41 +587,12 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
       // try to sample parameters for which transformed image doesn't go outside the borders of the original one
       // in order to check this, just apply the transformations to 4 corners
       while (good_params < 4 && counter < max_num_tries) {
-        good_params = 0;
-        generate_spatial_coeffs(aug, coeff, discount_coeff);
-  
-        //LOG(INFO) << "angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
-        
-        for (x = 0; x < cropped_width_; x += cropped_width_-1) {
-          for (y = 0; y < cropped_height_; y += cropped_height_-1) {
-            // move the origin and mirror
-            if (coeff.mirror()) {
-              x1 =  static_cast<Dtype>(x) - .5 * static_cast<Dtype>(cropped_width_);
-              y1 = -static_cast<Dtype>(y) + .5 * static_cast<Dtype>(cropped_height_);            
-            } 
-            else {
-              x1 = static_cast<Dtype>(x) - .5 * static_cast<Dtype>(cropped_width_);
-              y1 = static_cast<Dtype>(y) - .5 * static_cast<Dtype>(cropped_height_);
-            }
-            // rotate
-            x2 =  cos(coeff.angle()) * x1 - sin(coeff.angle()) * y1;
-            y2 =  sin(coeff.angle()) * x1 + cos(coeff.angle()) * y1;
-            // translate
-            x2 = x2 + coeff.dx() * static_cast<Dtype>(cropped_width_);
-            y2 = y2 + coeff.dy() * static_cast<Dtype>(cropped_height_);
-            // zoom
-            x2 = x2 / coeff.zoom_x();
-            y2 = y2 / coeff.zoom_y();
-            // move the origin back
-            x2 = x2 + .5 * static_cast<Dtype>(width);
-            y2 = y2 + .5 * static_cast<Dtype>(height);
-            
-            if (!(floor(x2) < 0 || floor(x2) > static_cast<Dtype>(width - 2) || floor(y2) < 0 || floor(y2) > static_cast<Dtype>(height - 2)))
-                good_params++;
-            //mexPrintf(" (%f,%f) ", x2, y2);
-          }
-        }
-        //mexPrintf("\n");
+        generate_spatial_coeffs(aug, coeff, &rng, discount_coeff);
+        warp_affine_matrix<Dtype>(coeff.mirror(), coeff.angle(), coeff.dx(),
+            coeff.dy(), coeff.zoom_x(), coeff.zoom_y(), cropped_width_,
+            cropped_height_, width, height, affine);
+        good_params = warp_inside(affine, cropped_width_, cropped_height_,
+            width, height) ? 4 : 0;
         counter++;
       }
       if (counter >= max_num_tries) {
@@ -366,7 +606,7 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
     } 
     
     if (do_chromatic_transform) {
-      generate_chromatic_coeffs(aug, coeff, discount_coeff);
+      generate_chromatic_coeffs(aug, coeff, &rng, discount_coeff);
       clear_defaults(coeff);
       do_chromatic_transform =  coeff.has_pow_nomean0()     || coeff.has_pow_nomean1()     || coeff.has_pow_nomean2()    ||
                                 coeff.has_add_nomean0()     || coeff.has_add_nomean1()     || coeff.has_add_nomean2()    ||
@@ -413,81 +653,26 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
     }
     
     // actually apply the transformation
-    if (do_spatial_transform) { 
-      int i00,i01,i10,i11;
-      for (x = 0; x < cropped_width_; x++) {
-        for (y = 0; y < cropped_height_; y++) {
-          // move the origin and mirror
-          if (coeff.mirror()) {
-            x1 =  static_cast<Dtype>(x) - .5 * static_cast<Dtype>(cropped_width_);
-            y1 = -static_cast<Dtype>(y) + .5 * static_cast<Dtype>(cropped_height_);            
-          } 
-          else {
-            x1 = static_cast<Dtype>(x) - .5 * static_cast<Dtype>(cropped_width_);
-            y1 = static_cast<Dtype>(y) - .5 * static_cast<Dtype>(cropped_height_);
-          }
-          // rotate
-          if (coeff.has_angle()) {
-            x2 =  cos(coeff.angle()) * x1 - sin(coeff.angle()) * y1;
-            y2 =  sin(coeff.angle()) * x1 + cos(coeff.angle()) * y1;
-          }
-          else {
-            x2 = x1;
-            y2 = y1;
-          }
-          // translate
-          if (coeff.has_dx())
-            x2 = x2 + coeff.dx() * static_cast<Dtype>(cropped_width_);
-          if (coeff.has_dy())
-            y2 = y2 + coeff.dy() * static_cast<Dtype>(cropped_height_);
-          // zoom
-          if (coeff.has_zoom_x())
-            x2 = x2 / coeff.zoom_x();
-          if (coeff.has_zoom_y())
-            y2 = y2 / coeff.zoom_y();
-          // move the origin back
-          x2 = x2 + .5 * static_cast<Dtype>(width);
-          y2 = y2 + .5 * static_cast<Dtype>(height);
-          
-
-          for (c = 0; c < channels; c++) {
-            top_idx = ((item_id*channels + c)*cropped_width_ + x)*cropped_height_ + y;
-            if (floor(x2) < 0. || floor(x2) > static_cast<Dtype>(width - 2) || floor(y2) < 0. || floor(y2) > static_cast<Dtype>(height - 2))
-              top_data[top_idx] = 0.;
-            else {
-              if (coeff.has_angle() || coeff.has_zoom_x() || coeff.has_zoom_y()) {
-                i00 = static_cast<int>(((item_id*channels + c) * width +  floor(x2)) *height + floor(y2));
-                i01 = i00 + 1;
-                i10 = i00 + height;
-                i11 = i00 + height + 1;
-                
-                top_data[top_idx] = bottom_data[i00] * ((floor(x2)+1)  - x2) * ((floor(y2)+1)  - y2) +
-                                    bottom_data[i01] * ((floor(x2)+1)  - x2) * (y2 - floor(y2))      +
-                                    bottom_data[i10] * (x2 - floor(x2))      * ((floor(y2)+1)  - y2) +
-                                    bottom_data[i11] * (x2 - floor(x2))      * (y2 - floor(y2));                
-              } 
-              else {
-                i00 = static_cast<int>(((item_id*channels + c) * width +  floor(x2)) *height + floor(y2));              
-                top_data[top_idx] = bottom_data[i00];
-              }
-            }         
-            // TODO Alexey check this
-            //top_data[i] = (top_data[i] - 127.5) * scale;
-          }
-          //mexPrintf(" (%f,%f) ", x2, y2);        
-        }
-      }
+    if (do_spatial_transform) {
+      // only the fields left after clear_defaults are applied
+      warp_affine_matrix<Dtype>(coeff.mirror(), coeff.angle(), coeff.dx(),
+          coeff.dy(), coeff.zoom_x(), coeff.zoom_y(), cropped_width_,
+          cropped_height_, width, height, affine);
+      warp_bilinear_cpu(bottom_data + item_id * channels * width * height,
+          channels, width, height, affine,
+          coeff.has_angle() || coeff.has_zoom_x() || coeff.has_zoom_y(),
+          static_cast<const Dtype*>(NULL), Dtype(1), cropped_width_,
+          cropped_height_, top_data + item_id * channels * cropped_width_
+          * cropped_height_);
     }
     else {
       h_off = (height - cropped_height_)/2;
       w_off = (width - cropped_width_)/2;
-      for (x = 0; x < cropped_width_; x++) {
-        for (y = 0; y < cropped_height_; y++) {
-          for (c = 0; c < channels; c++) {
-            top_idx = ((item_id*channels + c)*cropped_width_ + x)*cropped_height_ + y;
-            bottom_idx = ((item_id*channels + c)*width + x + w_off)*height + y + h_off;
-            top_data[top_idx] = bottom_data[bottom_idx];
-          }
+      for (c = 0; c < channels; c++) {
+        for (x = 0; x < cropped_width_; x++) {
+          top_idx = ((item_id*channels + c)*cropped_width_ + x)*cropped_height_;
+          bottom_idx = ((item_id*channels + c)*width + x + w_off)*height + h_off;
+          caffe_copy(cropped_height_, bottom_data + bottom_idx, top_data + top_idx);
         }
       }
     }
@@ -698,25 +883,24 @@ Dtype DataAugmentationLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bott
 //     }
 //   }
 
-  return Dtype(0);
 }
 
 template <typename Dtype>
-void DataAugmentationLayer<Dtype>::generate_spatial_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, Dtype discount_coeff) {    
+void DataAugmentationLayer<Dtype>::generate_spatial_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, CounterRNG* rng, Dtype discount_coeff) {    
   if (aug.has_mirror())
-    coeff.set_mirror(static_cast<float>(caffe_rng_generate<bool>(aug.mirror())));
+    coeff.set_mirror(static_cast<float>(caffe_rng_generate<bool>(aug.mirror(), rng)));
   if (aug.has_translate()) {
-    coeff.set_dx(caffe_rng_generate<float>(aug.translate(), discount_coeff));
-    coeff.set_dy(caffe_rng_generate<float>(aug.translate(), discount_coeff));
+    coeff.set_dx(caffe_rng_generate<float>(aug.translate(), rng, discount_coeff));
+    coeff.set_dy(caffe_rng_generate<float>(aug.translate(), rng, discount_coeff));
   } 
   if (aug.has_rotate())
-    coeff.set_angle(caffe_rng_generate<float>(aug.rotate(), discount_coeff));
+    coeff.set_angle(caffe_rng_generate<float>(aug.rotate(), rng, discount_coeff));
   if (aug.has_zoom()) {
-    coeff.set_zoom_x(caffe_rng_generate<float>(aug.zoom(), discount_coeff));
+    coeff.set_zoom_x(caffe_rng_generate<float>(aug.zoom(), rng, discount_coeff));
     coeff.set_zoom_y(coeff.zoom_x());
   }
   if (aug.has_squeeze()) {
-    float squeeze_coeff = caffe_rng_generate<float>(aug.squeeze(), discount_coeff);
+    float squeeze_coeff = caffe_rng_generate<float>(aug.squeeze(), rng, discount_coeff);
     coeff.set_zoom_x(coeff.zoom_x() * squeeze_coeff);
     coeff.set_zoom_y(coeff.zoom_y() / squeeze_coeff);
   }
@@ -733,51 +917,51 @@ void DataAugmentationLayer<Dtype>::clear_spatial_coeffs(AugmentationCoeff& coeff
 }
 
 template <typename Dtype>
-void DataAugmentationLayer<Dtype>::generate_chromatic_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, Dtype discount_coeff) {  
+void DataAugmentationLayer<Dtype>::generate_chromatic_coeffs(const AugmentationParameter& aug, AugmentationCoeff& coeff, CounterRNG* rng, Dtype discount_coeff) {  
   if (aug.has_ladd_pow())
-    coeff.set_pow_nomean0(caffe_rng_generate<float>(aug.ladd_pow(), discount_coeff));
+    coeff.set_pow_nomean0(caffe_rng_generate<float>(aug.ladd_pow(), rng, discount_coeff));
   if (aug.has_col_pow()) {
-    coeff.set_pow_nomean1(caffe_rng_generate<float>(aug.col_pow(), discount_coeff));
-    coeff.set_pow_nomean2(caffe_rng_generate<float>(aug.col_pow(), discount_coeff));
+    coeff.set_pow_nomean1(caffe_rng_generate<float>(aug.col_pow(), rng, discount_coeff));
+    coeff.set_pow_nomean2(caffe_rng_generate<float>(aug.col_pow(), rng, discount_coeff));
   }
   
   if (aug.has_ladd_add())
-    coeff.set_add_nomean0(caffe_rng_generate<float>(aug.ladd_add(), discount_coeff));
+    coeff.set_add_nomean0(caffe_rng_generate<float>(aug.ladd_add(), rng, discount_coeff));
   if (aug.has_col_add()) {
-    coeff.set_add_nomean1(caffe_rng_generate<float>(aug.col_add(), discount_coeff));
-    coeff.set_add_nomean2(caffe_rng_generate<float>(aug.col_add(), discount_coeff));
+    coeff.set_add_nomean1(caffe_rng_generate<float>(aug.col_add(), rng, discount_coeff));
+    coeff.set_add_nomean2(caffe_rng_generate<float>(aug.col_add(), rng, discount_coeff));
   }
   
   if (aug.has_ladd_mult())
-    coeff.set_mult_nomean0(caffe_rng_generate<float>(aug.ladd_mult(), discount_coeff));
+    coeff.set_mult_nomean0(caffe_rng_generate<float>(aug.ladd_mult(), rng, discount_coeff));
   if (aug.has_col_mult()) {
-    coeff.set_mult_nomean1(caffe_rng_generate<float>(aug.col_mult(), discount_coeff));
-    coeff.set_mult_nomean2(caffe_rng_generate<float>(aug.col_mult(), discount_coeff));
+    coeff.set_mult_nomean1(caffe_rng_generate<float>(aug.col_mult(), rng, discount_coeff));
+    coeff.set_mult_nomean2(caffe_rng_generate<float>(aug.col_mult(), rng, discount_coeff));
   }     
 
   if (aug.has_sat_pow()) {
-    coeff.set_pow_withmean1(caffe_rng_generate<float>(aug.sat_pow(), discount_coeff));
+    coeff.set_pow_withmean1(caffe_rng_generate<float>(aug.sat_pow(), rng, discount_coeff));
     coeff.set_pow_withmean2(coeff.pow_withmean1());
   }
   
   if (aug.has_sat_add()) {
-    coeff.set_add_withmean1(caffe_rng_generate<float>(aug.sat_add(), discount_coeff));
+    coeff.set_add_withmean1(caffe_rng_generate<float>(aug.sat_add(), rng, discount_coeff));
     coeff.set_add_withmean2(coeff.add_withmean1());
   }
   
   if (aug.has_sat_mult()) {
-    coeff.set_mult_withmean1(caffe_rng_generate<float>(aug.sat_mult(), discount_coeff));
+    coeff.set_mult_withmean1(caffe_rng_generate<float>(aug.sat_mult(), rng, discount_coeff));
     coeff.set_mult_withmean2(coeff.mult_withmean1());
   }
   
   if (aug.has_lmult_pow())
-    coeff.set_lmult_pow(caffe_rng_generate<float>(aug.lmult_pow(), discount_coeff));
+    coeff.set_lmult_pow(caffe_rng_generate<float>(aug.lmult_pow(), rng, discount_coeff));
   if (aug.has_lmult_mult())
-    coeff.set_lmult_mult(caffe_rng_generate<float>(aug.lmult_mult(), discount_coeff));
+    coeff.set_lmult_mult(caffe_rng_generate<float>(aug.lmult_mult(), rng, discount_coeff));
   if (aug.has_lmult_add())
-    coeff.set_lmult_add(caffe_rng_generate<float>(aug.lmult_add(), discount_coeff));
+    coeff.set_lmult_add(caffe_rng_generate<float>(aug.lmult_add(), rng, discount_coeff));
   if (aug.has_col_rotate())
-    coeff.set_col_angle(caffe_rng_generate<float>(aug.col_rotate(), discount_coeff));  
+    coeff.set_col_angle(caffe_rng_generate<float>(aug.col_rotate(), rng, discount_coeff));  
 }
 
 template <typename Dtype>
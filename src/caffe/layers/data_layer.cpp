@@ -4,10 +4,14 @@
 #include <leveldb/db.h>
 #include <pthread.h>
 
+#include <map>
 #include <string>
 #include <vector>
 
+#include "boost/weak_ptr.hpp"
+
 #include "caffe/layer.hpp"
+#include "caffe/util/datum_transform.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -18,100 +22,204 @@ using std::string;
 
 namespace caffe {
 
+// LevelDB locks its database against a second open, and LMDB must not be
+// opened twice by a process, so the data layers reading a source (e.g. the
+// replicas of a data parallel solver) share one handle, each with its own
+// cursor.
+static pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<string, boost::weak_ptr<leveldb::DB> > leveldbs;
+static std::map<string, boost::weak_ptr<MDB_env> > lmdb_envs;
+
+static shared_ptr<leveldb::DB> OpenLevelDB(const string& source) {
+  pthread_mutex_lock(&db_mutex);
+  shared_ptr<leveldb::DB> db = leveldbs[source].lock();
+  if (!db) {
+    leveldb::DB* db_temp;
+    leveldb::Options options;
+    options.create_if_missing = false;
+    options.max_open_files = 100;
+    LOG(INFO) << "Opening leveldb " << source;
+    leveldb::Status status = leveldb::DB::Open(options, source, &db_temp);
+    CHECK(status.ok()) << "Failed to open leveldb " << source << std::endl
+                       << status.ToString();
+    db.reset(db_temp);
+    leveldbs[source] = db;
+  }
+  pthread_mutex_unlock(&db_mutex);
+  return db;
+}
+
+static shared_ptr<MDB_env> OpenLMDB(const string& source) {
+  pthread_mutex_lock(&db_mutex);
+  shared_ptr<MDB_env> env = lmdb_envs[source].lock();
+  if (!env) {
+    MDB_env* env_temp;
+    CHECK_EQ(mdb_env_create(&env_temp), MDB_SUCCESS) << "mdb_env_create failed";
+    CHECK_EQ(mdb_env_set_mapsize(env_temp, 1099511627776), MDB_SUCCESS);  // 1TB
+    CHECK_EQ(mdb_env_open(env_temp, source.c_str(), MDB_RDONLY|MDB_NOTLS,
+             0664), MDB_SUCCESS) << "mdb_env_open failed";
+    LOG(INFO) << "Opening lmdb " << source;
+    env.reset(env_temp, mdb_env_close);
+    lmdb_envs[source] = env;
+  }
+  pthread_mutex_unlock(&db_mutex);
+  return env;
+}
+
 template <typename Dtype>
 void* DataLayerPrefetch(void* layer_pointer) {
   CHECK(layer_pointer);
   DataLayer<Dtype>* layer = static_cast<DataLayer<Dtype>*>(layer_pointer);
   CHECK(layer);
-  Datum datum;
-  CHECK(layer->prefetch_data_);
-  Dtype* top_data = layer->prefetch_data_->mutable_cpu_data();
-  Dtype* top_label;
-  if (layer->output_labels_) {
-    top_label = layer->prefetch_label_->mutable_cpu_data();
-  }
-  const Dtype scale = layer->layer_param_.data_param().scale();
+  typename DataLayer<Dtype>::PrefetchBatch batch;
   const int batch_size = layer->layer_param_.data_param().batch_size();
-  const int crop_size = layer->layer_param_.data_param().crop_size();
-  const bool mirror = layer->layer_param_.data_param().mirror();
+  batch.records.resize(batch_size);
+  batch.record_sizes.resize(batch_size);
+  batch.values.resize(batch_size);
+  int slot;
+  while ((slot = layer->ReadBatch(&batch)) >= 0) {
+    layer->TransformBatch(batch, slot);
+    pthread_mutex_lock(&layer->prefetch_mutex_);
+    layer->prefetch_ready_[slot] = true;
+    pthread_cond_broadcast(&layer->batch_ready_);
+    pthread_mutex_unlock(&layer->prefetch_mutex_);
+  }
+  return static_cast<void*>(NULL);
+}
 
-  if (mirror && crop_size == 0) {
-    LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
-        << "set at the same time.";
+template <typename Dtype>
+int DataLayer<Dtype>::ReadBatch(PrefetchBatch* batch) {
+  // Batches are read under cursor_mutex_ in the order they are claimed.
+  pthread_mutex_lock(&cursor_mutex_);
+  pthread_mutex_lock(&prefetch_mutex_);
+  const int depth = prefetch_data_.size();
+  while (!prefetch_stop_ && prefetch_read_ >= prefetch_used_ + depth) {
+    pthread_cond_wait(&batch_free_, &prefetch_mutex_);
   }
-  // datum scales
-  const int channels = layer->datum_channels_;
-  const int height = layer->datum_height_;
-  const int width = layer->datum_width_;
-  const int size = layer->datum_size_;
-  const Dtype* mean = layer->data_mean_.cpu_data();
-  for (int item_id = 0; item_id < batch_size; ++item_id) {
+  if (prefetch_stop_) {
+    pthread_mutex_unlock(&prefetch_mutex_);
+    pthread_mutex_unlock(&cursor_mutex_);
+    return -1;
+  }
+  batch->index = prefetch_read_++;
+  batch->phase = phase_;
+  pthread_mutex_unlock(&prefetch_mutex_);
+
+  const int randomize =
+      this->layer_param_.data_param().randomize_data_sampling();
+  for (int item_id = 0; item_id < batch->records.size(); ++item_id) {
     // get a blob
-    switch (layer->layer_param_.data_param().backend()) {
+    switch (this->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
-      CHECK(layer->iter_);
-      CHECK(layer->iter_->Valid());
-      datum.ParseFromString(layer->iter_->value().ToString());
+      CHECK(iter_);
+      CHECK(iter_->Valid());
+      batch->values[item_id].assign(iter_->value().data(),
+          iter_->value().size());
+      batch->records[item_id] = batch->values[item_id].data();
+      batch->record_sizes[item_id] = batch->values[item_id].size();
       break;
     case DataParameter_DB_LMDB:
-      CHECK_EQ(mdb_cursor_get(layer->mdb_cursor_, &layer->mdb_key_,
-              &layer->mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(layer->mdb_value_.mv_data,
-          layer->mdb_value_.mv_size);
+      CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
+              &mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
+      batch->records[item_id] = static_cast<const char*>(mdb_value_.mv_data);
+      batch->record_sizes[item_id] = mdb_value_.mv_size;
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
+    // go to the next iter, of this shard
+    int num_skip = 1;
+    if (randomize > 1 && batch->phase == Caffe::TRAIN) {
+      CounterRNG rng(rng_seed_, batch->index, item_id, 1);
+      num_skip = rng() % randomize + 1;
+    }
+    SkipRecords(num_skip * this->layer_param_.data_param().num_shards());
+  }
+  pthread_mutex_unlock(&cursor_mutex_);
+  return batch->index % depth;
+}
 
-    const string& data = datum.data();
+template <typename Dtype>
+void DataLayer<Dtype>::SkipRecords(const int num_skip) {
+  switch (this->layer_param_.data_param().backend()) {
+  case DataParameter_DB_LEVELDB:
+    for (int s=0; s<num_skip; s++) {
+      iter_->Next();
+      if (!iter_->Valid()) {
+        // We have reached the end. Restart from the first.
+        DLOG(INFO) << "Restarting data prefetching from start.";
+        iter_->SeekToFirst();
+      }
+    }
+    break;
+  case DataParameter_DB_LMDB:
+    for (int s=0; s<num_skip; s++) {
+      if (mdb_cursor_get(mdb_cursor_, &mdb_key_,
+              &mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
+        // We have reached the end. Restart from the first.
+        DLOG(INFO) << "Restarting data prefetching from start.";
+        CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_,
+                &mdb_value_, MDB_FIRST), MDB_SUCCESS);
+      }
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown database backend";
+  }
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::TransformBatch(const PrefetchBatch& batch,
+    const int slot) {
+  Datum datum;
+  Dtype* top_data = prefetch_data_[slot]->mutable_cpu_data();
+  Dtype* top_label = NULL;
+  if (output_labels_) {
+    top_label = prefetch_label_[slot]->mutable_cpu_data();
+  }
+  const Dtype scale = this->layer_param_.data_param().scale();
+  const int crop_size = this->layer_param_.data_param().crop_size();
+  const bool mirror = this->layer_param_.data_param().mirror();
+  // datum scales
+  const int channels = datum_channels_;
+  const int height = datum_height_;
+  const int width = datum_width_;
+  const int size = datum_size_;
+  const int size_cropped = channels * crop_size * crop_size;
+  const Dtype* mean = data_mean_.cpu_data();
+  DatumView view;
+  for (int item_id = 0; item_id < batch.records.size(); ++item_id) {
+    // Datums of uint8 data are decoded in place; the others are parsed
+    if (!ParseDatumView(batch.records[item_id], batch.record_sizes[item_id],
+        &view)) {
+      datum.ParseFromArray(batch.records[item_id],
+          batch.record_sizes[item_id]);
+      view.label = datum.label();
+      view.data = reinterpret_cast<const uint8_t*>(datum.data().data());
+      view.data_size = datum.data().size();
+    }
     if (crop_size) {
-      CHECK(data.size()) << "Image cropping only support uint8 data";
+      CHECK(view.data_size) << "Image cropping only support uint8 data";
       int h_off, w_off;
+      bool mirror_item = false;
       // We only do random crop when we do training.
-      if (layer->phase_ == Caffe::TRAIN) {
-        h_off = layer->PrefetchRand() % (height - crop_size);
-        w_off = layer->PrefetchRand() % (width - crop_size);
+      if (batch.phase == Caffe::TRAIN) {
+        CounterRNG rng(rng_seed_, batch.index, item_id);
+        h_off = rng() % (height - crop_size);
+        w_off = rng() % (width - crop_size);
+        mirror_item = mirror && rng() % 2;
       } else {
         h_off = (height - crop_size) / 2;
         w_off = (width - crop_size) / 2;
       }
-      if (mirror && layer->PrefetchRand() % 2) {
-        // Copy mirrored version
-        for (int c = 0; c < channels; ++c) {
-          for (int h = 0; h < crop_size; ++h) {
-            for (int w = 0; w < crop_size; ++w) {
-              int top_index = ((item_id * channels + c) * crop_size + h)
-                              * crop_size + (crop_size - 1 - w);
-              int data_index = (c * height + h + h_off) * width + w + w_off;
-              Dtype datum_element =
-                  static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-              top_data[top_index] = (datum_element - mean[data_index]) * scale;
-            }
-          }
-        }
-      } else {
-        // Normal copy
-        for (int c = 0; c < channels; ++c) {
-          for (int h = 0; h < crop_size; ++h) {
-            for (int w = 0; w < crop_size; ++w) {
-              int top_index = ((item_id * channels + c) * crop_size + h)
-                              * crop_size + w;
-              int data_index = (c * height + h + h_off) * width + w + w_off;
-              Dtype datum_element =
-                  static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-              top_data[top_index] = (datum_element - mean[data_index]) * scale;
-            }
-          }
-        }
-      }
+      datum_transform_cpu(view.data, channels, height, width, mean, scale,
+          crop_size, crop_size, h_off, w_off, mirror_item,
+          top_data + item_id * size_cropped);
     } else {
       // we will prefer to use data() first, and then try float_data()
-      if (data.size()) {
-        for (int j = 0; j < size; ++j) {
-          Dtype datum_element =
-              static_cast<Dtype>(static_cast<uint8_t>(data[j]));
-          top_data[item_id * size + j] = (datum_element - mean[j]) * scale;
-        }
+      if (view.data_size) {
+        datum_transform_cpu(view.data, channels, height, width, mean, scale,
+            height, width, 0, 0, false, top_data + item_id * size);
       } else {
         for (int j = 0; j < size; ++j) {
           top_data[item_id * size + j] =
@@ -120,46 +228,10 @@ void* DataLayerPrefetch(void* layer_pointer) {
       }
     }
 
-    if (layer->output_labels_) {
-      top_label[item_id] = datum.label();
-      //if (layer->phase_ == Caffe::TRAIN) {
-      //  LOG(INFO) << datum.label(); 
-      //}
-    }
-    // go to the next iter
-    int num_skip;
-    if (layer->layer_param_.data_param().randomize_data_sampling() <= 1)
-      num_skip = 1;
-    else
-      num_skip = (layer->PrefetchRand()) % (layer->layer_param_.data_param().randomize_data_sampling()) + 1;
-    switch (layer->layer_param_.data_param().backend()) {
-    case DataParameter_DB_LEVELDB:
-      for (int s=0; s<num_skip; s++) {
-        layer->iter_->Next();
-        if (!layer->iter_->Valid()) {
-          // We have reached the end. Restart from the first.
-          DLOG(INFO) << "Restarting data prefetching from start.";
-          layer->iter_->SeekToFirst();
-        }
-      }
-      break;
-    case DataParameter_DB_LMDB:
-      for (int s=0; s<num_skip; s++) {
-        if (mdb_cursor_get(layer->mdb_cursor_, &layer->mdb_key_,
-                &layer->mdb_value_, MDB_NEXT) != MDB_SUCCESS) {
-          // We have reached the end. Restart from the first.
-          DLOG(INFO) << "Restarting data prefetching from start.";
-          CHECK_EQ(mdb_cursor_get(layer->mdb_cursor_, &layer->mdb_key_,
-                  &layer->mdb_value_, MDB_FIRST), MDB_SUCCESS);
-        }
-      }
-      break;
-    default:
-      LOG(FATAL) << "Unknown database backend";
+    if (output_labels_) {
+      top_label[item_id] = view.label;
     }
   }
-
-  return static_cast<void*>(NULL);
 }
 
 template <typename Dtype>
@@ -170,10 +242,10 @@ DataLayer<Dtype>::~DataLayer<Dtype>() {
   case DataParameter_DB_LEVELDB:
     break;  // do nothing
   case DataParameter_DB_LMDB:
+    // the environment closes with the last layer using it
     mdb_cursor_close(mdb_cursor_);
-    mdb_close(mdb_env_, mdb_dbi_);
+    mdb_close(mdb_env_.get(), mdb_dbi_);
     mdb_txn_abort(mdb_txn_);
-    mdb_env_close(mdb_env_);
     break;
   default:
     LOG(FATAL) << "Unknown database backend";
@@ -192,35 +264,18 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   // Initialize DB
   switch (this->layer_param_.data_param().backend()) {
   case DataParameter_DB_LEVELDB:
-    {
-    leveldb::DB* db_temp;
-    leveldb::Options options;
-    options.create_if_missing = false;
-    options.max_open_files = 100;
-    LOG(INFO) << "Opening leveldb " << this->layer_param_.data_param().source();
-    leveldb::Status status = leveldb::DB::Open(
-        options, this->layer_param_.data_param().source(), &db_temp);
-    CHECK(status.ok()) << "Failed to open leveldb "
-                       << this->layer_param_.data_param().source() << std::endl
-                       << status.ToString();
-    db_.reset(db_temp);
+    db_ = OpenLevelDB(this->layer_param_.data_param().source());
     iter_.reset(db_->NewIterator(leveldb::ReadOptions()));
     iter_->SeekToFirst();
-    }
     break;
   case DataParameter_DB_LMDB:
-    CHECK_EQ(mdb_env_create(&mdb_env_), MDB_SUCCESS) << "mdb_env_create failed";
-    CHECK_EQ(mdb_env_set_mapsize(mdb_env_, 1099511627776), MDB_SUCCESS);  // 1TB
-    CHECK_EQ(mdb_env_open(mdb_env_,
-             this->layer_param_.data_param().source().c_str(),
-             MDB_RDONLY|MDB_NOTLS, 0664), MDB_SUCCESS) << "mdb_env_open failed";
-    CHECK_EQ(mdb_txn_begin(mdb_env_, NULL, MDB_RDONLY, &mdb_txn_), MDB_SUCCESS)
-        << "mdb_txn_begin failed";
+    mdb_env_ = OpenLMDB(this->layer_param_.data_param().source());
+    CHECK_EQ(mdb_txn_begin(mdb_env_.get(), NULL, MDB_RDONLY, &mdb_txn_),
+        MDB_SUCCESS) << "mdb_txn_begin failed";
     CHECK_EQ(mdb_open(mdb_txn_, NULL, 0, &mdb_dbi_), MDB_SUCCESS)
         << "mdb_open failed";
     CHECK_EQ(mdb_cursor_open(mdb_txn_, mdb_dbi_, &mdb_cursor_), MDB_SUCCESS)
         << "mdb_cursor_open failed";
-    LOG(INFO) << "Opening lmdb " << this->layer_param_.data_param().source();
     CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_FIRST),
         MDB_SUCCESS) << "mdb_cursor_get failed";
     break;
@@ -228,31 +283,18 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
     LOG(FATAL) << "Unknown database backend";
   }
 
-  // Check if we would need to randomly skip a few data points
+  // Check if we would need to randomly skip a few data points, in whole
+  // rounds of the shards, and go to the first datum of this shard
+  const int num_shards = this->layer_param_.data_param().num_shards();
+  const int shard_id = this->layer_param_.data_param().shard_id();
+  CHECK_GE(num_shards, 1);
+  CHECK_LT(shard_id, num_shards);
+  unsigned int skip = 0;
   if (this->layer_param_.data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
-                        this->layer_param_.data_param().rand_skip();
-    LOG(INFO) << "Skipping first " << skip << " data points.";
-    while (skip-- > 0) {
-      switch (this->layer_param_.data_param().backend()) {
-      case DataParameter_DB_LEVELDB:
-        iter_->Next();
-        if (!iter_->Valid()) {
-          iter_->SeekToFirst();
-        }
-        break;
-      case DataParameter_DB_LMDB:
-        if (mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_, MDB_NEXT)
-            != MDB_SUCCESS) {
-          CHECK_EQ(mdb_cursor_get(mdb_cursor_, &mdb_key_, &mdb_value_,
-                   MDB_FIRST), MDB_SUCCESS);
-        }
-        break;
-      default:
-        LOG(FATAL) << "Unknown database backend";
-      }
-    }
+    skip = caffe_rng_rand() % this->layer_param_.data_param().rand_skip();
+    LOG(INFO) << "Skipping first " << skip * num_shards << " data points.";
   }
+  SkipRecords(skip * num_shards + shard_id);
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
   switch (this->layer_param_.data_param().backend()) {
@@ -268,19 +310,17 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 
   // image
   int crop_size = this->layer_param_.data_param().crop_size();
+  if (this->layer_param_.data_param().mirror() && crop_size == 0) {
+    LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
+        << "set at the same time.";
+  }
   if (crop_size > 0) {
     (*top)[0]->Reshape(this->layer_param_.data_param().batch_size(),
                        datum.channels(), crop_size, crop_size);
-    prefetch_data_.reset(new Blob<Dtype>(
-        this->layer_param_.data_param().batch_size(), datum.channels(),
-        crop_size, crop_size));
   } else {
     (*top)[0]->Reshape(
         this->layer_param_.data_param().batch_size(), datum.channels(),
         datum.height(), datum.width());
-    prefetch_data_.reset(new Blob<Dtype>(
-        this->layer_param_.data_param().batch_size(), datum.channels(),
-        datum.height(), datum.width()));
   }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -288,8 +328,19 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   // label
   if (output_labels_) {
     (*top)[1]->Reshape(this->layer_param_.data_param().batch_size(), 1, 1, 1);
-    prefetch_label_.reset(
-        new Blob<Dtype>(this->layer_param_.data_param().batch_size(), 1, 1, 1));
+  }
+  // the ring of prefetched batches
+  const int prefetch_depth = this->layer_param_.data_param().prefetch_depth();
+  CHECK_GT(prefetch_depth, 0) << "prefetch_depth must be positive.";
+  prefetch_data_.resize(prefetch_depth);
+  prefetch_label_.resize(prefetch_depth);
+  for (int i = 0; i < prefetch_depth; ++i) {
+    prefetch_data_[i].reset(new Blob<Dtype>());
+    prefetch_data_[i]->ReshapeLike(*(*top)[0]);
+    if (output_labels_) {
+      prefetch_label_[i].reset(new Blob<Dtype>());
+      prefetch_label_[i]->ReshapeLike(*(*top)[1]);
+    }
   }
   // datum size
   datum_channels_ = datum.channels();
@@ -317,9 +368,11 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   // cpu_data calls so that the prefetch thread does not accidentally make
   // simultaneous cudaMalloc calls when the main thread is running. In some
   // GPUs this seems to cause failures if we do not so.
-  prefetch_data_->mutable_cpu_data();
-  if (output_labels_) {
-    prefetch_label_->mutable_cpu_data();
+  for (int i = 0; i < prefetch_depth; ++i) {
+    prefetch_data_[i]->mutable_cpu_data();
+    if (output_labels_) {
+      prefetch_label_[i]->mutable_cpu_data();
+    }
   }
   data_mean_.cpu_data();
   DLOG(INFO) << "Initializing prefetch";
@@ -330,48 +383,85 @@ void DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void DataLayer<Dtype>::CreatePrefetchThread() {
   phase_ = Caffe::phase();
-  const bool prefetch_needs_rand = (phase_ == Caffe::TRAIN) &&
-      (this->layer_param_.data_param().mirror() ||
-       this->layer_param_.data_param().crop_size() ||
-      (this->layer_param_.data_param().randomize_data_sampling() >= 2)); 
-  if (prefetch_needs_rand) {
-    const unsigned int prefetch_rng_seed = caffe_rng_rand();
-    prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
-  } else {
-    prefetch_rng_.reset();
+  rng_seed_ = caffe_rng_rand();
+  prefetch_ready_.assign(prefetch_data_.size(), false);
+  prefetch_read_ = 0;
+  prefetch_used_ = 0;
+  prefetch_stop_ = false;
+  pthread_mutex_init(&prefetch_mutex_, NULL);
+  pthread_mutex_init(&cursor_mutex_, NULL);
+  pthread_cond_init(&batch_free_, NULL);
+  pthread_cond_init(&batch_ready_, NULL);
+  const int num_threads = this->layer_param_.data_param().prefetch_threads();
+  CHECK_GT(num_threads, 0) << "prefetch_threads must be positive.";
+  threads_.resize(num_threads);
+  // Create the threads.
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK(!pthread_create(&threads_[i], NULL, DataLayerPrefetch<Dtype>,
+          static_cast<void*>(this))) << "Pthread execution failed.";
   }
-  // Create the thread.
-  CHECK(!pthread_create(&thread_, NULL, DataLayerPrefetch<Dtype>,
-        static_cast<void*>(this))) << "Pthread execution failed.";
 }
 
 template <typename Dtype>
 void DataLayer<Dtype>::JoinPrefetchThread() {
-  CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
+  if (threads_.empty()) {
+    return;
+  }
+  pthread_mutex_lock(&prefetch_mutex_);
+  prefetch_stop_ = true;
+  pthread_cond_broadcast(&batch_free_);
+  pthread_mutex_unlock(&prefetch_mutex_);
+  for (int i = 0; i < threads_.size(); ++i) {
+    CHECK(!pthread_join(threads_[i], NULL)) << "Pthread joining failed.";
+  }
+  threads_.clear();
+  pthread_cond_destroy(&batch_ready_);
+  pthread_cond_destroy(&batch_free_);
+  pthread_mutex_destroy(&cursor_mutex_);
+  pthread_mutex_destroy(&prefetch_mutex_);
+}
+
+template <typename Dtype>
+int DataLayer<Dtype>::WaitForBatch() {
+  pthread_mutex_lock(&prefetch_mutex_);
+  // batches read from now on follow the current phase
+  phase_ = Caffe::phase();
+  const int batch = prefetch_used_ % prefetch_data_.size();
+  while (!prefetch_ready_[batch]) {
+    pthread_cond_wait(&batch_ready_, &prefetch_mutex_);
+  }
+  pthread_mutex_unlock(&prefetch_mutex_);
+  return batch;
+}
+
+template <typename Dtype>
+void DataLayer<Dtype>::ReleaseBatch() {
+  pthread_mutex_lock(&prefetch_mutex_);
+  prefetch_ready_[prefetch_used_ % prefetch_data_.size()] = false;
+  ++prefetch_used_;
+  pthread_cond_broadcast(&batch_free_);
+  pthread_mutex_unlock(&prefetch_mutex_);
 }
 
+// Exchanges the data memory of two blobs of the same size.
 template <typename Dtype>
-unsigned int DataLayer<Dtype>::PrefetchRand() {
-  CHECK(prefetch_rng_);
-  caffe::rng_t* prefetch_rng =
-      static_cast<caffe::rng_t*>(prefetch_rng_->generator());
-  return (*prefetch_rng)();
+static void swap_data(Blob<Dtype>* a, Blob<Dtype>* b) {
+  const shared_ptr<SyncedMemory> data = a->data();
+  a->SetDataMemory(b->data());
+  b->SetDataMemory(data);
 }
 
 template <typename Dtype>
 Dtype DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
-  // Copy the data
-  caffe_copy(prefetch_data_->count(), prefetch_data_->cpu_data(),
-             (*top)[0]->mutable_cpu_data());
+  const int batch = WaitForBatch();
+  // Hand the batch to the top blobs instead of copying it; their previous
+  // memory goes back to the ring.
+  swap_data(prefetch_data_[batch].get(), (*top)[0]);
   if (output_labels_) {
-    caffe_copy(prefetch_label_->count(), prefetch_label_->cpu_data(),
-               (*top)[1]->mutable_cpu_data());
+    swap_data(prefetch_label_[batch].get(), (*top)[1]);
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  ReleaseBatch();
   return Dtype(0.);
 }
 
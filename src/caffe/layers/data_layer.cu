@@ -18,19 +18,19 @@ namespace caffe {
 template <typename Dtype>
 Dtype DataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-  // First, join the thread
-  JoinPrefetchThread();
+  const int batch = WaitForBatch();
   // Copy the data
   CUDA_CHECK(cudaMemcpy((*top)[0]->mutable_gpu_data(),
-      prefetch_data_->cpu_data(), sizeof(Dtype) * prefetch_data_->count(),
+      prefetch_data_[batch]->cpu_data(),
+      sizeof(Dtype) * prefetch_data_[batch]->count(),
       cudaMemcpyHostToDevice));
   if (output_labels_) {
     CUDA_CHECK(cudaMemcpy((*top)[1]->mutable_gpu_data(),
-        prefetch_label_->cpu_data(), sizeof(Dtype) * prefetch_label_->count(),
+        prefetch_label_[batch]->cpu_data(),
+        sizeof(Dtype) * prefetch_label_[batch]->count(),
         cudaMemcpyHostToDevice));
   }
-  // Start a new prefetch thread
-  CreatePrefetchThread();
+  ReleaseBatch();
   return Dtype(0.);
 }
 
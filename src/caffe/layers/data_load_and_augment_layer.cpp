@@ -15,6 +15,7 @@
 #include "caffe/vision_layers.hpp"
 #include "caffe/util/rng.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/warp.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/proto/caffe.pb.h"
 
@@ -39,15 +40,18 @@ template <typename T> int sgn(T val) {
   return (T(0) < val) - (val < T(0));
 }
   
+// Draws from the stream of an item (see CounterRNG), as the prefetch thread
+// must not use the generator of the main thread.
 template <typename Dtype>
-Dtype caffe_rng_generate(const RandomGeneratorParameter param) {
+Dtype caffe_rng_generate(const RandomGeneratorParameter param,
+    CounterRNG* rng) {
   const std::string rand_type =  param.rand_type();
   //std::cout << rand_type << " " << rand_type.compare("uniform") << " " << rand_type.compare("gaussian") << " " << rand_type.compare("bernoulli");
   Dtype rand;
   if (rand_type.compare("uniform") == 0) {
     float tmp;
     if (param.spread() > 0.)
-      caffe_rng_uniform(1, param.mean() - param.spread(), param.mean() + param.spread(), &tmp);
+      tmp = rng->uniform<float>(param.mean() - param.spread(), param.mean() + param.spread());
     else
       tmp = param.mean();
     if (param.exp())
@@ -57,7 +61,7 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter param) {
   else if (rand_type.compare("gaussian") == 0) {
     float tmp;
     if (param.spread() > 0.)
-      caffe_rng_gaussian(1, param.mean(), param.spread(), &tmp);
+      tmp = rng->gaussian<float>(param.mean(), param.spread());
     else
       tmp = param.mean();
     if (param.exp())
@@ -67,7 +71,7 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter param) {
   else if (rand_type.compare("bernoulli") == 0) {
     int tmp;
     if (param.prob() > 0.)
-      caffe_rng_bernoulli(1, param.prob(), &tmp);
+      tmp = rng->bernoulli(param.prob());
     else
       tmp = 0;
     rand = static_cast<Dtype>(tmp);
@@ -77,12 +81,12 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter param) {
     int tmp2;
     
     if (param.spread() > 0.) 
-      caffe_rng_uniform(1, param.mean() - param.spread(), param.mean() + param.spread(), &tmp1);
+      tmp1 = rng->uniform<float>(param.mean() - param.spread(), param.mean() + param.spread());
     else
       tmp1 = param.mean();
     
     if (param.prob() > 0.)
-      caffe_rng_bernoulli(1, param.prob(), &tmp2);
+      tmp2 = rng->bernoulli(param.prob());
     else
       tmp2 = 0;
     
@@ -98,12 +102,12 @@ Dtype caffe_rng_generate(const RandomGeneratorParameter param) {
     int tmp2;
     
     if (param.spread() > 0.) 
-      caffe_rng_gaussian(1, param.mean() - param.spread(), param.mean() + param.spread(), &tmp1);
+      tmp1 = rng->gaussian<float>(param.mean() - param.spread(), param.mean() + param.spread());
     else
       tmp1 = param.mean();
     
     if (param.prob() > 0.)
-      caffe_rng_bernoulli(1, param.prob(), &tmp2);
+      tmp2 = rng->bernoulli(param.prob());
     else
       tmp2 = 0;
     
@@ -127,23 +131,14 @@ void* DataLoadAndAugmentLayerPrefetch(void* layer_pointer) {
   CHECK(layer_pointer);
   DataLoadAndAugmentLayer<Dtype>* layer = static_cast<DataLoadAndAugmentLayer<Dtype>*>(layer_pointer);
   CHECK(layer);
-  Datum datum;
   CHECK(layer->prefetch_data_);
   Dtype* top_data = layer->prefetch_data_->mutable_cpu_data();
-  Dtype* top_label;
+  Dtype* top_label = NULL;
   if (layer->output_labels_) {
     top_label = layer->prefetch_label_->mutable_cpu_data();
   }
-  const Dtype scale = layer->layer_param_.data_param().scale();
   const int batch_size = layer->layer_param_.data_param().batch_size();
-  
-  // datum scales
   const int channels = layer->datum_channels_;
-  const int height = layer->datum_height_;
-  const int width = layer->datum_width_;
-  const int size = layer->datum_size_;
-  const Dtype* mean = layer->data_mean_.cpu_data();   
-  const int crop_size = layer->cropped_width_; 
   
   string write_augmented;
   if (layer->layer_param_.has_augmentation_param())
@@ -151,400 +146,28 @@ void* DataLoadAndAugmentLayerPrefetch(void* layer_pointer) {
   else
     write_augmented = std::string("");
    
+  // Read the records of the batch in cursor order...
+  vector<string>& values = layer->prefetch_values_;
+  values.resize(batch_size);
   for (int item_id = 0; item_id < batch_size; ++item_id) {
     // get a blob
     switch (layer->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
       CHECK(layer->iter_);
       CHECK(layer->iter_->Valid());
-      datum.ParseFromString(layer->iter_->value().ToString());
+      values[item_id].assign(layer->iter_->value().data(),
+          layer->iter_->value().size());
       break;
     case DataParameter_DB_LMDB:
       CHECK_EQ(mdb_cursor_get(layer->mdb_cursor_, &layer->mdb_key_,
               &layer->mdb_value_, MDB_GET_CURRENT), MDB_SUCCESS);
-      datum.ParseFromArray(layer->mdb_value_.mv_data,
+      values[item_id].assign(
+          static_cast<const char*>(layer->mdb_value_.mv_data),
           layer->mdb_value_.mv_size);
       break;
     default:
       LOG(FATAL) << "Unknown database backend";
     }
-    
-    const string& data = datum.data();
-    if (layer->layer_param_.has_augmentation_param()) {
-      AugmentationParameter aug = layer->layer_param_.augmentation_param();
-      int x, y, c, top_idx, bottom_idx, h_off, w_off;
-      float x1, y1, x2, y2;
-      
-      bool do_spatial_transform, do_chromatic_transform;
-      
-      //   We only do transformations during training.
-      if (Caffe::phase() != Caffe::TRAIN) {
-        do_spatial_transform   = false;
-        do_chromatic_transform = false;
-      }
-      
-      Dtype angle = 0.;
-      Dtype zoom_coeff = 1.;
-      Dtype dx = 0.;
-      Dtype dy = 0.;
-      bool mirror = false;  
-      
-      Dtype lmult_pow_coeff = 1.;
-      Dtype lmult_mult_coeff = 1.;
-      Dtype lmult_add_coeff = 0.;  
-      Dtype pow_coeffs [3] = {1., 1., 1.};
-      Dtype mult_coeffs [3] = {1., 1., 1.};
-      Dtype add_coeffs [3] = {0., 0., 0.};  
-      Dtype pow_factor = 1.;
-      Dtype mult_factor = 1.;
-      Dtype add_factor = 1.;
-      
-      //LOG(INFO) <<  " === thread " << omp_get_thread_num() << "/" << omp_get_num_threads() << " === ";
-      
-      do_spatial_transform   = (aug.has_mirror()    || aug.has_translate()  || aug.has_rotate()    || aug.has_zoom());
-      do_chromatic_transform = (aug.has_lmult_pow() || aug.has_lmult_mult() || aug.has_lmult_add() || 
-                                  aug.has_sat_pow()   || aug.has_sat_mult()   || aug.has_sat_add()   ||
-                                  aug.has_col_pow()   || aug.has_col_mult()   || aug.has_col_add()   ||
-                                  aug.has_ladd_pow()  || aug.has_ladd_mult()  || aug.has_ladd_add());
-      
-      // sample the parameters of the transoformations  
-      if (do_spatial_transform) {
-        int counter = 0;
-        int max_num_tries = 20;    
-        int good_params = 0;
-        
-        // try to sample parameters for which transformed image doesn't go outside the borders of the original one
-        // in order to do check this, just apply the transformations to 4 corners
-        while (good_params < 4 && counter < max_num_tries) {
-          good_params = 0;
-          if (aug.has_rotate())
-            angle = caffe_rng_generate<float>(aug.rotate());
-          if (aug.has_zoom())
-            zoom_coeff = caffe_rng_generate<float>(aug.zoom());
-          if (aug.has_translate()) {
-            dx = caffe_rng_generate<float>(aug.translate());
-            dy = caffe_rng_generate<float>(aug.translate());
-          }
-          if (aug.has_mirror())
-            mirror = caffe_rng_generate<bool>(aug.mirror());
-    
-          //LOG(INFO) << "angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
-          
-          for (x = 0; x < crop_size; x += crop_size-1) {
-            for (y = 0; y < crop_size; y += crop_size-1) {
-              // move the origin and mirror
-              if (mirror) {
-                x1 =  static_cast<Dtype>(x) - .5 * static_cast<Dtype>(crop_size);
-                y1 = -static_cast<Dtype>(y) + .5 * static_cast<Dtype>(crop_size);            
-              } 
-              else {
-                x1 = static_cast<Dtype>(x) - .5 * static_cast<Dtype>(crop_size);
-                y1 = static_cast<Dtype>(y) - .5 * static_cast<Dtype>(crop_size);
-              }
-              // rotate
-              x2 =  cos(angle) * x1 - sin(angle) * y1;
-              y2 =  sin(angle) * x1 + cos(angle) * y1;
-              // translate
-              x2 = x2 + dx * static_cast<Dtype>(crop_size);
-              y2 = y2 + dy * static_cast<Dtype>(crop_size);
-              // zoom
-              x2 = x2 / zoom_coeff;
-              y2 = y2 / zoom_coeff;
-              // move the origin back
-              x2 = x2 + .5 * static_cast<Dtype>(width);
-              y2 = y2 + .5 * static_cast<Dtype>(height);
-              
-              if (!(floor(x2) < 0 || floor(x2) > static_cast<Dtype>(width - 2) || floor(y2) < 0 || floor(y2) > static_cast<Dtype>(height - 2)))
-                  good_params++;
-              //mexPrintf(" (%f,%f) ", x2, y2);
-            }
-          }
-          //mexPrintf("\n");
-          counter++;
-        }
-        if (counter >= max_num_tries) {
-          angle=0.;
-          zoom_coeff=1.;
-          dx=0.;
-          dy=0.;
-          mirror = false;
-        }
-        
-        if (write_augmented.size()) { 
-          if (do_spatial_transform)
-            LOG(INFO) << " Augmenting. angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
-          else
-            LOG(INFO) << "Couldn't find appropriate spatial augmentation parameters";
-        }
-      } 
-      
-      if (do_chromatic_transform) {
-        if (aug.has_lmult_pow())
-          lmult_pow_coeff = caffe_rng_generate<float>(aug.lmult_pow());
-        if (aug.has_lmult_mult())
-          lmult_mult_coeff = caffe_rng_generate<float>(aug.lmult_mult());
-        if (aug.has_lmult_add())
-          lmult_add_coeff = caffe_rng_generate<float>(aug.lmult_add());
-        
-        if (aug.has_ladd_pow())
-          pow_coeffs[0] = caffe_rng_generate<float>(aug.ladd_pow());
-        if (aug.has_ladd_mult())
-          mult_coeffs[0] = caffe_rng_generate<float>(aug.ladd_mult());
-        if (aug.has_ladd_add())
-          add_coeffs[0] = caffe_rng_generate<float>(aug.ladd_add());
-        
-        for (c=1; c<3; c++) {
-          if (aug.has_sat_pow())
-            pow_coeffs[c] = caffe_rng_generate<float>(aug.sat_pow());
-          if (aug.has_sat_mult())
-            mult_coeffs[c] = caffe_rng_generate<float>(aug.sat_mult());
-          if (aug.has_sat_add())
-            add_coeffs[c] = caffe_rng_generate<float>(aug.sat_add());
-        }
-        
-        if (aug.has_col_pow())
-          pow_factor = caffe_rng_generate<float>(aug.col_pow());
-        if (aug.has_col_mult())
-          mult_factor = caffe_rng_generate<float>(aug.col_mult());
-        if (aug.has_col_add())
-          add_factor = caffe_rng_generate<float>(aug.col_add());
-        
-        pow_coeffs[1] = pow_coeffs[1] * pow_factor;
-        pow_coeffs[2] = pow_coeffs[2] / pow_factor;
-        mult_coeffs[1] = mult_coeffs[1] * mult_factor;
-        mult_coeffs[2] = mult_coeffs[2] / mult_factor;
-        add_coeffs[1] = add_coeffs[1] + add_factor;
-        add_coeffs[2] = add_coeffs[2] - add_factor;
-        
-        if (write_augmented.size()) {
-          LOG(INFO) << "Augmenting. lmult_pow: " << lmult_pow_coeff << ", lmult_mult: " << lmult_mult_coeff << ", lmult_add: " << lmult_add_coeff;      
-        }
-      }
-      
-      bool do_rotate = aug.has_rotate();
-      bool do_translate = aug.has_translate();
-      bool do_mirror = aug.has_mirror();
-      bool do_zoom = aug.has_zoom();
-      
-      if (do_rotate)
-        do_rotate = (fabs(angle) >1e-2);
-      if (do_translate)
-        do_translate = ( fabs(dx) > 1e-2 || fabs(dy) > 1e-2) ;
-      if (do_mirror)
-        do_mirror = mirror;
-      if (do_zoom)
-        do_zoom = (fabs(zoom_coeff - 1.) >1e-2);
-      
-      do_spatial_transform = (do_rotate || do_translate || do_mirror || do_zoom);
-      
-      bool do_pow [3] = {false, false, false};
-      bool do_mult [3] = {false, false, false};
-      bool do_add [3] = {false, false, false};
-      bool do_lmult_pow = aug.has_lmult_pow();
-      bool do_lmult_add = aug.has_lmult_add();
-      bool do_lmult_mult = aug.has_lmult_mult();;
-      
-      do_chromatic_transform = false;
-      
-      for (c=0; c<3; c++) {
-        if (((c==1 || c==2) && (aug.has_sat_pow() || aug.has_col_pow())) || (c==0 && aug.has_ladd_pow()))
-          do_pow[c] = true;
-        if (((c==1 || c==2) && (aug.has_sat_add() || aug.has_col_add())) || (c==0 && aug.has_ladd_add()))
-          do_add[c] = true;
-        if (((c==1 || c==2) && (aug.has_sat_mult() || aug.has_col_mult())) || (c==0 && aug.has_ladd_mult()))
-          do_mult[c] = true;
-        if (do_pow[c])
-          do_pow[c] = (fabs(pow_coeffs[c] - 1.) > 1e-2);
-        if (do_add[c])
-          do_add[c] = (fabs(add_coeffs[c]) > 1e-2);
-        if (do_mult[c])
-          do_mult[c] = (fabs(mult_coeffs[c] - 1.) > 1e-2);
-        do_chromatic_transform = (do_chromatic_transform || do_pow[c] || do_add[c] || do_mult[c]);
-      }
-      if (do_lmult_pow)
-        do_lmult_pow = (fabs(lmult_pow_coeff - 1.) > 1e-2);
-      if (do_lmult_add)
-        do_lmult_add = (fabs(lmult_add_coeff) > 1e-2);
-      if (do_lmult_mult)
-        do_lmult_mult = (fabs(lmult_mult_coeff - 1.) > 1e-2);
-      do_chromatic_transform = (do_chromatic_transform || do_lmult_pow || do_lmult_add || do_lmult_mult);
-      
-  //     LOG(INFO) << "item_id " << item_id << " do_translate " << do_translate << " do_rotate " << do_rotate << " do_zoom " << do_zoom;
-  //     LOG(INFO) << "angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
-      // actually apply the transformation
-      if (do_spatial_transform) { 
-  //       LOG(INFO) << " >>> do spatial transform " << item_id;
-        int i00,i01,i10,i11;
-        for (x = 0; x < crop_size; x++) {
-          for (y = 0; y < crop_size; y++) {
-            // move the origin and mirror
-            if (mirror) {
-              x1 =  static_cast<Dtype>(x) - .5 * static_cast<Dtype>(crop_size);
-              y1 = -static_cast<Dtype>(y) + .5 * static_cast<Dtype>(crop_size);            
-            } 
-            else {
-              x1 = static_cast<Dtype>(x) - .5 * static_cast<Dtype>(crop_size);
-              y1 = static_cast<Dtype>(y) - .5 * static_cast<Dtype>(crop_size);
-            }
-            // rotate
-            if (do_rotate) {
-              x2 =  cos(angle) * x1 - sin(angle) * y1;
-              y2 =  sin(angle) * x1 + cos(angle) * y1;
-            }
-            else {
-              x2 = x1;
-              y2 = y1;
-            }
-            // translate
-            if (do_translate) {
-              x2 = x2 + dx * static_cast<Dtype>(crop_size);
-              y2 = y2 + dy * static_cast<Dtype>(crop_size);
-            }
-            // zoom
-            if (do_zoom) {
-              x2 = x2 / zoom_coeff;
-              y2 = y2 / zoom_coeff;
-            }
-            // move the origin back
-            x2 = x2 + .5 * static_cast<Dtype>(width);
-            y2 = y2 + .5 * static_cast<Dtype>(height);
-            
-
-            for (c = 0; c < channels; c++) {
-              top_idx = ((item_id*channels + c)*crop_size + x)*crop_size + y;
-              if (floor(x2) < 0. || floor(x2) > static_cast<Dtype>(width - 2) || floor(y2) < 0. || floor(y2) > static_cast<Dtype>(height - 2))
-                top_data[top_idx] = 0.;
-              else {
-                if (do_rotate || do_zoom) {
-                  i00 = static_cast<int>((c * width +  floor(x2)) *height + floor(y2));
-                  i01 = i00 + 1;
-                  i10 = i00 + height;
-                  i11 = i00 + height + 1;
-                                    
-                  top_data[top_idx] = static_cast<Dtype>(static_cast<uint8_t>(data[i00])) * ((floor(x2)+1)  - x2) * ((floor(y2)+1)  - y2) +
-                                      static_cast<Dtype>(static_cast<uint8_t>(data[i01])) * ((floor(x2)+1)  - x2) * (y2 - floor(y2))      +
-                                      static_cast<Dtype>(static_cast<uint8_t>(data[i10])) * (x2 - floor(x2))      * ((floor(y2)+1)  - y2) +
-                                      static_cast<Dtype>(static_cast<uint8_t>(data[i11])) * (x2 - floor(x2))      * (y2 - floor(y2));                
-                } 
-                else {
-                  i00 = static_cast<int>((c * width +  floor(x2)) *height + floor(y2));              
-                  top_data[top_idx] = static_cast<Dtype>(static_cast<uint8_t>(data[i00]));
-                }
-                top_data[top_idx] = (top_data[top_idx] - mean[i00]) * scale;
-              }         
-              // TODO: return the mean when end debugging
-              //top_data[i] = (top_data[i] - 127.5) * scale;
-            }
-            //mexPrintf(" (%f,%f) ", x2, y2);        
-          }
-        }
-      }
-      else {
-        h_off = (height - crop_size)/2;
-        w_off = (width - crop_size)/2;
-        for (x = 0; x < crop_size; x++) {
-          for (y = 0; y < crop_size; y++) {
-            for (c = 0; c < channels; c++) {
-              top_idx = ((item_id*channels + c)*crop_size + x)*crop_size + y;
-              bottom_idx = (c*width + x + w_off)*height + y + h_off;
-              top_data[top_idx] = static_cast<Dtype>(static_cast<uint8_t>(data[bottom_idx]));
-              top_data[top_idx] = (top_data[top_idx] - mean[bottom_idx]) * scale;
-            }
-          }
-        }
-      }
-      
-      if (do_chromatic_transform) {
-  //       LOG(INFO) << " >>> do chromatic transform " << item_id;
-        Dtype l;
-        Dtype rgb [3];
-        Dtype eig [3];
-        Dtype max_abs_eig[3] = {0., 0., 0.};
-        Dtype max_abs_rgb[3] = {0., 0., 0.};
-        const Dtype eigvec [9] = {0.5579, 0.5859, 0.5878, 0.8021, -0.1989, -0.5631, -0.2130, 0.7856, -0.5809};
-        // compute max abs values of eigs (projections onto color space eigenvectors)
-        for (x=0; x<crop_size; x++) {
-          for (y=0; y<crop_size; y++) {
-            for (c=0; c<channels; c++)
-              rgb[c] = top_data[((item_id*channels + c)*crop_size + x)*crop_size + y];
-            for (c=0; c<channels; c++) {
-              eig[c] = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1] + eigvec[3*c+2] * rgb[2];
-              if (fabs(eig[c]) > max_abs_eig[c])
-                max_abs_eig[c] = fabs(eig[c]);
-              if (fabs(rgb[c]) > max_abs_rgb[c])
-                max_abs_rgb[c] = fabs(rgb[c]);
-            }
-          }
-        }
-        // actually apply the transform
-        for (x=0; x<crop_size; x++) {
-          for (y=0; y<crop_size; y++) {
-            for (c=0; c<channels; c++)
-              rgb[c] = top_data[((item_id*channels + c)*crop_size + x)*crop_size + y];
-            for (c=0; c<channels; c++) {
-              eig[c] = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1] + eigvec[3*c+2] * rgb[2];
-              if ( max_abs_eig[c] > 1e-5 ) {
-                eig[c] = eig[c] / max_abs_eig[c]; 
-                if (do_pow[c])            
-                  eig[c] = static_cast<float>(sgn(eig[c])) * pow(fabs(eig[c]), pow_coeffs[c]);
-                if (do_add[c])
-                  eig[c] = eig[c] + add_coeffs[c];
-                if (do_mult[c])
-                  eig[c] = eig[c] * mult_coeffs[c];
-                eig[c] = eig[c] * max_abs_eig[c]; 
-              }
-            }
-            if (do_lmult_pow)
-              l = pow(fabs(eig[0]), lmult_pow_coeff);
-            else
-              l = fabs(eig[0]);
-            if (do_lmult_add) {
-              l = l + lmult_add_coeff;
-              if (l < 0.)
-                l = 0.;
-            }
-            if (do_lmult_mult)
-              l = l * lmult_mult_coeff;
-            if ((do_lmult_pow || do_lmult_add || do_lmult_mult) && fabs(eig[0]) > 1e-5) {
-              for (c=channels-1; c>=0; c--) {
-                eig[c] = eig[c] / fabs(eig[0]) * l;
-              }
-            }
-            for (c=0; c<channels; c++) {
-              rgb[c] = eigvec[c] * eig[0] + eigvec[3+c] * eig[1] + eigvec[6+c] * eig[2];
-              if (rgb[c] > aug.max_multiplier()*max_abs_rgb[c])
-                rgb[c] = aug.max_multiplier()*max_abs_rgb[c];
-              if (rgb[c] < -aug.max_multiplier()*max_abs_rgb[c])
-                rgb[c] = -aug.max_multiplier()*max_abs_rgb[c];
-              top_data[((item_id*channels + c)*crop_size + x)*crop_size + y] = rgb[c];
-            }
-            
-          }
-        } 
-      }
-    } else {
-      int h_off = (height - crop_size)/2;
-      int w_off = (width - crop_size)/2;
-      for (int c = 0; c < channels; ++c) {
-        for (int h = 0; h < crop_size; ++h) {
-          for (int w = 0; w < crop_size; ++w) {
-            int top_index = ((item_id * channels + c) * crop_size + h)
-                            * crop_size + w;
-            int data_index = (c * height + h + h_off) * width + w + w_off;
-            Dtype datum_element =
-                static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-            top_data[top_index] = (datum_element - mean[data_index]) * scale;
-          }
-        }
-      }
-    }
-
-    if (layer->output_labels_) {
-      top_label[item_id] = datum.label();
-      //if (layer->phase_ == Caffe::TRAIN) {
-      //  LOG(INFO) << datum.label(); 
-      //}
-    }
     // go to the next iter
     switch (layer->layer_param_.data_param().backend()) {
     case DataParameter_DB_LEVELDB:
@@ -568,6 +191,15 @@ void* DataLoadAndAugmentLayerPrefetch(void* layer_pointer) {
       LOG(FATAL) << "Unknown database backend";
     }
   }
+  // ...then parse and augment them in parallel, each into its own slot and
+  // from its own random stream, so that the batch does not depend on the
+  // number of threads.
+  const int threads = caffe_cpu_threads(
+      layer->layer_param_.data_param().augment_threads(), batch_size);
+#pragma omp parallel for num_threads(threads)
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    layer->TransformItem(values[item_id], item_id, top_data, top_label);
+  }
   
   if (write_augmented.size()) {  
     std::ofstream out_file (write_augmented.data(), std::ios::out | std::ios::binary);
@@ -592,6 +224,318 @@ void* DataLoadAndAugmentLayerPrefetch(void* layer_pointer) {
   return static_cast<void*>(NULL);
 }
 
+template <typename Dtype>
+void DataLoadAndAugmentLayer<Dtype>::TransformItem(const string& value,
+    const int item_id, Dtype* top_data, Dtype* top_label) {
+  Datum datum;
+  datum.ParseFromString(value);
+  const Dtype scale = this->layer_param_.data_param().scale();
+  
+  // datum scales
+  const int channels = datum_channels_;
+  const int height = datum_height_;
+  const int width = datum_width_;
+  const Dtype* mean = data_mean_.cpu_data();   
+  const int crop_size = cropped_width_; 
+  const string& write_augmented =
+      this->layer_param_.augmentation_param().write_augmented();
+  
+  const string& data = datum.data();
+  if (this->layer_param_.has_augmentation_param()) {
+    AugmentationParameter aug = this->layer_param_.augmentation_param();
+    CounterRNG rng(rng_seed_, prefetch_iter_, item_id);
+    int x, y, c, top_idx, bottom_idx, h_off, w_off;
+    Dtype affine[6];
+    
+    bool do_spatial_transform, do_chromatic_transform;
+    
+    //   We only do transformations during training.
+    if (phase_ != Caffe::TRAIN) {
+      do_spatial_transform   = false;
+      do_chromatic_transform = false;
+    }
+    
+    Dtype angle = 0.;
+    Dtype zoom_coeff = 1.;
+    Dtype dx = 0.;
+    Dtype dy = 0.;
+    bool mirror = false;  
+    
+    Dtype lmult_pow_coeff = 1.;
+    Dtype lmult_mult_coeff = 1.;
+    Dtype lmult_add_coeff = 0.;  
+    Dtype pow_coeffs [3] = {1., 1., 1.};
+    Dtype mult_coeffs [3] = {1., 1., 1.};
+    Dtype add_coeffs [3] = {0., 0., 0.};  
+    Dtype pow_factor = 1.;
+    Dtype mult_factor = 1.;
+    Dtype add_factor = 1.;
+    
+    //LOG(INFO) <<  " === thread " << omp_get_thread_num() << "/" << omp_get_num_threads() << " === ";
+    
+    do_spatial_transform   = (aug.has_mirror()    || aug.has_translate()  || aug.has_rotate()    || aug.has_zoom());
+    do_chromatic_transform = (aug.has_lmult_pow() || aug.has_lmult_mult() || aug.has_lmult_add() || 
+                                aug.has_sat_pow()   || aug.has_sat_mult()   || aug.has_sat_add()   ||
+                                aug.has_col_pow()   || aug.has_col_mult()   || aug.has_col_add()   ||
+                                aug.has_ladd_pow()  || aug.has_ladd_mult()  || aug.has_ladd_add());
+    
+    // sample the parameters of the transoformations  
+    if (do_spatial_transform) {
+      int counter = 0;
+      int max_num_tries = 20;    
+      int good_params = 0;
+      
+      // try to sample parameters for which transformed image doesn't go outside the borders of the original one
+      // in order to do check this, just apply the transformations to 4 corners
+      while (good_params < 4 && counter < max_num_tries) {
+        if (aug.has_rotate())
+          angle = caffe_rng_generate<float>(aug.rotate(), &rng);
+        if (aug.has_zoom())
+          zoom_coeff = caffe_rng_generate<float>(aug.zoom(), &rng);
+        if (aug.has_translate()) {
+          dx = caffe_rng_generate<float>(aug.translate(), &rng);
+          dy = caffe_rng_generate<float>(aug.translate(), &rng);
+        }
+        if (aug.has_mirror())
+          mirror = caffe_rng_generate<bool>(aug.mirror(), &rng);
+  
+        //LOG(INFO) << "angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
+        
+        warp_affine_matrix<Dtype>(mirror, angle, dx, dy, zoom_coeff,
+            zoom_coeff, crop_size, crop_size, width, height, affine);
+        good_params = warp_inside(affine, crop_size, crop_size, width,
+            height) ? 4 : 0;
+        counter++;
+      }
+      if (counter >= max_num_tries) {
+        angle=0.;
+        zoom_coeff=1.;
+        dx=0.;
+        dy=0.;
+        mirror = false;
+      }
+      
+      if (write_augmented.size()) { 
+        if (do_spatial_transform)
+          LOG(INFO) << " Augmenting. angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
+        else
+          LOG(INFO) << "Couldn't find appropriate spatial augmentation parameters";
+      }
+    } 
+    
+    if (do_chromatic_transform) {
+      if (aug.has_lmult_pow())
+        lmult_pow_coeff = caffe_rng_generate<float>(aug.lmult_pow(), &rng);
+      if (aug.has_lmult_mult())
+        lmult_mult_coeff = caffe_rng_generate<float>(aug.lmult_mult(), &rng);
+      if (aug.has_lmult_add())
+        lmult_add_coeff = caffe_rng_generate<float>(aug.lmult_add(), &rng);
+      
+      if (aug.has_ladd_pow())
+        pow_coeffs[0] = caffe_rng_generate<float>(aug.ladd_pow(), &rng);
+      if (aug.has_ladd_mult())
+        mult_coeffs[0] = caffe_rng_generate<float>(aug.ladd_mult(), &rng);
+      if (aug.has_ladd_add())
+        add_coeffs[0] = caffe_rng_generate<float>(aug.ladd_add(), &rng);
+      
+      for (c=1; c<3; c++) {
+        if (aug.has_sat_pow())
+          pow_coeffs[c] = caffe_rng_generate<float>(aug.sat_pow(), &rng);
+        if (aug.has_sat_mult())
+          mult_coeffs[c] = caffe_rng_generate<float>(aug.sat_mult(), &rng);
+        if (aug.has_sat_add())
+          add_coeffs[c] = caffe_rng_generate<float>(aug.sat_add(), &rng);
+      }
+      
+      if (aug.has_col_pow())
+        pow_factor = caffe_rng_generate<float>(aug.col_pow(), &rng);
+      if (aug.has_col_mult())
+        mult_factor = caffe_rng_generate<float>(aug.col_mult(), &rng);
+      if (aug.has_col_add())
+        add_factor = caffe_rng_generate<float>(aug.col_add(), &rng);
+      
+      pow_coeffs[1] = pow_coeffs[1] * pow_factor;
+      pow_coeffs[2] = pow_coeffs[2] / pow_factor;
+      mult_coeffs[1] = mult_coeffs[1] * mult_factor;
+      mult_coeffs[2] = mult_coeffs[2] / mult_factor;
+      add_coeffs[1] = add_coeffs[1] + add_factor;
+      add_coeffs[2] = add_coeffs[2] - add_factor;
+      
+      if (write_augmented.size()) {
+        LOG(INFO) << "Augmenting. lmult_pow: " << lmult_pow_coeff << ", lmult_mult: " << lmult_mult_coeff << ", lmult_add: " << lmult_add_coeff;      
+      }
+    }
+    
+    bool do_rotate = aug.has_rotate();
+    bool do_translate = aug.has_translate();
+    bool do_mirror = aug.has_mirror();
+    bool do_zoom = aug.has_zoom();
+    
+    if (do_rotate)
+      do_rotate = (fabs(angle) >1e-2);
+    if (do_translate)
+      do_translate = ( fabs(dx) > 1e-2 || fabs(dy) > 1e-2) ;
+    if (do_mirror)
+      do_mirror = mirror;
+    if (do_zoom)
+      do_zoom = (fabs(zoom_coeff - 1.) >1e-2);
+    
+    do_spatial_transform = (do_rotate || do_translate || do_mirror || do_zoom);
+    
+    bool do_pow [3] = {false, false, false};
+    bool do_mult [3] = {false, false, false};
+    bool do_add [3] = {false, false, false};
+    bool do_lmult_pow = aug.has_lmult_pow();
+    bool do_lmult_add = aug.has_lmult_add();
+    bool do_lmult_mult = aug.has_lmult_mult();;
+    
+    do_chromatic_transform = false;
+    
+    for (c=0; c<3; c++) {
+      if (((c==1 || c==2) && (aug.has_sat_pow() || aug.has_col_pow())) || (c==0 && aug.has_ladd_pow()))
+        do_pow[c] = true;
+      if (((c==1 || c==2) && (aug.has_sat_add() || aug.has_col_add())) || (c==0 && aug.has_ladd_add()))
+        do_add[c] = true;
+      if (((c==1 || c==2) && (aug.has_sat_mult() || aug.has_col_mult())) || (c==0 && aug.has_ladd_mult()))
+        do_mult[c] = true;
+      if (do_pow[c])
+        do_pow[c] = (fabs(pow_coeffs[c] - 1.) > 1e-2);
+      if (do_add[c])
+        do_add[c] = (fabs(add_coeffs[c]) > 1e-2);
+      if (do_mult[c])
+        do_mult[c] = (fabs(mult_coeffs[c] - 1.) > 1e-2);
+      do_chromatic_transform = (do_chromatic_transform || do_pow[c] || do_add[c] || do_mult[c]);
+    }
+    if (do_lmult_pow)
+      do_lmult_pow = (fabs(lmult_pow_coeff - 1.) > 1e-2);
+    if (do_lmult_add)
+      do_lmult_add = (fabs(lmult_add_coeff) > 1e-2);
+    if (do_lmult_mult)
+      do_lmult_mult = (fabs(lmult_mult_coeff - 1.) > 1e-2);
+    do_chromatic_transform = (do_chromatic_transform || do_lmult_pow || do_lmult_add || do_lmult_mult);
+    
+//     LOG(INFO) << "item_id " << item_id << " do_translate " << do_translate << " do_rotate " << do_rotate << " do_zoom " << do_zoom;
+//     LOG(INFO) << "angle: " << angle << ", zoom: " << zoom_coeff << ", dx: " << dx << ", dy: " << dy << ", mirror: " << mirror;
+    // actually apply the transformation
+    if (do_spatial_transform) {
+      // parameters below the thresholds above are not applied
+      warp_affine_matrix<Dtype>(mirror, do_rotate ? angle : 0,
+          do_translate ? dx : 0, do_translate ? dy : 0,
+          do_zoom ? zoom_coeff : 1, do_zoom ? zoom_coeff : 1, crop_size,
+          crop_size, width, height, affine);
+      warp_bilinear_cpu(reinterpret_cast<const uint8_t*>(data.data()),
+          channels, width, height, affine, do_rotate || do_zoom, mean, scale,
+          crop_size, crop_size,
+          top_data + item_id * channels * crop_size * crop_size);
+    }
+    else {
+      h_off = (height - crop_size)/2;
+      w_off = (width - crop_size)/2;
+      for (c = 0; c < channels; c++) {
+        for (x = 0; x < crop_size; x++) {
+          for (y = 0; y < crop_size; y++) {
+            top_idx = ((item_id*channels + c)*crop_size + x)*crop_size + y;
+            bottom_idx = (c*width + x + w_off)*height + y + h_off;
+            top_data[top_idx] = static_cast<Dtype>(static_cast<uint8_t>(data[bottom_idx]));
+            top_data[top_idx] = (top_data[top_idx] - mean[bottom_idx]) * scale;
+          }
+        }
+      }
+    }
+    
+    if (do_chromatic_transform) {
+//       LOG(INFO) << " >>> do chromatic transform " << item_id;
+      Dtype l;
+      Dtype rgb [3];
+      Dtype eig [3];
+      Dtype max_abs_eig[3] = {0., 0., 0.};
+      Dtype max_abs_rgb[3] = {0., 0., 0.};
+      const Dtype eigvec [9] = {0.5579, 0.5859, 0.5878, 0.8021, -0.1989, -0.5631, -0.2130, 0.7856, -0.5809};
+      // compute max abs values of eigs (projections onto color space eigenvectors)
+      for (x=0; x<crop_size; x++) {
+        for (y=0; y<crop_size; y++) {
+          for (c=0; c<channels; c++)
+            rgb[c] = top_data[((item_id*channels + c)*crop_size + x)*crop_size + y];
+          for (c=0; c<channels; c++) {
+            eig[c] = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1] + eigvec[3*c+2] * rgb[2];
+            if (fabs(eig[c]) > max_abs_eig[c])
+              max_abs_eig[c] = fabs(eig[c]);
+            if (fabs(rgb[c]) > max_abs_rgb[c])
+              max_abs_rgb[c] = fabs(rgb[c]);
+          }
+        }
+      }
+      // actually apply the transform
+      for (x=0; x<crop_size; x++) {
+        for (y=0; y<crop_size; y++) {
+          for (c=0; c<channels; c++)
+            rgb[c] = top_data[((item_id*channels + c)*crop_size + x)*crop_size + y];
+          for (c=0; c<channels; c++) {
+            eig[c] = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1] + eigvec[3*c+2] * rgb[2];
+            if ( max_abs_eig[c] > 1e-5 ) {
+              eig[c] = eig[c] / max_abs_eig[c]; 
+              if (do_pow[c])            
+                eig[c] = static_cast<float>(sgn(eig[c])) * pow(fabs(eig[c]), pow_coeffs[c]);
+              if (do_add[c])
+                eig[c] = eig[c] + add_coeffs[c];
+              if (do_mult[c])
+                eig[c] = eig[c] * mult_coeffs[c];
+              eig[c] = eig[c] * max_abs_eig[c]; 
+            }
+          }
+          if (do_lmult_pow)
+            l = pow(fabs(eig[0]), lmult_pow_coeff);
+          else
+            l = fabs(eig[0]);
+          if (do_lmult_add) {
+            l = l + lmult_add_coeff;
+            if (l < 0.)
+              l = 0.;
+          }
+          if (do_lmult_mult)
+            l = l * lmult_mult_coeff;
+          if ((do_lmult_pow || do_lmult_add || do_lmult_mult) && fabs(eig[0]) > 1e-5) {
+            for (c=channels-1; c>=0; c--) {
+              eig[c] = eig[c] / fabs(eig[0]) * l;
+            }
+          }
+          for (c=0; c<channels; c++) {
+            rgb[c] = eigvec[c] * eig[0] + eigvec[3+c] * eig[1] + eigvec[6+c] * eig[2];
+            if (rgb[c] > aug.max_multiplier()*max_abs_rgb[c])
+              rgb[c] = aug.max_multiplier()*max_abs_rgb[c];
+            if (rgb[c] < -aug.max_multiplier()*max_abs_rgb[c])
+              rgb[c] = -aug.max_multiplier()*max_abs_rgb[c];
+            top_data[((item_id*channels + c)*crop_size + x)*crop_size + y] = rgb[c];
+          }
+          
+        }
+      } 
+    }
+  } else {
+    int h_off = (height - crop_size)/2;
+    int w_off = (width - crop_size)/2;
+    for (int c = 0; c < channels; ++c) {
+      for (int h = 0; h < crop_size; ++h) {
+        for (int w = 0; w < crop_size; ++w) {
+          int top_index = ((item_id * channels + c) * crop_size + h)
+                          * crop_size + w;
+          int data_index = (c * height + h + h_off) * width + w + w_off;
+          Dtype datum_element =
+              static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
+          top_data[top_index] = (datum_element - mean[data_index]) * scale;
+        }
+      }
+    }
+  }
+
+  if (output_labels_) {
+    top_label[item_id] = datum.label();
+    //if (phase_ == Caffe::TRAIN) {
+    //  LOG(INFO) << datum.label(); 
+    //}
+  }
+}
+
 template <typename Dtype>
 DataLoadAndAugmentLayer<Dtype>::~DataLoadAndAugmentLayer<Dtype>() {
   JoinPrefetchThread();
@@ -614,6 +558,8 @@ template <typename Dtype>
 void DataLoadAndAugmentLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   Layer<Dtype>::SetUp(bottom, top);
+  rng_seed_ = caffe_rng_rand();
+  prefetch_iter_ = 0;
   if (top->size() == 1) {
     output_labels_ = false;
   } else {
@@ -769,6 +715,7 @@ void DataLoadAndAugmentLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void DataLoadAndAugmentLayer<Dtype>::CreatePrefetchThread() {
   phase_ = Caffe::phase();
+  ++prefetch_iter_;
   const bool prefetch_needs_rand = (phase_ == Caffe::TRAIN);
   if (prefetch_needs_rand) {
     const unsigned int prefetch_rng_seed = caffe_rng_rand();
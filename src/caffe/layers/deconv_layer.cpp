@@ -5,6 +5,8 @@
 #include <iostream>
 #include "caffe/layer.hpp"
 #include "caffe/vision_layers.hpp"
+#include "caffe/util/activation.hpp"
+#include "caffe/util/fft_conv.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -29,6 +31,10 @@ void DeConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   //channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
+  // A 1x1 deconvolution without padding and striding writes its gemm result
+  // straight into the top, so the CPU code skips col2im and im2col.
+  is_1x1_ = kernel_size_ == 1 && stride_ == 1 && pad_ == 0 &&
+      height_out_ == height_ && width_out_ == width_;
   //num_output_ = this->layer_param_.deconvolution_param().num_output();
   num_output_ = this->layer_param_.deconvolution_param().output_channels();
   int inverse_num_out = bottom[0]->channels();
@@ -39,6 +45,28 @@ void DeConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   //std::cout << "nout "<< num_output_ << " " << height_out_ << " " << width_out_ << std::endl;
   col_buffer_.Reshape(
       1, channels_ * kernel_size_ * kernel_size_, height_, width_);
+  num_threads_ = this->layer_param_.deconvolution_param().num_threads();
+  // each of the threads calls BLAS
+  Caffe::reserve_cpu_threads(num_threads_);
+  const ConvolutionParameter_Engine engine =
+      this->layer_param_.deconvolution_param().engine();
+  const int fft_min_kernel_size =
+      this->layer_param_.deconvolution_param().fft_min_kernel_size();
+  use_fft_ = false;
+  fft_weight_mem_ = NULL;
+  fft_weight_version_ = 0;
+  if (engine == ConvolutionParameter_Engine_FFT ||
+      (engine == ConvolutionParameter_Engine_DEFAULT &&
+       fft_min_kernel_size > 0 && kernel_size_ >= fft_min_kernel_size)) {
+    if (stride_ == 1 && group_ == 1) {
+      use_fft_ = true;
+      fft_size_ = fft_conv_size(kernel_size_, height_, width_);
+      fft_size_backward_ = fft_conv_size(kernel_size_, height_out_,
+          width_out_);
+    } else if (engine == ConvolutionParameter_Engine_FFT) {
+      LOG(INFO) << "FFT needs stride 1 and no groups; falling back to im2col";
+    }
+  }
   // Set the parameters
   CHECK_EQ(inverse_num_out % group_, 0)
       << "Number of output should be multiples of group.";
@@ -88,44 +116,57 @@ void DeConvolutionLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 Dtype DeConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
-
+  if (use_fft_) {
+    return Forward_cpu_fft(bottom, top);
+  }
   //const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   //const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
 
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
-
-  
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int bottom_offset = M_ * N_;
-  for (int n = 0; n < num_; ++n) {
+  // Split the batch across threads, each with its own slice of col_buffer_
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_base = col_buffer_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_data = col_base + col_buffer_.offset(t);
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      Dtype* col = is_1x1_ ? top_data + (*top)[0]->offset(n) : col_data;
       for (int g = 0; g < group_; ++g) {
         caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
           (Dtype)1., weight + weight_offset * g,
           bottom_data + bottom[0]->offset(n) + bottom_offset * g,
-          (Dtype)0., col_data + col_offset * g);
+          (Dtype)0., col + col_offset * g);
       }
       // col2im forward to the top_data
-      col2im_cpu(col_data, channels_, height_out_, width_out_, kernel_size_, pad_,
-                 stride_, top_data + (*top)[0]->offset(n));
+      if (!is_1x1_) {
+        col2im_cpu(col_data, channels_, height_out_, width_out_,
+                   kernel_size_, pad_, stride_,
+                   top_data + (*top)[0]->offset(n));
+      }
       // add bias
       if (bias_term_) {
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-                                N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-                                reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-                                (Dtype)1., top_data + (*top)[0]->offset(n));
+        caffe_cpu_bias_activation(num_output_, N_, bias, true,
+            LayerParameter_LayerType_NONE, Dtype(0),
+            top_data + (*top)[0]->offset(n));
       }
-      // Debugging stuff
-      /*
-      for (int k = 0; k < col_buffer_.count(); ++k) {
-          std::cout << col_buffer_.cpu_data()[k] <<  "  "; 
+      // the bias only covers N_ values per channel, so the fused activation
+      // runs as a separate pass over the image while it is still in cache
+      if (fused_activation_ != LayerParameter_LayerType_NONE) {
+        caffe_cpu_bias_activation(num_output_, height_out_ * width_out_,
+            static_cast<const Dtype*>(NULL), true, fused_activation_,
+            fused_negative_slope_, top_data + (*top)[0]->offset(n));
       }
-      std::cout << std::endl;
-      */
+    }
   }
   
   return Dtype(0.);
@@ -134,17 +175,28 @@ Dtype DeConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void DeConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const bool propagate_down, vector<Blob<Dtype>*>* bottom) {
+  if (use_fft_ && propagate_down) {
+    // parameter gradients by im2col, the bottom gradient by FFT
+    Backward_cpu(top, false, bottom);
+    Backward_cpu_fft(top, bottom);
+    return;
+  }
+  if (fused_activation_ != LayerParameter_LayerType_NONE) {
+    // backward of the fused activation, whose output the top holds
+    caffe_cpu_activation_backward(top[0]->count(), fused_activation_,
+        fused_negative_slope_, top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
   Dtype* bias_diff = NULL;
   if (bias_term_) {
       bias_diff = this->blobs_[1]->mutable_cpu_diff();
-      memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+      if (!this->accumulate_param_diffs_) {
+        memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+      }
       //JTS fixed gradient wrt. bias, not sure about the group stuff ...
       for (int n = 0; n < num_; ++n) {
             caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
@@ -157,24 +209,62 @@ void DeConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int bottom_offset = M_ * N_;
-  memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
-  for (int n = 0; n < num_; ++n) {
-      im2col_cpu(top_diff + top[0]->offset(n), channels_, height_out_,
-                 width_out_, kernel_size_, pad_, stride_, col_diff);
+  const int weight_count = this->blobs_[0]->count();
+  if (!this->accumulate_param_diffs_) {
+    memset(weight_diff, 0, sizeof(Dtype) * weight_count);
+  }
+  // Split the batch across threads; thread 0 accumulates its weight gradient
+  // in place, the others into weight_diff_buffer_, reduced at the end.
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_diff_base = col_buffer_.mutable_cpu_diff();
+  Dtype* weight_diff_partial = NULL;
+  if (threads > 1) {
+    if (weight_diff_buffer_.count() < (threads - 1) * weight_count) {
+      weight_diff_buffer_.Reshape(threads - 1, 1, 1, weight_count);
+    }
+    weight_diff_partial = weight_diff_buffer_.mutable_cpu_data();
+    memset(weight_diff_partial, 0,
+        sizeof(Dtype) * (threads - 1) * weight_count);
+  }
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_buf = col_diff_base + col_buffer_.offset(t);
+    Dtype* thread_weight_diff = (t == 0) ? weight_diff :
+        weight_diff_partial + (t - 1) * weight_count;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      const Dtype* col_diff = col_buf;
+      if (is_1x1_) {
+        col_diff = top_diff + top[0]->offset(n);
+      } else {
+        im2col_cpu(top_diff + top[0]->offset(n), channels_, height_out_,
+                   width_out_, kernel_size_, pad_, stride_, col_buf);
+      }
       // gradient wrt. weights
       for (int g = 0; g < group_; ++g) {
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                                (Dtype)1., bottom_data + (*bottom)[0]->offset(n) + bottom_offset * g,
-                                col_diff + col_offset * g, (Dtype)1.,
-                                weight_diff + weight_offset * g);
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+            (Dtype)1.,
+            bottom_data + (*bottom)[0]->offset(n) + bottom_offset * g,
+            col_diff + col_offset * g, (Dtype)1.,
+            thread_weight_diff + weight_offset * g);
       }
       if (propagate_down) {
-          for (int g = 0; g < group_; ++g) {
-              caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-                                    (Dtype)1., weight + weight_offset * g, col_diff + col_offset * g,
-                                    (Dtype)0., bottom_diff + (*bottom)[0]->offset(n) + bottom_offset * g);
-          }
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+              (Dtype)1., weight + weight_offset * g, col_diff + col_offset * g,
+              (Dtype)0.,
+              bottom_diff + (*bottom)[0]->offset(n) + bottom_offset * g);
+        }
       }
+    }
+  }
+  // reduce the per-thread weight gradients
+  for (int t = 1; t < threads; ++t) {
+    caffe_axpy<Dtype>(weight_count, (Dtype)1.,
+        weight_diff_partial + (t - 1) * weight_count, weight_diff);
   }
   /* debug
   for (int n = 0; n < this->blobs_[0]->count(); ++n) {
@@ -188,6 +278,104 @@ void DeConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   */
 }
 
+template <typename Dtype>
+bool DeConvolutionLayer<Dtype>::FuseActivation(
+      const LayerParameter& activation_param) {
+  return caffe_fusable_activation(activation_param, &fused_activation_,
+      &fused_negative_slope_);
+}
+
+template <typename Dtype>
+void DeConvolutionLayer<Dtype>::FFTTransformWeights() {
+  const SyncedMemory* weight_mem = this->blobs_[0]->data().get();
+  if (weight_mem == fft_weight_mem_ &&
+      weight_mem->version() == fft_weight_version_) {
+    return;
+  }
+  // The forward pass is the transposed convolution of the bottom channels,
+  // the backward pass the correlation of the top diff.
+  const int inverse_num_out = this->blobs_[0]->num();
+  fft_weight_.Reshape(1, 1, 1,
+      fft_conv_kernel_count(channels_, inverse_num_out, fft_size_));
+  fft_weight_backward_.Reshape(1, 1, 1,
+      fft_conv_kernel_count(inverse_num_out, channels_, fft_size_backward_));
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  fft_conv_kernel_transform_cpu(weight, inverse_num_out, channels_,
+      kernel_size_, true, fft_size_, fft_weight_.mutable_cpu_data());
+  fft_conv_kernel_transform_cpu(weight, inverse_num_out, channels_,
+      kernel_size_, false, fft_size_backward_,
+      fft_weight_backward_.mutable_cpu_data());
+  fft_weight_mem_ = weight_mem;
+  fft_weight_version_ = weight_mem->version();
+}
+
+template <typename Dtype>
+Dtype DeConvolutionLayer<Dtype>::Forward_cpu_fft(
+      const vector<Blob<Dtype>*>& bottom, vector<Blob<Dtype>*>* top) {
+  FFTTransformWeights();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = (*top)[0]->mutable_cpu_data();
+  const Dtype* weight = fft_weight_.cpu_data();
+  const int inverse_num_out = bottom[0]->channels();
+  const int buffer_size = fft_conv_buffer_count(inverse_num_out, channels_,
+      width_, kernel_size_, fft_size_);
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (fft_buffer_.count() < threads * buffer_size) {
+    fft_buffer_.Reshape(threads, 1, 1, buffer_size);
+  }
+  Dtype* buffer_base = fft_buffer_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* buffer = buffer_base + t * buffer_size;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      fft_conv_cpu(bottom_data + bottom[0]->offset(n), inverse_num_out,
+          height_, width_, weight, channels_, kernel_size_, fft_size_, pad_,
+          height_out_, width_out_, buffer, top_data + (*top)[0]->offset(n));
+      if (bias_term_) {
+        caffe_cpu_bias_activation(num_output_, N_, bias, true,
+            LayerParameter_LayerType_NONE, Dtype(0),
+            top_data + (*top)[0]->offset(n));
+      }
+      // the bias only covers N_ values per channel, so the fused activation
+      // runs as a separate pass over the image while it is still in cache
+      if (fused_activation_ != LayerParameter_LayerType_NONE) {
+        caffe_cpu_bias_activation(num_output_, height_out_ * width_out_,
+            static_cast<const Dtype*>(NULL), true, fused_activation_,
+            fused_negative_slope_, top_data + (*top)[0]->offset(n));
+      }
+    }
+  }
+  return Dtype(0.);
+}
+
+template <typename Dtype>
+void DeConvolutionLayer<Dtype>::Backward_cpu_fft(
+      const vector<Blob<Dtype>*>& top, vector<Blob<Dtype>*>* bottom) {
+  FFTTransformWeights();
+  const Dtype* top_diff = top[0]->cpu_diff();
+  Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
+  const Dtype* weight = fft_weight_backward_.cpu_data();
+  const int inverse_num_out = (*bottom)[0]->channels();
+  const int buffer_size = fft_conv_buffer_count(channels_, inverse_num_out,
+      width_out_, kernel_size_, fft_size_backward_);
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (fft_buffer_.count() < threads * buffer_size) {
+    fft_buffer_.Reshape(threads, 1, 1, buffer_size);
+  }
+  Dtype* buffer_base = fft_buffer_.mutable_cpu_data();
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* buffer = buffer_base + t * buffer_size;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      fft_conv_cpu(top_diff + top[0]->offset(n), channels_, height_out_,
+          width_out_, weight, inverse_num_out, kernel_size_,
+          fft_size_backward_, kernel_size_ - 1 - pad_, height_, width_,
+          buffer, bottom_diff + (*bottom)[0]->offset(n));
+    }
+  }
+}
+
 INSTANTIATE_CLASS(DeConvolutionLayer);
 
 }  // namespace caffe
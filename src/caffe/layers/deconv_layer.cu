@@ -63,8 +63,10 @@ void DeConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   Dtype* bias_diff = NULL;
   if (bias_term_) {
     bias_diff = this->blobs_[1]->mutable_gpu_diff();
-    CUDA_CHECK(cudaMemset(bias_diff, 0,
-        sizeof(Dtype) * this->blobs_[1]->count()));
+    if (!this->accumulate_param_diffs_) {
+      CUDA_CHECK(cudaMemset(bias_diff, 0,
+          sizeof(Dtype) * this->blobs_[1]->count()));
+    }
     //JTS fixed gradient wrt. bias, not sure about the group stuff ...
     for (int n = 0; n < num_; ++n) {
         caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
@@ -77,8 +79,10 @@ void DeConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int bottom_offset = M_ * N_;
-  CUDA_CHECK(cudaMemset(weight_diff, 0,
-      sizeof(Dtype) * this->blobs_[0]->count()));
+  if (!this->accumulate_param_diffs_) {
+    CUDA_CHECK(cudaMemset(weight_diff, 0,
+        sizeof(Dtype) * this->blobs_[0]->count()));
+  }
   for (int n = 0; n < num_; ++n) {
       im2col_gpu(top_diff + top[0]->offset(n), channels_, height_out_,
                  width_out_, kernel_size_, pad_, stride_, col_diff);
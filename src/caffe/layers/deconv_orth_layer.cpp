@@ -28,6 +28,10 @@ void DeConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   //channels_ = bottom[0]->channels();
   height_ = bottom[0]->height();
   width_ = bottom[0]->width();
+  // A 1x1 deconvolution without padding and striding writes its gemm result
+  // straight into the top, so the CPU code skips col2im and im2col.
+  is_1x1_ = kernel_size_ == 1 && stride_ == 1 && pad_ == 0 &&
+      height_out_ == height_ && width_out_ == width_;
   //num_output_ = this->layer_param_.deconvolution_param().num_output();
   num_output_ = this->layer_param_.deconvolution_param().output_channels();
   int inverse_num_out = bottom[0]->channels();
@@ -38,6 +42,9 @@ void DeConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   //std::cout << "nout "<< num_output_ << " " << height_out_ << " " << width_out_ << std::endl;
   col_buffer_.Reshape(
       1, channels_ * kernel_size_ * kernel_size_, height_, width_);
+  num_threads_ = this->layer_param_.deconvolution_param().num_threads();
+  // each of the threads calls BLAS
+  Caffe::reserve_cpu_threads(num_threads_);
   // Set the parameters
   CHECK_EQ(inverse_num_out % group_, 0)
       << "Number of output should be multiples of group.";
@@ -110,6 +117,15 @@ void DeConvolutionOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void DeConvolutionOrthLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  // keep the iteration count
+  const int iter = iter_;
+  SetUp(bottom, top);
+  iter_ = iter;
+}
+
 
 template <typename Dtype>
 Dtype DeConvolutionOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -121,10 +137,6 @@ Dtype DeConvolutionOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bot
   //const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* top_data = (*top)[0]->mutable_cpu_data();
 
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
-
-  
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int bottom_offset = M_ * N_;
@@ -191,26 +203,40 @@ Dtype DeConvolutionOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bot
   
   // actual forward pass
   
-  for (int n = 0; n < num_; ++n) {
+  // Split the batch across threads, each with its own slice of col_buffer_
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_base = col_buffer_.mutable_cpu_data();
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  const Dtype* bias_multiplier = bias_term_ ?
+      reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()) : NULL;
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_data = col_base + col_buffer_.offset(t);
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      Dtype* col = is_1x1_ ? top_data + (*top)[0]->offset(n) : col_data;
       for (int g = 0; g < group_; ++g) {
         caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, K_, N_, M_,
           (Dtype)1., weight + weight_offset * g,
           bottom_data + bottom[0]->offset(n) + bottom_offset * g,
-          (Dtype)0., col_data + col_offset * g);
-              // add bias
+          (Dtype)0., col + col_offset * g);
       }
-
       // col2im forward to the top_data
-      col2im_cpu(col_data, channels_, height_out_, width_out_, kernel_size_, pad_,
-                 stride_, top_data + (*top)[0]->offset(n));
-
+      if (!is_1x1_) {
+        col2im_cpu(col_data, channels_, height_out_, width_out_,
+                   kernel_size_, pad_, stride_,
+                   top_data + (*top)[0]->offset(n));
+      }
       // add bias
       if (bias_term_) {
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
-                                N_, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
-                                reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
-                                (Dtype)1., top_data + (*top)[0]->offset(n));
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+                              N_, 1, (Dtype)1., bias, bias_multiplier,
+                              (Dtype)1., top_data + (*top)[0]->offset(n));
       }
+    }
   }
   /* Debugging stuff
   for (int n = 0; n < col_buffer_.count(); ++n) {
@@ -229,12 +255,12 @@ void DeConvolutionOrthLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   Dtype* bottom_diff = (*bottom)[0]->mutable_cpu_diff();
-  Dtype* col_data = col_buffer_.mutable_cpu_data();
-  Dtype* col_diff = col_buffer_.mutable_cpu_diff();
   Dtype* bias_diff = NULL;
   if (bias_term_) {
       bias_diff = this->blobs_[1]->mutable_cpu_diff();
-      memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+      if (!this->accumulate_param_diffs_) {
+        memset(bias_diff, 0, sizeof(Dtype) * this->blobs_[1]->count());
+      }
       //JTS fixed gradient wrt. bias, not sure about the group stuff ...
       for (int n = 0; n < num_; ++n) {
             caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, N_,
@@ -249,25 +275,62 @@ void DeConvolutionOrthLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top
   int weight_offset = M_ * K_;
   int col_offset = K_ * N_;
   int bottom_offset = M_ * N_;
-  memset(weight_diff, 0, sizeof(Dtype) * this->blobs_[0]->count());
-  for (int n = 0; n < num_; ++n) {
-      im2col_cpu(top_diff + top[0]->offset(n), channels_, height_out_,
-                 width_out_, kernel_size_, pad_, stride_, col_diff);
+  const int weight_count = this->blobs_[0]->count();
+  if (!this->accumulate_param_diffs_) {
+    memset(weight_diff, 0, sizeof(Dtype) * weight_count);
+  }
+  // Split the batch across threads; thread 0 accumulates its weight gradient
+  // in place, the others into weight_diff_buffer_, reduced at the end.
+  const int threads = caffe_cpu_threads(num_threads_, num_);
+  if (col_buffer_.num() < threads) {
+    col_buffer_.Reshape(threads, col_buffer_.channels(),
+        col_buffer_.height(), col_buffer_.width());
+  }
+  Dtype* col_diff_base = col_buffer_.mutable_cpu_diff();
+  Dtype* weight_diff_partial = NULL;
+  if (threads > 1) {
+    if (weight_diff_buffer_.count() < (threads - 1) * weight_count) {
+      weight_diff_buffer_.Reshape(threads - 1, 1, 1, weight_count);
+    }
+    weight_diff_partial = weight_diff_buffer_.mutable_cpu_data();
+    memset(weight_diff_partial, 0,
+        sizeof(Dtype) * (threads - 1) * weight_count);
+  }
+#pragma omp parallel for num_threads(threads)
+  for (int t = 0; t < threads; ++t) {
+    Dtype* col_buf = col_diff_base + col_buffer_.offset(t);
+    Dtype* thread_weight_diff = (t == 0) ? weight_diff :
+        weight_diff_partial + (t - 1) * weight_count;
+    for (int n = num_ * t / threads; n < num_ * (t + 1) / threads; ++n) {
+      const Dtype* col_diff = col_buf;
+      if (is_1x1_) {
+        col_diff = top_diff + top[0]->offset(n);
+      } else {
+        im2col_cpu(top_diff + top[0]->offset(n), channels_, height_out_,
+                   width_out_, kernel_size_, pad_, stride_, col_buf);
+      }
       // gradient wrt. weights
       for (int g = 0; g < group_; ++g) {
-          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
-                                (Dtype)1., bottom_data + (*bottom)[0]->offset(n) + bottom_offset * g,
-                                col_diff + col_offset * g, (Dtype)1.,
-                                weight_diff + weight_offset * g);         
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, K_, N_,
+            (Dtype)1.,
+            bottom_data + (*bottom)[0]->offset(n) + bottom_offset * g,
+            col_diff + col_offset * g, (Dtype)1.,
+            thread_weight_diff + weight_offset * g);
       }
-      
       if (propagate_down) {
-          for (int g = 0; g < group_; ++g) {
-              caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
-                                    (Dtype)1., weight + weight_offset * g, col_diff + col_offset * g,
-                                    (Dtype)0., bottom_diff + (*bottom)[0]->offset(n) + bottom_offset * g);
-          }
+        for (int g = 0; g < group_; ++g) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, K_,
+              (Dtype)1., weight + weight_offset * g, col_diff + col_offset * g,
+              (Dtype)0.,
+              bottom_diff + (*bottom)[0]->offset(n) + bottom_offset * g);
+        }
       }
+    }
+  }
+  // reduce the per-thread weight gradients
+  for (int t = 1; t < threads; ++t) {
+    caffe_axpy<Dtype>(weight_count, (Dtype)1.,
+        weight_diff_partial + (t - 1) * weight_count, weight_diff);
   }
   /* debug
   for (int n = 0; n < this->blobs_[0]->count(); ++n) {
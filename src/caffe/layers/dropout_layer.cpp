@@ -6,6 +6,7 @@
 
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/vision_layers.hpp"
@@ -24,6 +25,7 @@ void DropoutLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   DCHECK(threshold_ < 1.);
   scale_ = 1. / (1. - threshold_);
   uint_thres_ = static_cast<unsigned int>(UINT_MAX * threshold_);
+  rng_seed_ = caffe_rng_rand();
 }
 
 template <typename Dtype>
@@ -34,10 +36,20 @@ Dtype DropoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   unsigned int* mask = rand_vec_->mutable_cpu_data();
   const int count = bottom[0]->count();
   if (Caffe::phase() == Caffe::TRAIN) {
-    // Create random numbers
-    caffe_rng_bernoulli(count, 1. - threshold_, mask);
-    for (int i = 0; i < count; ++i) {
-      top_data[i] = bottom_data[i] * mask[i] * scale_;
+    // Create random numbers, from a stream per item so that the mask does
+    // not depend on the number of threads
+    const int num = bottom[0]->num();
+    const int dim = count / num;
+    const Dtype keep = 1. - threshold_;
+    const int iter = rng_iter_++;
+    const int threads = caffe_cpu_threads(0, num);
+#pragma omp parallel for num_threads(threads)
+    for (int n = 0; n < num; ++n) {
+      CounterRNG rng(rng_seed_, iter, n);
+      for (int i = n * dim; i < (n + 1) * dim; ++i) {
+        mask[i] = rng.bernoulli(keep);
+        top_data[i] = bottom_data[i] * mask[i] * scale_;
+      }
     }
   } else {
     caffe_copy(bottom[0]->count(), bottom_data, top_data);
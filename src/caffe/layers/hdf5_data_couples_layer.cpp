@@ -7,6 +7,7 @@ TODO:
   :: don't forget to update hdf5_daa_layer.cu accordingly
 - add ability to shuffle filenames if flag is set
 */
+#include <pthread.h>
 #include <stdint.h>
 #include <string>
 #include <vector>
@@ -34,8 +35,10 @@ void HDF5DataCouplesLayer<Dtype>::LoadHDF5FileData(const char* filename,
   Blob<Dtype>* data_blob, Blob<Dtype>* label_blob) {
 
   LOG(INFO) << "Loading HDF5 file " << filename;
+  pthread_mutex_lock(hdf5_mutex());
   hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
   if (file_id < 0) {
+    pthread_mutex_unlock(hdf5_mutex());
     LOG(ERROR) << "Failed opening HDF5 file" << filename;
     return;
   }
@@ -57,6 +60,7 @@ void HDF5DataCouplesLayer<Dtype>::LoadHDF5FileData(const char* filename,
       << label_blob->height() << "x" << label_blob->width();
 
   herr_t status = H5Fclose(file_id);
+  pthread_mutex_unlock(hdf5_mutex());
   CHECK_EQ(data_blob->num(), label_blob->num());
   LOG(INFO) << "Successully loaded " << data_blob->num() << " rows";
 }
@@ -68,7 +72,6 @@ void HDF5DataCouplesLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_EQ(top->size(), 3) << "HDF5DataCouplesLayer takes three blobs as output.";
 
   data_in_memory_ = this->layer_param_.hdf5_data_param().data_in_memory();
-  CHECK(data_in_memory_) << "Currently only works with data_in_memory=true";
   
   match_ratio_ = static_cast<Dtype>(this->layer_param_.couples_param().match_ratio());
 
@@ -76,19 +79,35 @@ void HDF5DataCouplesLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading data from " << source;
 
+  delete data_blob_;
+  delete label_blob_;
   data_blob_ = new Blob<Dtype>();
   label_blob_ = new Blob<Dtype>();
-  LoadHDF5FileData(source.c_str(), data_blob_, label_blob_);
-  
-  in_data_num_ = data_blob_->num();
+  data_reader_.reset();
+  int channels, height, width;
+  if (data_in_memory_) {
+    LoadHDF5FileData(source.c_str(), data_blob_, label_blob_);
+    in_data_num_ = data_blob_->num();
+    channels = data_blob_->channels();
+    height = data_blob_->height();
+    width = data_blob_->width();
+  } else {
+    // the pairs are random rows: one chunk per window and no read-ahead
+    const size_t capacity = static_cast<size_t>(
+        this->layer_param_.hdf5_data_param().cache_mb()) << 20;
+    data_reader_.reset(new HDF5RowReader<Dtype>(source, "data", 2, 4, 1,
+        capacity, false));
+    in_data_num_ = data_reader_->num();
+    channels = data_reader_->channels();
+    height = data_reader_->height();
+    width = data_reader_->width();
+  }
   scale_ = this->layer_param_.couples_param().scale();
  
   // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  (*top)[0]->Reshape(batch_size, data_blob_->channels(),
-                     data_blob_->width(), data_blob_->height());
-  (*top)[1]->Reshape(batch_size, data_blob_->channels(),
-                     data_blob_->width(), data_blob_->height());
+  (*top)[0]->Reshape(batch_size, channels, width, height);
+  (*top)[1]->Reshape(batch_size, channels, width, height);
   (*top)[2]->Reshape(batch_size, 1, 1, 1);
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
@@ -112,8 +131,7 @@ Dtype HDF5DataCouplesLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& botto
   Dtype* top_data1 = (*top)[0]->mutable_cpu_data();
   Dtype* top_data2 = (*top)[1]->mutable_cpu_data();
   Dtype* top_label = (*top)[2]->mutable_cpu_data();
-  const Dtype* in_data = data_blob_->cpu_data();
-  const Dtype* in_label = label_blob_->cpu_data();
+  const Dtype* in_data = data_in_memory_ ? data_blob_->cpu_data() : NULL;
   
   caffe_rng_bernoulli(batch_size, match_ratio_, top_label);
   
@@ -129,8 +147,13 @@ Dtype HDF5DataCouplesLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& botto
         n2 = caffe_rng_rand() % in_data_num_;
       } while (n2 == n1);
     }
-    memcpy(&top_data1[i * data_dim], &in_data[n1 * data_dim], sizeof(Dtype) * data_dim);
-    memcpy(&top_data2[i * data_dim], &in_data[n2 * data_dim], sizeof(Dtype) * data_dim);
+    if (data_in_memory_) {
+      memcpy(&top_data1[i * data_dim], &in_data[n1 * data_dim], sizeof(Dtype) * data_dim);
+      memcpy(&top_data2[i * data_dim], &in_data[n2 * data_dim], sizeof(Dtype) * data_dim);
+    } else {
+      data_reader_->ReadRow(n1, &top_data1[i * data_dim]);
+      data_reader_->ReadRow(n2, &top_data2[i * data_dim]);
+    }
 //     LOG(INFO) << "i=" << i << ", n1=" << n1 << ", n2=" << n2 << ", label=" << top_label[i];
   }
   
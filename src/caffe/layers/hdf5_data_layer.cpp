@@ -1,13 +1,14 @@
 // Copyright 2014 BVLC and contributors.
 /*
 TODO:
-- load file in a separate thread ("prefetch")
 - can be smarter about the memcpy call instead of doing it row-by-row
   :: use util functions caffe_copy, and Blob->offset()
   :: don't forget to update hdf5_daa_layer.cu accordingly
 - add ability to shuffle filenames if flag is set
 */
+#include <pthread.h>
 #include <stdint.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <fstream>  // NOLINT(readability/streams)
@@ -23,21 +24,95 @@ namespace caffe {
 
 template <typename Dtype>
 HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
-  for (int i = 0; i < num_files_; ++i)
+  if (prefetching_) {
+    JoinPrefetchThread();
+  }
+  for (int i = 0; i < data_blobs_.size(); ++i)
   {
     delete data_blobs_[i];
     delete label_blobs_[i];
   }
 }
 
+template <typename Dtype>
+void* HDF5DataLayerPrefetch(void* layer_pointer) {
+  CHECK(layer_pointer);
+  HDF5DataLayer<Dtype>* layer =
+      static_cast<HDF5DataLayer<Dtype>*>(layer_pointer);
+  const int depth = layer->prefetch_data_.size();
+  while (true) {
+    pthread_mutex_lock(&layer->prefetch_mutex_);
+    while (!layer->prefetch_stop_ &&
+        layer->prefetch_loaded_ >= layer->prefetch_used_ + depth) {
+      pthread_cond_wait(&layer->file_free_, &layer->prefetch_mutex_);
+    }
+    if (layer->prefetch_stop_) {
+      pthread_mutex_unlock(&layer->prefetch_mutex_);
+      break;
+    }
+    const int n = layer->prefetch_loaded_;
+    pthread_mutex_unlock(&layer->prefetch_mutex_);
+    // the files after the first one, in order
+    const int file = (n + 1) % layer->num_files_;
+    layer->LoadHDF5FileData(layer->hdf_filenames_[file].c_str(),
+        layer->prefetch_data_[n % depth], layer->prefetch_label_[n % depth]);
+    pthread_mutex_lock(&layer->prefetch_mutex_);
+    ++layer->prefetch_loaded_;
+    pthread_cond_broadcast(&layer->file_ready_);
+    pthread_mutex_unlock(&layer->prefetch_mutex_);
+  }
+  return static_cast<void*>(NULL);
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CreatePrefetchThread() {
+  const int depth = this->layer_param_.hdf5_data_param().prefetch_files();
+  prefetch_data_.resize(depth);
+  prefetch_label_.resize(depth);
+  for (int i = 0; i < depth; ++i) {
+    prefetch_data_[i] = new Blob<Dtype>();
+    prefetch_label_[i] = new Blob<Dtype>();
+  }
+  prefetch_stop_ = false;
+  prefetch_loaded_ = 0;
+  prefetch_used_ = 0;
+  CHECK(!pthread_mutex_init(&prefetch_mutex_, NULL));
+  CHECK(!pthread_cond_init(&file_ready_, NULL));
+  CHECK(!pthread_cond_init(&file_free_, NULL));
+  CHECK(!pthread_create(&thread_, NULL, HDF5DataLayerPrefetch<Dtype>,
+        static_cast<void*>(this))) << "Pthread execution failed.";
+  prefetching_ = true;
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::JoinPrefetchThread() {
+  pthread_mutex_lock(&prefetch_mutex_);
+  prefetch_stop_ = true;
+  pthread_cond_broadcast(&file_free_);
+  pthread_mutex_unlock(&prefetch_mutex_);
+  CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
+  pthread_cond_destroy(&file_free_);
+  pthread_cond_destroy(&file_ready_);
+  pthread_mutex_destroy(&prefetch_mutex_);
+  for (int i = 0; i < prefetch_data_.size(); ++i) {
+    delete prefetch_data_[i];
+    delete prefetch_label_[i];
+  }
+  prefetch_data_.clear();
+  prefetch_label_.clear();
+  prefetching_ = false;
+}
+
 // Load data and label from HDF5 filename into the class property blobs.
 template <typename Dtype>
 void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename,
   Blob<Dtype>* data_blob, Blob<Dtype>* label_blob) {
 
   LOG(INFO) << "Loading HDF5 file" << filename;
+  pthread_mutex_lock(hdf5_mutex());
   hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
   if (file_id < 0) {
+    pthread_mutex_unlock(hdf5_mutex());
     LOG(ERROR) << "Failed opening HDF5 file" << filename;
     return;
   }
@@ -53,15 +128,40 @@ void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename,
     file_id, "label", MIN_LABEL_DIM, MAX_LABEL_DIM, label_blob);
 
   herr_t status = H5Fclose(file_id);
+  pthread_mutex_unlock(hdf5_mutex());
   CHECK_EQ(data_blob->num(), label_blob->num());
   LOG(INFO) << "Successully loaded " << data_blob->num() << " rows";
 }
 
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::OpenHDF5FileReaders(const char* filename) {
+  const HDF5DataParameter& param = this->layer_param_.hdf5_data_param();
+  const size_t capacity = static_cast<size_t>(param.cache_mb()) << 20;
+  // close the previous file first, to keep one file cached at a time
+  data_reader_.reset();
+  label_reader_.reset();
+  data_reader_.reset(new HDF5RowReader<Dtype>(filename, "data", 2, 4,
+      param.batch_size(), capacity, true));
+  label_reader_.reset(new HDF5RowReader<Dtype>(filename, "label", 1, 2,
+      param.batch_size(), capacity, true));
+  CHECK_EQ(data_reader_->num(), label_reader_->num());
+}
+
 template <typename Dtype>
 void HDF5DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
   CHECK_EQ(bottom.size(), 0) << "HDF5DataLayer takes no input blobs.";
   CHECK_EQ(top->size(), 2) << "HDF5DataLayer takes two blobs as output.";
+  // start over if set up again
+  if (prefetching_) {
+    JoinPrefetchThread();
+  }
+  for (int i = 0; i < data_blobs_.size(); ++i) {
+    delete data_blobs_[i];
+    delete label_blobs_[i];
+  }
+  data_reader_.reset();
+  label_reader_.reset();
 
   data_in_memory_ = this->layer_param_.hdf5_data_param().data_in_memory();
 
@@ -90,6 +190,11 @@ void HDF5DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
       label_blobs_[i] = new Blob<Dtype>();
       LoadHDF5FileData(hdf_filenames_[i].c_str(), data_blobs_[i], label_blobs_[i]);
     }
+  } else if (this->layer_param_.hdf5_data_param().cache_mb() > 0) {
+    // Read the first HDF5 file in windows
+    data_blobs_.clear();
+    label_blobs_.clear();
+    OpenHDF5FileReaders(hdf_filenames_[current_file_].c_str());
   } else {
     // Load the first HDF5 file 
     data_blobs_.resize(1);
@@ -97,25 +202,75 @@ void HDF5DataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
     data_blobs_[0] = new Blob<Dtype>();
     label_blobs_[0] = new Blob<Dtype>();
     LoadHDF5FileData(hdf_filenames_[current_file_].c_str(), data_blobs_[0], label_blobs_[0]);
+    if (num_files_ > 1 &&
+        this->layer_param_.hdf5_data_param().prefetch_files() > 0) {
+      CreatePrefetchThread();
+    }
   }
 
   //Initialize the line counter.
   current_row_ = 0;
   current_file_ = 0;
-  current_data_blob_ = data_blobs_[0];
-  current_label_blob_ = label_blobs_[0];
-
-  // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  (*top)[0]->Reshape(batch_size, current_data_blob_->channels(),
-                     current_data_blob_->width(), current_data_blob_->height());
-  (*top)[1]->Reshape(batch_size, current_label_blob_->channels(),
-                     current_label_blob_->width(), current_label_blob_->height());
+  if (data_reader_) {
+    current_data_blob_ = NULL;
+    current_label_blob_ = NULL;
+    (*top)[0]->Reshape(batch_size, data_reader_->channels(),
+                       data_reader_->width(), data_reader_->height());
+    (*top)[1]->Reshape(batch_size, label_reader_->channels(),
+                       label_reader_->width(), label_reader_->height());
+  } else {
+    current_data_blob_ = data_blobs_[0];
+    current_label_blob_ = label_blobs_[0];
+
+    // Reshape blobs.
+    (*top)[0]->Reshape(batch_size, current_data_blob_->channels(),
+                       current_data_blob_->width(), current_data_blob_->height());
+    (*top)[1]->Reshape(batch_size, current_label_blob_->channels(),
+                       current_label_blob_->width(), current_label_blob_->height());
+  }
   LOG(INFO) << "output data size: " << (*top)[0]->num() << ","
       << (*top)[0]->channels() << "," << (*top)[0]->height() << ","
       << (*top)[0]->width();
 }
 
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::NextFile() {
+  if (num_files_ > 1) {
+    current_file_ += 1;
+    if (current_file_ == num_files_) {
+      current_file_ = 0;
+      LOG(INFO) << "looping around to first file";
+    }
+    if(data_in_memory_) {
+      current_data_blob_ = data_blobs_[current_file_];
+      current_label_blob_ = label_blobs_[current_file_];
+    } else if (data_reader_) {
+      OpenHDF5FileReaders(hdf_filenames_[current_file_].c_str());
+    } else if (prefetching_) {
+      // wait for the file read ahead and swap it in; the slot then takes
+      // the next file to read
+      pthread_mutex_lock(&prefetch_mutex_);
+      while (prefetch_loaded_ <= prefetch_used_) {
+        pthread_cond_wait(&file_ready_, &prefetch_mutex_);
+      }
+      const int slot = prefetch_used_ % prefetch_data_.size();
+      pthread_mutex_unlock(&prefetch_mutex_);
+      std::swap(data_blobs_[0], prefetch_data_[slot]);
+      std::swap(label_blobs_[0], prefetch_label_[slot]);
+      current_data_blob_ = data_blobs_[0];
+      current_label_blob_ = label_blobs_[0];
+      pthread_mutex_lock(&prefetch_mutex_);
+      ++prefetch_used_;
+      pthread_cond_broadcast(&file_free_);
+      pthread_mutex_unlock(&prefetch_mutex_);
+    } else {
+      LoadHDF5FileData(hdf_filenames_[current_file_].c_str(), current_data_blob_, current_label_blob_);
+    }
+  }
+  current_row_ = 0;
+}
+
 template <typename Dtype>
 Dtype HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -123,22 +278,26 @@ Dtype HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const int data_count = (*top)[0]->count() / (*top)[0]->num();
   const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
 
+  if (data_reader_) {
+    // the rows left in the current file at a time
+    for (int i = 0; i < batch_size; ) {
+      if (current_row_ == data_reader_->num()) {
+        NextFile();
+      }
+      const int rows = std::min<int>(batch_size - i,
+          data_reader_->num() - current_row_);
+      data_reader_->ReadRows(current_row_, rows,
+          &(*top)[0]->mutable_cpu_data()[i * data_count]);
+      label_reader_->ReadRows(current_row_, rows,
+          &(*top)[1]->mutable_cpu_data()[i * label_data_count]);
+      i += rows;
+      current_row_ += rows;
+    }
+    return Dtype(0.);
+  }
   for (int i = 0; i < batch_size; ++i, ++current_row_) {
     if (current_row_ == current_data_blob_->num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
-        }
-        if(data_in_memory_) {
-          current_data_blob_ = data_blobs_[current_file_];
-          current_label_blob_ = label_blobs_[current_file_];
-        } else {
-          LoadHDF5FileData(hdf_filenames_[current_file_].c_str(), current_data_blob_, current_label_blob_);
-        }
-      }
-      current_row_ = 0;
+      NextFile();
     }
     memcpy(&(*top)[0]->mutable_cpu_data()[i * data_count],
            &current_data_blob_->cpu_data()[current_row_ * data_count],
@@ -26,22 +26,13 @@ Dtype HDF5DataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   const int data_count = (*top)[0]->count() / (*top)[0]->num();
   const int label_data_count = (*top)[1]->count() / (*top)[1]->num();
 
+  if (data_reader_) {
+    // read into the cpu data, which is copied over when used
+    return Forward_cpu(bottom, top);
+  }
   for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == data_blobs_[current_file_]->num()) {
-      if (num_files_ > 1) {
-        current_file_ += 1;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          LOG(INFO) << "looping around to first file";
-        }
-        if(data_in_memory_) {
-          current_data_blob_ = data_blobs_[current_file_];
-          current_label_blob_ = label_blobs_[current_file_];
-        } else {
-          LoadHDF5FileData(hdf_filenames_[current_file_].c_str(), current_data_blob_, current_label_blob_);
-        }
-      }
-      current_row_ = 0;
+    if (current_row_ == current_data_blob_->num()) {
+      NextFile();
     }
     CUDA_CHECK(cudaMemcpy(
             &(*top)[0]->mutable_gpu_data()[i * data_count],
@@ -19,14 +19,18 @@ HDF5OutputLayer<Dtype>::HDF5OutputLayer(const LayerParameter& param)
     : Layer<Dtype>(param),
       file_name_(param.hdf5_output_param().file_name()) {
   /* create a HDF5 file */
+  pthread_mutex_lock(hdf5_mutex());
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
+  pthread_mutex_unlock(hdf5_mutex());
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
 }
 
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::~HDF5OutputLayer<Dtype>() {
+  pthread_mutex_lock(hdf5_mutex());
   herr_t status = H5Fclose(file_id_);
+  pthread_mutex_unlock(hdf5_mutex());
   CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
 }
 
@@ -36,8 +40,10 @@ void HDF5OutputLayer<Dtype>::SaveBlobs() {
   LOG(INFO) << "Saving HDF5 file" << file_name_;
   CHECK_EQ(data_blob_.num(), label_blob_.num()) <<
       "data blob and label blob must have the same batch size";
+  pthread_mutex_lock(hdf5_mutex());
   hdf5_save_nd_dataset(file_id_, HDF5_DATA_DATASET_NAME, data_blob_);
   hdf5_save_nd_dataset(file_id_, HDF5_DATA_LABEL_NAME, label_blob_);
+  pthread_mutex_unlock(hdf5_mutex());
   LOG(INFO) << "Successfully saved " << data_blob_.num() << " rows";
 }
 
@@ -14,30 +14,37 @@ using std::max;
 
 namespace caffe {
 
+template <typename Dtype>
+void HingeLossLayer<Dtype>::FurtherSetUp(const vector<Blob<Dtype>*>& bottom,
+    vector<Blob<Dtype>*>* top) {
+  margin_.ReshapeLike(*bottom[0]);
+  margin_.set_diff_enabled(false);
+}
+
 template <typename Dtype>
 Dtype HingeLossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  Dtype* margin = margin_.mutable_cpu_data();
   const Dtype* label = bottom[1]->cpu_data();
   int num = bottom[0]->num();
   int count = bottom[0]->count();
   int dim = count / num;
 
-  caffe_copy(count, bottom_data, bottom_diff);
+  caffe_copy(count, bottom_data, margin);
   for (int i = 0; i < num; ++i) {
-    bottom_diff[i * dim + static_cast<int>(label[i])] *= -1;
+    margin[i * dim + static_cast<int>(label[i])] *= -1;
   }
   for (int i = 0; i < num; ++i) {
     for (int j = 0; j < dim; ++j) {
-      bottom_diff[i * dim + j] = max(Dtype(0), 1 + bottom_diff[i * dim + j]);
+      margin[i * dim + j] = max(Dtype(0), 1 + margin[i * dim + j]);
     }
   }
   switch (this->layer_param_.hinge_loss_param().norm()) {
   case HingeLossParameter_Norm_L1:
-    return caffe_cpu_asum(count, bottom_diff) / num;
+    return caffe_cpu_asum(count, margin) / num;
   case HingeLossParameter_Norm_L2:
-    return caffe_cpu_dot(count, bottom_diff, bottom_diff) / num;
+    return caffe_cpu_dot(count, margin, margin) / num;
   default:
     LOG(FATAL) << "Unknown Norm";
   }
@@ -52,6 +59,7 @@ void HingeLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   int count = (*bottom)[0]->count();
   int dim = count / num;
 
+  caffe_copy(count, margin_.cpu_data(), bottom_diff);
   for (int i = 0; i < num; ++i) {
     bottom_diff[i * dim + static_cast<int>(label[i])] *= -1;
   }
@@ -11,6 +11,7 @@
 #include <utility>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -39,6 +40,7 @@ void* ImageDataLayerPrefetch(void* layer_pointer) {
   const bool mirror = image_data_param.mirror();
   const int new_height = image_data_param.new_height();
   const int new_width = image_data_param.new_width();
+  ImageCache* cache = image_data_param.cache_mb() ? ImageCache::Get() : NULL;
 
   if (mirror && crop_size == 0) {
     LOG(FATAL) << "Current implementation requires mirror and crop_size to be "
@@ -56,7 +58,7 @@ void* ImageDataLayerPrefetch(void* layer_pointer) {
     CHECK_GT(lines_size, layer->lines_id_);
     if (!ReadImageToDatum(layer->lines_[layer->lines_id_].first,
           layer->lines_[layer->lines_id_].second,
-          new_height, new_width, &datum)) {
+          new_height, new_width, true, &datum, cache)) {
       continue;
     }
     const string& data = datum.data();
@@ -174,10 +176,15 @@ void ImageDataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_GT(lines_.size(), skip) << "Not enough points to skip";
     lines_id_ = skip;
   }
+  const int cache_mb = this->layer_param_.image_data_param().cache_mb();
+  if (cache_mb) {
+    ImageCache::Reserve(static_cast<size_t>(cache_mb) << 20);
+  }
   // Read a data point, and use it to initialize the top blob.
   Datum datum;
   CHECK(ReadImageToDatum(lines_[lines_id_].first, lines_[lines_id_].second,
-                         new_height, new_width, &datum));
+                         new_height, new_width, true, &datum,
+                         cache_mb ? ImageCache::Get() : NULL));
   // image
   const int crop_size = this->layer_param_.image_data_param().crop_size();
   const int batch_size = this->layer_param_.image_data_param().batch_size();
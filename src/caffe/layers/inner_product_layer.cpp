@@ -7,6 +7,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/vision_layers.hpp"
+#include "caffe/util/activation.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -64,7 +65,11 @@ Dtype InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const Dtype* weight = this->blobs_[0]->cpu_data();
   caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
       bottom_data, weight, (Dtype)0., top_data);
-  if (bias_term_) {
+  if (fused_activation_ != LayerParameter_LayerType_NONE) {
+    caffe_cpu_bias_activation(M_, N_,
+        bias_term_ ? this->blobs_[1]->cpu_data() : NULL, false,
+        fused_activation_, fused_negative_slope_, top_data);
+  } else if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
@@ -76,16 +81,22 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const bool propagate_down,
     vector<Blob<Dtype>*>* bottom) {
+  if (fused_activation_ != LayerParameter_LayerType_NONE) {
+    // backward of the fused activation, whose output the top holds
+    caffe_cpu_activation_backward(top[0]->count(), fused_activation_,
+        fused_negative_slope_, top[0]->cpu_data(), top[0]->mutable_cpu_diff());
+  }
   const Dtype* top_diff = top[0]->cpu_diff();
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   // Gradient with respect to weight
   caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Dtype)1.,
-      top_diff, bottom_data, (Dtype)0., this->blobs_[0]->mutable_cpu_diff());
+      top_diff, bottom_data, this->param_diff_beta(),
+      this->blobs_[0]->mutable_cpu_diff());
   if (bias_term_) {
     // Gradient with respect to bias
     caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
-        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), (Dtype)0.,
-        this->blobs_[1]->mutable_cpu_diff());
+        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+        this->param_diff_beta(), this->blobs_[1]->mutable_cpu_diff());
   }
   if (propagate_down) {
     // Gradient with respect to bottom data
@@ -95,6 +106,13 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
 }
 
+template <typename Dtype>
+bool InnerProductLayer<Dtype>::FuseActivation(
+      const LayerParameter& activation_param) {
+  return caffe_fusable_activation(activation_param, &fused_activation_,
+      &fused_negative_slope_);
+}
+
 template <typename Dtype>
 void InnerProductLayer<Dtype>::normalize_weights(Dtype mnorm) {
   Dtype *weight = 0;
@@ -88,6 +88,15 @@ void InnerProductOrthLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void InnerProductOrthLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  // keep the iteration count
+  const int iter = iter_;
+  SetUp(bottom, top);
+  iter_ = iter;
+}
+
 template <typename Dtype>
 Dtype InnerProductOrthLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     vector<Blob<Dtype>*>* top) {
@@ -180,12 +189,13 @@ void InnerProductOrthLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* bottom_data = (*bottom)[0]->cpu_data();
   // Gradient with respect to weight
   caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Dtype)1.,
-      top_diff, bottom_data, (Dtype)0., this->blobs_[0]->mutable_cpu_diff());
+      top_diff, bottom_data, this->param_diff_beta(),
+      this->blobs_[0]->mutable_cpu_diff());
   if (bias_term_) {
     // Gradient with respect to bias
     caffe_cpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
-        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()), (Dtype)0.,
-        this->blobs_[1]->mutable_cpu_diff());
+        reinterpret_cast<const Dtype*>(bias_multiplier_->cpu_data()),
+        this->param_diff_beta(), this->blobs_[1]->mutable_cpu_diff());
   }
   if (propagate_down) {
     // Gradient with respect to bottom data
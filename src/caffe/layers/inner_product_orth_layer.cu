@@ -113,12 +113,13 @@ void InnerProductOrthLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const Dtype* bottom_data = (*bottom)[0]->gpu_data();
   // Gradient with respect to weight
   caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, N_, K_, M_, (Dtype)1.,
-      top_diff, bottom_data, (Dtype)0., this->blobs_[0]->mutable_gpu_diff());
+      top_diff, bottom_data, this->param_diff_beta(),
+      this->blobs_[0]->mutable_gpu_diff());
   if (bias_term_) {
     // Gradient with respect to bias
     caffe_gpu_gemv<Dtype>(CblasTrans, M_, N_, (Dtype)1., top_diff,
         reinterpret_cast<const Dtype*>(bias_multiplier_->gpu_data()),
-        (Dtype)0., this->blobs_[1]->mutable_gpu_diff());
+        this->param_diff_beta(), this->blobs_[1]->mutable_gpu_diff());
   }
   if (propagate_down) {
     // Gradient with respect to bottom data
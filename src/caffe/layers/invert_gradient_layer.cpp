@@ -20,6 +20,17 @@ void InvertGradientLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   coeff_ = initial_coeff_;
 }
 
+template <typename Dtype>
+void InvertGradientLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      vector<Blob<Dtype>*>* top) {
+  // keep the position in the coefficient schedule
+  const int iter = iter_;
+  const Dtype coeff = coeff_;
+  SetUp(bottom, top);
+  iter_ = iter;
+  coeff_ = coeff;
+}
+
 template <typename Dtype>
 Dtype InvertGradientLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       vector<Blob<Dtype>*>* top) {
@@ -17,6 +17,7 @@
 #include "opencv2/imgproc/imgproc.hpp"
 
 #include "caffe/layer.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -57,6 +58,8 @@ void* WindowDataLayerPrefetch(void* layer_pointer) {
   const string& crop_mode = layer->layer_param_.window_data_param().crop_mode();
 
   bool use_square = (crop_mode == "square") ? true : false;
+  ImageCache* cache = layer->layer_param_.window_data_param().cache_mb() ?
+      ImageCache::Get() : NULL;
 
   // zero out batch
   memset(top_data, 0, sizeof(Dtype)*layer->prefetch_data_->count());
@@ -84,7 +87,9 @@ void* WindowDataLayerPrefetch(void* layer_pointer) {
       pair<std::string, vector<int> > image =
           layer->image_database_[window[WindowDataLayer<Dtype>::IMAGE_INDEX]];
 
-      cv::Mat cv_img = cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
+      // all windows of an image share its decoded pixels through the cache
+      cv::Mat cv_img = cache ? cache->Read(image.first, 0, 0, true) :
+          cv::imread(image.first, CV_LOAD_IMAGE_COLOR);
       if (!cv_img.data) {
         LOG(ERROR) << "Could not open or find file " << image.first;
         return reinterpret_cast<void*>(NULL);
@@ -181,8 +186,9 @@ void* WindowDataLayerPrefetch(void* layer_pointer) {
       }
 
       cv::Rect roi(x1, y1, x2-x1+1, y2-y1+1);
-      cv::Mat cv_cropped_img = cv_img(roi);
-      cv::resize(cv_cropped_img, cv_cropped_img,
+      // into new pixels, as the image may be the cached one
+      cv::Mat cv_cropped_img;
+      cv::resize(cv_img(roi), cv_cropped_img,
           cv_crop_size, 0, 0, cv::INTER_LINEAR);
 
       // horizontal flip at random
@@ -363,6 +369,11 @@ void WindowDataLayer<Dtype>::SetUp(const vector<Blob<Dtype>*>& bottom,
   LOG(INFO) << "Crop mode: "
       << this->layer_param_.window_data_param().crop_mode();
 
+  const int cache_mb = this->layer_param_.window_data_param().cache_mb();
+  if (cache_mb) {
+    ImageCache::Reserve(static_cast<size_t>(cache_mb) << 20);
+  }
+
   // image
   int crop_size = this->layer_param_.window_data_param().crop_size();
   CHECK_GT(crop_size, 0);
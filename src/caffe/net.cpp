@@ -1,5 +1,6 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <algorithm>
 #include <map>
 #include <set>
 #include <string>
@@ -11,6 +12,7 @@
 #include "caffe/net.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/insert_splits.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 using std::pair;
@@ -45,6 +47,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   int num_layers = param.layers_size();
   CHECK_EQ(param.input_size() * 4, param.input_dim_size())
       << "Incorrect input blob dimension specifications.";
+  inference_ = param.inference();
+  CHECK(!inference_ || !param.force_backward())
+      << "An inference net cannot force backward.";
   memory_used_ = 0;
   // set the input blobs
   for (int input_id = 0; input_id < param.input_size(); ++input_id) {
@@ -72,12 +77,17 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       // If a blob needs backward, this layer should provide it.
       need_backward |= blob_need_backward_[blob_id];
     }
+    const int first_new_blob_id = blobs_.size();
     for (int top_id = 0; top_id < layer_param.top_size(); ++top_id) {
       AppendTop(param, layer_id, top_id, &available_blobs, &blob_name_to_idx);
     }
     // After this layer is connected, set it up.
     // LOG(INFO) << "Setting up " << layer_names_[layer_id];
     layers_[layer_id]->SetUp(bottom_vecs_[layer_id], &top_vecs_[layer_id]);
+    // the new tops only have their shape after the setup
+    for (int blob_id = first_new_blob_id; blob_id < blobs_.size(); ++blob_id) {
+      memory_used_ += blobs_[blob_id]->count();
+    }
     if (layer_param.force_output())
       LOG(INFO) << "This layers outputs its blobs";
     for (int top_id = 0; top_id < top_vecs_[layer_id].size(); ++top_id) {
@@ -105,6 +115,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       // learning rate to be 1. Thus we will need to perform backward.
       need_backward = true;
     }
+    if (inference_) {
+      need_backward = false;
+    }
     // Finally, set the backward flag
     layer_need_backward_.push_back(need_backward);
     if (need_backward) {
@@ -117,6 +130,31 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
                 << " does not need backward computation.";
     }
   }
+  // Only the blobs read or written by the backward pass get a diff; the
+  // parameters of an inference net have none either.
+  vector<bool> blob_need_diff(blobs_.size(), false);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (layer_need_backward_[layer_id]) {
+      for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+        blob_need_diff[bottom_id_vecs_[layer_id][i]] = true;
+      }
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        blob_need_diff[top_id_vecs_[layer_id][i]] = true;
+      }
+    }
+    if (inference_) {
+      for (int i = 0; i < layers_[layer_id]->blobs().size(); ++i) {
+        layers_[layer_id]->blobs()[i]->set_diff_enabled(false);
+      }
+    }
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    blobs_[blob_id]->set_diff_enabled(blob_need_diff[blob_id]);
+  }
+  layer_fused_.assign(layers_.size(), false);
+  if (param.fuse_activations()) {
+    FuseActivations();
+  }
   // In the end, all remaining blobs are considered output blobs.
   for (set<string>::iterator it = available_blobs.begin();
       it != available_blobs.end(); ++it) {
@@ -130,6 +168,35 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
+  share_activations_ =
+      param.share_activations() && Caffe::phase() == Caffe::TEST;
+  if (share_activations_) {
+    // inputs, outputs, the tops of data layers and the tops a layer swaps
+    // its own memory into keep their memory
+    blob_pinned_.assign(blobs_.size(), false);
+    blob_buffer_.assign(blobs_.size(), -1);
+    for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+      blob_pinned_[net_input_blob_indices_[i]] = true;
+    }
+    for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+      blob_pinned_[net_output_blob_indices_[i]] = true;
+    }
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      if (layers_[layer_id]->layer_param().force_output() ||
+          bottom_id_vecs_[layer_id].empty() ||
+          layers_[layer_id]->ForwardSwapsTopMemory()) {
+        for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+          blob_pinned_[top_id_vecs_[layer_id][i]] = true;
+        }
+      }
+    }
+    for (int i = 0; i < param.keep_blob_size(); ++i) {
+      CHECK(blob_names_index_.count(param.keep_blob(i)))
+          << "Unknown blob name " << param.keep_blob(i);
+      blob_pinned_[blob_names_index_[param.keep_blob(i)]] = true;
+    }
+    PlanActivationMemory();
+  }
   
   // Share weights
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
@@ -162,6 +229,149 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
 }
 
+// Helper for Net::Init: offer every in-place activation layer that directly
+// follows a layer with a single top to that layer for fusion.
+template <typename Dtype>
+void Net<Dtype>::FuseActivations() {
+  for (int layer_id = 1; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    const vector<int>& prev_top_ids = top_id_vecs_[layer_id - 1];
+    if (bottom_ids.size() != 1 || top_ids.size() != 1 ||
+        top_ids[0] != bottom_ids[0] || prev_top_ids.size() != 1 ||
+        prev_top_ids[0] != bottom_ids[0] || layer_fused_[layer_id - 1]) {
+      continue;
+    }
+    if (layers_[layer_id - 1]->FuseActivation(
+        layers_[layer_id]->layer_param())) {
+      layer_fused_[layer_id] = true;
+      LOG(INFO) << layer_names_[layer_id] << " is fused into "
+          << layer_names_[layer_id - 1] << " on the CPU";
+    }
+  }
+}
+
+// Greedy interval allocation: walking through the layers, every top that is
+// not pinned gets the best fitting buffer whose blobs are no longer used.
+// Tops of layers that share the data of their bottom in the forward pass
+// are treated as part of that bottom.
+template <typename Dtype>
+void Net<Dtype>::PlanActivationMemory() {
+  const int num_blobs = blobs_.size();
+  vector<int> root(num_blobs);
+  vector<int> begin(num_blobs, -1);
+  vector<int> end(num_blobs, -1);
+  vector<bool> pinned(blob_pinned_);
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    root[blob_id] = blob_id;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& bottom_ids = bottom_id_vecs_[layer_id];
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < bottom_ids.size(); ++i) {
+      end[root[bottom_ids[i]]] = layer_id;
+    }
+    for (int i = 0; i < top_ids.size(); ++i) {
+      if (layers_[layer_id]->ForwardSharesData() && !bottom_ids.empty() &&
+          top_ids[i] != bottom_ids[0]) {
+        root[top_ids[i]] = root[bottom_ids[0]];
+      } else if (end[top_ids[i]] < 0) {
+        begin[top_ids[i]] = layer_id;
+      }
+      end[root[top_ids[i]]] = layer_id;
+    }
+  }
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    if (pinned[blob_id]) {
+      pinned[root[blob_id]] = true;
+    }
+  }
+  // assign the buffers in the order the blobs are produced
+  vector<int> buffer(num_blobs, -1);
+  vector<int> buffer_count;
+  vector<int> buffer_end;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    const vector<int>& top_ids = top_id_vecs_[layer_id];
+    for (int i = 0; i < top_ids.size(); ++i) {
+      const int blob_id = top_ids[i];
+      const int count = blobs_[blob_id]->count();
+      if (root[blob_id] != blob_id || begin[blob_id] != layer_id ||
+          pinned[blob_id] || count == 0) {
+        continue;
+      }
+      int best = -1;
+      for (int k = 0; k < buffer_count.size(); ++k) {
+        if (buffer_end[k] >= layer_id) {
+          continue;
+        }
+        // the smallest buffer that fits, otherwise the largest one
+        if (best < 0) {
+          best = k;
+          continue;
+        }
+        const bool fits = buffer_count[k] >= count;
+        const bool best_fits = buffer_count[best] >= count;
+        if ((fits && (!best_fits || buffer_count[k] < buffer_count[best])) ||
+            (!fits && !best_fits && buffer_count[k] > buffer_count[best])) {
+          best = k;
+        }
+      }
+      if (best < 0) {
+        best = buffer_count.size();
+        buffer_count.push_back(0);
+        buffer_end.push_back(0);
+      }
+      buffer_count[best] = std::max(buffer_count[best], count);
+      buffer_end[best] = end[blob_id];
+      buffer[blob_id] = best;
+    }
+  }
+  activation_buffers_.resize(buffer_count.size());
+  for (int k = 0; k < buffer_count.size(); ++k) {
+    activation_buffers_[k].reset(
+        new SyncedMemory(buffer_count[k] * sizeof(Dtype)));
+  }
+  size_t naive = 0;
+  size_t planned = 0;
+  for (int blob_id = 0; blob_id < num_blobs; ++blob_id) {
+    Blob<Dtype>* blob = blobs_[blob_id].get();
+    naive += blob->count();
+    const int k = buffer[root[blob_id]];
+    if (k >= 0) {
+      blob->SetDataMemory(activation_buffers_[k]);
+    } else {
+      planned += blob->count();
+      if (blob_buffer_[blob_id] >= 0) {
+        // pinned after having been in a shared buffer
+        blob->SetDataMemory(shared_ptr<SyncedMemory>(
+            new SyncedMemory(blob->count() * sizeof(Dtype))));
+      }
+    }
+    blob_buffer_[blob_id] = k;
+  }
+  for (int k = 0; k < buffer_count.size(); ++k) {
+    planned += buffer_count[k];
+  }
+  memory_used_ = planned;
+  LOG(INFO) << "Activations share " << buffer_count.size() << " buffers: "
+      << planned * sizeof(Dtype) << " bytes instead of "
+      << naive * sizeof(Dtype);
+}
+
+template <typename Dtype>
+void Net<Dtype>::PinBlob(const int blob_id) {
+  if (share_activations_ && !blob_pinned_[blob_id]) {
+    blob_pinned_[blob_id] = true;
+    PlanActivationMemory();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PinBlob(const string& blob_name) {
+  CHECK(has_blob(blob_name)) << "Unknown blob name " << blob_name;
+  PinBlob(blob_names_index_[blob_name]);
+}
+
 // Helper for Net::Init: add a new input or top blob to the net.  (Inputs have
 // layer_id == -1, tops have layer_id >= 0.)
 template <typename Dtype>
@@ -204,11 +414,11 @@ void Net<Dtype>::AppendTop(const NetParameter& param, const int layer_id,
                             param.input_dim(top_id * 4 + 3));
       net_input_blob_indices_.push_back(blob_id);
       net_input_blobs_.push_back(blob_pointer.get());
+      memory_used_ += blob_pointer->count();
     } else {
       top_id_vecs_[layer_id].push_back(blob_id);
       top_vecs_[layer_id].push_back(blob_pointer.get());
     }
-    memory_used_ += blob_pointer->count();
   }
   available_blobs->insert(blob_name);
 }
@@ -229,7 +439,6 @@ int Net<Dtype>::AppendBottom(const NetParameter& param,
   bottom_vecs_[layer_id].push_back(blobs_[blob_id].get());
   bottom_id_vecs_[layer_id].push_back(blob_id);
   available_blobs->erase(blob_name);
-  bool need_backward = param.force_backward() || blob_need_backward_[blob_id];
   return blob_id;
 }
 
@@ -280,6 +489,9 @@ const vector<Blob<Dtype>*>& Net<Dtype>::ForwardPrefilled(Dtype* loss) {
     *loss = Dtype(0.);
   }
   for (int i = 0; i < layers_.size(); ++i) {
+    if (layer_fused_[i] && Caffe::mode() == Caffe::CPU) {
+      continue;
+    }
 //     LOG(ERROR) << "Forwarding " << layer_names_[i];
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
     if (loss != NULL) {
@@ -299,6 +511,9 @@ const vector<Blob<Dtype>*> Net<Dtype>::ForwardPrefilled_extra_output(Dtype* loss
     *loss = Dtype(0.);
   }
   for (int i = 0; i < layers_.size(); ++i) {
+    if (layer_fused_[i] && Caffe::mode() == Caffe::CPU) {
+      continue;
+    }
 //     LOG(ERROR) << "Forwarding " << layer_names_[i];
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], &top_vecs_[i]);
     if (loss != NULL) {
@@ -314,6 +529,25 @@ const vector<Blob<Dtype>*> Net<Dtype>::ForwardPrefilled_extra_output(Dtype* loss
   return all_output_blobs;
 }
 
+template <typename Dtype>
+void Net<Dtype>::Reshape() {
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->Reshape(bottom_vecs_[i], &top_vecs_[i]);
+  }
+  if (share_activations_) {
+    PlanActivationMemory();
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReshapeInputs(const int num) {
+  for (int i = 0; i < net_input_blobs_.size(); ++i) {
+    Blob<Dtype>* blob = net_input_blobs_[i];
+    blob->Reshape(num, blob->channels(), blob->height(), blob->width());
+  }
+  Reshape();
+}
+
 template <typename Dtype>
 const vector<Blob<Dtype>*>& Net<Dtype>::Forward(
     const vector<Blob<Dtype>*> & bottom, Dtype* loss) {
@@ -348,8 +582,13 @@ string Net<Dtype>::Forward(const string& input_blob_protos, Dtype* loss) {
 
 template <typename Dtype>
 void Net<Dtype>::Backward() {
+  CHECK(!inference_) << "Backward called on an inference net.";
+  // the activations backward reads have been overwritten by other layers
+  CHECK(!share_activations_)
+      << "Backward called on a net sharing activation memory.";
   for (int i = layers_.size() - 1; i >= 0; --i) {
-    if (layer_need_backward_[i]) {
+    if (layer_need_backward_[i] &&
+        !(layer_fused_[i] && Caffe::mode() == Caffe::CPU)) {
       layers_[i]->Backward(top_vecs_[i], true, &bottom_vecs_[i]);
     }
   }
@@ -386,6 +625,37 @@ void Net<Dtype>::ShareTrainedLayersWith(Net* other) {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::CopyTrainedLayersFrom(Net* other) {
+  int num_source_layers = other->layers().size();
+  for (int i = 0; i < num_source_layers; ++i) {
+    Layer<Dtype>* source_layer = other->layers()[i].get();
+    const string& source_layer_name = other->layer_names()[i];
+    int target_layer_id = 0;
+    while (target_layer_id != layer_names_.size() &&
+        layer_names_[target_layer_id] != source_layer_name) {
+      ++target_layer_id;
+    }
+    if (target_layer_id == layer_names_.size()) {
+      DLOG(INFO) << "Ignoring source layer " << source_layer_name;
+      continue;
+    }
+    DLOG(INFO) << "Copying source layer " << source_layer_name << " to " << layer_names_[target_layer_id];
+    vector<shared_ptr<Blob<Dtype> > >& target_blobs =
+        layers_[target_layer_id]->blobs();
+    CHECK_EQ(target_blobs.size(), source_layer->blobs().size())
+        << "Incompatible number of blobs for layer " << source_layer_name;
+    for (int j = 0; j < target_blobs.size(); ++j) {
+      Blob<Dtype>* source_blob = source_layer->blobs()[j].get();
+      CHECK_EQ(target_blobs[j]->num(), source_blob->num());
+      CHECK_EQ(target_blobs[j]->channels(), source_blob->channels());
+      CHECK_EQ(target_blobs[j]->height(), source_blob->height());
+      CHECK_EQ(target_blobs[j]->width(), source_blob->width());
+      target_blobs[j]->CopyFrom(*source_blob);
+    }
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::CopyTrainedLayersFrom(const NetParameter& param) {
   int num_source_layers = param.layers_size();
@@ -453,6 +723,48 @@ void Net<Dtype>::Update() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::SetAccumulateParamDiffs(const bool accumulate) {
+  for (int i = 0; i < layers_.size(); ++i) {
+    layers_[i]->set_accumulate_param_diffs(accumulate);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ClearParamDiffs() {
+  for (int i = 0; i < params_.size(); ++i) {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_set(params_[i]->count(), Dtype(0),
+          params_[i]->mutable_cpu_diff());
+      break;
+    case Caffe::GPU:
+      caffe_gpu_set(params_[i]->count(), Dtype(0),
+          params_[i]->mutable_gpu_diff());
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ScaleParamDiffs(const Dtype scale) {
+  for (int i = 0; i < params_.size(); ++i) {
+    switch (Caffe::mode()) {
+    case Caffe::CPU:
+      caffe_scal(params_[i]->count(), scale, params_[i]->mutable_cpu_diff());
+      break;
+    case Caffe::GPU:
+      caffe_gpu_scal(params_[i]->count(), scale,
+          params_[i]->mutable_gpu_diff());
+      break;
+    default:
+      LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+    }
+  }
+}
+
 template <typename Dtype>
 bool Net<Dtype>::has_blob(const string& blob_name) {
   return blob_names_index_.find(blob_name) != blob_names_index_.end();
@@ -1,25 +1,195 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
 #include <cstdio>
 #include <ctime>
 #include <cstdlib>
 #include <cmath> 
 
 #include <algorithm>
+#include <map>
 #include <string>
 #include <vector>
 
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using std::max;
 using std::min;
 
 namespace caffe {
 
+// The per-layer losses of several passes, by layer id: their sum and the
+// number of passes the layer reported a loss in. Net::losses() only holds
+// the layers with a nonzero loss, so the passes can list different layers.
+typedef std::map<int, std::pair<float, int> > LayerLossSums;
+
+static void AddLayerLosses(const vector<std::pair<int, float> >& losses,
+    LayerLossSums* sums) {
+  for (int j = 0; j < losses.size(); ++j) {
+    std::pair<float, int>& sum = (*sums)[losses[j].first];
+    sum.first += losses[j].second;
+    ++sum.second;
+  }
+}
+
+// Sets losses to the sums divided by num, or by the number of passes that
+// reported each loss if num is 0.
+static void SetLayerLosses(const LayerLossSums& sums, const int num,
+    vector<std::pair<int, float> >* losses) {
+  losses->clear();
+  for (LayerLossSums::const_iterator it = sums.begin(); it != sums.end();
+      ++it) {
+    losses->push_back(std::make_pair(it->first,
+        it->second.first / (num > 0 ? num : it->second.second)));
+  }
+}
+
+// Pins the calling thread to the share of the cores of worker id of
+// num_workers: contiguous ranges, which usually share a NUMA node.
+static void PinWorker(const int id, const int num_workers) {
+  const int num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+  const int first = num_cores * id / num_workers;
+  const int last = std::max(num_cores * (id + 1) / num_workers, first + 1);
+  cpu_set_t cores;
+  CPU_ZERO(&cores);
+  for (int core = first; core < last; ++core) {
+    CPU_SET(core % num_cores, &cores);
+  }
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores)) {
+    LOG(WARNING) << "Pinning worker " << id << " to cores " << first
+        << " to " << last - 1 << " failed";
+  }
+}
+
+// The train net of worker id of num_workers, whose data layers read the
+// datums of shard id of their source.
+static NetParameter WorkerNetParameter(const NetParameter& param,
+    const int id, const int num_workers) {
+  NetParameter worker_param(param);
+  for (int i = 0; i < worker_param.layers_size(); ++i) {
+    LayerParameter* layer_param = worker_param.mutable_layers(i);
+    if (layer_param->type() == LayerParameter_LayerType_DATA) {
+      layer_param->mutable_data_param()->set_shard_id(id);
+      layer_param->mutable_data_param()->set_num_shards(num_workers);
+    } else if (num_workers > 1 && id == 0 &&
+        layer_param->bottom_size() == 0) {
+      LOG(WARNING) << "Layer " << layer_param->name() << " is not a DATA "
+          << "layer and feeds the same data to all workers";
+    }
+  }
+  return worker_param;
+}
+
+template <typename Dtype>
+void* SolverWorker(void* worker_pointer) {
+  CHECK(worker_pointer);
+  typename Solver<Dtype>::Worker* worker =
+      static_cast<typename Solver<Dtype>::Worker*>(worker_pointer);
+  Solver<Dtype>* solver = worker->solver;
+  const int num_workers = solver->workers_.size();
+  if (solver->param_.pin_workers()) {
+    PinWorker(worker->id, num_workers);
+  }
+  // Built here, after pinning, so that the activations are allocated on the
+  // worker's node and the prefetch threads of its data layers inherit its
+  // cores; the fillers are seeded from the caller's generator.
+  Caffe::RNG rng(caffe_rng_rand());
+  Caffe::set_thread_rng_stream(&rng);
+  worker->net.reset(new Net<Dtype>(WorkerNetParameter(
+      solver->train_net_param_, worker->id, num_workers)));
+  const vector<shared_ptr<Blob<Dtype> > >& params = worker->net->params();
+  const vector<shared_ptr<Blob<Dtype> > >& root_params =
+      solver->net_->params();
+  CHECK_EQ(params.size(), root_params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    params[i]->ShareData(*root_params[i]);
+  }
+  worker->net->SetAccumulateParamDiffs(solver->param_.iter_size() > 1);
+  vector<Blob<Dtype>*> bottom_vec;
+  Timer timer;
+  pthread_mutex_lock(&solver->worker_mutex_);
+  // built
+  ++solver->workers_done_;
+  pthread_cond_signal(&solver->worker_done_);
+  int generation = solver->workers_generation_;
+  while (solver->param_.hogwild()) {
+    while (!solver->workers_stop_ && solver->workers_paused_) {
+      pthread_cond_wait(&solver->worker_start_, &solver->worker_mutex_);
+    }
+    if (solver->workers_stop_) {
+      break;
+    }
+    ++solver->workers_running_;
+    pthread_mutex_unlock(&solver->worker_mutex_);
+    solver->HogwildStep(worker->id, bottom_vec);
+    pthread_mutex_lock(&solver->worker_mutex_);
+    if (--solver->workers_running_ == 0 && solver->workers_paused_) {
+      pthread_cond_signal(&solver->worker_done_);
+    }
+  }
+  while (!solver->param_.hogwild()) {
+    while (!solver->workers_stop_ &&
+        solver->workers_generation_ == generation) {
+      pthread_cond_wait(&solver->worker_start_, &solver->worker_mutex_);
+    }
+    if (solver->workers_stop_) {
+      break;
+    }
+    generation = solver->workers_generation_;
+    pthread_mutex_unlock(&solver->worker_mutex_);
+    timer.Start();
+    worker->loss = solver->ForwardBackward(worker->net.get(), bottom_vec);
+    worker->seconds = timer.Seconds();
+    pthread_mutex_lock(&solver->worker_mutex_);
+    ++solver->workers_done_;
+    pthread_cond_signal(&solver->worker_done_);
+  }
+  pthread_mutex_unlock(&solver->worker_mutex_);
+  Caffe::set_thread_rng_stream(NULL);
+  worker->net.reset();
+  return static_cast<void*>(NULL);
+}
+
+template <typename Dtype>
+void* SolverTester(void* tester_pointer) {
+  CHECK(tester_pointer);
+  typename Solver<Dtype>::Tester* tester =
+      static_cast<typename Solver<Dtype>::Tester*>(tester_pointer);
+  Solver<Dtype>* solver = tester->solver;
+  // the solver thread keeps training meanwhile
+  Caffe::set_thread_phase(Caffe::TEST);
+  Caffe::RNG rng(tester->seed);
+  Caffe::set_thread_rng_stream(&rng);
+  pthread_mutex_lock(&solver->tester_mutex_);
+  while (true) {
+    while (!solver->testers_stop_ &&
+        tester->state != Solver<Dtype>::TESTER_RUNNING) {
+      pthread_cond_wait(&solver->tester_start_, &solver->tester_mutex_);
+    }
+    if (solver->testers_stop_) {
+      break;
+    }
+    pthread_mutex_unlock(&solver->tester_mutex_);
+    solver->Evaluate(tester->id, &tester->test_score, &tester->loss);
+    pthread_mutex_lock(&solver->tester_mutex_);
+    tester->state = Solver<Dtype>::TESTER_DONE;
+    pthread_cond_broadcast(&solver->tester_done_);
+  }
+  pthread_mutex_unlock(&solver->tester_mutex_);
+  Caffe::set_thread_rng_stream(NULL);
+  Caffe::clear_thread_phase();
+  return static_cast<void*>(NULL);
+}
+
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param)
     : net_() {
@@ -34,6 +204,12 @@ Solver<Dtype>::Solver(const string& param_file)
   Init(param);
 }
 
+template <typename Dtype>
+Solver<Dtype>::~Solver() {
+  JoinTesters();
+  JoinWorkers();
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Init(const SolverParameter& param) {
   LOG(INFO) << "Initializing solver from parameters: " << std::endl
@@ -52,13 +228,28 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
     CHECK(!param_.has_train_net()) << "Either train_net_param or train_net may "
                                    << "be specified, but not both.";
     LOG(INFO) << "Creating training net specified in SolverParameter.";
-    net_.reset(new Net<Dtype>(param_.train_net_param()));
+    train_net_param_.CopyFrom(param_.train_net_param());
   } else {
     CHECK(param_.has_train_net())
         << "Neither train_net nor train_net_param were specified.";
     LOG(INFO) << "Creating training net from file: " << param_.train_net();
-    net_.reset(new Net<Dtype>(param_.train_net()));
+    ReadNetParamsFromTextFileOrDie(param_.train_net(), &train_net_param_);
+  }
+  CHECK_GE(param_.num_workers(), 1);
+  if (param_.num_workers() > 1) {
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "Data parallel training runs on the CPU only.";
   }
+  if (param_.hogwild()) {
+    CHECK(!param_.weight_constraint())
+        << "Hogwild training does not constrain the weights.";
+  }
+  if (param_.test_async()) {
+    CHECK_EQ(Caffe::mode(), Caffe::CPU)
+        << "Asynchronous tests run on the CPU only.";
+  }
+  net_.reset(new Net<Dtype>(WorkerNetParameter(train_net_param_, 0,
+      param_.num_workers())));
   const int num_test_net_params = param_.test_net_param_size();
   const int num_test_net_files = param_.test_net_size();
   const int num_test_nets = num_test_net_params + num_test_net_files;
@@ -68,16 +259,23 @@ void Solver<Dtype>::Init(const SolverParameter& param) {
     CHECK_GT(param_.test_interval(), 0);
   }
   test_nets_.resize(num_test_nets);
+  // Test nets only run forward and are built without diffs, unless they
+  // explicitly ask for backward.
   for (int i = 0; i < num_test_net_params; ++i) {
       LOG(INFO) << "Creating testing net (#" << i
                 << ") specified in SolverParameter.";
-      test_nets_[i].reset(new Net<Dtype>(param_.test_net_param(i)));
+      NetParameter test_net_param(param_.test_net_param(i));
+      test_net_param.set_inference(!test_net_param.force_backward());
+      test_nets_[i].reset(new Net<Dtype>(test_net_param));
   }
   for (int i = 0, test_net_id = num_test_net_params;
        i < num_test_net_files; ++i, ++test_net_id) {
       LOG(INFO) << "Creating testing net (#" << test_net_id
                 << ") from file: " << param.test_net(i);
-      test_nets_[test_net_id].reset(new Net<Dtype>(param_.test_net(i)));
+      NetParameter test_net_param;
+      ReadNetParamsFromTextFileOrDie(param_.test_net(i), &test_net_param);
+      test_net_param.set_inference(!test_net_param.force_backward());
+      test_nets_[test_net_id].reset(new Net<Dtype>(test_net_param));
   }
   CHECK_GT(this->param_.termination_criterion().size(), 0) << "at least one termination criterion needed.";
   termination_criterions_.resize(this->param_.termination_criterion().size());
@@ -147,10 +345,19 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   // very long time (param_.test_interval() training iterations) to report that
   // there's not enough memory to run the test net and crash, etc.; and to gauge
   // the effect of the first training iterations.
+  CreateTesters();
   if (param_.test_interval()) {
     TestAll();
   }
 
+  CHECK_GE(param_.iter_size(), 1);
+  if (param_.iter_size() > 1) {
+    LOG(INFO) << "Averaging the gradients of " << param_.iter_size()
+              << " batches per iteration";
+    net_->SetAccumulateParamDiffs(true);
+  }
+  CreateWorkers();
+
   // For a network that is trained by the solver, no bottom or top vecs
   // should be given, and we will just provide dummy vecs.
   vector<Blob<Dtype>*> bottom_vec;
@@ -159,25 +366,54 @@ void Solver<Dtype>::Solve(const char* resume_file) {
     for (int i=0; i < termination_criterions_.size(); i++) {
       termination_criterions_[i]->NotifyIteration(iter_);
     }
+    ReportTests();
 
-    Dtype loss = net_->ForwardBackward(bottom_vec);
-    ComputeUpdateValue();
-    net_->Update();
+    Dtype loss;
+    if (hogwild()) {
+      ResumeWorkers();
+      loss = HogwildStep(0, bottom_vec);
+    } else {
+      loss = ForwardBackward(bottom_vec);
+      ApplyUpdate();
+    }
 
     if (param_.display() && iter_ % param_.display() == 0) {
       //LOG(INFO) << "Iteration " << iter_ << ", loss = " << loss;
       for(std::vector<std::pair<int, float> >::iterator it = net_->losses().begin(); it != net_->losses().end(); ++it)
         LOG(INFO) << "Iteration " << iter_ << ", loss layer " << net_->layer_names()[(*it).first] << " = " << (*it).second;
       LOG(INFO) << "Iteration " << iter_ << ", total loss = " << loss;
+      if (hogwild()) {
+        pthread_mutex_lock(&worker_mutex_);
+        LOG(INFO) << "Iteration " << iter_ << ", " << workers_.size()
+                  << " Hogwild workers, " << hogwild_updates_
+                  << " updates, staleness mean = " << staleness_sum_ /
+                     std::max(hogwild_display_updates_, 1)
+                  << ", max = " << staleness_max_;
+        hogwild_display_updates_ = 0;
+        staleness_sum_ = 0;
+        staleness_max_ = 0;
+        pthread_mutex_unlock(&worker_mutex_);
+      } else if (workers_.size() > 1) {
+        // the share of the time the workers were busy with their passes,
+        // rather than waiting for each other or reducing the gradients
+        LOG(INFO) << "Iteration " << iter_ << ", " << workers_.size()
+                  << " workers, scaling efficiency = "
+                  << 100 * worker_seconds_ / iteration_seconds_ << "%";
+        worker_seconds_ = iteration_seconds_ = 0;
+      }
     }
     if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
+      PauseWorkers();
       TestAll();
     }
     // Check if we need to do snapshot
     if (param_.snapshot() && iter_ % param_.snapshot() == 0) {
+      PauseWorkers();
       Snapshot();
     }
   } while (!TerminationCriterionsMet());
+  JoinTesters();
+  JoinWorkers();
   if (param_.snapshot_on_exit()) {
     //iter_--;
     Snapshot();
@@ -185,6 +421,220 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   LOG(INFO) << "Optimization Done.";
 }
 
+template <typename Dtype>
+Dtype Solver<Dtype>::ForwardBackward(const vector<Blob<Dtype>*>& bottom) {
+  if (workers_.size() <= 1) {
+    return ForwardBackward(net_.get(), bottom);
+  }
+  Timer timer;
+  timer.Start();
+  pthread_mutex_lock(&worker_mutex_);
+  ++workers_generation_;
+  workers_done_ = 0;
+  pthread_cond_broadcast(&worker_start_);
+  pthread_mutex_unlock(&worker_mutex_);
+  Worker& root = workers_[0];
+  Timer root_timer;
+  root_timer.Start();
+  root.loss = ForwardBackward(net_.get(), bottom);
+  root.seconds = root_timer.Seconds();
+  pthread_mutex_lock(&worker_mutex_);
+  while (workers_done_ < workers_.size() - 1) {
+    pthread_cond_wait(&worker_done_, &worker_mutex_);
+  }
+  pthread_mutex_unlock(&worker_mutex_);
+  ReduceParamDiffs();
+  Dtype loss = 0;
+  LayerLossSums layer_losses;
+  for (int w = 0; w < workers_.size(); ++w) {
+    loss += workers_[w].loss;
+    worker_seconds_ += workers_[w].seconds / workers_.size();
+    AddLayerLosses(workers_[w].net->losses(), &layer_losses);
+  }
+  SetLayerLosses(layer_losses, 0, &net_->losses());
+  iteration_seconds_ += timer.Seconds();
+  return loss / workers_.size();
+}
+
+template <typename Dtype>
+Dtype Solver<Dtype>::ForwardBackward(Net<Dtype>* net,
+    const vector<Blob<Dtype>*>& bottom) {
+  const int iter_size = param_.iter_size();
+  if (iter_size == 1) {
+    return net->ForwardBackward(bottom);
+  }
+  // the layers add to the diffs, cleared here rather than by Backward
+  net->ClearParamDiffs();
+  Dtype loss = 0;
+  LayerLossSums layer_losses;
+  for (int i = 0; i < iter_size; ++i) {
+    loss += net->ForwardBackward(bottom);
+    AddLayerLosses(net->losses(), &layer_losses);
+  }
+  net->ScaleParamDiffs(Dtype(1) / iter_size);
+  // a loss missing from a pass was zero in it
+  SetLayerLosses(layer_losses, iter_size, &net->losses());
+  return loss / iter_size;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::CreateWorkers() {
+  const int num_workers = param_.num_workers();
+  if (num_workers <= 1 || !workers_.empty()) {
+    return;
+  }
+  LOG(INFO) << "Training " << (param_.hogwild() ? "Hogwild" : "data parallel")
+            << " on " << num_workers << " workers";
+  workers_generation_ = 0;
+  workers_done_ = 0;
+  workers_stop_ = false;
+  worker_seconds_ = iteration_seconds_ = 0;
+  // the Hogwild workers start with the first iteration
+  workers_paused_ = true;
+  workers_running_ = 0;
+  hogwild_iter_ = iter_;
+  hogwild_updates_ = hogwild_display_updates_ = 0;
+  staleness_sum_ = 0;
+  staleness_max_ = 0;
+  CHECK(!pthread_mutex_init(&worker_mutex_, NULL));
+  CHECK(!pthread_cond_init(&worker_start_, NULL));
+  CHECK(!pthread_cond_init(&worker_done_, NULL));
+  // The workers' BLAS calls and layer loops run concurrently, each on its
+  // own cores.
+  cpu_threads_ = Caffe::cpu_threads();
+  Caffe::set_cpu_threads(std::max(cpu_threads_ / num_workers, 1));
+  caffe_set_cpu_blas_num_threads(1);
+  workers_.resize(num_workers);
+  for (int w = 0; w < num_workers; ++w) {
+    workers_[w].solver = this;
+    workers_[w].id = w;
+    workers_[w].loss = 0;
+    workers_[w].seconds = 0;
+  }
+  workers_[0].net = net_;
+  // One at a time, as building a net draws from the caller's generator.
+  for (int w = 1; w < num_workers; ++w) {
+    CHECK(!pthread_create(&workers_[w].thread, NULL, SolverWorker<Dtype>,
+          static_cast<void*>(&workers_[w]))) << "Pthread execution failed.";
+    pthread_mutex_lock(&worker_mutex_);
+    while (workers_done_ < w) {
+      pthread_cond_wait(&worker_done_, &worker_mutex_);
+    }
+    pthread_mutex_unlock(&worker_mutex_);
+  }
+  // Worker 0 is the solver thread, pinned after the others were created so
+  // that they do not start on its cores. Its net was built before, so only
+  // its passes, not its memory, move to its share.
+  solver_pinned_ = param_.pin_workers() &&
+      !pthread_getaffinity_np(pthread_self(), sizeof(solver_cores_),
+          &solver_cores_);
+  if (solver_pinned_) {
+    PinWorker(0, num_workers);
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::JoinWorkers() {
+  if (workers_.empty()) {
+    return;
+  }
+  pthread_mutex_lock(&worker_mutex_);
+  workers_stop_ = true;
+  pthread_cond_broadcast(&worker_start_);
+  pthread_mutex_unlock(&worker_mutex_);
+  for (int w = 1; w < workers_.size(); ++w) {
+    CHECK(!pthread_join(workers_[w].thread, NULL))
+        << "Pthread joining failed.";
+  }
+  workers_.clear();
+  pthread_cond_destroy(&worker_done_);
+  pthread_cond_destroy(&worker_start_);
+  pthread_mutex_destroy(&worker_mutex_);
+  if (solver_pinned_) {
+    pthread_setaffinity_np(pthread_self(), sizeof(solver_cores_),
+        &solver_cores_);
+  }
+  // which also gives BLAS its threads back
+  Caffe::set_cpu_threads(cpu_threads_);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::PauseWorkers() {
+  if (!hogwild()) {
+    return;
+  }
+  pthread_mutex_lock(&worker_mutex_);
+  workers_paused_ = true;
+  while (workers_running_ > 0) {
+    pthread_cond_wait(&worker_done_, &worker_mutex_);
+  }
+  pthread_mutex_unlock(&worker_mutex_);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ResumeWorkers() {
+  if (!hogwild() || !workers_paused_) {
+    return;
+  }
+  pthread_mutex_lock(&worker_mutex_);
+  workers_paused_ = false;
+  pthread_cond_broadcast(&worker_start_);
+  pthread_mutex_unlock(&worker_mutex_);
+}
+
+template <typename Dtype>
+Dtype Solver<Dtype>::HogwildStep(const int worker_id,
+    const vector<Blob<Dtype>*>& bottom) {
+  Worker& worker = workers_[worker_id];
+  pthread_mutex_lock(&worker_mutex_);
+  if (worker_id == 0) {
+    // the solver thread owns iter_
+    hogwild_iter_ = iter_;
+  }
+  const int iter = hogwild_iter_;
+  const int read_updates = hogwild_updates_;
+  pthread_mutex_unlock(&worker_mutex_);
+  worker.loss = ForwardBackward(worker.net.get(), bottom);
+  // the weights change under the passes and the update: that is Hogwild
+  ApplyWorkerUpdate(worker_id, iter);
+  pthread_mutex_lock(&worker_mutex_);
+  const int staleness = hogwild_updates_ - read_updates;
+  ++hogwild_updates_;
+  ++hogwild_display_updates_;
+  staleness_sum_ += staleness;
+  staleness_max_ = std::max(staleness_max_, staleness);
+  pthread_mutex_unlock(&worker_mutex_);
+  return worker.loss;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReduceParamDiffs() {
+  const int num_workers = workers_.size();
+  const vector<shared_ptr<Blob<Dtype> > >& params = net_->params();
+  const Dtype scale = Dtype(1) / num_workers;
+  // slices of 64 KB of floats
+  const int slice = 16384;
+  for (int i = 0; i < params.size(); ++i) {
+    const int count = params[i]->count();
+    const int num_slices = (count + slice - 1) / slice;
+    Dtype* diff = params[i]->mutable_cpu_diff();
+    vector<const Dtype*> worker_diffs(num_workers);
+    for (int w = 1; w < num_workers; ++w) {
+      worker_diffs[w] = workers_[w].net->params()[i]->cpu_diff();
+    }
+    const int threads = caffe_cpu_threads(num_workers, num_slices);
+#pragma omp parallel for num_threads(threads)
+    for (int s = 0; s < num_slices; ++s) {
+      const int begin = s * slice;
+      const int n = std::min(count, begin + slice) - begin;
+      for (int w = 1; w < num_workers; ++w) {
+        caffe_axpy<Dtype>(n, Dtype(1), worker_diffs[w] + begin, diff + begin);
+      }
+      caffe_scal<Dtype>(n, scale, diff + begin);
+    }
+  }
+}
+
 template <typename Dtype>
 bool Solver<Dtype>::TerminationCriterionsMet() {
   for (int i=0; i < termination_criterions_.size(); i++) {
@@ -201,7 +651,11 @@ void Solver<Dtype>::TestAll() {
   timer = time(NULL);
   LOG(INFO) << "Test timestamp " << timer;
   for (int test_net_id = 0; test_net_id < test_nets_.size(); ++test_net_id) {
-    Test(test_net_id);
+    if (testers_.empty()) {
+      Test(test_net_id);
+    } else {
+      TestAsync(test_net_id);
+    }
   }
 }
 
@@ -215,20 +669,30 @@ void Solver<Dtype>::Test(const int test_net_id) {
   CHECK_NOTNULL(test_nets_[test_net_id].get())->
       ShareTrainedLayersWith(net_.get());
   vector<Dtype> test_score;
+  Dtype loss;
+  Evaluate(test_net_id, &test_score, &loss);
+  ReportTest(test_net_id, iter_, test_score, loss);
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::Evaluate(const int test_net_id,
+    vector<Dtype>* test_score, Dtype* loss) {
   vector<Blob<Dtype>*> bottom_vec;
-  Dtype loss = 0;
+  test_score->clear();
+  *loss = 0;
   for (int i = 0; i < param_.test_iter(test_net_id); ++i) {
     Dtype iter_loss;
     const vector<Blob<Dtype>*>& result =
         test_nets_[test_net_id]->Forward(bottom_vec, &iter_loss);
     if (param_.test_compute_loss()) {
-      loss += iter_loss;
+      *loss += iter_loss;
     }
     if (i == 0) {
       for (int j = 0; j < result.size(); ++j) {
         const Dtype* result_vec = result[j]->cpu_data();
         for (int k = 0; k < result[j]->count(); ++k) {
-          test_score.push_back(result_vec[k]);
+          test_score->push_back(result_vec[k]);
         }
       }
     } else {
@@ -236,14 +700,19 @@ void Solver<Dtype>::Test(const int test_net_id) {
       for (int j = 0; j < result.size(); ++j) {
         const Dtype* result_vec = result[j]->cpu_data();
         for (int k = 0; k < result[j]->count(); ++k) {
-          test_score[idx++] += result_vec[k];
+          (*test_score)[idx++] += result_vec[k];
         }
       }
     }
   }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReportTest(const int test_net_id, const int iter,
+    const vector<Dtype>& test_score, const Dtype loss) {
   if (param_.test_compute_loss()) {
-    loss /= param_.test_iter(test_net_id);
-    LOG(INFO) << test_nets_[test_net_id]->name() << " test loss: " << loss;
+    LOG(INFO) << test_nets_[test_net_id]->name() << " test loss: "
+        << loss / param_.test_iter(test_net_id);
   }
   for (int i = 0; i < test_score.size(); ++i) {
     LOG(INFO) << test_nets_[test_net_id]->name() << " test score #" << i << ": "
@@ -257,7 +726,102 @@ void Solver<Dtype>::Test(const int test_net_id) {
       termination_criterions_[i]->NotifyValidationLoss(valid_loss);
     }
   }
-  Caffe::set_phase(Caffe::TRAIN);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::CreateTesters() {
+  if (!param_.test_async() || test_nets_.empty() || !testers_.empty()) {
+    return;
+  }
+  LOG(INFO) << "Testing asynchronously on " << test_nets_.size()
+            << " threads";
+  testers_stop_ = false;
+  CHECK(!pthread_mutex_init(&tester_mutex_, NULL));
+  CHECK(!pthread_cond_init(&tester_start_, NULL));
+  CHECK(!pthread_cond_init(&tester_done_, NULL));
+  testers_.resize(test_nets_.size());
+  for (int t = 0; t < testers_.size(); ++t) {
+    testers_[t].solver = this;
+    testers_[t].id = t;
+    testers_[t].seed = caffe_rng_rand();
+    testers_[t].state = TESTER_IDLE;
+    testers_[t].iter = 0;
+    testers_[t].loss = 0;
+  }
+  for (int t = 0; t < testers_.size(); ++t) {
+    CHECK(!pthread_create(&testers_[t].thread, NULL, SolverTester<Dtype>,
+          static_cast<void*>(&testers_[t]))) << "Pthread execution failed.";
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::TestAsync(const int test_net_id) {
+  Tester& tester = testers_[test_net_id];
+  pthread_mutex_lock(&tester_mutex_);
+  if (tester.state == TESTER_RUNNING) {
+    LOG(INFO) << "Iteration " << iter_ << ", waiting for the test of "
+              << "iteration " << tester.iter << " (#" << test_net_id << ")";
+    while (tester.state == TESTER_RUNNING) {
+      pthread_cond_wait(&tester_done_, &tester_mutex_);
+    }
+  }
+  pthread_mutex_unlock(&tester_mutex_);
+  ReportTests();
+  LOG(INFO) << "Iteration " << iter_
+            << ", Testing net (#" << test_net_id << ") asynchronously";
+  test_nets_[test_net_id]->CopyTrainedLayersFrom(net_.get());
+  pthread_mutex_lock(&tester_mutex_);
+  tester.iter = iter_;
+  tester.timer.Start();
+  tester.state = TESTER_RUNNING;
+  pthread_cond_broadcast(&tester_start_);
+  pthread_mutex_unlock(&tester_mutex_);
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReportTests() {
+  for (int t = 0; t < testers_.size(); ++t) {
+    Tester& tester = testers_[t];
+    pthread_mutex_lock(&tester_mutex_);
+    const bool done = tester.state == TESTER_DONE;
+    pthread_mutex_unlock(&tester_mutex_);
+    if (!done) {
+      continue;
+    }
+    LOG(INFO) << "Iteration " << iter_ << ", Tested net (#" << t
+              << ") at iteration " << tester.iter << ", "
+              << iter_ - tester.iter << " iterations and "
+              << tester.timer.Seconds() << " s ago";
+    ReportTest(t, tester.iter, tester.test_score, tester.loss);
+    pthread_mutex_lock(&tester_mutex_);
+    tester.state = TESTER_IDLE;
+    pthread_mutex_unlock(&tester_mutex_);
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::JoinTesters() {
+  if (testers_.empty()) {
+    return;
+  }
+  pthread_mutex_lock(&tester_mutex_);
+  for (int t = 0; t < testers_.size(); ++t) {
+    while (testers_[t].state == TESTER_RUNNING) {
+      pthread_cond_wait(&tester_done_, &tester_mutex_);
+    }
+  }
+  testers_stop_ = true;
+  pthread_cond_broadcast(&tester_start_);
+  pthread_mutex_unlock(&tester_mutex_);
+  ReportTests();
+  for (int t = 0; t < testers_.size(); ++t) {
+    CHECK(!pthread_join(testers_[t].thread, NULL))
+        << "Pthread joining failed.";
+  }
+  testers_.clear();
+  pthread_cond_destroy(&tester_done_);
+  pthread_cond_destroy(&tester_start_);
+  pthread_mutex_destroy(&tester_mutex_);
 }
 
 
@@ -305,25 +869,25 @@ void Solver<Dtype>::Restore(const char* state_file) {
 // where base_lr, gamma, step and power are defined in the solver parameter
 // protocol buffer, and iter is the current iteration.
 template <typename Dtype>
-Dtype SGDSolver<Dtype>::GetLearningRate() {
+Dtype SGDSolver<Dtype>::GetLearningRate(const int iter) {
   Dtype rate;
   const string& lr_policy = this->param_.lr_policy();
   if (lr_policy == "fixed") {
     rate = this->param_.base_lr();
   } else if (lr_policy == "step") {
     CHECK_GT(this->param_.stepsize(), 0) << "step size necessary.";
-    int current_step = this->iter_ / this->param_.stepsize();
+    int current_step = iter / this->param_.stepsize();
     rate = this->param_.base_lr() *
         pow(this->param_.gamma(), current_step);
   } else if (lr_policy == "exp") {
-    rate = this->param_.base_lr() * pow(this->param_.gamma(), this->iter_);
+    rate = this->param_.base_lr() * pow(this->param_.gamma(), iter);
   } else if (lr_policy == "inv") {
     rate = this->param_.base_lr() *
-        pow(Dtype(1) + this->param_.gamma() * this->iter_,
+        pow(Dtype(1) + this->param_.gamma() * iter,
             - this->param_.power());
   } else if (lr_policy == "inv_bergstra_bengio") {
     CHECK_GT(this->param_.stepsize(), 0) << "step size necessary.";
-    rate = (this->iter_ > this->param_.stepsize()) ? this->param_.base_lr() * Dtype(this->param_.stepsize()) / this->iter_
+    rate = (iter > this->param_.stepsize()) ? this->param_.base_lr() * Dtype(this->param_.stepsize()) / iter
       : this->param_.base_lr();
   } else if (lr_policy == "arbitrary_steps") {
     CHECK_GE(this->param_.step_lr_size(), 1) << "need step_lr and step_iter for the fixed_steps policy";
@@ -331,9 +895,9 @@ Dtype SGDSolver<Dtype>::GetLearningRate() {
     int nsteps = this->param_.step_iter_size();
     int end_iter = 0;
     int i;
-    for (i=0; i < nsteps && this->iter_ >= end_iter; ++i)
+    for (i=0; i < nsteps && iter >= end_iter; ++i)
       end_iter += this->param_.step_iter().Get(i);
-    if (this->iter_ >= end_iter)
+    if (iter >= end_iter)
       rate = this->param_.step_lr().Get(i);
     else
       rate = this->param_.step_lr().Get(i-1);
@@ -355,11 +919,63 @@ void SGDSolver<Dtype>::PreSolve() {
         net_param->num(), net_param->channels(), net_param->height(),
         net_param->width())));
   }
+  // allocated by the workers, on their nodes
+  worker_history_.clear();
+  worker_history_.resize(this->param_.num_workers());
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyWorkerUpdate(const int worker_id,
+    const int iter) {
+  if (worker_id == 0) {
+    ApplyUpdate();
+    return;
+  }
+  Net<Dtype>* net = this->workers_[worker_id].net.get();
+  vector<shared_ptr<Blob<Dtype> > >& net_params = net->params();
+  vector<float>& net_params_lr = net->params_lr();
+  vector<float>& net_params_weight_decay = net->params_weight_decay();
+  vector<shared_ptr<Blob<Dtype> > >& history = worker_history_[worker_id];
+  if (history.empty()) {
+    for (int i = 0; i < net_params.size(); ++i) {
+      const Blob<Dtype>* net_param = net_params[i].get();
+      history.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>(
+          net_param->num(), net_param->channels(), net_param->height(),
+          net_param->width())));
+    }
+  }
+  // at the iteration of the solver thread
+  Dtype rate = GetLearningRate(iter);
+  Dtype momentum = this->param_.momentum();
+  Dtype weight_decay = this->param_.weight_decay();
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
+    Dtype local_rate = rate * net_params_lr[param_id];
+    Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
+    caffe_cpu_sgd_update(net_params[param_id]->count(), local_rate,
+        momentum, local_decay, true,
+        net_params[param_id]->mutable_cpu_data(),
+        net_params[param_id]->mutable_cpu_diff(),
+        history[param_id]->mutable_cpu_data());
+  }
 }
 
 
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyUpdate() {
+  if (Caffe::mode() == Caffe::CPU && !this->param_.weight_constraint()) {
+    ComputeUpdateValue(true);
+  } else {
+    Solver<Dtype>::ApplyUpdate();
+  }
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue() {
+  ComputeUpdateValue(false);
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateValue(const bool update_data) {
   vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
   const vector<shared_ptr<Layer<Dtype> > >& net_layers = this->net_->layers();
   vector<float>& net_params_lr = this->net_->params_lr();
@@ -376,35 +992,26 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   switch (Caffe::mode()) {
   case Caffe::CPU:
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
-      // Compute the value to history, and then copy them to the blob's diff.
+      // Compute the value to history and the blob's diff in one pass, and
+      // apply it to the blob's data too if asked to.
       Dtype local_rate = rate * net_params_lr[param_id];
       Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-      Dtype weight_constraint = net_params_weight_constraint[param_id];
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-          net_params[param_id]->cpu_diff(), momentum,
+      caffe_cpu_sgd_update(net_params[param_id]->count(), local_rate,
+          momentum, local_decay, update_data,
+          net_params[param_id]->mutable_cpu_data(),
+          net_params[param_id]->mutable_cpu_diff(),
           history_[param_id]->mutable_cpu_data());
-      if (local_decay) {
-        // add weight decay
-        caffe_axpy(net_params[param_id]->count(),
-            local_decay * local_rate,
-            net_params[param_id]->cpu_data(),
-            history_[param_id]->mutable_cpu_data());
-      }
     }
-    // rescale if necessary
+    // rescale if necessary; the diff is applied to the rescaled weights
     if (constrain_weights) {
+        CHECK(!update_data);
         for (int layer_id = 0; layer_id < net_layers.size(); ++layer_id) {
             net_layers[layer_id]->normalize_weights(net_params_weight_constraint[layer_id]);
         }
     }
-    for (int param_id = 0; param_id < net_params.size(); ++param_id) {
-      // copy
-      caffe_copy(net_params[param_id]->count(),
-          history_[param_id]->cpu_data(),
-          net_params[param_id]->mutable_cpu_diff());
-    }
     break;
   case Caffe::GPU:
+    CHECK(!update_data);
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
       // Compute the value to history, and then copy them to the blob's diff.
       Dtype local_rate = rate * net_params_lr[param_id];
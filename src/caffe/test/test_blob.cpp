@@ -57,4 +57,29 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestReshapeCapacity) {
+  // Shrinking and regrowing within the capacity keeps the memory.
+  const TypeParam* data = this->blob_preshaped_->cpu_data();
+  this->blob_preshaped_->Reshape(1, 3, 4, 5);
+  EXPECT_EQ(this->blob_preshaped_->count(), 60);
+  EXPECT_EQ(this->blob_preshaped_->capacity(), 120);
+  EXPECT_EQ(this->blob_preshaped_->cpu_data(), data);
+  this->blob_preshaped_->Reshape(2, 3, 4, 5);
+  EXPECT_EQ(this->blob_preshaped_->cpu_data(), data);
+  this->blob_preshaped_->Reshape(3, 3, 4, 5);
+  EXPECT_EQ(this->blob_preshaped_->count(), 180);
+  EXPECT_EQ(this->blob_preshaped_->capacity(), 180);
+}
+
+TYPED_TEST(BlobSimpleTest, TestDiffEnabled) {
+  EXPECT_TRUE(this->blob_preshaped_->diff_enabled());
+  this->blob_preshaped_->set_diff_enabled(false);
+  EXPECT_FALSE(this->blob_preshaped_->diff());
+  this->blob_preshaped_->Reshape(3, 3, 4, 5);
+  EXPECT_FALSE(this->blob_preshaped_->diff_enabled());
+  this->blob_preshaped_->set_diff_enabled(true);
+  EXPECT_EQ(this->blob_preshaped_->diff()->size(), 180 * sizeof(TypeParam));
+  EXPECT_TRUE(this->blob_preshaped_->cpu_diff());
+}
+
 }  // namespace caffe
@@ -0,0 +1,193 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <vector>
+
+#include "cuda_runtime.h"
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+#include "caffe/util/benchmark.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+extern cudaDeviceProp CAFFE_TEST_CUDA_PROP;
+
+// Times the CPU forward and backward passes of the convolution layers for a
+// range of settings and logs the throughput, so that the CPU engines can be
+// compared on the machine the tests run on. The results of every setting are
+// also checked against the first one.
+class ConvolutionBenchmarkTest : public ::testing::Test {
+ protected:
+  ConvolutionBenchmarkTest()
+      : blob_bottom_(new Blob<float>()),
+        blob_top_(new Blob<float>()) {}
+  virtual void SetUp() {
+    blob_bottom_->Reshape(16, 32, 27, 27);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    Caffe::set_mode(Caffe::CPU);
+  }
+  virtual ~ConvolutionBenchmarkTest() { delete blob_bottom_; delete blob_top_; }
+
+  // Runs num_iter forward/backward passes of layer and returns the number of
+  // images per second.
+  float Throughput(Layer<float>* layer, const int num_iter) {
+    layer->SetUp(blob_bottom_vec_, &blob_top_vec_);
+    FillerParameter filler_param;
+    GaussianFiller<float> filler(filler_param);
+    filler.Fill(this->blob_top_);
+    caffe_copy(blob_top_->count(), blob_top_->cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    // warm up
+    layer->Forward(blob_bottom_vec_, &blob_top_vec_);
+    layer->Backward(blob_top_vec_, true, &blob_bottom_vec_);
+    Timer timer;
+    timer.Start();
+    for (int i = 0; i < num_iter; ++i) {
+      layer->Forward(blob_bottom_vec_, &blob_top_vec_);
+      layer->Backward(blob_top_vec_, true, &blob_bottom_vec_);
+    }
+    return num_iter * blob_bottom_->num() / timer.Seconds();
+  }
+
+  void ExpectNear(const Blob<float>& reference, const Blob<float>& blob) {
+    ASSERT_EQ(reference.count(), blob.count());
+    for (int i = 0; i < blob.count(); ++i) {
+      EXPECT_NEAR(reference.cpu_data()[i], blob.cpu_data()[i], 1e-3);
+    }
+  }
+
+  Blob<float>* const blob_bottom_;
+  Blob<float>* const blob_top_;
+  vector<Blob<float>*> blob_bottom_vec_;
+  vector<Blob<float>*> blob_top_vec_;
+};
+
+TEST_F(ConvolutionBenchmarkTest, TestCPUThreadScaling) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(64);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Blob<float> top_reference;
+  vector<shared_ptr<Blob<float> > > params;
+  float serial_throughput = 0;
+  for (int threads = 1; threads <= blob_bottom_->num(); threads *= 2) {
+    convolution_param->set_num_threads(threads);
+    ConvolutionLayer<float> layer(layer_param);
+    // all settings share the parameters of the serial layer
+    layer.blobs() = params;
+    const float throughput = Throughput(&layer, 3);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    if (threads == 1) {
+      serial_throughput = throughput;
+      params = layer.blobs();
+      top_reference.CopyFrom(*blob_top_, false, true);
+    } else {
+      ExpectNear(top_reference, *blob_top_);
+    }
+    LOG(INFO) << "Convolution, " << threads << " thread(s): " << throughput
+        << " images/s (x" << throughput / serial_throughput << ")";
+  }
+}
+
+TEST_F(ConvolutionBenchmarkTest, TestCPUWinograd) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(64);
+  convolution_param->set_num_threads(1);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<float> layer(layer_param);
+  const float im2col_throughput = Throughput(&layer, 3);
+  layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+  Blob<float> top_reference;
+  top_reference.CopyFrom(*blob_top_, false, true);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  ConvolutionLayer<float> layer_winograd(layer_param);
+  layer_winograd.blobs() = layer.blobs();
+  const float winograd_throughput = Throughput(&layer_winograd, 3);
+  layer_winograd.Forward(blob_bottom_vec_, &blob_top_vec_);
+  ExpectNear(top_reference, *blob_top_);
+  LOG(INFO) << "Convolution 3x3, im2col: " << im2col_throughput
+      << " images/s, Winograd: " << winograd_throughput << " images/s (x"
+      << winograd_throughput / im2col_throughput << ")";
+}
+
+TEST_F(ConvolutionBenchmarkTest, TestCPUFFT) {
+  for (int kernel_size = 3; kernel_size <= 11; kernel_size += 2) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(kernel_size);
+    convolution_param->set_pad(kernel_size / 2);
+    convolution_param->set_num_output(16);
+    convolution_param->set_num_threads(1);
+    convolution_param->set_engine(ConvolutionParameter_Engine_IM2COL);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    ConvolutionLayer<float> layer(layer_param);
+    const float im2col_throughput = Throughput(&layer, 1);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    Blob<float> top_reference;
+    top_reference.CopyFrom(*blob_top_, false, true);
+    convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+    ConvolutionLayer<float> layer_fft(layer_param);
+    layer_fft.blobs() = layer.blobs();
+    const float fft_throughput = Throughput(&layer_fft, 1);
+    layer_fft.Forward(blob_bottom_vec_, &blob_top_vec_);
+    ExpectNear(top_reference, *blob_top_);
+    LOG(INFO) << "Convolution " << kernel_size << "x" << kernel_size
+        << ", im2col: " << im2col_throughput << " images/s, FFT: "
+        << fft_throughput << " images/s (x"
+        << fft_throughput / im2col_throughput << ")";
+  }
+}
+
+TEST_F(ConvolutionBenchmarkTest, TestCPUDeconvolutionFFT) {
+  for (int kernel_size = 3; kernel_size <= 11; kernel_size += 2) {
+    LayerParameter layer_param;
+    DeConvolutionParameter* deconvolution_param =
+        layer_param.mutable_deconvolution_param();
+    deconvolution_param->set_kernel_size(kernel_size);
+    deconvolution_param->set_stride(1);
+    deconvolution_param->set_pad(kernel_size / 2);
+    deconvolution_param->set_output_channels(3);
+    deconvolution_param->set_output_height(blob_bottom_->height());
+    deconvolution_param->set_output_width(blob_bottom_->width());
+    deconvolution_param->set_num_threads(1);
+    deconvolution_param->set_engine(ConvolutionParameter_Engine_IM2COL);
+    deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+    deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+    DeConvolutionLayer<float> layer(layer_param);
+    const float im2col_throughput = Throughput(&layer, 1);
+    layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+    Blob<float> top_reference;
+    top_reference.CopyFrom(*blob_top_, false, true);
+    deconvolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+    DeConvolutionLayer<float> layer_fft(layer_param);
+    layer_fft.blobs() = layer.blobs();
+    const float fft_throughput = Throughput(&layer_fft, 1);
+    layer_fft.Forward(blob_bottom_vec_, &blob_top_vec_);
+    ExpectNear(top_reference, *blob_top_);
+    LOG(INFO) << "Deconvolution " << kernel_size << "x" << kernel_size
+        << ", im2col: " << im2col_throughput << " images/s, FFT: "
+        << fft_throughput << " images/s (x"
+        << fft_throughput / im2col_throughput << ")";
+  }
+}
+
+}  // namespace caffe
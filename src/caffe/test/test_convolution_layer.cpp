@@ -252,6 +252,340 @@ TYPED_TEST(ConvolutionLayerTest, TestCPUGradientGroup) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestCPUBatchedColBuffer) {
+  // The batched column buffer should give the same result as the
+  // one-image-at-a-time path.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  convolution_param->set_col_buffer_mb(1);
+  ConvolutionLayer<TypeParam> layer_batched(layer_param);
+  layer_batched.blobs().push_back(layer.blobs()[0]);
+  layer_batched.blobs().push_back(layer.blobs()[1]);
+  layer_batched.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer_batched.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const TypeParam* ref_data = top_reference.cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradientBatchedColBuffer) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_col_buffer_mb(1);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradientThreaded) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_num_threads(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUAccumulateParamDiffs) {
+  // A second backward pass adds its gradients to the parameter diffs, on the
+  // threaded and the batched column buffer paths alike.
+  for (int batched = 0; batched < 2; ++batched) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_stride(2);
+    convolution_param->set_num_output(4);
+    if (batched) {
+      convolution_param->set_col_buffer_mb(1);
+    } else {
+      convolution_param->set_num_threads(2);
+    }
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    Caffe::set_mode(Caffe::CPU);
+    ConvolutionLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    FillerParameter filler_param;
+    GaussianFiller<TypeParam> filler(filler_param);
+    filler.Fill(this->blob_top_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+    vector<shared_ptr<Blob<TypeParam> > > diffs;
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      diffs.push_back(shared_ptr<Blob<TypeParam> >(new Blob<TypeParam>()));
+      diffs[i]->CopyFrom(*layer.blobs()[i], true, true);
+    }
+    layer.set_accumulate_param_diffs(true);
+    layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      for (int j = 0; j < diffs[i]->count(); ++j) {
+        EXPECT_NEAR(layer.blobs()[i]->cpu_diff()[j],
+            2 * diffs[i]->cpu_diff()[j], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUSimpleConvolutionStride1) {
+  // Summing a constant image with padding counts the pixels inside the image.
+  FillerParameter filler_param;
+  filler_param.set_value(1.);
+  ConstantFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(1);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("constant");
+  convolution_param->mutable_weight_filler()->set_value(1);
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<TypeParam> > layer(
+      new ConvolutionLayer<TypeParam>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  EXPECT_EQ(this->blob_top_->height(), 6);
+  EXPECT_EQ(this->blob_top_->width(), 4);
+  Caffe::set_mode(Caffe::CPU);
+  layer->Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  for (int n = 0; n < this->blob_top_->num(); ++n) {
+    for (int c = 0; c < this->blob_top_->channels(); ++c) {
+      for (int h = 0; h < 6; ++h) {
+        for (int w = 0; w < 4; ++w) {
+          int rows = (h == 0 || h == 5) ? 2 : 3;
+          int cols = (w == 0 || w == 3) ? 2 : 3;
+          EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w),
+              3 * rows * cols + 0.1, 1e-4);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradientStride1) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(1);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradient1x1) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_stride(1);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_num_threads(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUWinograd) {
+  // The Winograd engine should match im2col, also after the weights change.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  ConvolutionLayer<TypeParam> layer_winograd(layer_param);
+  layer_winograd.blobs() = layer.blobs();
+  layer_winograd.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    top_reference.CopyFrom(*this->blob_top_, false, true);
+    layer_winograd.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const TypeParam* top_data = this->blob_top_->cpu_data();
+    const TypeParam* ref_data = top_reference.cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_data[i], 1e-4);
+    }
+    caffe_scal(layer.blobs()[0]->count(), TypeParam(-2),
+        layer.blobs()[0]->mutable_cpu_data());
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradientWinograd) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUFFT) {
+  // The FFT engine should match im2col, also after the weights change.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(5);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_engine(ConvolutionParameter_Engine_IM2COL);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  ConvolutionLayer<TypeParam> layer_fft(layer_param);
+  layer_fft.blobs() = layer.blobs();
+  layer_fft.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  for (int iter = 0; iter < 2; ++iter) {
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    top_reference.CopyFrom(*this->blob_top_, false, true);
+    layer_fft.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    const TypeParam* top_data = this->blob_top_->cpu_data();
+    const TypeParam* ref_data = top_reference.cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_data[i], 1e-4);
+    }
+    caffe_scal(layer.blobs()[0]->count(), TypeParam(-2),
+        layer.blobs()[0]->mutable_cpu_data());
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradientFFT) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUFusedReLU) {
+  // A fused ReLU should match the convolution followed by a ReLU layer.
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  LayerParameter relu_param;
+  relu_param.set_type(LayerParameter_LayerType_RELU);
+  relu_param.mutable_relu_param()->set_negative_slope(0.1);
+  ReLULayer<TypeParam> relu_layer(relu_param);
+  relu_layer.SetUp(this->blob_top_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  relu_layer.Forward(this->blob_top_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  ConvolutionLayer<TypeParam> layer_fused(layer_param);
+  layer_fused.blobs() = layer.blobs();
+  EXPECT_TRUE(layer_fused.FuseActivation(relu_param));
+  layer_fused.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer_fused.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const TypeParam* ref_data = top_reference.cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestCPUGradientFusedTanH) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  ConvolutionLayer<TypeParam> layer(layer_param);
+  LayerParameter tanh_param;
+  tanh_param.set_type(LayerParameter_LayerType_TANH);
+  EXPECT_TRUE(layer.FuseActivation(tanh_param));
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
 TYPED_TEST(ConvolutionLayerTest, TestGPUGradient) {
   LayerParameter layer_param;
   ConvolutionParameter* convolution_param =
@@ -0,0 +1,321 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <google/protobuf/text_format.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "cuda_runtime.h"
+#include "gtest/gtest.h"
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/data_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::string;
+
+namespace caffe {
+
+extern cudaDeviceProp CAFFE_TEST_CUDA_PROP;
+
+template <typename Dtype>
+class DataAugmentationLayerTest : public ::testing::Test {
+ protected:
+  DataAugmentationLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(2, 3, 8, 8)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 1, 1)),
+        blob_top_data_(new Blob<Dtype>()),
+        blob_top_label_(new Blob<Dtype>()) {
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_top_vec_.push_back(blob_top_data_);
+    blob_top_vec_.push_back(blob_top_label_);
+    Caffe::set_mode(Caffe::CPU);
+    Caffe::set_phase(Caffe::TRAIN);
+  }
+  virtual ~DataAugmentationLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_top_data_;
+    delete blob_top_label_;
+  }
+
+  // The input batch of an iteration.
+  void FillBottom(const int iter) {
+    Dtype* data = blob_bottom_data_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_data_->count(); ++i) {
+      data[i] = (iter * 7 + i) % 50;
+    }
+    for (int n = 0; n < blob_bottom_label_->num(); ++n) {
+      blob_bottom_label_->mutable_cpu_data()[n] = iter * 10 + n;
+    }
+  }
+
+  // Runs num_iter forward passes and stores the tops of each.
+  void Run(const LayerParameter& param, const int num_iter,
+      vector<shared_ptr<Blob<Dtype> > >* data,
+      vector<shared_ptr<Blob<Dtype> > >* labels) {
+    DataAugmentationLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    EXPECT_EQ(blob_top_data_->num(), 2);
+    EXPECT_EQ(blob_top_data_->channels(), 3);
+    EXPECT_EQ(blob_top_data_->height(), 6);
+    EXPECT_EQ(blob_top_data_->width(), 6);
+    EXPECT_EQ(blob_top_label_->count(), 2);
+    for (int iter = 0; iter < num_iter; ++iter) {
+      FillBottom(iter);
+      layer.Forward(blob_bottom_vec_, &blob_top_vec_);
+      data->push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      data->back()->CopyFrom(*blob_top_data_, false, true);
+      labels->push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      labels->back()->CopyFrom(*blob_top_label_, false, true);
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_data_;
+  Blob<Dtype>* const blob_top_label_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(DataAugmentationLayerTest, Dtypes);
+
+TYPED_TEST(DataAugmentationLayerTest, TestCropPassthrough) {
+  LayerParameter param;
+  param.mutable_augmentation_param()->set_crop_size(6);
+  param.mutable_augmentation_param()->set_num_passthrough(1);
+  vector<shared_ptr<Blob<TypeParam> > > data;
+  vector<shared_ptr<Blob<TypeParam> > > labels;
+  this->Run(param, 3, &data, &labels);
+  for (int iter = 0; iter < 3; ++iter) {
+    this->FillBottom(iter);
+    // the centered crop and the labels of the same batch
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 3; ++c) {
+        for (int h = 0; h < 6; ++h) {
+          for (int w = 0; w < 6; ++w) {
+            EXPECT_EQ(data[iter]->data_at(n, c, h, w),
+                this->blob_bottom_data_->data_at(n, c, h + 1, w + 1));
+          }
+        }
+      }
+      EXPECT_EQ(labels[iter]->cpu_data()[n], iter * 10 + n);
+    }
+  }
+}
+
+TYPED_TEST(DataAugmentationLayerTest, TestAsync) {
+  LayerParameter param;
+  param.mutable_augmentation_param()->set_crop_size(6);
+  param.mutable_augmentation_param()->set_num_passthrough(1);
+  vector<shared_ptr<Blob<TypeParam> > > data;
+  vector<shared_ptr<Blob<TypeParam> > > labels;
+  this->Run(param, 4, &data, &labels);
+  param.mutable_augmentation_param()->set_async(true);
+  vector<shared_ptr<Blob<TypeParam> > > async_data;
+  vector<shared_ptr<Blob<TypeParam> > > async_labels;
+  this->Run(param, 4, &async_data, &async_labels);
+  // every batch comes one forward pass later, with its labels
+  for (int iter = 0; iter < 4; ++iter) {
+    const int batch = iter > 0 ? iter - 1 : 0;
+    for (int i = 0; i < data[batch]->count(); ++i) {
+      EXPECT_EQ(async_data[iter]->cpu_data()[i], data[batch]->cpu_data()[i]);
+    }
+    for (int i = 0; i < labels[batch]->count(); ++i) {
+      EXPECT_EQ(async_labels[iter]->cpu_data()[i],
+          labels[batch]->cpu_data()[i]);
+    }
+  }
+}
+
+TYPED_TEST(DataAugmentationLayerTest, TestAsyncShareActivations) {
+  const string proto =
+      "name: 'TestAsyncShareActivations' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 8 "
+      "input_dim: 8 "
+      "layers: { "
+      "  name: 'aug' "
+      "  type: DATA_AUGMENTATION "
+      "  augmentation_param { "
+      "    crop_size: 6 "
+      "    async: true "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'aug' "
+      "} "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 6 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'aug' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 4 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'ip3' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'ip2' "
+      "  top: 'ip3' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_phase(Caffe::TEST);
+  Net<TypeParam> net(param);
+  // ip2 could take the memory of aug, which goes to the pipeline
+  param.set_share_activations(true);
+  Net<TypeParam> net_shared(param);
+  net_shared.ShareTrainedLayersWith(&net);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  for (int iter = 0; iter < 4; ++iter) {
+    filler.Fill(net.input_blobs()[0]);
+    net_shared.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+    const Blob<TypeParam>* output = net.ForwardPrefilled()[0];
+    const Blob<TypeParam>* output_shared = net_shared.ForwardPrefilled()[0];
+    for (int i = 0; i < output->count(); ++i) {
+      EXPECT_EQ(output->cpu_data()[i], output_shared->cpu_data()[i])
+          << "debug: iter " << iter << " i " << i;
+    }
+  }
+}
+
+// Exposes the colour statistics.
+template <typename Dtype>
+class ColorStatsAugmentationLayer : public DataAugmentationLayer<Dtype> {
+ public:
+  explicit ColorStatsAugmentationLayer(const LayerParameter& param)
+      : DataAugmentationLayer<Dtype>(param) {}
+  const Dtype* mean_rgb() const { return this->mean_rgb_; }
+  const Dtype* max_abs_eig() const { return this->max_abs_eig_; }
+  const Dtype* max_rgb() const { return this->max_rgb_; }
+  const Dtype* min_rgb() const { return this->min_rgb_; }
+};
+
+// The serial pass over the batch the layer made before.
+template <typename Dtype>
+void color_stats_reference(const Blob<Dtype>& blob, Dtype* mean_rgb,
+    Dtype* max_abs_eig, Dtype* max_rgb, Dtype* min_rgb) {
+  const Dtype eigvec[9] = {0.51, 0.56, 0.65, 0.79, 0.01, -0.62, 0.35, -0.83,
+      0.44};
+  const int width = blob.height();
+  const int height = blob.width();
+  for (int c = 0; c < 3; ++c) {
+    mean_rgb[c] = max_abs_eig[c] = max_rgb[c] = min_rgb[c] = 0;
+  }
+  for (int n = 0; n < blob.num(); ++n) {
+    for (int x = 0; x < width; ++x) {
+      for (int y = 0; y < height; ++y) {
+        Dtype rgb[3];
+        for (int c = 0; c < 3; ++c) {
+          rgb[c] = blob.cpu_data()[((n * 3 + c) * width + x) * height + y];
+        }
+        for (int c = 0; c < 3; ++c) {
+          const Dtype eig = eigvec[3*c] * rgb[0] + eigvec[3*c+1] * rgb[1]
+              + eigvec[3*c+2] * rgb[2];
+          max_abs_eig[c] = std::max(max_abs_eig[c], Dtype(fabs(eig)));
+          max_rgb[c] = std::max(max_rgb[c], rgb[c]);
+          min_rgb[c] = std::min(min_rgb[c], rgb[c]);
+          mean_rgb[c] += rgb[c] / width / height;
+        }
+      }
+    }
+  }
+  for (int c = 0; c < 3; ++c) {
+    mean_rgb[c] /= blob.num();
+  }
+}
+
+TYPED_TEST(DataAugmentationLayerTest, TestColorStats) {
+  // an odd number of pixels, so that some are left after the vector loop
+  Blob<TypeParam> bottom(5, 3, 9, 7);
+  for (int i = 0; i < bottom.count(); ++i) {
+    bottom.mutable_cpu_data()[i] = ((i * 37) % 101) / 10. - 4.;
+  }
+  vector<Blob<TypeParam>*> bottom_vec(1, &bottom);
+  vector<Blob<TypeParam>*> top_vec(1, this->blob_top_data_);
+  LayerParameter param;
+  param.mutable_augmentation_param()->set_crop_size(5);
+  ColorStatsAugmentationLayer<TypeParam> layer(param);
+  layer.SetUp(bottom_vec, &top_vec);
+  layer.Forward(bottom_vec, &top_vec);
+  TypeParam mean_rgb[3], max_abs_eig[3], max_rgb[3], min_rgb[3];
+  color_stats_reference(bottom, mean_rgb, max_abs_eig, max_rgb, min_rgb);
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_NEAR(layer.mean_rgb()[c], mean_rgb[c], 1e-4);
+    EXPECT_NEAR(layer.max_abs_eig()[c], max_abs_eig[c], 1e-5);
+    EXPECT_EQ(layer.max_rgb()[c], max_rgb[c]);
+    EXPECT_EQ(layer.min_rgb()[c], min_rgb[c]);
+  }
+}
+
+TYPED_TEST(DataAugmentationLayerTest, TestColorStatsInterval) {
+  LayerParameter param;
+  param.mutable_augmentation_param()->set_crop_size(6);
+  param.mutable_augmentation_param()->set_num_passthrough(1);
+  param.mutable_augmentation_param()->set_color_stats_interval(2);
+  ColorStatsAugmentationLayer<TypeParam> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+  TypeParam mean_rgb[2][3], max_abs_eig[2][3], max_rgb[2][3], min_rgb[2][3];
+  for (int iter = 0; iter < 3; ++iter) {
+    this->FillBottom(iter);
+    // shift the batches apart
+    caffe_add_scalar(this->blob_bottom_data_->count(), TypeParam(iter * 10),
+        this->blob_bottom_data_->mutable_cpu_data());
+    if (iter % 2 == 0) {
+      color_stats_reference(*this->blob_bottom_data_, mean_rgb[iter / 2],
+          max_abs_eig[iter / 2], max_rgb[iter / 2], min_rgb[iter / 2]);
+    }
+    layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+    // measured on the first batch and kept for the second
+    for (int c = 0; iter < 2 && c < 3; ++c) {
+      EXPECT_NEAR(layer.mean_rgb()[c], mean_rgb[0][c], 1e-4);
+      EXPECT_NEAR(layer.max_abs_eig()[c], max_abs_eig[0][c], 1e-4);
+      EXPECT_EQ(layer.max_rgb()[c], max_rgb[0][c]);
+    }
+  }
+  // the third batch is averaged in
+  for (int c = 0; c < 3; ++c) {
+    EXPECT_NEAR(layer.mean_rgb()[c], (mean_rgb[0][c] + mean_rgb[1][c]) / 2,
+        1e-4);
+    EXPECT_NEAR(layer.max_abs_eig()[c],
+        std::max(max_abs_eig[0][c], max_abs_eig[1][c]), 1e-4);
+    EXPECT_EQ(layer.max_rgb()[c], std::max(max_rgb[0][c], max_rgb[1][c]));
+    EXPECT_EQ(layer.min_rgb()[c], std::min(min_rgb[0][c], min_rgb[1][c]));
+  }
+}
+
+}  // namespace caffe
@@ -1,5 +1,6 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <google/protobuf/text_format.h>
 #include <string>
 #include <vector>
 
@@ -9,6 +10,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/net.hpp"
 #include "caffe/vision_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/test/test_caffe_main.hpp"
@@ -298,6 +300,160 @@ class DataLayerTest : public ::testing::Test {
     }
   }
 
+  void TestReadCropTrainSequenceThreads() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(3);
+    data_param->set_crop_size(1);
+    data_param->set_mirror(true);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    // Get crop sequence with Caffe seed 1701 and a single worker.
+    Caffe::set_random_seed(seed_);
+    vector<vector<Dtype> > crop_sequence;
+    {
+      DataLayer<Dtype> layer1(param);
+      layer1.SetUp(blob_bottom_vec_, &blob_top_vec_);
+      for (int iter = 0; iter < 10; ++iter) {
+        layer1.Forward(blob_bottom_vec_, &blob_top_vec_);
+        crop_sequence.push_back(vector<Dtype>(blob_top_data_->cpu_data(),
+            blob_top_data_->cpu_data() + blob_top_data_->count()));
+      }
+    }  // destroy 1st data layer and unlock the database
+
+    // More workers and batches should give the same batches in order.
+    Caffe::set_random_seed(seed_);
+    data_param->set_prefetch_threads(3);
+    data_param->set_prefetch_depth(4);
+    DataLayer<Dtype> layer2(param);
+    layer2.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer2.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ((iter * 3 + i) % 5, blob_top_label_->cpu_data()[i]);
+      }
+      for (int i = 0; i < blob_top_data_->count(); ++i) {
+        EXPECT_EQ(crop_sequence[iter][i], blob_top_data_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+      }
+    }
+  }
+
+  void TestAugmentThreads() {
+    LayerParameter param;
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(3);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    AugmentationParameter* aug_param = param.mutable_augmentation_param();
+    aug_param->set_crop_size(2);
+    aug_param->mutable_mirror()->set_rand_type("bernoulli");
+    aug_param->mutable_translate()->set_spread(0.3);
+
+    // Get the augmented sequence with Caffe seed 1701 and a single thread.
+    Caffe::set_random_seed(seed_);
+    data_param->set_augment_threads(1);
+    vector<vector<Dtype> > crop_sequence;
+    {
+      DataLoadAndAugmentLayer<Dtype> layer1(param);
+      layer1.SetUp(blob_bottom_vec_, &blob_top_vec_);
+      for (int iter = 0; iter < 5; ++iter) {
+        layer1.Forward(blob_bottom_vec_, &blob_top_vec_);
+        crop_sequence.push_back(vector<Dtype>(blob_top_data_->cpu_data(),
+            blob_top_data_->cpu_data() + blob_top_data_->count()));
+      }
+    }  // destroy 1st data layer and unlock the database
+
+    // Items augmented concurrently should give the same batches.
+    Caffe::set_random_seed(seed_);
+    data_param->set_augment_threads(3);
+    DataLoadAndAugmentLayer<Dtype> layer2(param);
+    layer2.SetUp(blob_bottom_vec_, &blob_top_vec_);
+    for (int iter = 0; iter < 5; ++iter) {
+      layer2.Forward(blob_bottom_vec_, &blob_top_vec_);
+      for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ((iter * 3 + i) % 5, blob_top_label_->cpu_data()[i]);
+      }
+      for (int i = 0; i < blob_top_data_->count(); ++i) {
+        EXPECT_EQ(crop_sequence[iter][i], blob_top_data_->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+      }
+    }
+  }
+
+  // Runs a net reading batches through a prefetch ring with and without
+  // shared activations; ip2 could take the memory of the data.
+  void TestShareActivations() {
+    stringstream proto;
+    proto <<
+        "name: 'TestShareActivations' "
+        "layers: { "
+        "  name: 'data' "
+        "  type: DATA "
+        "  data_param { "
+        "    source: '" << *filename_ << "' "
+        "    backend: " << DataParameter_DB_Name(backend_) << " "
+        "    batch_size: 2 "
+        "    prefetch_depth: 3 "
+        "  } "
+        "  top: 'data' "
+        "  top: 'label' "
+        "} "
+        "layers: { "
+        "  name: 'ip1' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 6 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "    } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "} "
+        "layers: { "
+        "  name: 'ip2' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 4 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "    } "
+        "  } "
+        "  bottom: 'ip1' "
+        "  top: 'ip2' "
+        "} "
+        "layers: { "
+        "  name: 'ip3' "
+        "  type: INNER_PRODUCT "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { "
+        "      type: 'gaussian' "
+        "    } "
+        "  } "
+        "  bottom: 'ip2' "
+        "  top: 'ip3' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(), &param));
+    Net<Dtype> net(param);
+    param.set_share_activations(true);
+    Net<Dtype> net_shared(param);
+    net_shared.ShareTrainedLayersWith(&net);
+    const shared_ptr<Blob<Dtype> > ip3 = net.blob_by_name("ip3");
+    const shared_ptr<Blob<Dtype> > ip3_shared = net_shared.blob_by_name("ip3");
+    for (int iter = 0; iter < 6; ++iter) {
+      net.ForwardPrefilled();
+      net_shared.ForwardPrefilled();
+      for (int i = 0; i < ip3->count(); ++i) {
+        EXPECT_EQ(ip3->cpu_data()[i], ip3_shared->cpu_data()[i])
+            << "debug: iter " << iter << " i " << i;
+      }
+    }
+  }
+
   virtual ~DataLayerTest() { delete blob_top_data_; delete blob_top_label_; }
 
   DataParameter_DB backend_;
@@ -362,6 +518,26 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLevelDBGPU) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that several prefetch workers give the same sequence of batches as a
+// single one.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceThreadsLevelDBCPU) {
+  Caffe::set_phase(Caffe::TRAIN);
+  Caffe::set_mode(Caffe::CPU);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLevelDB(unique_pixels);
+  this->TestReadCropTrainSequenceThreads();
+}
+
+// Test that the items of a DataLoadAndAugmentLayer batch are augmented the
+// same way by one or several threads.
+TYPED_TEST(DataLayerTest, TestAugmentThreadsLevelDBCPU) {
+  Caffe::set_phase(Caffe::TRAIN);
+  Caffe::set_mode(Caffe::CPU);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLevelDB(unique_pixels);
+  this->TestAugmentThreads();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDBCPU) {
@@ -382,6 +558,16 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLevelDBGPU) {
   this->TestReadCropTrainSequenceUnseeded();
 }
 
+// Test that a net sharing its activations does not hand shared memory to the
+// prefetch ring.
+TYPED_TEST(DataLayerTest, TestShareActivationsLevelDBCPU) {
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_mode(Caffe::CPU);
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->FillLevelDB(unique_pixels);
+  this->TestShareActivations();
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTestLevelDBCPU) {
   Caffe::set_phase(Caffe::TEST);
   Caffe::set_mode(Caffe::CPU);
@@ -448,6 +634,16 @@ TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceSeededLMDBGPU) {
   this->TestReadCropTrainSequenceSeeded();
 }
 
+// Test that several prefetch workers give the same sequence of batches as a
+// single one.
+TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceThreadsLMDBCPU) {
+  Caffe::set_phase(Caffe::TRAIN);
+  Caffe::set_mode(Caffe::CPU);
+  const bool unique_pixels = true;  // all images the same; pixels different
+  this->FillLMDB(unique_pixels);
+  this->TestReadCropTrainSequenceThreads();
+}
+
 // Test that the sequence of random crops differs across iterations when
 // Caffe::set_random_seed isn't called (and seeds from srand are ignored).
 TYPED_TEST(DataLayerTest, TestReadCropTrainSequenceUnseededLMDBCPU) {
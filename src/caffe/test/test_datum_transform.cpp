@@ -0,0 +1,193 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/datum_transform.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::string;
+
+namespace caffe {
+
+// The per pixel loop DataLayer used before datum_transform_cpu, as the
+// reference.
+template <typename Dtype>
+void datum_transform_reference(const string& data, const int channels,
+    const int height, const int width, const Dtype* mean, const Dtype scale,
+    const int crop_size, const int h_off, const int w_off, const bool mirror,
+    Dtype* dst) {
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < crop_size; ++h) {
+      for (int w = 0; w < crop_size; ++w) {
+        int top_index = (c * crop_size + h) * crop_size
+            + (mirror ? crop_size - 1 - w : w);
+        int data_index = (c * height + h + h_off) * width + w + w_off;
+        Dtype datum_element =
+            static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
+        dst[top_index] = (datum_element - mean[data_index]) * scale;
+      }
+    }
+  }
+}
+
+class ParseDatumViewTest : public ::testing::Test {
+ protected:
+  ParseDatumViewTest() {
+    datum_.set_channels(3);
+    datum_.set_height(5);
+    datum_.set_width(7);
+    datum_.set_label(-2);
+    string data(3 * 5 * 7, 0);
+    for (int i = 0; i < data.size(); ++i) {
+      data[i] = (i * 13) % 256;
+    }
+    datum_.set_data(data);
+  }
+
+  Datum datum_;
+};
+
+TEST_F(ParseDatumViewTest, TestUint8) {
+  string value;
+  datum_.SerializeToString(&value);
+  DatumView view;
+  ASSERT_TRUE(ParseDatumView(value.data(), value.size(), &view));
+  EXPECT_EQ(view.channels, 3);
+  EXPECT_EQ(view.height, 5);
+  EXPECT_EQ(view.width, 7);
+  EXPECT_EQ(view.label, -2);
+  ASSERT_EQ(view.data_size, datum_.data().size());
+  // pointing into the buffer
+  EXPECT_GE(reinterpret_cast<const char*>(view.data), value.data());
+  EXPECT_LT(reinterpret_cast<const char*>(view.data), value.data()
+      + value.size());
+  for (int i = 0; i < view.data_size; ++i) {
+    EXPECT_EQ(view.data[i], static_cast<uint8_t>(datum_.data()[i]));
+  }
+}
+
+TEST_F(ParseDatumViewTest, TestFallback) {
+  DatumView view;
+  string value;
+  // float data is left to protobuf
+  datum_.clear_data();
+  datum_.add_float_data(1.5);
+  datum_.SerializeToString(&value);
+  EXPECT_FALSE(ParseDatumView(value.data(), value.size(), &view));
+  datum_.clear_float_data();
+  datum_.SerializeToString(&value);
+  EXPECT_FALSE(ParseDatumView(value.data(), value.size(), &view));
+  // and so are truncated records
+  datum_.set_data(string(10, 'a'));
+  datum_.SerializeToString(&value);
+  EXPECT_TRUE(ParseDatumView(value.data(), value.size(), &view));
+  EXPECT_FALSE(ParseDatumView(value.data(), value.size() - 3, &view));
+}
+
+template <typename Dtype>
+class DatumTransformTest : public ::testing::Test {
+ protected:
+  DatumTransformTest()
+      : channels_(3), height_(21), width_(37), data_(channels_ * height_
+        * width_, 0), mean_(data_.size()) {
+    for (int i = 0; i < data_.size(); ++i) {
+      data_[i] = (i * 37 + i / 7) % 256;
+      mean_[i] = (i * 11) % 128 + 0.25;
+    }
+  }
+
+  void ExpectTransform(const int crop_size, const int h_off, const int w_off,
+      const bool mirror) {
+    const Dtype scale = 0.5;
+    std::vector<Dtype> dst(channels_ * crop_size * crop_size);
+    std::vector<Dtype> dst_reference(dst.size());
+    datum_transform_cpu(reinterpret_cast<const uint8_t*>(data_.data()),
+        channels_, height_, width_, &mean_[0], scale, crop_size, crop_size,
+        h_off, w_off, mirror, &dst[0]);
+    datum_transform_reference(data_, channels_, height_, width_, &mean_[0],
+        scale, crop_size, h_off, w_off, mirror, &dst_reference[0]);
+    for (int i = 0; i < dst.size(); ++i) {
+      EXPECT_EQ(dst[i], dst_reference[i]);
+    }
+  }
+
+  const int channels_;
+  const int height_;
+  const int width_;
+  string data_;
+  std::vector<Dtype> mean_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(DatumTransformTest, Dtypes);
+
+TYPED_TEST(DatumTransformTest, TestFull) {
+  const TypeParam scale = 2;
+  std::vector<TypeParam> dst(this->data_.size());
+  datum_transform_cpu(reinterpret_cast<const uint8_t*>(this->data_.data()),
+      this->channels_, this->height_, this->width_, &this->mean_[0], scale,
+      this->height_, this->width_, 0, 0, false, &dst[0]);
+  for (int i = 0; i < dst.size(); ++i) {
+    EXPECT_EQ(dst[i], (static_cast<uint8_t>(this->data_[i]) - this->mean_[i])
+        * scale);
+  }
+}
+
+TYPED_TEST(DatumTransformTest, TestCrop) {
+  // crops of rows longer and shorter than the vector loop
+  this->ExpectTransform(19, 1, 3, false);
+  this->ExpectTransform(5, 9, 20, false);
+}
+
+TYPED_TEST(DatumTransformTest, TestCropMirror) {
+  this->ExpectTransform(19, 2, 17, true);
+  this->ExpectTransform(16, 0, 0, true);
+  this->ExpectTransform(3, 4, 4, true);
+}
+
+// Logs the throughput of datum_transform_cpu and of the reference loop on
+// ImageNet sized datums.
+TEST(DatumTransformBenchmarkTest, TestCropMirror) {
+  const int num = 64;
+  const int channels = 3;
+  const int size = 256;
+  const int crop_size = 227;
+  string data(channels * size * size, 0);
+  for (int i = 0; i < data.size(); ++i) {
+    data[i] = i % 251;
+  }
+  std::vector<float> mean(data.size(), 100.f);
+  std::vector<float> dst(channels * crop_size * crop_size);
+  std::vector<float> dst_reference(dst.size());
+  Timer timer;
+  timer.Start();
+  for (int n = 0; n < num; ++n) {
+    datum_transform_reference(data, channels, size, size, &mean[0], 0.5f,
+        crop_size, n % 29, n % 13, n % 2, &dst_reference[0]);
+  }
+  const float reference_throughput = num / timer.Seconds();
+  timer.Start();
+  for (int n = 0; n < num; ++n) {
+    datum_transform_cpu(reinterpret_cast<const uint8_t*>(data.data()),
+        channels, size, size, &mean[0], 0.5f, crop_size, crop_size, n % 29,
+        n % 13, n % 2, &dst[0]);
+  }
+  const float throughput = num / timer.Seconds();
+  for (int i = 0; i < dst.size(); ++i) {
+    EXPECT_EQ(dst[i], dst_reference[i]);
+  }
+  LOG(INFO) << "Datum crop and mirror, reference loop: "
+      << reference_throughput << " images/s, datum_transform_cpu: "
+      << throughput << " images/s (x" << throughput / reference_throughput
+      << ")";
+}
+
+}  // namespace caffe
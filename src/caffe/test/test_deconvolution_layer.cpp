@@ -144,6 +144,136 @@ TYPED_TEST(DeConvolutionLayerTest, TestCPUGradient) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(DeConvolutionLayerTest, TestCPUGradientThreaded) {
+  LayerParameter layer_param;
+  DeConvolutionParameter* deconvolution_param =
+      layer_param.mutable_deconvolution_param();
+  deconvolution_param->set_kernel_size(3);
+  deconvolution_param->set_stride(2);
+  deconvolution_param->set_output_channels(3);
+  deconvolution_param->set_output_height(6);
+  deconvolution_param->set_output_width(4);
+  deconvolution_param->set_num_threads(2);
+  deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+  deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  DeConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(DeConvolutionLayerTest, TestCPUGradientStride1) {
+  LayerParameter layer_param;
+  DeConvolutionParameter* deconvolution_param =
+      layer_param.mutable_deconvolution_param();
+  deconvolution_param->set_kernel_size(3);
+  deconvolution_param->set_stride(1);
+  deconvolution_param->set_pad(1);
+  deconvolution_param->set_output_channels(3);
+  deconvolution_param->set_output_height(6);
+  deconvolution_param->set_output_width(4);
+  deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+  deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  DeConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(DeConvolutionLayerTest, TestCPUGradient1x1) {
+  LayerParameter layer_param;
+  DeConvolutionParameter* deconvolution_param =
+      layer_param.mutable_deconvolution_param();
+  deconvolution_param->set_kernel_size(1);
+  deconvolution_param->set_stride(1);
+  deconvolution_param->set_output_channels(3);
+  deconvolution_param->set_output_height(6);
+  deconvolution_param->set_output_width(4);
+  deconvolution_param->set_num_threads(2);
+  deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+  deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  DeConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(DeConvolutionLayerTest, TestCPUFFT) {
+  // The FFT engine should give the same result as im2col.
+  LayerParameter layer_param;
+  DeConvolutionParameter* deconvolution_param =
+      layer_param.mutable_deconvolution_param();
+  deconvolution_param->set_kernel_size(5);
+  deconvolution_param->set_stride(1);
+  deconvolution_param->set_pad(2);
+  deconvolution_param->set_output_channels(3);
+  deconvolution_param->set_output_height(6);
+  deconvolution_param->set_output_width(4);
+  deconvolution_param->set_engine(ConvolutionParameter_Engine_IM2COL);
+  deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+  deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  DeConvolutionLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Blob<TypeParam> top_reference;
+  top_reference.CopyFrom(*this->blob_top_, false, true);
+  deconvolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  DeConvolutionLayer<TypeParam> layer_fft(layer_param);
+  layer_fft.blobs() = layer.blobs();
+  layer_fft.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer_fft.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  const TypeParam* ref_data = top_reference.cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(DeConvolutionLayerTest, TestCPUGradientFFT) {
+  LayerParameter layer_param;
+  DeConvolutionParameter* deconvolution_param =
+      layer_param.mutable_deconvolution_param();
+  deconvolution_param->set_kernel_size(3);
+  deconvolution_param->set_stride(1);
+  deconvolution_param->set_pad(1);
+  deconvolution_param->set_output_channels(3);
+  deconvolution_param->set_output_height(6);
+  deconvolution_param->set_output_width(4);
+  deconvolution_param->set_engine(ConvolutionParameter_Engine_FFT);
+  deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+  deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  DeConvolutionLayer<TypeParam> layer(layer_param);
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
+TYPED_TEST(DeConvolutionLayerTest, TestCPUGradientFusedSigmoid) {
+  LayerParameter layer_param;
+  DeConvolutionParameter* deconvolution_param =
+      layer_param.mutable_deconvolution_param();
+  deconvolution_param->set_kernel_size(3);
+  deconvolution_param->set_stride(2);
+  deconvolution_param->set_output_channels(3);
+  deconvolution_param->set_output_height(6);
+  deconvolution_param->set_output_width(4);
+  deconvolution_param->mutable_weight_filler()->set_type("gaussian");
+  deconvolution_param->mutable_bias_filler()->set_type("gaussian");
+  Caffe::set_mode(Caffe::CPU);
+  DeConvolutionLayer<TypeParam> layer(layer_param);
+  LayerParameter sigmoid_param;
+  sigmoid_param.set_type(LayerParameter_LayerType_SIGMOID);
+  EXPECT_TRUE(layer.FuseActivation(sigmoid_param));
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
 TYPED_TEST(DeConvolutionLayerTest, TestGPUGradient) {
   LayerParameter layer_param;
   DeConvolutionParameter* deconvolution_param =
@@ -0,0 +1,154 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hdf5.h"
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/util/hdf5_reader.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class HDF5RowReaderTest : public ::testing::Test {
+ protected:
+  HDF5RowReaderTest()
+      : filename_(std::string(tmpnam(NULL)) + ".h5"), num_(23),
+        row_size_(2 * 3 * 2) {}
+
+  // A float dataset of 23 rows of 2x3x2 in chunks of 4 rows, where value i
+  // is i.
+  virtual void SetUp() {
+    std::vector<float> data(num_ * row_size_);
+    for (int i = 0; i < data.size(); ++i) {
+      data[i] = i;
+    }
+    const hsize_t dims[4] = {num_, 2, 3, 2};
+    const hsize_t chunk_dims[4] = {4, 2, 3, 2};
+    hid_t file_id = H5Fcreate(filename_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+        H5P_DEFAULT);
+    ASSERT_GE(file_id, 0);
+    hid_t space_id = H5Screate_simple(4, dims, NULL);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist_id, 4, chunk_dims);
+    hid_t dataset_id = H5Dcreate2(file_id, "data", H5T_NATIVE_FLOAT, space_id,
+        H5P_DEFAULT, plist_id, H5P_DEFAULT);
+    ASSERT_GE(H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL,
+        H5P_DEFAULT, &data[0]), 0);
+    H5Dclose(dataset_id);
+    H5Pclose(plist_id);
+    H5Sclose(space_id);
+    H5Fclose(file_id);
+  }
+
+  virtual void TearDown() {
+    remove(filename_.c_str());
+  }
+
+  // The bytes of a window of rows.
+  size_t window_bytes(const int rows) const {
+    return sizeof(Dtype) * rows * row_size_;
+  }
+
+  void ExpectRows(const int row, const int num_rows, const Dtype* data) {
+    for (int i = 0; i < num_rows * row_size_; ++i) {
+      EXPECT_EQ(data[i], row * row_size_ + i);
+    }
+  }
+
+  const std::string filename_;
+  const int num_;
+  const int row_size_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(HDF5RowReaderTest, Dtypes);
+
+TYPED_TEST(HDF5RowReaderTest, TestShape) {
+  HDF5RowReader<TypeParam> reader(this->filename_, "data", 2, 4, 5, 0, false);
+  EXPECT_EQ(reader.num(), this->num_);
+  EXPECT_EQ(reader.channels(), 2);
+  EXPECT_EQ(reader.height(), 3);
+  EXPECT_EQ(reader.width(), 2);
+  EXPECT_EQ(reader.row_size(), this->row_size_);
+  // rounded up to whole chunks
+  EXPECT_EQ(reader.window_rows(), 8);
+  HDF5RowReader<TypeParam> row_reader(this->filename_, "data", 2, 4, 1, 0,
+      false);
+  EXPECT_EQ(row_reader.window_rows(), 4);
+}
+
+TYPED_TEST(HDF5RowReaderTest, TestReadRows) {
+  HDF5RowReader<TypeParam> reader(this->filename_, "data", 2, 4, 5,
+      this->window_bytes(24), false);
+  std::vector<TypeParam> data(this->num_ * this->row_size_);
+  // across windows, and the short last one
+  reader.ReadRows(6, 11, &data[0]);
+  this->ExpectRows(6, 11, &data[0]);
+  reader.ReadRows(15, 8, &data[0]);
+  this->ExpectRows(15, 8, &data[0]);
+  reader.ReadRow(0, &data[0]);
+  this->ExpectRows(0, 1, &data[0]);
+  reader.ReadRows(0, this->num_, &data[0]);
+  this->ExpectRows(0, this->num_, &data[0]);
+  HDF5ReaderStats stats = reader.stats();
+  EXPECT_EQ(stats.num_misses, 3);
+  EXPECT_EQ(stats.num_hits, 6);
+  EXPECT_EQ(stats.num_windows, 3);
+  EXPECT_EQ(stats.bytes_cached, this->window_bytes(this->num_));
+}
+
+TYPED_TEST(HDF5RowReaderTest, TestEvict) {
+  // room for two windows of 4 rows only
+  HDF5RowReader<TypeParam> reader(this->filename_, "data", 2, 4, 1, 0, false);
+  std::vector<TypeParam> data(this->row_size_);
+  for (int i = 0; i < 50; ++i) {
+    const int row = (i * 7) % this->num_;
+    reader.ReadRow(row, &data[0]);
+    this->ExpectRows(row, 1, &data[0]);
+    EXPECT_LE(reader.stats().num_windows, 2);
+    EXPECT_LE(reader.stats().bytes_cached, this->window_bytes(8));
+  }
+  // the same window again
+  reader.ReadRow(0, &data[0]);
+  const size_t num_hits = reader.stats().num_hits;
+  reader.ReadRow(1, &data[0]);
+  EXPECT_EQ(reader.stats().num_hits, num_hits + 1);
+}
+
+TYPED_TEST(HDF5RowReaderTest, TestReadAhead) {
+  HDF5RowReader<TypeParam> reader(this->filename_, "data", 2, 4, 4, 0, true);
+  std::vector<TypeParam> data(4 * this->row_size_);
+  reader.ReadRows(0, 4, &data[0]);
+  // wait for the second window to be read ahead
+  for (int i = 0; i < 1000 && reader.stats().bytes_cached <
+      this->window_bytes(8); ++i) {
+    usleep(1000);
+  }
+  EXPECT_EQ(reader.stats().num_read_ahead, 1);
+  reader.ReadRows(4, 4, &data[0]);
+  this->ExpectRows(4, 4, &data[0]);
+  EXPECT_EQ(reader.stats().num_misses, 1);
+  EXPECT_EQ(reader.stats().num_hits, 1);
+  // three passes over the windows of 4 rows in order
+  for (int i = 0; i < 18; ++i) {
+    const int row = (i % 6) * 4;
+    const int rows = std::min(4, this->num_ - row);
+    reader.ReadRows(row, rows, &data[0]);
+    this->ExpectRows(row, rows, &data[0]);
+    // the two cached, and the one being read ahead
+    EXPECT_LE(reader.stats().num_windows, 3);
+  }
+  HDF5ReaderStats stats = reader.stats();
+  EXPECT_EQ(stats.num_hits + stats.num_misses, 20);
+}
+
+}  // namespace caffe
@@ -129,4 +129,74 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+
+TYPED_TEST(HDF5DataLayerTest, TestReadStreaming) {
+  // The same data as TestRead, read one file at a time, with the next files
+  // read ahead or not.
+  const int batch_size = 5;
+  const int data_size = 8 * 5 * 5;
+  for (int prefetch_files = 0; prefetch_files < 3; ++prefetch_files) {
+    LayerParameter param;
+    HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+    hdf5_data_param->set_batch_size(batch_size);
+    hdf5_data_param->set_source(*(this->filename));
+    hdf5_data_param->set_data_in_memory(false);
+    hdf5_data_param->set_prefetch_files(prefetch_files);
+    Caffe::set_mode(Caffe::CPU);
+    HDF5DataLayer<TypeParam> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+      int label_offset = (iter % 2 == 0) ? 0 : batch_size;
+      int data_offset = (iter % 2 == 0) ? 0 : batch_size * data_size;
+      int file_offset = (iter % 4 < 2) ? 0 : 2000;
+      for (int i = 0; i < batch_size; ++i) {
+        EXPECT_EQ(label_offset + i, this->blob_top_label_->cpu_data()[i]);
+      }
+      for (int idx = 0; idx < batch_size * data_size; ++idx) {
+        EXPECT_EQ(file_offset + data_offset + idx,
+            this->blob_top_data_->cpu_data()[idx])
+            << "debug: idx " << idx << " iter " << iter
+            << " prefetch_files " << prefetch_files;
+      }
+    }
+  }
+}
+
+TYPED_TEST(HDF5DataLayerTest, TestReadWindows) {
+  // The same data as TestRead, read in windows of the current file, with
+  // batches spanning the files.
+  const int data_size = 8 * 5 * 5;
+  for (int batch_size = 3; batch_size < 6; batch_size += 2) {
+    LayerParameter param;
+    HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+    hdf5_data_param->set_batch_size(batch_size);
+    hdf5_data_param->set_source(*(this->filename));
+    hdf5_data_param->set_data_in_memory(false);
+    hdf5_data_param->set_cache_mb(1);
+    Caffe::set_mode(Caffe::CPU);
+    HDF5DataLayer<TypeParam> layer(param);
+    layer.SetUp(this->blob_bottom_vec_, &this->blob_top_vec_);
+    EXPECT_EQ(this->blob_top_data_->num(), batch_size);
+    EXPECT_EQ(this->blob_top_data_->channels(), 8);
+    EXPECT_EQ(this->blob_top_data_->height(), 5);
+    EXPECT_EQ(this->blob_top_data_->width(), 5);
+    EXPECT_EQ(this->blob_top_label_->channels(), 1);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, &this->blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        // the files have 10 rows each
+        const int row = (iter * batch_size + i) % 20;
+        const int file_offset = (row < 10) ? 0 : 2000;
+        EXPECT_EQ(row % 10, this->blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < data_size; ++j) {
+          EXPECT_EQ(file_offset + (row % 10) * data_size + j,
+              this->blob_top_data_->cpu_data()[i * data_size + j])
+              << "debug: i " << i << " iter " << iter;
+        }
+      }
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,145 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {};
+
+TEST_F(HostAllocatorTest, TestSizeClasses) {
+  EXPECT_EQ(CachingHostAllocator::size_class(1), 0);
+  EXPECT_EQ(CachingHostAllocator::size_class(64), 0);
+  EXPECT_EQ(CachingHostAllocator::size_class(65), 1);
+  for (size_t size = 1; size < (1 << 20); size = size * 3 / 2 + 1) {
+    const int c = CachingHostAllocator::size_class(size);
+    const size_t bytes = CachingHostAllocator::class_size(c);
+    EXPECT_GE(bytes, size);
+    EXPECT_EQ(bytes % CachingHostAllocator::kAlignment, 0);
+    if (c > 0) {
+      EXPECT_LT(CachingHostAllocator::class_size(c - 1), size);
+    }
+    EXPECT_LE(bytes, size + size / 4 + CachingHostAllocator::kAlignment);
+  }
+}
+
+TEST_F(HostAllocatorTest, TestReuse) {
+  CachingHostAllocator allocator;
+  void* ptr = allocator.Allocate(1000);
+  EXPECT_EQ(reinterpret_cast<size_t>(ptr) % CachingHostAllocator::kAlignment,
+      0);
+  memset(ptr, 1, 1000);
+  allocator.Free(ptr, 1000);
+  // same size class
+  void* ptr2 = allocator.Allocate(900);
+  EXPECT_EQ(ptr2, ptr);
+  // large blocks go through the shared free lists
+  void* ptr3 = allocator.Allocate(10 << 20);
+  allocator.Free(ptr3, 10 << 20);
+  EXPECT_EQ(allocator.Allocate(10 << 20), ptr3);
+  HostAllocatorStats stats = allocator.stats();
+  EXPECT_EQ(stats.num_allocs, 4);
+  EXPECT_EQ(stats.num_cache_hits, 2);
+  EXPECT_EQ(stats.hit_rate(), 0.5);
+  EXPECT_EQ(stats.bytes_cached, 0);
+  EXPECT_EQ(stats.bytes_in_use,
+      CachingHostAllocator::class_size(CachingHostAllocator::size_class(900))
+      + CachingHostAllocator::class_size(
+      CachingHostAllocator::size_class(10 << 20)));
+  allocator.Free(ptr2, 900);
+  allocator.Free(ptr3, 10 << 20);
+  stats = allocator.stats();
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_GT(stats.peak_bytes_in_use, 10 << 20);
+  EXPECT_GT(stats.bytes_cached, 10 << 20);
+  allocator.ReleaseCached();
+  EXPECT_EQ(allocator.stats().bytes_cached, 0);
+}
+
+TEST_F(HostAllocatorTest, TestCacheLimit) {
+  const size_t block = 1 << 20;
+  CachingHostAllocator allocator(3 * block);
+  std::vector<void*> ptrs;
+  for (int i = 0; i < 5; ++i) {
+    ptrs.push_back(allocator.Allocate(block));
+  }
+  for (int i = 0; i < 5; ++i) {
+    allocator.Free(ptrs[i], block);
+    EXPECT_LE(allocator.stats().bytes_cached, 3 * block);
+  }
+  EXPECT_EQ(allocator.stats().bytes_cached, 3 * block);
+  // blocks larger than the cache are not kept at all
+  allocator.Free(allocator.Allocate(4 * block), 4 * block);
+  EXPECT_EQ(allocator.stats().bytes_cached, 3 * block);
+  EXPECT_EQ(allocator.stats().bytes_in_use, 0);
+}
+
+TEST_F(HostAllocatorTest, TestMalloc) {
+  MallocHostAllocator allocator;
+  void* ptr = allocator.Allocate(100);
+  EXPECT_TRUE(ptr);
+  EXPECT_EQ(allocator.stats().bytes_in_use, 100);
+  allocator.Free(ptr, 100);
+  HostAllocatorStats stats = allocator.stats();
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.peak_bytes_in_use, 100);
+  EXPECT_EQ(stats.num_cache_hits, 0);
+}
+
+TEST_F(HostAllocatorTest, TestSyncedMemory) {
+  MallocHostAllocator allocator;
+  HostAllocator::Set(&allocator);
+  SyncedMemory* mem = new SyncedMemory(10);
+  mem->cpu_data();
+  // memory allocated before the switch goes back to its own allocator
+  HostAllocator::Set(NULL);
+  EXPECT_EQ(allocator.stats().bytes_in_use, 10);
+  delete mem;
+  EXPECT_EQ(allocator.stats().bytes_in_use, 0);
+}
+
+void* AllocateAndFree(void* allocator_ptr) {
+  HostAllocator* allocator = static_cast<HostAllocator*>(allocator_ptr);
+  std::vector<void*> ptrs;
+  for (int iter = 0; iter < 100; ++iter) {
+    for (int i = 0; i < 10; ++i) {
+      const size_t size = (i + 1) * 1000 * (iter % 3 + 1);
+      ptrs.push_back(allocator->Allocate(size));
+      memset(ptrs.back(), i, size);
+    }
+    for (int i = 0; i < 10; ++i) {
+      allocator->Free(ptrs[i], (i + 1) * 1000 * (iter % 3 + 1));
+    }
+    ptrs.clear();
+  }
+  return NULL;
+}
+
+TEST_F(HostAllocatorTest, TestThreads) {
+  CachingHostAllocator allocator;
+  const int num_threads = 4;
+  pthread_t threads[num_threads];
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK(!pthread_create(&threads[i], NULL, AllocateAndFree, &allocator));
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK(!pthread_join(threads[i], NULL));
+  }
+  HostAllocatorStats stats = allocator.stats();
+  EXPECT_EQ(stats.bytes_in_use, 0);
+  EXPECT_EQ(stats.num_allocs, num_threads * 1000);
+  EXPECT_GT(stats.hit_rate(), 0.9);
+  allocator.ReleaseCached();
+  EXPECT_EQ(allocator.stats().bytes_cached, 0);
+}
+
+}  // namespace caffe
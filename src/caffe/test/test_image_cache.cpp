@@ -0,0 +1,138 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  ImageCacheTest()
+      : filename_(std::string(tmpnam(NULL)) + ".png"),
+        image_(12, 16, CV_8UC3) {}
+
+  virtual void SetUp() {
+    for (int h = 0; h < image_.rows; ++h) {
+      for (int w = 0; w < image_.cols; ++w) {
+        for (int c = 0; c < 3; ++c) {
+          image_.at<cv::Vec3b>(h, w)[c] = (h * 31 + w * 7 + c * 50) % 256;
+        }
+      }
+    }
+    CHECK(cv::imwrite(filename_, image_));
+  }
+
+  virtual void TearDown() {
+    remove(filename_.c_str());
+  }
+
+  // The bytes of image_ in color.
+  size_t image_bytes() const {
+    return image_.rows * image_.cols * 3;
+  }
+
+  const std::string filename_;
+  cv::Mat image_;
+};
+
+TEST_F(ImageCacheTest, TestHit) {
+  ImageCache cache(1 << 20);
+  cv::Mat first = cache.Read(filename_, 0, 0, true);
+  ASSERT_TRUE(first.data);
+  cv::Mat second = cache.Read(filename_, 0, 0, true);
+  // the cached pixels are shared
+  EXPECT_EQ(first.data, second.data);
+  for (int h = 0; h < image_.rows; ++h) {
+    for (int w = 0; w < image_.cols; ++w) {
+      for (int c = 0; c < 3; ++c) {
+        EXPECT_EQ(second.at<cv::Vec3b>(h, w)[c],
+            image_.at<cv::Vec3b>(h, w)[c]);
+      }
+    }
+  }
+  ImageCacheStats stats = cache.stats();
+  EXPECT_EQ(stats.num_hits, 1);
+  EXPECT_EQ(stats.num_misses, 1);
+  EXPECT_EQ(stats.num_images, 1);
+  EXPECT_EQ(stats.bytes_cached, image_bytes());
+  EXPECT_EQ(stats.hit_rate(), 0.5);
+}
+
+TEST_F(ImageCacheTest, TestKeys) {
+  ImageCache cache(1 << 20);
+  cache.Read(filename_, 0, 0, true);
+  // resized images are cached on their own
+  cv::Mat resized = cache.Read(filename_, 4, 6, true);
+  EXPECT_EQ(resized.rows, 6);
+  EXPECT_EQ(resized.cols, 4);
+  cache.Read(filename_, 4, 6, true);
+  // missing files are not cached
+  EXPECT_FALSE(cache.Read(filename_ + ".missing", 0, 0, true).data);
+  ImageCacheStats stats = cache.stats();
+  EXPECT_EQ(stats.num_hits, 1);
+  EXPECT_EQ(stats.num_misses, 3);
+  EXPECT_EQ(stats.num_images, 2);
+}
+
+TEST_F(ImageCacheTest, TestEvict) {
+  // room for the full image and one resized to 4x6, but not for a third one
+  ImageCache cache(image_bytes() + 4 * 6 * 3);
+  cache.Read(filename_, 4, 6, true);
+  cache.Read(filename_, 0, 0, true);
+  cache.Read(filename_, 2, 6, true);
+  // the least recently used one went first
+  EXPECT_EQ(cache.stats().num_evictions, 1);
+  cache.Read(filename_, 0, 0, true);
+  EXPECT_EQ(cache.stats().num_hits, 1);
+  cache.Read(filename_, 4, 6, true);
+  EXPECT_EQ(cache.stats().num_hits, 1);
+  cache.set_capacity(0);
+  ImageCacheStats stats = cache.stats();
+  EXPECT_EQ(stats.num_images, 0);
+  EXPECT_EQ(stats.bytes_cached, 0);
+  // nothing fits any more
+  cache.Read(filename_, 0, 0, true);
+  EXPECT_EQ(cache.stats().num_images, 0);
+}
+
+struct ImageCacheReader {
+  ImageCache* cache;
+  const std::string* filename;
+};
+
+void* ReadImages(void* reader_ptr) {
+  ImageCacheReader* reader = static_cast<ImageCacheReader*>(reader_ptr);
+  for (int i = 0; i < 100; ++i) {
+    CHECK(reader->cache->Read(*reader->filename, i % 5 + 1, 4, true).data);
+  }
+  return NULL;
+}
+
+TEST_F(ImageCacheTest, TestThreads) {
+  ImageCache cache(1 << 20);
+  ImageCacheReader reader = {&cache, &filename_};
+  const int num_threads = 4;
+  pthread_t threads[num_threads];
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK(!pthread_create(&threads[i], NULL, ReadImages, &reader));
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    CHECK(!pthread_join(threads[i], NULL));
+  }
+  ImageCacheStats stats = cache.stats();
+  EXPECT_EQ(stats.num_hits + stats.num_misses, num_threads * 100);
+  EXPECT_EQ(stats.num_images, 5);
+  EXPECT_LE(stats.num_misses, num_threads * 5);
+}
+
+}  // namespace caffe
@@ -75,6 +75,40 @@ TYPED_TEST(InnerProductLayerTest, TestCPU) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestCPUAccumulateParamDiffs) {
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  Caffe::set_mode(Caffe::CPU);
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("uniform");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  InnerProductLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  FillerParameter filler_param;
+  UniformFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_top_);
+  caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+      this->blob_top_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  Blob<TypeParam> weight_diff;
+  Blob<TypeParam> bias_diff;
+  weight_diff.CopyFrom(*layer.blobs()[0], true, true);
+  bias_diff.CopyFrom(*layer.blobs()[1], true, true);
+  // the second pass adds to the diffs of the first
+  layer.set_accumulate_param_diffs(true);
+  layer.Backward(this->blob_top_vec_, true, &(this->blob_bottom_vec_));
+  for (int i = 0; i < weight_diff.count(); ++i) {
+    EXPECT_NEAR(layer.blobs()[0]->cpu_diff()[i], 2 * weight_diff.cpu_diff()[i],
+        1e-5);
+  }
+  for (int i = 0; i < bias_diff.count(); ++i) {
+    EXPECT_NEAR(layer.blobs()[1]->cpu_diff()[i], 2 * bias_diff.cpu_diff()[i],
+        1e-5);
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGPU) {
   if (sizeof(TypeParam) == 4 || CAFFE_TEST_CUDA_PROP.major >= 2) {
     LayerParameter layer_param;
@@ -116,6 +150,23 @@ TYPED_TEST(InnerProductLayerTest, TestCPUGradient) {
       &(this->blob_top_vec_));
 }
 
+TYPED_TEST(InnerProductLayerTest, TestCPUGradientFusedTanH) {
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  Caffe::set_mode(Caffe::CPU);
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<TypeParam> layer(layer_param);
+  LayerParameter tanh_param;
+  tanh_param.set_type(LayerParameter_LayerType_TANH);
+  EXPECT_TRUE(layer.FuseActivation(tanh_param));
+  GradientChecker<TypeParam> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, &(this->blob_bottom_vec_),
+      &(this->blob_top_vec_));
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGPUGradient) {
   if (sizeof(TypeParam) == 4 || CAFFE_TEST_CUDA_PROP.major >= 2) {
     LayerParameter layer_param;
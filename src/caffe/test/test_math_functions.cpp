@@ -227,4 +227,73 @@ TYPED_TEST(MathFunctionsTest, TestCopyGPU) {
   }
 }
 
+TYPED_TEST(MathFunctionsTest, TestSGDUpdateCPU) {
+  const int cpu_threads = Caffe::cpu_threads();
+  const int n = this->blob_bottom_->count();
+  const TypeParam rate = 0.01;
+  const TypeParam momentum = 0.9;
+  const TypeParam decays[2] = {0, 0.0005};
+  for (int d = 0; d < 2; ++d) {
+    for (int update_data = 0; update_data < 2; ++update_data) {
+      Blob<TypeParam> param(this->blob_bottom_->num(),
+          this->blob_bottom_->channels(), this->blob_bottom_->height(),
+          this->blob_bottom_->width());
+      Blob<TypeParam> history(param.num(), param.channels(), param.height(),
+          param.width());
+      caffe_copy(n, this->blob_bottom_->cpu_data(), param.mutable_cpu_data());
+      caffe_copy(n, this->blob_top_->cpu_data(), param.mutable_cpu_diff());
+      caffe_cpu_scale(n, TypeParam(0.1), this->blob_top_->cpu_data(),
+          history.mutable_cpu_data());
+      // the steps SGDSolver and Net::Update took before
+      Blob<TypeParam> reference_param(param.num(), param.channels(),
+          param.height(), param.width());
+      Blob<TypeParam> reference_history(param.num(), param.channels(),
+          param.height(), param.width());
+      reference_param.CopyFrom(param, false);
+      reference_param.CopyFrom(param, true);
+      reference_history.CopyFrom(history);
+      caffe_cpu_axpby(n, rate, reference_param.cpu_diff(), momentum,
+          reference_history.mutable_cpu_data());
+      if (decays[d]) {
+        caffe_axpy(n, decays[d] * rate, reference_param.cpu_data(),
+            reference_history.mutable_cpu_data());
+      }
+      caffe_copy(n, reference_history.cpu_data(),
+          reference_param.mutable_cpu_diff());
+      if (update_data) {
+        reference_param.Update();
+      }
+      // a single thread computes every element in the same order
+      Blob<TypeParam> serial_param(param.num(), param.channels(),
+          param.height(), param.width());
+      Blob<TypeParam> serial_history(param.num(), param.channels(),
+          param.height(), param.width());
+      serial_param.CopyFrom(param, false);
+      serial_param.CopyFrom(param, true);
+      serial_history.CopyFrom(history);
+      Caffe::set_cpu_threads(1);
+      caffe_cpu_sgd_update(n, rate, momentum, decays[d], update_data,
+          serial_param.mutable_cpu_data(), serial_param.mutable_cpu_diff(),
+          serial_history.mutable_cpu_data());
+      // more than one block, so that the blocks are split over threads
+      Caffe::set_cpu_threads(4);
+      caffe_cpu_sgd_update(n, rate, momentum, decays[d], update_data,
+          param.mutable_cpu_data(), param.mutable_cpu_diff(),
+          history.mutable_cpu_data());
+      for (int i = 0; i < n; ++i) {
+        EXPECT_EQ(history.cpu_data()[i], serial_history.cpu_data()[i]);
+        EXPECT_EQ(param.cpu_data()[i], serial_param.cpu_data()[i]);
+        EXPECT_EQ(param.cpu_diff()[i], history.cpu_data()[i]);
+        // the BLAS kernels of the reference may fuse the multiply-adds, so
+        // it can differ from the plain loop in the last bits
+        EXPECT_NEAR(history.cpu_data()[i], reference_history.cpu_data()[i],
+            1e-6);
+        EXPECT_NEAR(param.cpu_data()[i], reference_param.cpu_data()[i],
+            1e-6);
+      }
+    }
+  }
+  Caffe::set_cpu_threads(cpu_threads);
+}
+
 }  // namespace caffe
@@ -1,10 +1,12 @@
 // Copyright 2014 BVLC and contributors.
 
 #include <google/protobuf/text_format.h>
+#include <sstream>
 #include <string>
 
 #include "gtest/gtest.h"
 #include "caffe/common.hpp"
+#include "caffe/filler.hpp"
 #include "caffe/net.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
@@ -104,4 +106,387 @@ TYPED_TEST(NetTest, TestGetLayerByName) {
   EXPECT_FALSE(this->net_->layer_by_name("label"));
 }
 
+TYPED_TEST(NetTest, TestReshape) {
+  // Changing the batch size of a net with inputs should give the same
+  // outputs for the remaining items.
+  const string& proto =
+      "name: 'TestReshape' "
+      "input: 'data' "
+      "input_dim: 4 "
+      "input_dim: 2 "
+      "input_dim: 5 "
+      "input_dim: 6 "
+      "layers: { "
+      "  name: 'conv' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 3 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'innerproduct' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'innerproduct' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_mode(Caffe::CPU);
+  Net<TypeParam> net(param);
+  Blob<TypeParam>* input = net.input_blobs()[0];
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(input);
+  Blob<TypeParam> reference;
+  reference.CopyFrom(*net.ForwardPrefilled()[0], false, true);
+  const TypeParam* output_memory = net.output_blobs()[0]->cpu_data();
+  net.ReshapeInputs(2);
+  EXPECT_EQ(net.blob_by_name("conv")->num(), 2);
+  const vector<Blob<TypeParam>*>& output = net.ForwardPrefilled();
+  EXPECT_EQ(output[0]->num(), 2);
+  EXPECT_EQ(output[0]->cpu_data(), output_memory);
+  for (int i = 0; i < output[0]->count(); ++i) {
+    EXPECT_NEAR(output[0]->cpu_data()[i], reference.cpu_data()[i], 1e-4);
+  }
+  net.ReshapeInputs(6);
+  filler.Fill(input);
+  EXPECT_EQ(net.ForwardPrefilled()[0]->num(), 6);
+}
+
+TYPED_TEST(NetTest, TestShareActivations) {
+  // A chain of layers should need less activation memory with sharing and
+  // compute the same outputs.
+  string proto =
+      "name: 'TestShareActivations' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 4 "
+      "input_dim: 5 ";
+  for (int i = 1; i <= 4; ++i) {
+    const char* bottom[] = { "data", "ip1", "ip2", "ip3" };
+    std::ostringstream layer;
+    layer << "layers: { "
+        << "  name: 'ip" << i << "' "
+        << "  type: INNER_PRODUCT "
+        << "  inner_product_param { "
+        << "    num_output: " << 40 / i << " "
+        << "    weight_filler { "
+        << "      type: 'gaussian' "
+        << "      std: 0.1 "
+        << "    } "
+        << "  } "
+        << "  bottom: '" << bottom[i - 1] << "' "
+        << "  top: 'ip" << i << "' "
+        << "} "
+        << "layers: { "
+        << "  name: 'tanh" << i << "' "
+        << "  type: TANH "
+        << "  bottom: 'ip" << i << "' "
+        << "  top: 'ip" << i << "' "
+        << "} ";
+    proto += layer.str();
+  }
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TEST);
+  Net<TypeParam> net(param);
+  param.set_share_activations(true);
+  Net<TypeParam> net_shared(param);
+  net_shared.ShareTrainedLayersWith(&net);
+  EXPECT_LT(net_shared.memory_used(), net.memory_used());
+  // ip1 and ip3 can use the same memory, ip4 is the output
+  EXPECT_EQ(net_shared.blobs()[1]->data(), net_shared.blobs()[3]->data());
+  EXPECT_NE(net_shared.blobs()[1]->data(), net_shared.blobs()[2]->data());
+  EXPECT_NE(net_shared.blobs()[3]->data(), net_shared.blobs()[4]->data());
+  // looking blobs up does not move them
+  EXPECT_TRUE(net_shared.has_blob("ip1"));
+  EXPECT_EQ(net_shared.blob_by_name("ip1")->data(),
+      net_shared.blobs()[3]->data());
+  // pinned blobs keep their data
+  net_shared.PinBlob("ip1");
+  EXPECT_NE(net_shared.blobs()[1]->data(), net_shared.blobs()[3]->data());
+  param.add_keep_blob("ip1");
+  Net<TypeParam> net_kept(param);
+  net_kept.ShareTrainedLayersWith(&net);
+  EXPECT_NE(net_kept.blobs()[1]->data(), net_kept.blobs()[3]->data());
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(net.input_blobs()[0]);
+  net_shared.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+  net_kept.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+  const TypeParam* output = net.ForwardPrefilled()[0]->cpu_data();
+  const TypeParam* output_shared = net_shared.ForwardPrefilled()[0]->cpu_data();
+  net_kept.ForwardPrefilled();
+  for (int i = 0; i < net.output_blobs()[0]->count(); ++i) {
+    EXPECT_EQ(output[i], output_shared[i]);
+  }
+  // read after a single forward pass
+  const TypeParam* ip1 = net.blob_by_name("ip1")->cpu_data();
+  const TypeParam* ip1_shared = net_shared.blob_by_name("ip1")->cpu_data();
+  const TypeParam* ip1_kept = net_kept.blob_by_name("ip1")->cpu_data();
+  for (int i = 0; i < net.blob_by_name("ip1")->count(); ++i) {
+    EXPECT_EQ(ip1_shared[i], ip1[i]);
+    EXPECT_EQ(ip1_kept[i], ip1[i]);
+  }
+  Caffe::set_phase(Caffe::TRAIN);
+}
+
+TYPED_TEST(NetTest, TestFuseActivations) {
+  // Activations fused into the layer before them should give the results of
+  // the separate layers, forward and backward.
+  const string proto =
+      "name: 'TestFuseActivations' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "input: 'target' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "force_backward: true "
+      "layers: { "
+      "  name: 'conv' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  relu_param { "
+      "    negative_slope: 0.1 "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'tanh' "
+      "  type: TANH "
+      "  bottom: 'ip1' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "      std: 0.1 "
+      "    } "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'sigmoid' "
+      "  type: SIGMOID "
+      "  bottom: 'ip2' "
+      "  top: 'ip2' "
+      "} "
+      "layers: { "
+      "  name: 'loss' "
+      "  type: EUCLIDEAN_LOSS "
+      "  bottom: 'ip2' "
+      "  bottom: 'target' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_mode(Caffe::CPU);
+  param.set_fuse_activations(false);
+  Net<TypeParam> net(param);
+  param.set_fuse_activations(true);
+  Net<TypeParam> net_fused(param);
+  net_fused.CopyTrainedLayersFrom(&net);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  for (int i = 0; i < net.input_blobs().size(); ++i) {
+    filler.Fill(net.input_blobs()[i]);
+    net_fused.input_blobs()[i]->CopyFrom(*net.input_blobs()[i]);
+  }
+  TypeParam loss;
+  TypeParam loss_fused;
+  net.ForwardPrefilled(&loss);
+  net_fused.ForwardPrefilled(&loss_fused);
+  net.Backward();
+  net_fused.Backward();
+  // the bias is added and the activation applied with the same arithmetic
+  EXPECT_EQ(loss, loss_fused);
+  const Blob<TypeParam>* data = net.input_blobs()[0];
+  const Blob<TypeParam>* data_fused = net_fused.input_blobs()[0];
+  for (int i = 0; i < data->count(); ++i) {
+    EXPECT_EQ(data->cpu_diff()[i], data_fused->cpu_diff()[i]);
+  }
+  for (int i = 0; i < net.params().size(); ++i) {
+    const Blob<TypeParam>* param_blob = net.params()[i].get();
+    const Blob<TypeParam>* param_fused = net_fused.params()[i].get();
+    for (int j = 0; j < param_blob->count(); ++j) {
+      EXPECT_EQ(param_blob->cpu_diff()[j], param_fused->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestDiffEnabled) {
+  // Only the blobs used by the backward pass have a diff: ip1 has no
+  // learnable parameters, so nothing is propagated back to data.
+  const string& proto =
+      "name: 'TestDiffEnabled' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "layers: { "
+      "  name: 'ip1' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 4 "
+      "  } "
+      "  blobs_lr: 0. "
+      "  blobs_lr: 0. "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layers: { "
+      "  name: 'ip2' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_mode(Caffe::CPU);
+  Net<TypeParam> net(param);
+  EXPECT_FALSE(net.inference());
+  EXPECT_FALSE(net.blob_by_name("data")->diff_enabled());
+  EXPECT_TRUE(net.blob_by_name("ip1")->diff_enabled());
+  EXPECT_TRUE(net.blob_by_name("ip2")->diff_enabled());
+  EXPECT_TRUE(net.layer_by_name("ip1")->blobs()[0]->diff_enabled());
+  net.ForwardPrefilled();
+  net.Backward();
+}
+
+TYPED_TEST(NetTest, TestInference) {
+  // An inference net has no diffs at all and computes the same outputs.
+  const string& proto =
+      "name: 'TestInference' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 4 "
+      "input_dim: 4 "
+      "layers: { "
+      "  name: 'conv' "
+      "  type: CONVOLUTION "
+      "  convolution_param { "
+      "    num_output: 3 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'relu' "
+      "  type: RELU "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layers: { "
+      "  name: 'innerproduct' "
+      "  type: INNER_PRODUCT "
+      "  inner_product_param { "
+      "    num_output: 2 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'innerproduct' "
+      "} ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_mode(Caffe::CPU);
+  Net<TypeParam> net(param);
+  param.set_inference(true);
+  Net<TypeParam> net_inference(param);
+  net_inference.ShareTrainedLayersWith(&net);
+  EXPECT_TRUE(net_inference.inference());
+  for (int i = 0; i < net_inference.blobs().size(); ++i) {
+    EXPECT_TRUE(net.blobs()[i]->diff_enabled());
+    EXPECT_FALSE(net_inference.blobs()[i]->diff_enabled());
+  }
+  for (int i = 0; i < net_inference.params().size(); ++i) {
+    EXPECT_FALSE(net_inference.params()[i]->diff_enabled());
+    EXPECT_FALSE(net_inference.params()[i]->diff());
+  }
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(net.input_blobs()[0]);
+  net_inference.input_blobs()[0]->CopyFrom(*net.input_blobs()[0]);
+  const Blob<TypeParam>* output = net.ForwardPrefilled()[0];
+  const Blob<TypeParam>* output_inference = net_inference.ForwardPrefilled()[0];
+  for (int i = 0; i < output->count(); ++i) {
+    EXPECT_EQ(output->cpu_data()[i], output_inference->cpu_data()[i]);
+  }
+}
+
 }  // namespace caffe
@@ -168,6 +168,40 @@ TYPED_TEST(NeuronLayerTest, TestDropoutCPU) {
 }
 
 
+TYPED_TEST(NeuronLayerTest, TestDropoutCPUThreads) {
+  LayerParameter layer_param;
+  Caffe::set_mode(Caffe::CPU);
+  Caffe::set_phase(Caffe::TRAIN);
+  const int cpu_threads = Caffe::cpu_threads();
+  // the mask only depends on the seed, not on the number of threads
+  Blob<TypeParam> top_single;
+  Caffe::set_random_seed(1701);
+  Caffe::set_cpu_threads(1);
+  {
+    DropoutLayer<TypeParam> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+    top_single.CopyFrom(*this->blob_top_, false, true);
+  }
+  Caffe::set_random_seed(1701);
+  Caffe::set_cpu_threads(4);
+  DropoutLayer<TypeParam> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  layer.Forward(this->blob_bottom_vec_, &(this->blob_top_vec_));
+  Caffe::set_cpu_threads(cpu_threads);
+  const TypeParam* top_data = this->blob_top_->cpu_data();
+  int num_dropped = 0;
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(top_data[i], top_single.cpu_data()[i]);
+    num_dropped += (top_data[i] == 0);
+  }
+  EXPECT_GT(num_dropped, 0);
+  EXPECT_LT(num_dropped, this->blob_top_->count());
+}
+
+
 TYPED_TEST(NeuronLayerTest, TestDropoutGradientCPU) {
   LayerParameter layer_param;
   Caffe::set_mode(Caffe::CPU);
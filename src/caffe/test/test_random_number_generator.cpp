@@ -8,6 +8,7 @@
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 #include "caffe/test/test_caffe_main.hpp"
 
 namespace caffe {
@@ -243,6 +244,50 @@ TYPED_TEST(RandomNumberGeneratorTest, TestRngUniform2) {
 }
 
 
+TYPED_TEST(RandomNumberGeneratorTest, TestCounterRNG) {
+  // the same key gives the same stream
+  CounterRNG rng(this->seed_, 3, 5);
+  CounterRNG rng_same(this->seed_, 3, 5);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(rng(), rng_same());
+  }
+  // any other key gives a different one
+  CounterRNG rng_keys[4] = { CounterRNG(this->seed_ + 1, 3, 5),
+      CounterRNG(this->seed_, 4, 5), CounterRNG(this->seed_, 3, 6),
+      CounterRNG(this->seed_, 3, 5, 1) };
+  for (int k = 0; k < 4; ++k) {
+    CounterRNG rng_ref(this->seed_, 3, 5);
+    int num_equal = 0;
+    for (int i = 0; i < 100; ++i) {
+      num_equal += (rng_keys[k]() == rng_ref());
+    }
+    EXPECT_LT(num_equal, 2);
+  }
+}
+
+
+TYPED_TEST(RandomNumberGeneratorTest, TestCounterRNGDistributions) {
+  // one number from each of many streams, as drawn by the data layers
+  TypeParam* data = static_cast<TypeParam*>(this->data_->mutable_cpu_data());
+  for (int i = 0; i < this->sample_size_; ++i) {
+    CounterRNG rng(this->seed_, 0, i);
+    data[i] = rng.uniform(TypeParam(-7.3), TypeParam(-2.3));
+  }
+  this->RngUniformChecks(-7.3, -2.3, data);
+  for (int i = 0; i < this->sample_size_; ++i) {
+    CounterRNG rng(this->seed_, 1, i);
+    data[i] = rng.gaussian(TypeParam(-2), TypeParam(3));
+  }
+  this->RngGaussianChecks(-2, 3, data);
+  int* bernoulli_data = static_cast<int*>(this->int_data_->mutable_cpu_data());
+  for (int i = 0; i < this->sample_size_; ++i) {
+    CounterRNG rng(this->seed_, 2, i);
+    bernoulli_data[i] = rng.bernoulli(0.3);
+  }
+  this->RngBernoulliChecks(0.3, bernoulli_data);
+}
+
+
 TYPED_TEST(RandomNumberGeneratorTest, TestRngBernoulli) {
   const TypeParam p = 0.3;
   void* bernoulli_data = this->int_data_->mutable_cpu_data();
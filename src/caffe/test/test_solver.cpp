@@ -0,0 +1,284 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <google/protobuf/text_format.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/solver.hpp"
+#include "caffe/util/benchmark.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+using std::string;
+using std::vector;
+
+namespace caffe {
+
+// Exposes the iteration the solver stopped at, the one last published to
+// the Hogwild workers and the passes of an iteration.
+template <typename Dtype>
+class IterSGDSolver : public SGDSolver<Dtype> {
+ public:
+  explicit IterSGDSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param) {}
+  int iter() const { return this->iter_; }
+  int hogwild_iter() const { return this->hogwild_iter_; }
+  Dtype ForwardBackward() {
+    return SGDSolver<Dtype>::ForwardBackward(vector<Blob<Dtype>*>());
+  }
+};
+
+template <typename Dtype>
+class SolverTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    InitParam(4, 12, 5, "constant");
+    Caffe::set_mode(Caffe::CPU);
+  }
+
+  // A least squares regression of num x channels data from data_filler onto
+  // a constant target of num_output values; constant data gives every
+  // worker the same batches.
+  void InitParam(const int num, const int channels, const int num_output,
+      const string& data_filler) {
+    std::ostringstream proto;
+    proto <<
+        "base_lr: 0.01 "
+        "lr_policy: 'fixed' "
+        "momentum: 0.9 "
+        "weight_decay: 0.001 "
+        "display: 5 "
+        "max_iter: 6 "
+        "random_seed: 1701 "
+        "solver_mode: CPU "
+        "termination_criterion: MAX_ITER "
+        "train_net_param { "
+        "  layers: { "
+        "    name: 'data' "
+        "    type: DUMMY_DATA "
+        "    dummy_data_param { "
+        "      num: " << num << " "
+        "      channels: " << channels << " "
+        "      height: 1 "
+        "      width: 1 "
+        "      num: " << num << " "
+        "      channels: " << num_output << " "
+        "      height: 1 "
+        "      width: 1 "
+        "      data_filler { "
+        "        type: '" << data_filler << "' "
+        "        value: 0.5 "
+        "      } "
+        "      data_filler { "
+        "        type: 'constant' "
+        "        value: 2 "
+        "      } "
+        "    } "
+        "    top: 'data' "
+        "    top: 'target' "
+        "  } "
+        "  layers: { "
+        "    name: 'innerproduct' "
+        "    type: INNER_PRODUCT "
+        "    inner_product_param { "
+        "      num_output: " << num_output << " "
+        "      weight_filler { "
+        "        type: 'gaussian' "
+        "        std: 0.1 "
+        "      } "
+        "      bias_filler { "
+        "        type: 'constant' "
+        "        value: 0.1 "
+        "      } "
+        "    } "
+        "    bottom: 'data' "
+        "    top: 'innerproduct' "
+        "  } "
+        "  layers: { "
+        "    name: 'loss' "
+        "    type: EUCLIDEAN_LOSS "
+        "    bottom: 'innerproduct' "
+        "    bottom: 'target' "
+        "  } "
+        "} ";
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto.str(),
+        &param_));
+  }
+
+  // Trains with num_workers workers and returns the loss of the trained net
+  // on a batch and, if params is not NULL, its parameters.
+  Dtype Train(const int num_workers, const bool hogwild, const int max_iter,
+      vector<vector<Dtype> >* params) {
+    SolverParameter param(param_);
+    param.set_num_workers(num_workers);
+    param.set_pin_workers(false);
+    param.set_hogwild(hogwild);
+    param.set_max_iter(max_iter);
+    SGDSolver<Dtype> solver(param);
+    solver.Solve();
+    const vector<shared_ptr<Blob<Dtype> > >& blobs = solver.net()->params();
+    for (int i = 0; params && i < blobs.size(); ++i) {
+      params->push_back(vector<Dtype>(blobs[i]->cpu_data(),
+          blobs[i]->cpu_data() + blobs[i]->count()));
+    }
+    Dtype loss;
+    solver.net()->ForwardPrefilled(&loss);
+    return loss;
+  }
+
+  // The loss of the net before training.
+  Dtype InitialLoss() {
+    Caffe::set_random_seed(param_.random_seed());
+    Net<Dtype> net(param_.train_net_param());
+    Dtype loss;
+    net.ForwardPrefilled(&loss);
+    return loss;
+  }
+
+  // Trains with lr 0 until the accuracy of a test net named valid, the first
+  // output of the net, has not improved for 3 tests, and returns the
+  // iteration the solver stopped at.
+  int TrainUntilNoProgress(const bool test_async) {
+    SolverParameter param(param_);
+    param.set_base_lr(0);
+    param.set_max_iter(100);
+    param.add_termination_criterion(SolverParameter::TEST_ACCURACY);
+    param.set_test_accuracy_stop_countdown(3);
+    param.set_test_interval(1);
+    param.add_test_iter(2);
+    param.set_test_async(test_async);
+    NetParameter* test_net_param = param.add_test_net_param();
+    test_net_param->CopyFrom(param_.train_net_param());
+    test_net_param->set_name("valid");
+    // the inner product output
+    test_net_param->mutable_layers()->RemoveLast();
+    IterSGDSolver<Dtype> solver(param);
+    solver.Solve();
+    return solver.iter();
+  }
+
+  // The seconds of the first of the runs of doubling max_iter training with
+  // num_workers brings the loss below target_loss, or -1 if none does.
+  float SecondsToLoss(const int num_workers, const bool hogwild,
+      const Dtype target_loss) {
+    Timer timer;
+    for (int max_iter = 1; max_iter < 100000; max_iter *= 2) {
+      timer.Start();
+      if (Train(num_workers, hogwild, max_iter, NULL) < target_loss) {
+        return timer.Seconds();
+      }
+    }
+    return -1;
+  }
+
+  SolverParameter param_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(SolverTest, Dtypes);
+
+TYPED_TEST(SolverTest, TestDataParallelCPU) {
+  // the workers' gradients are those of the single net, and so is their mean
+  vector<vector<TypeParam> > params;
+  this->Train(1, false, 6, &params);
+  for (int num_workers = 2; num_workers <= 3; ++num_workers) {
+    vector<vector<TypeParam> > worker_params;
+    this->Train(num_workers, false, 6, &worker_params);
+    ASSERT_EQ(worker_params.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      ASSERT_EQ(worker_params[i].size(), params[i].size());
+      for (int j = 0; j < params[i].size(); ++j) {
+        EXPECT_NEAR(worker_params[i][j], params[i][j], 1e-5);
+      }
+    }
+  }
+}
+
+TYPED_TEST(SolverTest, TestIterSizeCPU) {
+  // iter_size batches of constant data average to one batch iter_size times
+  // as large, in the reported losses as in the gradients
+  const int iter_size = 3;
+  this->InitParam(4 * iter_size, 12, 5, "constant");
+  vector<vector<TypeParam> > params;
+  this->Train(1, false, 6, &params);
+  IterSGDSolver<TypeParam> solver(this->param_);
+  const TypeParam loss = solver.ForwardBackward();
+  const vector<std::pair<int, float> > losses = solver.net()->losses();
+  this->InitParam(4, 12, 5, "constant");
+  this->param_.set_iter_size(iter_size);
+  vector<vector<TypeParam> > iter_size_params;
+  this->Train(1, false, 6, &iter_size_params);
+  IterSGDSolver<TypeParam> iter_size_solver(this->param_);
+  EXPECT_NEAR(iter_size_solver.ForwardBackward(), loss, 1e-5);
+  const vector<std::pair<int, float> >& iter_size_losses =
+      iter_size_solver.net()->losses();
+  ASSERT_EQ(iter_size_losses.size(), losses.size());
+  for (int i = 0; i < losses.size(); ++i) {
+    EXPECT_EQ(iter_size_losses[i].first, losses[i].first);
+    EXPECT_NEAR(iter_size_losses[i].second, losses[i].second, 1e-5);
+  }
+  ASSERT_EQ(iter_size_params.size(), params.size());
+  for (int i = 0; i < params.size(); ++i) {
+    ASSERT_EQ(iter_size_params[i].size(), params[i].size());
+    for (int j = 0; j < params[i].size(); ++j) {
+      EXPECT_NEAR(iter_size_params[i][j], params[i][j], 1e-5);
+    }
+  }
+}
+
+TYPED_TEST(SolverTest, TestHogwildCPU) {
+  const TypeParam initial_loss = this->InitialLoss();
+  const TypeParam loss = this->Train(1, false, 20, NULL);
+  EXPECT_LT(loss, initial_loss);
+  // at least as many updates as the single net, if stale
+  for (int num_workers = 2; num_workers <= 4; num_workers += 2) {
+    EXPECT_LT(this->Train(num_workers, true, 20, NULL), initial_loss);
+  }
+  // the workers compute their learning rates at the solver's iteration
+  SolverParameter param(this->param_);
+  param.set_num_workers(2);
+  param.set_pin_workers(false);
+  param.set_hogwild(true);
+  param.set_max_iter(20);
+  IterSGDSolver<TypeParam> solver(param);
+  solver.Solve();
+  EXPECT_EQ(solver.iter(), 20);
+  EXPECT_EQ(solver.hogwild_iter(), solver.iter());
+}
+
+TYPED_TEST(SolverTest, TestAsyncTestCPU) {
+  const int iter = this->TrainUntilNoProgress(false);
+  EXPECT_LT(iter, 10);
+  // the results arrive an iteration or so late, but they do arrive
+  const int async_iter = this->TrainUntilNoProgress(true);
+  EXPECT_GE(async_iter, iter);
+  EXPECT_LT(async_iter, 20);
+}
+
+// Logs the time training takes to reach a tenth of the initial loss on a
+// single net, data parallel and Hogwild. Disabled, as it takes long and its
+// results depend on the machine; run it with
+// --gtest_also_run_disabled_tests.
+TYPED_TEST(SolverTest, DISABLED_TestHogwildBenchmark) {
+  const int num_workers = 4;
+  this->InitParam(32, 512, 32, "gaussian");
+  const TypeParam target_loss = this->InitialLoss() / 10;
+  const float seconds = this->SecondsToLoss(1, false, target_loss);
+  const float parallel_seconds =
+      this->SecondsToLoss(num_workers, false, target_loss);
+  const float hogwild_seconds =
+      this->SecondsToLoss(num_workers, true, target_loss);
+  ASSERT_GT(seconds, 0) << "The single net never reached the loss.";
+  ASSERT_GT(parallel_seconds, 0) << "Data parallel never reached the loss.";
+  ASSERT_GT(hogwild_seconds, 0) << "Hogwild never reached the loss.";
+  LOG(INFO) << "Seconds to a tenth of the initial loss, single net: "
+      << seconds << ", " << num_workers << " workers data parallel: "
+      << parallel_seconds << ", Hogwild: " << hogwild_seconds;
+}
+
+}  // namespace caffe
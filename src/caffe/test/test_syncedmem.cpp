@@ -31,6 +31,19 @@ TEST_F(SyncedMemoryTest, TestAllocation) {
   EXPECT_TRUE(mem.mutable_gpu_data());
 }
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  EXPECT_EQ(mem.version(), 0);
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), 0);
+  mem.mutable_cpu_data();
+  EXPECT_EQ(mem.version(), 1);
+  mem.gpu_data();
+  EXPECT_EQ(mem.version(), 1);
+  mem.mutable_gpu_data();
+  EXPECT_EQ(mem.version(), 2);
+}
+
 TEST_F(SyncedMemoryTest, TestCPUWrite) {
   SyncedMemory mem(10);
   void* cpu_data = mem.mutable_cpu_data();
@@ -0,0 +1,217 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "caffe/common.hpp"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/warp.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// The per pixel loop the augmentation layers used before warp_bilinear_cpu,
+// as the reference.
+template <typename Dtype, typename Stype>
+void warp_reference(const Stype* src, const int channels, const int width,
+    const int height, const bool mirror, const Dtype angle, const Dtype dx,
+    const Dtype dy, const Dtype zoom, const bool interpolate,
+    const Dtype* mean, const Dtype scale, const int crop_width,
+    const int crop_height, Dtype* dst) {
+  for (int x = 0; x < crop_width; x++) {
+    for (int y = 0; y < crop_height; y++) {
+      Dtype x1 = static_cast<Dtype>(x) - .5 * crop_width;
+      Dtype y1 = static_cast<Dtype>(y) - .5 * crop_height;
+      if (mirror) {
+        y1 = -y1;
+      }
+      Dtype x2 = cos(angle) * x1 - sin(angle) * y1;
+      Dtype y2 = sin(angle) * x1 + cos(angle) * y1;
+      x2 = (x2 + dx * crop_width) / zoom + .5 * width;
+      y2 = (y2 + dy * crop_height) / zoom + .5 * height;
+      for (int c = 0; c < channels; c++) {
+        const int top_idx = (c * crop_width + x) * crop_height + y;
+        if (floor(x2) < 0. || floor(x2) > width - 2 ||
+            floor(y2) < 0. || floor(y2) > height - 2) {
+          dst[top_idx] = 0.;
+          continue;
+        }
+        const int i00 = static_cast<int>((c * width + floor(x2)) * height
+            + floor(y2));
+        if (interpolate) {
+          dst[top_idx] =
+              src[i00] * ((floor(x2) + 1) - x2) * ((floor(y2) + 1) - y2) +
+              src[i00 + 1] * ((floor(x2) + 1) - x2) * (y2 - floor(y2)) +
+              src[i00 + height] * (x2 - floor(x2)) * ((floor(y2) + 1) - y2) +
+              src[i00 + height + 1] * (x2 - floor(x2)) * (y2 - floor(y2));
+        } else {
+          dst[top_idx] = src[i00];
+        }
+        if (mean) {
+          dst[top_idx] = (dst[top_idx] - mean[i00]) * scale;
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+class WarpTest : public ::testing::Test {
+ protected:
+  WarpTest()
+      : channels_(3), width_(32), height_(24), crop_width_(16),
+        crop_height_(16), src_(channels_ * width_ * height_),
+        src_uint8_(src_.size()), mean_(src_.size()),
+        dst_(channels_ * crop_width_ * crop_height_),
+        dst_reference_(dst_.size()) {
+    for (int i = 0; i < src_.size(); ++i) {
+      src_uint8_[i] = (i * 37 + i / 7) % 256;
+      src_[i] = src_uint8_[i] / Dtype(255);
+      mean_[i] = (i * 11) % 128;
+    }
+  }
+
+  void Warp(const bool mirror, const Dtype angle, const Dtype dx,
+      const Dtype dy, const Dtype zoom, const bool interpolate) {
+    Dtype affine[6];
+    warp_affine_matrix(mirror, angle, dx, dy, zoom, zoom, crop_width_,
+        crop_height_, width_, height_, affine);
+    warp_bilinear_cpu(&src_[0], channels_, width_, height_, affine,
+        interpolate, static_cast<const Dtype*>(NULL), Dtype(1), crop_width_,
+        crop_height_, &dst_[0]);
+    warp_reference(&src_[0], channels_, width_, height_, mirror, angle, dx, dy,
+        zoom, interpolate, static_cast<const Dtype*>(NULL), Dtype(1),
+        crop_width_, crop_height_, &dst_reference_[0]);
+  }
+
+  void ExpectNear(const Dtype bound) {
+    for (int i = 0; i < dst_.size(); ++i) {
+      EXPECT_NEAR(dst_[i], dst_reference_[i], bound);
+    }
+  }
+
+  const int channels_;
+  const int width_;
+  const int height_;
+  const int crop_width_;
+  const int crop_height_;
+  std::vector<Dtype> src_;
+  std::vector<uint8_t> src_uint8_;
+  std::vector<Dtype> mean_;
+  std::vector<Dtype> dst_;
+  std::vector<Dtype> dst_reference_;
+};
+
+typedef ::testing::Types<float, double> Dtypes;
+TYPED_TEST_CASE(WarpTest, Dtypes);
+
+TYPED_TEST(WarpTest, TestCrop) {
+  this->Warp(false, 0, 0, 0, 1, false);
+  // the centered crop
+  for (int c = 0; c < this->channels_; ++c) {
+    for (int x = 0; x < this->crop_width_; ++x) {
+      for (int y = 0; y < this->crop_height_; ++y) {
+        EXPECT_EQ(this->dst_[(c * this->crop_width_ + x) * this->crop_height_
+            + y], this->src_[(c * this->width_ + x + 8) * this->height_
+            + y + 4]);
+      }
+    }
+  }
+  this->ExpectNear(0);
+}
+
+TYPED_TEST(WarpTest, TestMirrorTranslate) {
+  this->Warp(true, 0, 0.1, -0.1, 1, false);
+  this->ExpectNear(0);
+}
+
+TYPED_TEST(WarpTest, TestRotateZoom) {
+  TypeParam affine[6];
+  warp_affine_matrix<TypeParam>(true, 0.3, 0.05, 0.02, 1.2, 1.2,
+      this->crop_width_, this->crop_height_, this->width_, this->height_,
+      affine);
+  EXPECT_TRUE(warp_inside(affine, this->crop_width_, this->crop_height_,
+      this->width_, this->height_));
+  this->Warp(true, 0.3, 0.05, 0.02, 1.2, true);
+  this->ExpectNear(1e-4);
+}
+
+TYPED_TEST(WarpTest, TestOutside) {
+  TypeParam affine[6];
+  warp_affine_matrix<TypeParam>(false, 0.1, 1, 0, 1, 1, this->crop_width_,
+      this->crop_height_, this->width_, this->height_, affine);
+  EXPECT_FALSE(warp_inside(affine, this->crop_width_, this->crop_height_,
+      this->width_, this->height_));
+  // the crop reaches out of the source by half its width
+  this->Warp(false, 0.1, 1, 0, 1, true);
+  this->ExpectNear(1e-4);
+  int num_zero = 0;
+  for (int i = 0; i < this->dst_.size(); ++i) {
+    num_zero += (this->dst_[i] == 0);
+  }
+  EXPECT_GT(num_zero, this->dst_.size() / 4);
+}
+
+TYPED_TEST(WarpTest, TestUint8Mean) {
+  const TypeParam scale = 0.5;
+  TypeParam affine[6];
+  warp_affine_matrix<TypeParam>(false, -0.2, 0, 0.05, 0.9, 0.9,
+      this->crop_width_, this->crop_height_, this->width_, this->height_,
+      affine);
+  warp_bilinear_cpu(&this->src_uint8_[0], this->channels_, this->width_,
+      this->height_, affine, true, &this->mean_[0], scale, this->crop_width_,
+      this->crop_height_, &this->dst_[0]);
+  warp_reference<TypeParam, uint8_t>(&this->src_uint8_[0], this->channels_,
+      this->width_, this->height_, false, -0.2, 0, 0.05, 0.9, true,
+      &this->mean_[0], scale, this->crop_width_, this->crop_height_,
+      &this->dst_reference_[0]);
+  this->ExpectNear(1e-3);
+}
+
+// Logs the throughput of warp_bilinear_cpu and of the reference loop on
+// ImageNet sized crops.
+TEST(WarpBenchmarkTest, TestRotateZoom) {
+  const int num = 32;
+  const int channels = 3;
+  const int size = 256;
+  const int crop_size = 227;
+  std::vector<float> src(num * channels * size * size);
+  for (int i = 0; i < src.size(); ++i) {
+    src[i] = (i % 251) / 251.;
+  }
+  std::vector<float> dst(num * channels * crop_size * crop_size);
+  std::vector<float> dst_reference(dst.size());
+  const float angle = 0.1;
+  const float zoom = 1.1;
+  Timer timer;
+  timer.Start();
+  for (int n = 0; n < num; ++n) {
+    warp_reference(&src[n * channels * size * size], channels, size, size,
+        true, angle, 0.f, 0.f, zoom, true, static_cast<const float*>(NULL),
+        1.f, crop_size, crop_size,
+        &dst_reference[n * channels * crop_size * crop_size]);
+  }
+  const float reference_throughput = num / timer.Seconds();
+  timer.Start();
+  for (int n = 0; n < num; ++n) {
+    float affine[6];
+    warp_affine_matrix(true, angle, 0.f, 0.f, zoom, zoom, crop_size,
+        crop_size, size, size, affine);
+    warp_bilinear_cpu(&src[n * channels * size * size], channels, size, size,
+        affine, true, static_cast<const float*>(NULL), 1.f, crop_size,
+        crop_size, &dst[n * channels * crop_size * crop_size]);
+  }
+  const float throughput = num / timer.Seconds();
+  for (int i = 0; i < dst.size(); ++i) {
+    EXPECT_NEAR(dst[i], dst_reference[i], 1e-4);
+  }
+  LOG(INFO) << "Bilinear warp, reference loop: " << reference_throughput
+      << " images/s, warp_bilinear_cpu: " << throughput << " images/s (x"
+      << throughput / reference_throughput << ")";
+}
+
+}  // namespace caffe
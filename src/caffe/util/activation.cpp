@@ -0,0 +1,153 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "caffe/util/activation.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+struct IdentityOp {
+  inline Dtype operator()(const Dtype x) const { return x; }
+};
+
+template <typename Dtype>
+struct ReLUOp {
+  explicit ReLUOp(const Dtype negative_slope)
+      : negative_slope_(negative_slope) {}
+  inline Dtype operator()(const Dtype x) const {
+    return std::max(x, Dtype(0)) + negative_slope_ * std::min(x, Dtype(0));
+  }
+  Dtype negative_slope_;
+};
+
+template <typename Dtype>
+struct SigmoidOp {
+  inline Dtype operator()(const Dtype x) const {
+    return 1. / (1. + std::exp(-x));
+  }
+};
+
+template <typename Dtype>
+struct TanHOp {
+  inline Dtype operator()(const Dtype x) const {
+    const Dtype exp2x = std::exp(2 * x);
+    return (exp2x - Dtype(1)) / (exp2x + Dtype(1));
+  }
+};
+
+template <typename Dtype, typename Op>
+static void bias_activation(const int M, const int N, const Dtype* bias,
+    const bool bias_per_row, const Op& op, Dtype* Y) {
+  for (int i = 0; i < M; ++i) {
+    Dtype* y = Y + i * N;
+    if (bias == NULL) {
+      for (int j = 0; j < N; ++j) {
+        y[j] = op(y[j]);
+      }
+    } else if (bias_per_row) {
+      const Dtype b = bias[i];
+      for (int j = 0; j < N; ++j) {
+        y[j] = op(y[j] + b);
+      }
+    } else {
+      for (int j = 0; j < N; ++j) {
+        y[j] = op(y[j] + bias[j]);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_bias_activation(const int M, const int N, const Dtype* bias,
+    const bool bias_per_row, const LayerParameter_LayerType activation,
+    const Dtype negative_slope, Dtype* Y) {
+  switch (activation) {
+  case LayerParameter_LayerType_NONE:
+    bias_activation(M, N, bias, bias_per_row, IdentityOp<Dtype>(), Y);
+    break;
+  case LayerParameter_LayerType_RELU:
+    bias_activation(M, N, bias, bias_per_row, ReLUOp<Dtype>(negative_slope),
+        Y);
+    break;
+  case LayerParameter_LayerType_SIGMOID:
+    bias_activation(M, N, bias, bias_per_row, SigmoidOp<Dtype>(), Y);
+    break;
+  case LayerParameter_LayerType_TANH:
+    bias_activation(M, N, bias, bias_per_row, TanHOp<Dtype>(), Y);
+    break;
+  default:
+    LOG(FATAL) << "Unsupported activation "
+        << LayerParameter_LayerType_Name(activation);
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_activation_backward(const int count,
+    const LayerParameter_LayerType activation, const Dtype negative_slope,
+    const Dtype* Y, Dtype* dY) {
+  switch (activation) {
+  case LayerParameter_LayerType_RELU:
+    for (int i = 0; i < count; ++i) {
+      dY[i] *= (Y[i] > 0) + negative_slope * (Y[i] <= 0);
+    }
+    break;
+  case LayerParameter_LayerType_SIGMOID:
+    for (int i = 0; i < count; ++i) {
+      dY[i] = dY[i] * Y[i] * (1. - Y[i]);
+    }
+    break;
+  case LayerParameter_LayerType_TANH:
+    for (int i = 0; i < count; ++i) {
+      dY[i] *= 1 - Y[i] * Y[i];
+    }
+    break;
+  case LayerParameter_LayerType_NONE:
+    break;
+  default:
+    LOG(FATAL) << "Unsupported activation "
+        << LayerParameter_LayerType_Name(activation);
+  }
+}
+
+template <typename Dtype>
+bool caffe_fusable_activation(const LayerParameter& activation_param,
+    LayerParameter_LayerType* activation, Dtype* negative_slope) {
+  const LayerParameter_LayerType type = activation_param.type();
+  if (type != LayerParameter_LayerType_RELU &&
+      type != LayerParameter_LayerType_SIGMOID &&
+      type != LayerParameter_LayerType_TANH) {
+    return false;
+  }
+  *activation = type;
+  *negative_slope = (type == LayerParameter_LayerType_RELU) ?
+      activation_param.relu_param().negative_slope() : Dtype(0);
+  return true;
+}
+
+// Explicit instantiation
+template void caffe_cpu_bias_activation<float>(const int M, const int N,
+    const float* bias, const bool bias_per_row,
+    const LayerParameter_LayerType activation, const float negative_slope,
+    float* Y);
+template void caffe_cpu_bias_activation<double>(const int M, const int N,
+    const double* bias, const bool bias_per_row,
+    const LayerParameter_LayerType activation, const double negative_slope,
+    double* Y);
+template void caffe_cpu_activation_backward<float>(const int count,
+    const LayerParameter_LayerType activation, const float negative_slope,
+    const float* Y, float* dY);
+template void caffe_cpu_activation_backward<double>(const int count,
+    const LayerParameter_LayerType activation, const double negative_slope,
+    const double* Y, double* dY);
+template bool caffe_fusable_activation<float>(
+    const LayerParameter& activation_param,
+    LayerParameter_LayerType* activation, float* negative_slope);
+template bool caffe_fusable_activation<double>(
+    const LayerParameter& activation_param,
+    LayerParameter_LayerType* activation, double* negative_slope);
+
+}  // namespace caffe
@@ -0,0 +1,150 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "caffe/util/datum_transform.hpp"
+
+namespace caffe {
+
+// Reads a base 128 varint of the protobuf wire format.
+static bool read_varint(const uint8_t** p, const uint8_t* end,
+    uint64_t* value) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    const uint8_t byte = *(*p)++;
+    v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ParseDatumView(const char* buffer, const size_t size, DatumView* view) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(buffer);
+  const uint8_t* end = p + size;
+  view->channels = view->height = view->width = view->label = 0;
+  view->data = NULL;
+  view->data_size = 0;
+  while (p < end) {
+    uint64_t key, value;
+    if (!read_varint(&p, end, &key)) {
+      return false;
+    }
+    const int field = key >> 3;
+    const int wire_type = key & 7;
+    if (field == 4 && wire_type == 2) {
+      if (!read_varint(&p, end, &value) ||
+          value > static_cast<uint64_t>(end - p)) {
+        return false;
+      }
+      view->data = p;
+      view->data_size = value;
+      p += value;
+      continue;
+    }
+    // the int32 fields, the last one read winning as in protobuf
+    if (wire_type != 0 || !read_varint(&p, end, &value)) {
+      return false;
+    }
+    switch (field) {
+    case 1:
+      view->channels = static_cast<int32_t>(value);
+      break;
+    case 2:
+      view->height = static_cast<int32_t>(value);
+      break;
+    case 3:
+      view->width = static_cast<int32_t>(value);
+      break;
+    case 5:
+      view->label = static_cast<int32_t>(value);
+      break;
+    default:
+      return false;
+    }
+  }
+  return view->data_size > 0;
+}
+
+// Converts the pixels begin to end of a row of length end, writing pixel i
+// to end - 1 - i if mirror is set.
+template <typename Dtype>
+static void datum_row(const uint8_t* src, const Dtype* mean,
+    const Dtype scale, const bool mirror, const int begin, const int end,
+    Dtype* dst) {
+  if (mirror) {
+    for (int i = begin; i < end; ++i) {
+      dst[end - 1 - i] = (static_cast<Dtype>(src[i]) - mean[i]) * scale;
+    }
+  } else {
+    for (int i = begin; i < end; ++i) {
+      dst[i] = (static_cast<Dtype>(src[i]) - mean[i]) * scale;
+    }
+  }
+}
+
+#ifdef __SSE2__
+// Sixteen pixels at a time, widened from bytes to floats in registers.
+static void datum_row(const uint8_t* src, const float* mean,
+    const float scale, const bool mirror, const int begin, const int end,
+    float* dst) {
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+  int i = begin;
+  for (; i + 16 <= end; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const __m128i low = _mm_unpacklo_epi8(bytes, zero);
+    const __m128i high = _mm_unpackhi_epi8(bytes, zero);
+    __m128 values[4];
+    values[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero));
+    values[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero));
+    values[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero));
+    values[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero));
+    for (int k = 0; k < 4; ++k) {
+      const int j = i + 4 * k;
+      const __m128 value = _mm_mul_ps(
+          _mm_sub_ps(values[k], _mm_loadu_ps(mean + j)), scale4);
+      if (mirror) {
+        _mm_storeu_ps(dst + end - 4 - j,
+            _mm_shuffle_ps(value, value, _MM_SHUFFLE(0, 1, 2, 3)));
+      } else {
+        _mm_storeu_ps(dst + j, value);
+      }
+    }
+  }
+  datum_row<float>(src, mean, scale, mirror, i, end, dst);
+}
+#endif  // __SSE2__
+
+template <typename Dtype>
+void datum_transform_cpu(const uint8_t* data, const int channels,
+    const int height, const int width, const Dtype* mean, const Dtype scale,
+    const int crop_height, const int crop_width, const int h_off,
+    const int w_off, const bool mirror, Dtype* dst) {
+  for (int c = 0; c < channels; ++c) {
+    for (int h = 0; h < crop_height; ++h) {
+      const int offset = (c * height + h + h_off) * width + w_off;
+      datum_row(data + offset, mean + offset, scale, mirror, 0, crop_width,
+          dst + (c * crop_height + h) * crop_width);
+    }
+  }
+}
+
+template void datum_transform_cpu<float>(const uint8_t* data,
+    const int channels, const int height, const int width, const float* mean,
+    const float scale, const int crop_height, const int crop_width,
+    const int h_off, const int w_off, const bool mirror, float* dst);
+template void datum_transform_cpu<double>(const uint8_t* data,
+    const int channels, const int height, const int width,
+    const double* mean, const double scale, const int crop_height,
+    const int crop_width, const int h_off, const int w_off, const bool mirror,
+    double* dst);
+
+}  // namespace caffe
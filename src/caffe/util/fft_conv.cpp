@@ -0,0 +1,234 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/fft_conv.hpp"
+
+namespace caffe {
+
+// exp(-2 pi i k / n) for k < n / 2
+template <typename Dtype>
+static void fft_twiddle(const int n, std::complex<Dtype>* twiddle) {
+  for (int k = 0; k < n / 2; ++k) {
+    const double angle = -2. * M_PI * k / n;
+    twiddle[k] = std::complex<Dtype>(cos(angle), sin(angle));
+  }
+}
+
+// In-place iterative radix-2 transform of n values spaced by stride.
+template <typename Dtype>
+static void fft_1d(std::complex<Dtype>* x, const int n, const int stride,
+    const std::complex<Dtype>* twiddle, const bool inverse) {
+  for (int i = 1, j = 0; i < n; ++i) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      std::swap(x[i * stride], x[j * stride]);
+    }
+  }
+  for (int len = 2; len <= n; len <<= 1) {
+    const int half = len / 2;
+    const int step = n / len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < half; ++k) {
+        const std::complex<Dtype> w = inverse ?
+            std::conj(twiddle[k * step]) : twiddle[k * step];
+        const std::complex<Dtype> u = x[(i + k) * stride];
+        const std::complex<Dtype> v = x[(i + k + half) * stride] * w;
+        x[(i + k) * stride] = u + v;
+        x[(i + k + half) * stride] = u - v;
+      }
+    }
+  }
+}
+
+// Unscaled 2D transform of an n x n array of which only the first rows
+// rows may be non-zero.
+template <typename Dtype>
+static void fft_2d(std::complex<Dtype>* x, const int n, const int rows,
+    const std::complex<Dtype>* twiddle, const bool inverse) {
+  for (int r = 0; r < rows; ++r) {
+    fft_1d(x + r * n, n, 1, twiddle, inverse);
+  }
+  for (int c = 0; c < n; ++c) {
+    fft_1d(x + c, n, n, twiddle, inverse);
+  }
+}
+
+int fft_conv_size(const int ksize, const int height, const int width) {
+  int fft_size = 1;
+  while (fft_size < 2 * ksize) {
+    fft_size <<= 1;
+  }
+  // no need for transforms larger than a single tile covering the input
+  int image_size = 1;
+  while (image_size < std::max(height, width) + ksize - 1) {
+    image_size <<= 1;
+  }
+  return std::min(fft_size, image_size);
+}
+
+int fft_conv_kernel_count(const int num_out, const int num_in,
+    const int fft_size) {
+  return 2 * fft_size * (fft_size / 2 + 1) * num_out * num_in;
+}
+
+int fft_conv_buffer_count(const int num_in, const int num_out,
+    const int width, const int ksize, const int fft_size) {
+  const int tile = fft_size - ksize + 1;
+  const int tiles_w = (width + tile - 1) / tile;
+  const int bins = fft_size * (fft_size / 2 + 1);
+  return 2 * (fft_size / 2 + fft_size * fft_size +
+      bins * tiles_w * (num_in + num_out));
+}
+
+template <typename Dtype>
+void fft_conv_kernel_transform_cpu(const Dtype* kernel, const int num_a,
+    const int num_b, const int ksize, const bool transposed,
+    const int fft_size, Dtype* kernel_fft) {
+  const int num_out = transposed ? num_b : num_a;
+  const int num_in = transposed ? num_a : num_b;
+  const int half = fft_size / 2 + 1;
+  const int bins = fft_size * half;
+  std::vector<std::complex<Dtype> > twiddle(fft_size / 2);
+  std::vector<std::complex<Dtype> > work(fft_size * fft_size);
+  fft_twiddle(fft_size, &twiddle[0]);
+  std::complex<Dtype>* spectra =
+      reinterpret_cast<std::complex<Dtype>*>(kernel_fft);
+  for (int o = 0; o < num_out; ++o) {
+    for (int c = 0; c < num_in; ++c) {
+      const Dtype* k = kernel + (transposed ? c * num_b + o : o * num_b + c)
+          * ksize * ksize;
+      std::fill(work.begin(), work.end(), std::complex<Dtype>(0));
+      for (int i = 0; i < ksize; ++i) {
+        for (int j = 0; j < ksize; ++j) {
+          work[i * fft_size + j] = transposed ? k[i * ksize + j] :
+              k[(ksize - 1 - i) * ksize + (ksize - 1 - j)];
+        }
+      }
+      fft_2d(&work[0], fft_size, ksize, &twiddle[0], false);
+      for (int b = 0; b < bins; ++b) {
+        spectra[(b * num_out + o) * num_in + c] =
+            work[(b / half) * fft_size + b % half];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void fft_conv_cpu(const Dtype* data_in, const int num_in, const int height,
+    const int width, const Dtype* kernel_fft, const int num_out,
+    const int ksize, const int fft_size, const int offset,
+    const int height_out, const int width_out, Dtype* buffer,
+    Dtype* data_out) {
+  typedef std::complex<Dtype> Complex;
+  const int n = fft_size;
+  const int tile = n - ksize + 1;
+  const int tiles_h = (height + tile - 1) / tile;
+  const int tiles_w = (width + tile - 1) / tile;
+  const int half = n / 2 + 1;
+  const int bins = n * half;
+  const Complex* kernel = reinterpret_cast<const Complex*>(kernel_fft);
+  Complex* twiddle = reinterpret_cast<Complex*>(buffer);
+  Complex* work = twiddle + n / 2;
+  Complex* in_fft = work + n * n;
+  Complex* out_fft = in_fft + bins * num_in * tiles_w;
+  const Dtype scale = Dtype(1) / (n * n);
+  fft_twiddle(n, twiddle);
+  memset(data_out, 0, sizeof(Dtype) * num_out * height_out * width_out);
+  // one row of tiles at a time
+  for (int ty = 0; ty < tiles_h; ++ty) {
+    const int h0 = ty * tile;
+    const int rows = std::min(tile, height - h0);
+    for (int c = 0; c < num_in; ++c) {
+      for (int tx = 0; tx < tiles_w; ++tx) {
+        const int w0 = tx * tile;
+        const int cols = std::min(tile, width - w0);
+        std::fill(work, work + n * n, Complex(0));
+        for (int i = 0; i < rows; ++i) {
+          const Dtype* im = data_in + (c * height + h0 + i) * width + w0;
+          for (int j = 0; j < cols; ++j) {
+            work[i * n + j] = im[j];
+          }
+        }
+        fft_2d(work, n, rows, twiddle, false);
+        for (int b = 0; b < bins; ++b) {
+          in_fft[(b * num_in + c) * tiles_w + tx] =
+              work[(b / half) * n + b % half];
+        }
+      }
+    }
+    // products with the kernels, summed over the input channels
+    for (int b = 0; b < bins; ++b) {
+      for (int o = 0; o < num_out; ++o) {
+        Complex* out = out_fft + (b * num_out + o) * tiles_w;
+        std::fill(out, out + tiles_w, Complex(0));
+        for (int c = 0; c < num_in; ++c) {
+          const Complex k = kernel[(b * num_out + o) * num_in + c];
+          const Complex* in = in_fft + (b * num_in + c) * tiles_w;
+          for (int tx = 0; tx < tiles_w; ++tx) {
+            out[tx] += k * in[tx];
+          }
+        }
+      }
+    }
+    // back to the spatial domain, adding the tiles into the output window
+    for (int o = 0; o < num_out; ++o) {
+      for (int tx = 0; tx < tiles_w; ++tx) {
+        for (int u = 0; u < n; ++u) {
+          for (int v = 0; v < half; ++v) {
+            work[u * n + v] = out_fft[((u * half + v) * num_out + o) * tiles_w
+                + tx];
+          }
+        }
+        // the other half of the spectrum of a real signal is conjugate
+        for (int u = 0; u < n; ++u) {
+          for (int v = half; v < n; ++v) {
+            work[u * n + v] = std::conj(work[((n - u) % n) * n + n - v]);
+          }
+        }
+        fft_2d(work, n, n, twiddle, true);
+        const int w0 = tx * tile - offset;
+        for (int y = 0; y < n; ++y) {
+          const int h = h0 - offset + y;
+          if (h < 0 || h >= height_out) {
+            continue;
+          }
+          Dtype* out = data_out + (o * height_out + h) * width_out;
+          const int x_begin = std::max(0, -w0);
+          const int x_end = std::min(n, width_out - w0);
+          for (int x = x_begin; x < x_end; ++x) {
+            out[w0 + x] += scale * work[y * n + x].real();
+          }
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void fft_conv_kernel_transform_cpu<float>(const float* kernel,
+    const int num_a, const int num_b, const int ksize, const bool transposed,
+    const int fft_size, float* kernel_fft);
+template void fft_conv_kernel_transform_cpu<double>(const double* kernel,
+    const int num_a, const int num_b, const int ksize, const bool transposed,
+    const int fft_size, double* kernel_fft);
+template void fft_conv_cpu<float>(const float* data_in, const int num_in,
+    const int height, const int width, const float* kernel_fft,
+    const int num_out, const int ksize, const int fft_size, const int offset,
+    const int height_out, const int width_out, float* buffer,
+    float* data_out);
+template void fft_conv_cpu<double>(const double* data_in, const int num_in,
+    const int height, const int width, const double* kernel_fft,
+    const int num_out, const int ksize, const int fft_size, const int offset,
+    const int height_out, const int width_out, double* buffer,
+    double* data_out);
+
+}  // namespace caffe
@@ -0,0 +1,265 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hdf5.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/hdf5_reader.hpp"
+#include "caffe/util/io.hpp"
+
+using std::string;
+
+namespace caffe {
+
+// The HDF5 memory type of Dtype.
+template <typename Dtype>
+static hid_t hdf5_native_type();
+
+template <>
+hid_t hdf5_native_type<float>() { return H5T_NATIVE_FLOAT; }
+
+template <>
+hid_t hdf5_native_type<double>() { return H5T_NATIVE_DOUBLE; }
+
+template <typename Dtype>
+void* HDF5RowReaderPrefetch(void* reader_pointer) {
+  CHECK(reader_pointer);
+  HDF5RowReader<Dtype>* reader =
+      static_cast<HDF5RowReader<Dtype>*>(reader_pointer);
+  pthread_mutex_lock(&reader->mutex_);
+  while (true) {
+    while (!reader->stop_ && reader->wanted_window_ < 0) {
+      pthread_cond_wait(&reader->window_wanted_, &reader->mutex_);
+    }
+    if (reader->stop_) {
+      break;
+    }
+    const int index = reader->wanted_window_;
+    reader->wanted_window_ = -1;
+    if (reader->index_.count(index)) {
+      continue;
+    }
+    ++reader->num_read_ahead_;
+    typename HDF5RowReader<Dtype>::WindowIterator window =
+        reader->InsertWindow(index);
+    pthread_mutex_unlock(&reader->mutex_);
+    reader->LoadWindow(index, &window->data);
+    pthread_mutex_lock(&reader->mutex_);
+    window->loaded = true;
+    pthread_cond_broadcast(&reader->window_loaded_);
+    reader->Evict();
+  }
+  pthread_mutex_unlock(&reader->mutex_);
+  return static_cast<void*>(NULL);
+}
+
+template <typename Dtype>
+HDF5RowReader<Dtype>::HDF5RowReader(const string& filename,
+    const string& dataset, const int min_dim, const int max_dim,
+    const int min_window_rows, const size_t capacity, const bool read_ahead)
+    : filename_(filename), num_hits_(0), num_misses_(0), num_read_ahead_(0),
+      read_ahead_(read_ahead), stop_(false), wanted_window_(-1) {
+  hsize_t chunk_rows = 1;
+  pthread_mutex_lock(hdf5_mutex());
+  file_id_ = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+  CHECK_GE(file_id_, 0) << "Failed opening HDF5 file " << filename;
+  dataset_id_ = H5Dopen2(file_id_, dataset.c_str(), H5P_DEFAULT);
+  CHECK_GE(dataset_id_, 0) << "Failed opening dataset " << dataset << " of "
+      << filename;
+  hid_t type_id = H5Dget_type(dataset_id_);
+  CHECK_EQ(H5Tget_class(type_id), H5T_FLOAT)
+      << "Expected float or double data";
+  H5Tclose(type_id);
+  hid_t space_id = H5Dget_space(dataset_id_);
+  const int ndims = H5Sget_simple_extent_ndims(space_id);
+  CHECK_GE(ndims, min_dim);
+  CHECK_LE(ndims, max_dim);
+  dims_.resize(ndims);
+  H5Sget_simple_extent_dims(space_id, dims_.data(), NULL);
+  H5Sclose(space_id);
+  hid_t plist_id = H5Dget_create_plist(dataset_id_);
+  if (H5Pget_layout(plist_id) == H5D_CHUNKED) {
+    std::vector<hsize_t> chunk_dims(ndims);
+    H5Pget_chunk(plist_id, ndims, chunk_dims.data());
+    chunk_rows = chunk_dims[0];
+  }
+  H5Pclose(plist_id);
+  pthread_mutex_unlock(hdf5_mutex());
+
+  num_ = dims_[0];
+  channels_ = (ndims > 1) ? dims_[1] : 1;
+  height_ = (ndims > 2) ? dims_[2] : 1;
+  width_ = (ndims > 3) ? dims_[3] : 1;
+  CHECK_GT(num_, 0) << "No rows in dataset " << dataset << " of " << filename;
+  // whole chunks, as HDF5 reads and decompresses them whole anyway
+  const int rows = std::max(min_window_rows, 1);
+  window_rows_ = (rows + chunk_rows - 1) / chunk_rows * chunk_rows;
+  window_rows_ = std::min(window_rows_, num_);
+  const size_t window_bytes = sizeof(Dtype) * window_rows_ * row_size();
+  const size_t num_windows = (num_ + window_rows_ - 1) / window_rows_;
+  max_windows_ = std::min(std::max(capacity / window_bytes, size_t(2)),
+      num_windows);
+  LOG(INFO) << "Reading " << dataset << " of " << filename << " in windows of "
+      << window_rows_ << " rows (chunks of " << chunk_rows << "), caching "
+      << max_windows_ << " of " << num_windows;
+
+  CHECK(!pthread_mutex_init(&mutex_, NULL));
+  CHECK(!pthread_cond_init(&window_loaded_, NULL));
+  CHECK(!pthread_cond_init(&window_wanted_, NULL));
+  if (read_ahead_) {
+    CHECK(!pthread_create(&thread_, NULL, HDF5RowReaderPrefetch<Dtype>,
+          static_cast<void*>(this))) << "Pthread execution failed.";
+  }
+}
+
+template <typename Dtype>
+HDF5RowReader<Dtype>::~HDF5RowReader() {
+  if (read_ahead_) {
+    pthread_mutex_lock(&mutex_);
+    stop_ = true;
+    pthread_cond_signal(&window_wanted_);
+    pthread_mutex_unlock(&mutex_);
+    CHECK(!pthread_join(thread_, NULL)) << "Pthread joining failed.";
+  }
+  pthread_cond_destroy(&window_wanted_);
+  pthread_cond_destroy(&window_loaded_);
+  pthread_mutex_destroy(&mutex_);
+  pthread_mutex_lock(hdf5_mutex());
+  H5Dclose(dataset_id_);
+  H5Fclose(file_id_);
+  pthread_mutex_unlock(hdf5_mutex());
+}
+
+template <typename Dtype>
+void HDF5RowReader<Dtype>::ReadRows(const int row, const int num_rows,
+    Dtype* data) {
+  CHECK_GE(row, 0);
+  CHECK_LE(row + num_rows, num_) << "Reading past the rows of " << filename_;
+  const int num_windows = (num_ + window_rows_ - 1) / window_rows_;
+  const int end = row + num_rows;
+  pthread_mutex_lock(&mutex_);
+  for (int r = row; r < end; ) {
+    const int index = r / window_rows_;
+    WindowIterator window = UseWindow(index);
+    const int first = index * window_rows_;
+    const int rows = std::min(end, first + window_rows_) - r;
+    memcpy(data + (r - row) * row_size(),
+        &window->data[(r - first) * row_size()],
+        sizeof(Dtype) * rows * row_size());
+    --window->users;
+    r += rows;
+    if (read_ahead_) {
+      const int next = (index + 1) % num_windows;
+      if (!index_.count(next)) {
+        wanted_window_ = next;
+        pthread_cond_signal(&window_wanted_);
+      }
+    }
+    Evict();
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+template <typename Dtype>
+typename HDF5RowReader<Dtype>::WindowIterator HDF5RowReader<Dtype>::UseWindow(
+    const int index) {
+  typename std::map<int, WindowIterator>::iterator it = index_.find(index);
+  WindowIterator window;
+  if (it != index_.end()) {
+    ++num_hits_;
+    window = it->second;
+    lru_.splice(lru_.begin(), lru_, window);
+    ++window->users;
+    // it may still be read ahead
+    while (!window->loaded) {
+      pthread_cond_wait(&window_loaded_, &mutex_);
+    }
+    return window;
+  }
+  ++num_misses_;
+  window = InsertWindow(index);
+  ++window->users;
+  pthread_mutex_unlock(&mutex_);
+  LoadWindow(index, &window->data);
+  pthread_mutex_lock(&mutex_);
+  window->loaded = true;
+  pthread_cond_broadcast(&window_loaded_);
+  return window;
+}
+
+template <typename Dtype>
+typename HDF5RowReader<Dtype>::WindowIterator
+HDF5RowReader<Dtype>::InsertWindow(const int index) {
+  Window window;
+  window.index = index;
+  window.loaded = false;
+  window.users = 0;
+  lru_.push_front(window);
+  index_[index] = lru_.begin();
+  return lru_.begin();
+}
+
+template <typename Dtype>
+void HDF5RowReader<Dtype>::LoadWindow(const int index,
+    std::vector<Dtype>* data) {
+  const int first = index * window_rows_;
+  const int rows = std::min(window_rows_, num_ - first);
+  data->resize(rows * row_size());
+  std::vector<hsize_t> start(dims_.size(), 0);
+  std::vector<hsize_t> count(dims_);
+  start[0] = first;
+  count[0] = rows;
+  pthread_mutex_lock(hdf5_mutex());
+  hid_t file_space_id = H5Dget_space(dataset_id_);
+  H5Sselect_hyperslab(file_space_id, H5S_SELECT_SET, start.data(), NULL,
+      count.data(), NULL);
+  hid_t mem_space_id = H5Screate_simple(count.size(), count.data(), NULL);
+  herr_t status = H5Dread(dataset_id_, hdf5_native_type<Dtype>(),
+      mem_space_id, file_space_id, H5P_DEFAULT, data->data());
+  H5Sclose(mem_space_id);
+  H5Sclose(file_space_id);
+  pthread_mutex_unlock(hdf5_mutex());
+  CHECK_GE(status, 0) << "Failed reading rows " << first << " to "
+      << first + rows << " of " << filename_;
+}
+
+template <typename Dtype>
+void HDF5RowReader<Dtype>::Evict() {
+  WindowIterator it = lru_.end();
+  while (lru_.size() > max_windows_ && it != lru_.begin()) {
+    --it;
+    if (it->loaded && !it->users) {
+      index_.erase(it->index);
+      it = lru_.erase(it);
+    }
+  }
+}
+
+template <typename Dtype>
+HDF5ReaderStats HDF5RowReader<Dtype>::stats() const {
+  pthread_mutex_lock(&mutex_);
+  HDF5ReaderStats stats;
+  stats.num_hits = num_hits_;
+  stats.num_misses = num_misses_;
+  stats.num_read_ahead = num_read_ahead_;
+  stats.num_windows = lru_.size();
+  stats.bytes_cached = 0;
+  for (typename std::list<Window>::const_iterator it = lru_.begin();
+      it != lru_.end(); ++it) {
+    if (it->loaded) {
+      stats.bytes_cached += sizeof(Dtype) * it->data.size();
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+  return stats;
+}
+
+INSTANTIATE_CLASS(HDF5RowReader);
+
+}  // namespace caffe
@@ -0,0 +1,307 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+namespace caffe {
+
+static HostAllocator* host_allocator_ = NULL;
+
+HostAllocator::HostAllocator()
+    : bytes_in_use_(0), peak_bytes_in_use_(0), bytes_cached_(0),
+      num_allocs_(0), num_cache_hits_(0) {}
+
+HostAllocatorStats HostAllocator::stats() const {
+  HostAllocatorStats stats;
+  stats.bytes_in_use = bytes_in_use_;
+  stats.peak_bytes_in_use = peak_bytes_in_use_;
+  stats.bytes_cached = bytes_cached_;
+  stats.num_allocs = num_allocs_;
+  stats.num_cache_hits = num_cache_hits_;
+  return stats;
+}
+
+void HostAllocator::ResetPeak() {
+  peak_bytes_in_use_ = bytes_in_use_;
+}
+
+void HostAllocator::CountAlloc(size_t size, bool cache_hit) {
+  const size_t in_use = __sync_add_and_fetch(&bytes_in_use_, size);
+  size_t peak = peak_bytes_in_use_;
+  while (in_use > peak &&
+      !__sync_bool_compare_and_swap(&peak_bytes_in_use_, peak, in_use)) {
+    peak = peak_bytes_in_use_;
+  }
+  __sync_add_and_fetch(&num_allocs_, 1);
+  if (cache_hit) {
+    __sync_add_and_fetch(&num_cache_hits_, 1);
+  }
+}
+
+void HostAllocator::CountFree(size_t size) {
+  __sync_sub_and_fetch(&bytes_in_use_, size);
+}
+
+void HostAllocator::CountCached(size_t size, bool add) {
+  if (add) {
+    __sync_add_and_fetch(&bytes_cached_, size);
+  } else {
+    __sync_sub_and_fetch(&bytes_cached_, size);
+  }
+}
+
+// The allocator picked by CAFFE_HOST_ALLOCATOR.
+static HostAllocator* default_host_allocator() {
+  const char* name = getenv("CAFFE_HOST_ALLOCATOR");
+  if (name && strcmp(name, "malloc") == 0) {
+    LOG(INFO) << "Using malloc for host memory";
+    return HostAllocator::Malloc();
+  }
+  return HostAllocator::Caching();
+}
+
+HostAllocator* HostAllocator::Get() {
+  if (host_allocator_) {
+    return host_allocator_;
+  }
+  // initialized once, even if several threads allocate first
+  static HostAllocator* default_allocator = default_host_allocator();
+  return default_allocator;
+}
+
+void HostAllocator::Set(HostAllocator* allocator) {
+  host_allocator_ = allocator;
+}
+
+HostAllocator* HostAllocator::Malloc() {
+  static MallocHostAllocator* allocator = new MallocHostAllocator();
+  return allocator;
+}
+
+HostAllocator* HostAllocator::Caching() {
+  static CachingHostAllocator* allocator = new CachingHostAllocator();
+  return allocator;
+}
+
+void* MallocHostAllocator::Allocate(size_t size) {
+  void* ptr = malloc(size);
+  CHECK(ptr || size == 0) << "Failed to allocate " << size
+      << " bytes of host memory";
+  CountAlloc(size, false);
+  return ptr;
+}
+
+void MallocHostAllocator::Free(void* ptr, size_t size) {
+  free(ptr);
+  CountFree(size);
+}
+
+const size_t CachingHostAllocator::kAlignment;
+const size_t CachingHostAllocator::kMaxCachedSize;
+const size_t CachingHostAllocator::kMaxBytesCached;
+const size_t CachingHostAllocator::kMaxThreadCachedSize;
+const size_t CachingHostAllocator::kThreadCacheSize;
+
+// Free blocks of the small size classes kept by one thread.
+struct CachingHostAllocator::ThreadCache {
+  CachingHostAllocator* owner;
+  std::vector<std::vector<void*> > free_lists;
+  size_t size;
+};
+
+// Classes 0 to 3 are 64 to 256 bytes in steps of 64; above, every power of
+// two interval (2^e, 2^(e+1)] is split into four classes 5, 6, 7 and 8 times
+// 2^(e-2).
+int CachingHostAllocator::size_class(size_t size) {
+  if (size <= 4 * kAlignment) {
+    return size ? (size - 1) / kAlignment : 0;
+  }
+  int e = 8;
+  while ((size_t(1) << (e + 1)) < size) {
+    ++e;
+  }
+  const size_t step = size_t(1) << (e - 2);
+  const int m = (size + step - 1) / step;
+  return 4 + 4 * (e - 8) + m - 5;
+}
+
+size_t CachingHostAllocator::class_size(int size_class) {
+  if (size_class < 4) {
+    return (size_class + 1) * kAlignment;
+  }
+  const int e = 8 + (size_class - 4) / 4;
+  const size_t m = 5 + (size_class - 4) % 4;
+  return m << (e - 2);
+}
+
+static void* aligned_malloc(size_t size, size_t alignment) {
+  void* ptr = NULL;
+  if (posix_memalign(&ptr, alignment, size) != 0) {
+    return NULL;
+  }
+  return ptr;
+}
+
+CachingHostAllocator::CachingHostAllocator(size_t max_bytes_cached)
+    : max_bytes_cached_(max_bytes_cached),
+      free_lists_(size_class(kMaxCachedSize) + 1) {
+  pthread_mutex_init(&mutex_, NULL);
+  CHECK_EQ(pthread_key_create(&thread_cache_key_, DestroyThreadCache), 0);
+}
+
+// The caches of threads that are still running are leaked; memory still in
+// use must not be freed afterwards.
+CachingHostAllocator::~CachingHostAllocator() {
+  ThreadCache* cache = thread_cache(false);
+  if (cache) {
+    pthread_setspecific(thread_cache_key_, NULL);
+    DestroyThreadCache(cache);
+  }
+  ReleaseCached();
+  pthread_key_delete(thread_cache_key_);
+  pthread_mutex_destroy(&mutex_);
+}
+
+CachingHostAllocator::ThreadCache* CachingHostAllocator::thread_cache(
+    bool create) {
+  ThreadCache* cache =
+      static_cast<ThreadCache*>(pthread_getspecific(thread_cache_key_));
+  if (!cache && create) {
+    cache = new ThreadCache();
+    cache->owner = this;
+    cache->free_lists.resize(size_class(kMaxThreadCachedSize) + 1);
+    cache->size = 0;
+    pthread_setspecific(thread_cache_key_, cache);
+  }
+  return cache;
+}
+
+// Moves the blocks of a thread cache to the shared free lists.
+void CachingHostAllocator::FlushThreadCache(ThreadCache* cache) {
+  pthread_mutex_lock(&mutex_);
+  for (int c = 0; c < cache->free_lists.size(); ++c) {
+    free_lists_[c].insert(free_lists_[c].end(),
+        cache->free_lists[c].begin(), cache->free_lists[c].end());
+    cache->free_lists[c].clear();
+  }
+  pthread_mutex_unlock(&mutex_);
+  cache->size = 0;
+}
+
+// Called at the exit of threads that have freed memory.
+void CachingHostAllocator::DestroyThreadCache(void* cache) {
+  ThreadCache* thread_cache = static_cast<ThreadCache*>(cache);
+  thread_cache->owner->FlushThreadCache(thread_cache);
+  delete thread_cache;
+}
+
+void* CachingHostAllocator::Allocate(size_t size) {
+  if (size > kMaxCachedSize) {
+    void* ptr = aligned_malloc(size, kAlignment);
+    if (!ptr) {
+      ReleaseCached();
+      ptr = aligned_malloc(size, kAlignment);
+    }
+    CHECK(ptr) << "Failed to allocate " << size << " bytes of host memory";
+    CountAlloc(size, false);
+    return ptr;
+  }
+  const int c = size_class(size);
+  const size_t bytes = class_size(c);
+  void* ptr = NULL;
+  if (bytes <= kMaxThreadCachedSize) {
+    ThreadCache* cache = thread_cache(false);
+    if (cache && !cache->free_lists[c].empty()) {
+      ptr = cache->free_lists[c].back();
+      cache->free_lists[c].pop_back();
+      cache->size -= bytes;
+    }
+  }
+  if (!ptr) {
+    pthread_mutex_lock(&mutex_);
+    if (!free_lists_[c].empty()) {
+      ptr = free_lists_[c].back();
+      free_lists_[c].pop_back();
+    }
+    pthread_mutex_unlock(&mutex_);
+  }
+  if (ptr) {
+    CountCached(bytes, false);
+    CountAlloc(bytes, true);
+    return ptr;
+  }
+  ptr = aligned_malloc(bytes, kAlignment);
+  if (!ptr) {
+    // maybe the cached blocks of other sizes are in the way
+    ReleaseCached();
+    ptr = aligned_malloc(bytes, kAlignment);
+  }
+  CHECK(ptr) << "Failed to allocate " << bytes << " bytes of host memory";
+  CountAlloc(bytes, false);
+  return ptr;
+}
+
+void CachingHostAllocator::Free(void* ptr, size_t size) {
+  if (!ptr) {
+    return;
+  }
+  if (size > kMaxCachedSize) {
+    free(ptr);
+    CountFree(size);
+    return;
+  }
+  const int c = size_class(size);
+  const size_t bytes = class_size(c);
+  CountFree(bytes);
+  if (bytes > max_bytes_cached_) {
+    free(ptr);
+    return;
+  }
+  CountCached(bytes, true);
+  if (bytes <= kMaxThreadCachedSize) {
+    ThreadCache* cache = thread_cache(true);
+    if (cache->size + bytes <= kThreadCacheSize) {
+      cache->free_lists[c].push_back(ptr);
+      cache->size += bytes;
+      return;
+    }
+  }
+  pthread_mutex_lock(&mutex_);
+  free_lists_[c].push_back(ptr);
+  // over the cap, free the largest shared blocks first
+  for (int k = free_lists_.size() - 1;
+       bytes_cached_ > max_bytes_cached_ && k >= 0; --k) {
+    while (bytes_cached_ > max_bytes_cached_ && !free_lists_[k].empty()) {
+      free(free_lists_[k].back());
+      free_lists_[k].pop_back();
+      CountCached(class_size(k), false);
+    }
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+// Frees the shared free lists and the cache of the calling thread; the
+// caches of other threads are flushed when they exit.
+void CachingHostAllocator::ReleaseCached() {
+  ThreadCache* cache = thread_cache(false);
+  if (cache) {
+    FlushThreadCache(cache);
+  }
+  pthread_mutex_lock(&mutex_);
+  for (int c = 0; c < free_lists_.size(); ++c) {
+    for (int i = 0; i < free_lists_[c].size(); ++i) {
+      free(free_lists_[c][i]);
+    }
+    CountCached(class_size(c) * free_lists_[c].size(), false);
+    free_lists_[c].clear();
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+}  // namespace caffe
@@ -1,5 +1,6 @@
 // Copyright 2014 BVLC and contributors.
 
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -8,6 +9,36 @@
 
 namespace caffe {
 
+// With stride 1 the pixels of one column-buffer row are a contiguous segment
+// of an image row, so they are copied as a whole instead of pixel by pixel.
+// im_row is the image row for the row offset of the column row, or NULL if it
+// falls into the padding; w_shift = w_offset - pad.
+template <typename Dtype>
+inline void im2col_row_stride1(const Dtype* im_row, const int width,
+    const int width_col, const int w_shift, Dtype* col_row) {
+  if (im_row == NULL) {
+    memset(col_row, 0, sizeof(Dtype) * width_col);
+    return;
+  }
+  const int w_begin = std::min(width_col, std::max(0, -w_shift));
+  const int w_end = std::max(w_begin, std::min(width_col, width - w_shift));
+  memset(col_row, 0, sizeof(Dtype) * w_begin);
+  memcpy(col_row + w_begin, im_row + w_begin + w_shift,
+      sizeof(Dtype) * (w_end - w_begin));
+  memset(col_row + w_end, 0, sizeof(Dtype) * (width_col - w_end));
+}
+
+template <typename Dtype>
+inline void col2im_row_stride1(const Dtype* col_row, const int width,
+    const int width_col, const int w_shift, Dtype* im_row) {
+  const int w_begin = std::max(0, -w_shift);
+  const int w_end = std::min(width_col, width - w_shift);
+  Dtype* im = im_row + w_shift;
+  for (int w = w_begin; w < w_end; ++w) {
+    im[w] += col_row[w];
+  }
+}
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int ksize, const int pad,
@@ -19,6 +50,16 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     int w_offset = c % ksize;
     int h_offset = (c / ksize) % ksize;
     int c_im = c / ksize / ksize;
+    if (stride == 1) {
+      for (int h = 0; h < height_col; ++h) {
+        int h_pad = h - pad + h_offset;
+        im2col_row_stride1((h_pad >= 0 && h_pad < height) ?
+            data_im + (c_im * height + h_pad) * width : NULL,
+            width, width_col, w_offset - pad,
+            data_col + (c * height_col + h) * width_col);
+      }
+      continue;
+    }
     for (int h = 0; h < height_col; ++h) {
       for (int w = 0; w < width_col; ++w) {
         int h_pad = h * stride - pad + h_offset;
@@ -53,6 +94,16 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     int w_offset = c % ksize;
     int h_offset = (c / ksize) % ksize;
     int c_im = c / ksize / ksize;
+    if (stride == 1) {
+      for (int h = 0; h < height_col; ++h) {
+        int h_pad = h - pad + h_offset;
+        if (h_pad >= 0 && h_pad < height)
+          col2im_row_stride1(data_col + (c * height_col + h) * width_col,
+              width, width_col, w_offset - pad,
+              data_im + (c_im * height + h_pad) * width);
+      }
+      continue;
+    }
     for (int h = 0; h < height_col; ++h) {
       for (int w = 0; w < width_col; ++w) {
         int h_pad = h * stride - pad + h_offset;
@@ -73,4 +124,97 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int height, const int width, const int psize, const int pad,
     const int stride, double* data_im);
 
+template <typename Dtype>
+void im2col_batch_cpu(const Dtype* data_im, const int num, const int channels,
+    const int height, const int width, const int ksize, const int pad,
+    const int stride, Dtype* data_col) {
+  int height_col = (height + 2 * pad - ksize) / stride + 1;
+  int width_col = (width + 2 * pad - ksize) / stride + 1;
+  int channels_col = channels * ksize * ksize;
+  int image_size = channels * height * width;
+  int col_size = height_col * width_col;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % ksize;
+    int h_offset = (c / ksize) % ksize;
+    int c_im = c / ksize / ksize;
+    for (int n = 0; n < num; ++n) {
+      const Dtype* im = data_im + n * image_size + c_im * height * width;
+      Dtype* col = data_col + (c * num + n) * col_size;
+      if (stride == 1) {
+        for (int h = 0; h < height_col; ++h) {
+          int h_pad = h - pad + h_offset;
+          im2col_row_stride1((h_pad >= 0 && h_pad < height) ?
+              im + h_pad * width : NULL,
+              width, width_col, w_offset - pad, col + h * width_col);
+        }
+        continue;
+      }
+      for (int h = 0; h < height_col; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          int h_pad = h * stride - pad + h_offset;
+          int w_pad = w * stride - pad + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+            col[h * width_col + w] = im[h_pad * width + w_pad];
+          else
+            col[h * width_col + w] = 0;
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void im2col_batch_cpu<float>(const float* data_im, const int num,
+    const int channels, const int height, const int width, const int ksize,
+    const int pad, const int stride, float* data_col);
+template void im2col_batch_cpu<double>(const double* data_im, const int num,
+    const int channels, const int height, const int width, const int ksize,
+    const int pad, const int stride, double* data_col);
+
+template <typename Dtype>
+void col2im_batch_cpu(const Dtype* data_col, const int num, const int channels,
+    const int height, const int width, const int ksize, const int pad,
+    const int stride, Dtype* data_im) {
+  memset(data_im, 0, sizeof(Dtype) * num * height * width * channels);
+  int height_col = (height + 2 * pad - ksize) / stride + 1;
+  int width_col = (width + 2 * pad - ksize) / stride + 1;
+  int channels_col = channels * ksize * ksize;
+  int image_size = channels * height * width;
+  int col_size = height_col * width_col;
+  for (int c = 0; c < channels_col; ++c) {
+    int w_offset = c % ksize;
+    int h_offset = (c / ksize) % ksize;
+    int c_im = c / ksize / ksize;
+    for (int n = 0; n < num; ++n) {
+      Dtype* im = data_im + n * image_size + c_im * height * width;
+      const Dtype* col = data_col + (c * num + n) * col_size;
+      if (stride == 1) {
+        for (int h = 0; h < height_col; ++h) {
+          int h_pad = h - pad + h_offset;
+          if (h_pad >= 0 && h_pad < height)
+            col2im_row_stride1(col + h * width_col, width, width_col,
+                w_offset - pad, im + h_pad * width);
+        }
+        continue;
+      }
+      for (int h = 0; h < height_col; ++h) {
+        for (int w = 0; w < width_col; ++w) {
+          int h_pad = h * stride - pad + h_offset;
+          int w_pad = w * stride - pad + w_offset;
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
+            im[h_pad * width + w_pad] += col[h * width_col + w];
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void col2im_batch_cpu<float>(const float* data_col, const int num,
+    const int channels, const int height, const int width, const int psize,
+    const int pad, const int stride, float* data_im);
+template void col2im_batch_cpu<double>(const double* data_col, const int num,
+    const int channels, const int height, const int width, const int psize,
+    const int pad, const int stride, double* data_im);
+
 }  // namespace caffe
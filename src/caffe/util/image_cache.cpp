@@ -0,0 +1,146 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <pthread.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+
+using std::string;
+
+namespace caffe {
+
+cv::Mat ReadImageToCVMat(const string& filename, const int height,
+    const int width, const bool is_color) {
+  cv::Mat cv_img;
+  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+    CV_LOAD_IMAGE_GRAYSCALE);
+  if (height > 0 && width > 0) {
+    cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
+    if (cv_img_origin.data) {
+      cv::resize(cv_img_origin, cv_img, cv::Size(height, width));
+    }
+  } else {
+    cv_img = cv::imread(filename, cv_read_flag);
+  }
+  return cv_img;
+}
+
+// The bytes of the pixels of an image.
+static size_t image_bytes(const cv::Mat& image) {
+  return image.total() * image.elemSize();
+}
+
+ImageCache::ImageCache(size_t capacity)
+    : capacity_(capacity), bytes_cached_(0), num_hits_(0), num_misses_(0),
+      num_evictions_(0) {
+  CHECK(!pthread_mutex_init(&mutex_, NULL));
+}
+
+ImageCache::~ImageCache() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+cv::Mat ImageCache::Read(const string& filename, const int height,
+    const int width, const bool is_color) {
+  std::ostringstream key_stream;
+  key_stream << (is_color ? 'c' : 'g') << std::max(height, 0) << 'x'
+      << std::max(width, 0) << ':' << filename;
+  const string key = key_stream.str();
+  pthread_mutex_lock(&mutex_);
+  std::map<string, std::list<Entry>::iterator>::iterator it = index_.find(key);
+  if (it != index_.end()) {
+    ++num_hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    cv::Mat image = it->second->second;
+    pthread_mutex_unlock(&mutex_);
+    return image;
+  }
+  ++num_misses_;
+  pthread_mutex_unlock(&mutex_);
+
+  cv::Mat image = ReadImageToCVMat(filename, height, width, is_color);
+  if (!image.data) {
+    return image;
+  }
+  const size_t bytes = image_bytes(image);
+  pthread_mutex_lock(&mutex_);
+  // another thread may have read it meanwhile
+  if (bytes <= capacity_ && index_.find(key) == index_.end()) {
+    lru_.push_front(Entry(key, image));
+    index_[key] = lru_.begin();
+    bytes_cached_ += bytes;
+    Evict();
+  }
+  pthread_mutex_unlock(&mutex_);
+  return image;
+}
+
+void ImageCache::Evict() {
+  while (bytes_cached_ > capacity_) {
+    const Entry& entry = lru_.back();
+    bytes_cached_ -= image_bytes(entry.second);
+    index_.erase(entry.first);
+    lru_.pop_back();
+    ++num_evictions_;
+  }
+}
+
+ImageCacheStats ImageCache::stats() const {
+  pthread_mutex_lock(&mutex_);
+  ImageCacheStats stats;
+  stats.num_hits = num_hits_;
+  stats.num_misses = num_misses_;
+  stats.num_evictions = num_evictions_;
+  stats.num_images = lru_.size();
+  stats.bytes_cached = bytes_cached_;
+  pthread_mutex_unlock(&mutex_);
+  return stats;
+}
+
+void ImageCache::Clear() {
+  pthread_mutex_lock(&mutex_);
+  lru_.clear();
+  index_.clear();
+  bytes_cached_ = 0;
+  pthread_mutex_unlock(&mutex_);
+}
+
+size_t ImageCache::capacity() const {
+  pthread_mutex_lock(&mutex_);
+  const size_t capacity = capacity_;
+  pthread_mutex_unlock(&mutex_);
+  return capacity;
+}
+
+void ImageCache::set_capacity(size_t capacity) {
+  pthread_mutex_lock(&mutex_);
+  capacity_ = capacity;
+  Evict();
+  pthread_mutex_unlock(&mutex_);
+}
+
+ImageCache* ImageCache::Get() {
+  static ImageCache* cache = new ImageCache(0);
+  return cache;
+}
+
+void ImageCache::Reserve(size_t capacity) {
+  ImageCache* cache = Get();
+  pthread_mutex_lock(&cache->mutex_);
+  if (capacity > cache->capacity_) {
+    LOG(INFO) << "Caching up to " << (capacity >> 20)
+        << " MB of decoded images";
+    cache->capacity_ = capacity;
+  }
+  pthread_mutex_unlock(&cache->mutex_);
+}
+
+}  // namespace caffe
@@ -16,6 +16,7 @@
 #include <fstream>  // NOLINT(readability/streams)
 
 #include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/proto/caffe.pb.h"
 
@@ -72,16 +73,11 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
 }
 
 bool ReadImageToDatum(const string& filename, const int label,
-    const int height, const int width, const bool is_color, Datum* datum) {
-  cv::Mat cv_img;
-  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-    CV_LOAD_IMAGE_GRAYSCALE);
-  if (height > 0 && width > 0) {
-    cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
-    cv::resize(cv_img_origin, cv_img, cv::Size(height, width));
-  } else {
-    cv_img = cv::imread(filename, cv_read_flag);
-  }
+    const int height, const int width, const bool is_color, Datum* datum,
+    ImageCache* cache) {
+  const cv::Mat cv_img = cache ?
+      cache->Read(filename, height, width, is_color) :
+      ReadImageToCVMat(filename, height, width, is_color);
   if (!cv_img.data) {
     LOG(ERROR) << "Could not open or find file " << filename;
     return false;
@@ -182,4 +178,9 @@ void hdf5_save_nd_dataset<double>(
   CHECK_GE(status, 0) << "Failed to make double dataset " << dataset_name;
 }
 
+pthread_mutex_t* hdf5_mutex() {
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  return &mutex;
+}
+
 }  // namespace caffe
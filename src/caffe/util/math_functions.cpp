@@ -4,6 +4,7 @@
 #include <boost/random.hpp>
 #include <cublas_v2.h>
 
+#include <algorithm>
 #include <limits>
 
 #include "caffe/common.hpp"
@@ -34,6 +35,24 @@ void caffe_cpu_gemm<double>(const CBLAS_TRANSPOSE TransA,
       ldb, beta, C, N);
 }
 
+int caffe_cpu_blas_num_threads() {
+#if defined(USE_MKL)
+  return mkl_get_max_threads();
+#elif defined(USE_OPENBLAS)
+  return openblas_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+void caffe_set_cpu_blas_num_threads(const int threads) {
+#if defined(USE_MKL)
+  mkl_set_num_threads(threads);
+#elif defined(USE_OPENBLAS)
+  openblas_set_num_threads(threads);
+#endif
+}
+
 template <>
 void caffe_gpu_gemm<float>(const CBLAS_TRANSPOSE TransA,
     const CBLAS_TRANSPOSE TransB, const int M, const int N, const int K,
@@ -547,4 +566,40 @@ void caffe_gpu_scale<double>(const int n, const double alpha, const double *x,
   CUBLAS_CHECK(cublasDscal(Caffe::cublas_handle(), n, &alpha, y, 1));
 }
 
+template <typename Dtype>
+void caffe_cpu_sgd_update(const int n, const Dtype rate, const Dtype momentum,
+    const Dtype decay, const bool update_data, Dtype* data, Dtype* diff,
+    Dtype* history) {
+  // blocks of 64 KB of floats, so that small parameters stay on one thread
+  const int block = 16384;
+  const int num_blocks = (n + block - 1) / block;
+  const int threads = caffe_cpu_threads(0, num_blocks);
+  // the factor of the decay, as caffe_axpy is given
+  const Dtype decay_rate = decay * rate;
+#pragma omp parallel for num_threads(threads)
+  for (int b = 0; b < num_blocks; ++b) {
+    const int end = std::min(n, (b + 1) * block);
+    for (int i = b * block; i < end; ++i) {
+      Dtype value = rate * diff[i] + momentum * history[i];
+      if (decay) {
+        value += decay_rate * data[i];
+      }
+      history[i] = value;
+      diff[i] = value;
+      if (update_data) {
+        data[i] -= value;
+      }
+    }
+  }
+}
+
+template
+void caffe_cpu_sgd_update<float>(const int n, const float rate,
+    const float momentum, const float decay, const bool update_data,
+    float* data, float* diff, float* history);
+template
+void caffe_cpu_sgd_update<double>(const int n, const double rate,
+    const double momentum, const double decay, const bool update_data,
+    double* data, double* diff, double* history);
+
 }  // namespace caffe
@@ -0,0 +1,239 @@
+// Copyright 2014 BVLC and contributors.
+
+#include <stdint.h>
+
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "caffe/util/warp.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void warp_affine_matrix(const bool mirror, const Dtype angle, const Dtype dx,
+    const Dtype dy, const Dtype zoom_x, const Dtype zoom_y,
+    const int crop_width, const int crop_height, const int width,
+    const int height, Dtype* affine) {
+  const double m = mirror ? -1. : 1.;
+  const double cos_a = cos(angle);
+  const double sin_a = sin(angle);
+  const double cx = .5 * crop_width;
+  const double cy = .5 * crop_height;
+  affine[0] = cos_a / zoom_x;
+  affine[1] = -sin_a * m / zoom_x;
+  affine[2] = (-cos_a * cx + sin_a * m * cy + dx * crop_width) / zoom_x
+      + .5 * width;
+  affine[3] = sin_a / zoom_y;
+  affine[4] = cos_a * m / zoom_y;
+  affine[5] = (-sin_a * cx - cos_a * m * cy + dy * crop_height) / zoom_y
+      + .5 * height;
+}
+
+template <typename Dtype>
+bool warp_inside(const Dtype* affine, const int crop_width,
+    const int crop_height, const int width, const int height) {
+  for (int x = 0; x < crop_width; x += crop_width - 1) {
+    for (int y = 0; y < crop_height; y += crop_height - 1) {
+      const Dtype fx = floor(affine[0] * x + affine[1] * y + affine[2]);
+      const Dtype fy = floor(affine[3] * x + affine[4] * y + affine[5]);
+      if (!(fx >= 0 && fx <= width - 2 && fy >= 0 && fy <= height - 2)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Source offsets and interpolation weights of the pixels [begin, end) of a
+// crop row starting at (row_x, row_y) in the source. Pixels whose
+// neighbourhood leaves the source get offset -1.
+template <typename Dtype>
+static void warp_row_coords(const Dtype row_x, const Dtype row_y,
+    const Dtype step_x, const Dtype step_y, const int width, const int height,
+    const bool interpolate, const int begin, const int end, int* offset,
+    Dtype* wx, Dtype* wy) {
+  for (int y = begin; y < end; ++y) {
+    const Dtype sx = row_x + step_x * y;
+    const Dtype sy = row_y + step_y * y;
+    const Dtype fx = floor(sx);
+    const Dtype fy = floor(sy);
+    if (fx >= 0 && fx <= width - 2 && fy >= 0 && fy <= height - 2) {
+      offset[y] = static_cast<int>(fx) * height + static_cast<int>(fy);
+      wx[y] = interpolate ? sx - fx : 0;
+      wy[y] = interpolate ? sy - fy : 0;
+    } else {
+      offset[y] = -1;
+      wx[y] = 0;
+      wy[y] = 0;
+    }
+  }
+}
+
+// Interpolates the pixels [begin, end) of one channel of a crop row.
+template <typename Dtype, typename Stype>
+static void warp_row_channel(const Stype* src, const Dtype* mean,
+    const Dtype scale, const int height, const int begin, const int end,
+    const int* offset, const Dtype* wx, const Dtype* wy, Dtype* dst) {
+  for (int y = begin; y < end; ++y) {
+    const int o = offset[y];
+    if (o < 0) {
+      dst[y] = 0;
+      continue;
+    }
+    const Dtype p00 = src[o];
+    const Dtype p01 = src[o + 1];
+    const Dtype p10 = src[o + height];
+    const Dtype p11 = src[o + height + 1];
+    const Dtype top = p00 + wy[y] * (p01 - p00);
+    const Dtype bottom = p10 + wy[y] * (p11 - p10);
+    const Dtype value = top + wx[y] * (bottom - top);
+    dst[y] = mean ? (value - mean[o]) * scale : value * scale;
+  }
+}
+
+#ifdef __SSE2__
+static inline __m128 sse_floor(const __m128 x) {
+  const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+}
+
+// Four pixels at a time; the positions are computed as in the generic
+// version, so that both give the same results.
+static void warp_row_coords(const float row_x, const float row_y,
+    const float step_x, const float step_y, const int width, const int height,
+    const bool interpolate, const int begin, const int end, int* offset,
+    float* wx, float* wy) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 max_x = _mm_set1_ps(width - 2);
+  const __m128 max_y = _mm_set1_ps(height - 2);
+  const __m128 rows = _mm_set1_ps(height);
+  const __m128 keep = interpolate ?
+      _mm_castsi128_ps(_mm_set1_epi32(-1)) : zero;
+  const __m128i invalid = _mm_set1_epi32(-1);
+  int y = begin;
+  for (; y + 4 <= end; y += 4) {
+    const __m128 index = _mm_setr_ps(y, y + 1, y + 2, y + 3);
+    const __m128 sx = _mm_add_ps(_mm_set1_ps(row_x),
+        _mm_mul_ps(_mm_set1_ps(step_x), index));
+    const __m128 sy = _mm_add_ps(_mm_set1_ps(row_y),
+        _mm_mul_ps(_mm_set1_ps(step_y), index));
+    const __m128 fx = sse_floor(sx);
+    const __m128 fy = sse_floor(sy);
+    const __m128 valid = _mm_and_ps(
+        _mm_and_ps(_mm_cmpge_ps(fx, zero), _mm_cmple_ps(fx, max_x)),
+        _mm_and_ps(_mm_cmpge_ps(fy, zero), _mm_cmple_ps(fy, max_y)));
+    const __m128i valid_i = _mm_castps_si128(valid);
+    const __m128i o = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(fx, rows), fy));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(offset + y),
+        _mm_or_si128(_mm_and_si128(valid_i, o),
+        _mm_andnot_si128(valid_i, invalid)));
+    const __m128 mask = _mm_and_ps(valid, keep);
+    _mm_storeu_ps(wx + y, _mm_and_ps(mask, _mm_sub_ps(sx, fx)));
+    _mm_storeu_ps(wy + y, _mm_and_ps(mask, _mm_sub_ps(sy, fy)));
+  }
+  warp_row_coords<float>(row_x, row_y, step_x, step_y, width, height,
+      interpolate, y, end, offset, wx, wy);
+}
+
+// Gathers the four neighbours of four pixels and interpolates them at once.
+// Pixels outside the source gather zeros, which gives 0 after the mean.
+template <typename Stype>
+static void warp_row_channel(const Stype* src, const float* mean,
+    const float scale, const int height, const int begin, const int end,
+    const int* offset, const float* wx, const float* wy, float* dst) {
+  const __m128 scale4 = _mm_set1_ps(scale);
+  int y = begin;
+  for (; y + 4 <= end; y += 4) {
+    float p00[4], p01[4], p10[4], p11[4], m[4];
+    for (int k = 0; k < 4; ++k) {
+      const int o = offset[y + k];
+      if (o < 0) {
+        p00[k] = p01[k] = p10[k] = p11[k] = m[k] = 0;
+      } else {
+        p00[k] = src[o];
+        p01[k] = src[o + 1];
+        p10[k] = src[o + height];
+        p11[k] = src[o + height + 1];
+        m[k] = mean ? mean[o] : 0;
+      }
+    }
+    const __m128 a = _mm_loadu_ps(p00);
+    const __m128 b = _mm_loadu_ps(p10);
+    const __m128 v = _mm_loadu_ps(wy + y);
+    const __m128 top = _mm_add_ps(a,
+        _mm_mul_ps(v, _mm_sub_ps(_mm_loadu_ps(p01), a)));
+    const __m128 bottom = _mm_add_ps(b,
+        _mm_mul_ps(v, _mm_sub_ps(_mm_loadu_ps(p11), b)));
+    const __m128 value = _mm_add_ps(top,
+        _mm_mul_ps(_mm_loadu_ps(wx + y), _mm_sub_ps(bottom, top)));
+    _mm_storeu_ps(dst + y,
+        _mm_mul_ps(_mm_sub_ps(value, _mm_loadu_ps(m)), scale4));
+  }
+  warp_row_channel<float, Stype>(src, mean, scale, height, y, end, offset, wx,
+      wy, dst);
+}
+#endif  // __SSE2__
+
+template <typename Dtype, typename Stype>
+void warp_bilinear_cpu(const Stype* src, const int channels, const int width,
+    const int height, const Dtype* affine, const bool interpolate,
+    const Dtype* mean, const Dtype scale, const int crop_width,
+    const int crop_height, Dtype* dst) {
+  std::vector<int> offset(crop_height);
+  std::vector<Dtype> wx(crop_height);
+  std::vector<Dtype> wy(crop_height);
+  const int size = width * height;
+  for (int x = 0; x < crop_width; ++x) {
+    // the positions of a row only depend on its start and the step along y,
+    // and are shared by all channels
+    const Dtype row_x = affine[0] * x + affine[2];
+    const Dtype row_y = affine[3] * x + affine[5];
+    warp_row_coords(row_x, row_y, affine[1], affine[4], width, height,
+        interpolate, 0, crop_height, &offset[0], &wx[0], &wy[0]);
+    for (int c = 0; c < channels; ++c) {
+      warp_row_channel(src + c * size, mean ? mean + c * size : mean, scale,
+          height, 0, crop_height, &offset[0], &wx[0], &wy[0],
+          dst + (c * crop_width + x) * crop_height);
+    }
+  }
+}
+
+// Explicit instantiation
+template void warp_affine_matrix<float>(const bool mirror, const float angle,
+    const float dx, const float dy, const float zoom_x, const float zoom_y,
+    const int crop_width, const int crop_height, const int width,
+    const int height, float* affine);
+template void warp_affine_matrix<double>(const bool mirror,
+    const double angle, const double dx, const double dy, const double zoom_x,
+    const double zoom_y, const int crop_width, const int crop_height,
+    const int width, const int height, double* affine);
+template bool warp_inside<float>(const float* affine, const int crop_width,
+    const int crop_height, const int width, const int height);
+template bool warp_inside<double>(const double* affine, const int crop_width,
+    const int crop_height, const int width, const int height);
+template void warp_bilinear_cpu<float, float>(const float* src,
+    const int channels, const int width, const int height,
+    const float* affine, const bool interpolate, const float* mean,
+    const float scale, const int crop_width, const int crop_height,
+    float* dst);
+template void warp_bilinear_cpu<double, double>(const double* src,
+    const int channels, const int width, const int height,
+    const double* affine, const bool interpolate, const double* mean,
+    const double scale, const int crop_width, const int crop_height,
+    double* dst);
+template void warp_bilinear_cpu<float, uint8_t>(const uint8_t* src,
+    const int channels, const int width, const int height,
+    const float* affine, const bool interpolate, const float* mean,
+    const float scale, const int crop_width, const int crop_height,
+    float* dst);
+template void warp_bilinear_cpu<double, uint8_t>(const uint8_t* src,
+    const int channels, const int width, const int height,
+    const double* affine, const bool interpolate, const double* mean,
+    const double scale, const int crop_width, const int crop_height,
+    double* dst);
+
+}  // namespace caffe
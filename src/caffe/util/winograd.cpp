@@ -0,0 +1,141 @@
+// Copyright 2014 BVLC and contributors.
+
+#include "caffe/util/winograd.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+void winograd_kernel_transform_cpu(const Dtype* kernel, const int num_output,
+    const int channels, const bool backward, Dtype* U) {
+  const int stride = num_output * channels;
+  for (int o = 0; o < num_output; ++o) {
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* k = kernel + (o * channels + c) * 9;
+      Dtype g[3][3];
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          g[i][j] = backward ? k[(2 - i) * 3 + (2 - j)] : k[i * 3 + j];
+        }
+      }
+      // G * g
+      Dtype t[4][3];
+      for (int j = 0; j < 3; ++j) {
+        t[0][j] = g[0][j];
+        t[1][j] = Dtype(0.5) * (g[0][j] + g[1][j] + g[2][j]);
+        t[2][j] = Dtype(0.5) * (g[0][j] - g[1][j] + g[2][j]);
+        t[3][j] = g[2][j];
+      }
+      // (G * g) * G^T
+      Dtype* u = U + (backward ? c * num_output + o : o * channels + c);
+      for (int i = 0; i < 4; ++i) {
+        u[(i * 4 + 0) * stride] = t[i][0];
+        u[(i * 4 + 1) * stride] =
+            Dtype(0.5) * (t[i][0] + t[i][1] + t[i][2]);
+        u[(i * 4 + 2) * stride] =
+            Dtype(0.5) * (t[i][0] - t[i][1] + t[i][2]);
+        u[(i * 4 + 3) * stride] = t[i][2];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void winograd_input_transform_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int pad, const int tiles_h,
+    const int tiles_w, Dtype* V) {
+  const int tiles = tiles_h * tiles_w;
+  const int stride = channels * tiles;
+  for (int c = 0; c < channels; ++c) {
+    const Dtype* im = data_im + c * height * width;
+    for (int th = 0; th < tiles_h; ++th) {
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        const int h0 = th * 2 - pad;
+        const int w0 = tw * 2 - pad;
+        Dtype d[4][4];
+        for (int i = 0; i < 4; ++i) {
+          const int h = h0 + i;
+          for (int j = 0; j < 4; ++j) {
+            const int w = w0 + j;
+            d[i][j] = (h >= 0 && h < height && w >= 0 && w < width) ?
+                im[h * width + w] : Dtype(0);
+          }
+        }
+        // B^T * d
+        Dtype t[4][4];
+        for (int j = 0; j < 4; ++j) {
+          t[0][j] = d[0][j] - d[2][j];
+          t[1][j] = d[1][j] + d[2][j];
+          t[2][j] = d[2][j] - d[1][j];
+          t[3][j] = d[1][j] - d[3][j];
+        }
+        // (B^T * d) * B
+        Dtype* v = V + c * tiles + th * tiles_w + tw;
+        for (int i = 0; i < 4; ++i) {
+          v[(i * 4 + 0) * stride] = t[i][0] - t[i][2];
+          v[(i * 4 + 1) * stride] = t[i][1] + t[i][2];
+          v[(i * 4 + 2) * stride] = t[i][2] - t[i][1];
+          v[(i * 4 + 3) * stride] = t[i][1] - t[i][3];
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void winograd_output_transform_cpu(const Dtype* M, const int channels,
+    const int tiles_h, const int tiles_w, const int height, const int width,
+    Dtype* data_im) {
+  const int tiles = tiles_h * tiles_w;
+  const int stride = channels * tiles;
+  for (int c = 0; c < channels; ++c) {
+    Dtype* im = data_im + c * height * width;
+    for (int th = 0; th < tiles_h; ++th) {
+      for (int tw = 0; tw < tiles_w; ++tw) {
+        const Dtype* m = M + c * tiles + th * tiles_w + tw;
+        // A^T * m
+        Dtype t[2][4];
+        for (int j = 0; j < 4; ++j) {
+          const Dtype m0 = m[(0 * 4 + j) * stride];
+          const Dtype m1 = m[(1 * 4 + j) * stride];
+          const Dtype m2 = m[(2 * 4 + j) * stride];
+          const Dtype m3 = m[(3 * 4 + j) * stride];
+          t[0][j] = m0 + m1 + m2;
+          t[1][j] = m1 - m2 - m3;
+        }
+        // (A^T * m) * A, cropped to the image
+        for (int i = 0; i < 2; ++i) {
+          const int h = th * 2 + i;
+          if (h >= height) {
+            break;
+          }
+          const int w = tw * 2;
+          im[h * width + w] = t[i][0] + t[i][1] + t[i][2];
+          if (w + 1 < width) {
+            im[h * width + w + 1] = t[i][1] - t[i][2] - t[i][3];
+          }
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void winograd_kernel_transform_cpu<float>(const float* kernel,
+    const int num_output, const int channels, const bool backward, float* U);
+template void winograd_kernel_transform_cpu<double>(const double* kernel,
+    const int num_output, const int channels, const bool backward,
+    double* U);
+template void winograd_input_transform_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width, const int pad,
+    const int tiles_h, const int tiles_w, float* V);
+template void winograd_input_transform_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width, const int pad,
+    const int tiles_h, const int tiles_w, double* V);
+template void winograd_output_transform_cpu<float>(const float* M,
+    const int channels, const int tiles_h, const int tiles_w,
+    const int height, const int width, float* data_im);
+template void winograd_output_transform_cpu<double>(const double* M,
+    const int channels, const int tiles_h, const int tiles_w,
+    const int height, const int width, double* data_im);
+
+}  // namespace caffe